@@ -17,12 +17,25 @@
 #include "builtins.h"
 #include "builtins/common.h"
 #include "builtins/builtext.h"
+#include "input.h"
+#include "findcmd.h"
 
 #include "y.tab.h"
 
 #include "compiler.h"
 
-#define NYI(...) internal_warning("NYI: compilation of "__VA_ARGS__)
+extern int line_number;
+extern int current_token;
+extern int posixly_correct;
+extern int source_uses_path;
+extern int source_searches_cwd;
+
+/* counted, so that --compile-hybrid can tell what to interpret */
+static int nyi_count = 0;
+static int nyi_quiet = 0;
+
+#define NYI(...) do { nyi_count++; \
+	if (!nyi_quiet) internal_warning("NYI: compilation of "__VA_ARGS__); } while (0)
 #define EXPNYI(...) NYI("non-literal words (expansion, etc)")
 
 #define __must_use __attribute__((warn_unused_result))
@@ -32,41 +45,209 @@ static const char bashc_header[] =
 "#define _GNU_SOURCE 1\n"
 "#include <stdlib.h>\n"
 "#include <stdio.h>\n"
+"#include <string.h>\n"
 "#include <unistd.h>\n"
+"#include <fcntl.h>\n"
 "#include <sys/types.h>\n"
+"#include <sys/stat.h>\n"
 "#include <sys/wait.h>\n"
 "\n"
 "#include \"libbashc/libbashc.h\"\n"
 "\n"
+"static int G_status;\n"
+"\n"
+;
+
+static const char bashc_main_prologue[] =
 "int main(int argc, char** argv)\n"
 "{\n"
-	"\tint G_status;\n"
-	"\n"
-	"\t(void)argc;\n"
-	"\t(void)argv;\n"
+	"\tbashc_init(argc,argv);\n"
 	"\tG_status = 0;\n"
 	"\n"
 ;
 
 static const char bashc_footer[] =
+	"\tbashc_flush();\n"
 	"\treturn G_status;\n"
 "}\n"
 ;
 
+/*
+ * With --compile-loadable, the script's body is a function of its own,
+ * run by a loadable builtin named for the script.
+ */
+static const char bashc_script_prologue[] =
+"static int bashc_script_main(int argc, char** argv)\n"
+"{\n"
+	"\tbashc_init(argc,argv);\n"
+	"\tG_status = 0;\n"
+	"\n"
+;
+
+static const char bashc_loadable_trailer[] =
+"\n"
+"static int %1$s_builtin(struct word_list* list)\n"
+"{\n"
+	"\treturn bashc_loadable_run(bashc_script_main,\"%1$s\",list);\n"
+"}\n"
+"\n"
+"static char* const %1$s_doc[] = {\n"
+	"\t\"Run the compiled script %1$s in the shell's own process.\",\n"
+	"\tNULL,\n"
+"};\n"
+"\n"
+"struct bashc_loadable %1$s_struct = {\n"
+	"\t\"%1$s\", %1$s_builtin, BASHC_BUILTIN_ENABLED, %1$s_doc,\n"
+	"\t\"%1$s [arg ...]\", NULL,\n"
+"};\n"
+;
+
+/*
+ * With --compile-multicall, it's instead registered, under the
+ * script's name, for the main() in multicall.c to run.
+ */
+static const char bashc_multicall_trailer_start[] =
+"\n"
+"static const struct bashc_multicall bashc_multicall_entry BASHC_MULTICALL = {\n"
+	"\t\""
+;
+
+static const char bashc_multicall_trailer_end[] =
+	"\", bashc_script_main,\n"
+"};\n"
+;
+
+/*
+ * Generated code is written in sections, which are stitched together
+ * into the real output file once compilation is finished.
+ * `bashc_output' points at the section currently being written
+ * (normally main()'s body).  Shell functions are each written to a
+ * section of their own, then appended to `funcs_section'.
+ */
+struct csection {
+	FILE* stream;
+	char* buf;
+	size_t len;
+};
+
+static struct csection globals_section;
+static struct csection funcs_section;
+static struct csection main_section;
+
+/* Distinct literal command names, for resolving at startup */
+static HASH_TABLE* literal_cmd_table = NULL;
+static char** literal_cmds = NULL;
+static int num_literal_cmds = 0;
+
+/* Variables referenced, each looked up once at startup */
+static HASH_TABLE* var_table = NULL;
+static char** var_names = NULL;
+static int num_vars = 0;
+
+/*
+ * Shell functions defined anywhere in the script, found before any of
+ * it is compiled, since a call can come (textually) before the
+ * definition.  A function defined only once is called directly;
+ * otherwise through its slot, which every call checks first anyway,
+ * since it may not be defined yet when the call's reached.
+ */
+struct cfunc {
+	char* handle;		/* of its struct bashc_func, looked up at startup */
+	char* cname;		/* of its C function, if it's only defined once */
+	int ndefs;
+	COMMAND* body;		/* if it's only defined once */
+	/* see function_pure() */
+	int purity;
+	int depth;
+	struct cfunc** callees;
+	int ncallees;
+};
+
+static HASH_TABLE* func_table = NULL;
+static char** func_names = NULL;
+static int num_funcs = 0;
+
+/*
+ * Files `source'd (or `.'d) by a literal name, found and parsed with
+ * the script itself, as bash would find them when it's compiled.  Each
+ * compiles once, to a C function called wherever it's sourced, so the
+ * program never reads them.  They're listed, in the order found, in
+ * the --compile-deps manifest.
+ */
+struct csourced {
+	char* path;		/* resolved */
+	char* cname;		/* of its C function, once it's compiled */
+	COMMAND* body;		/* NULL if it's empty */
+};
+
+static HASH_TABLE* sourced_table = NULL;
+static struct csourced** sourced_files = NULL;
+static int num_sourced = 0;
+
+/* With --compile-hybrid, the simple commands compiled, and interpreted */
+static int native_commands = 0;
+static int interpreted_commands = 0;
+static int interpreted_fragments = 0;
+
+/* With --compile-profile, the command sites profiled */
+struct profsite {
+	int line;
+	char* text;
+};
+
+#define PROF_TEXT_MAX 60
+
+static struct profsite* prof_sites = NULL;
+static int num_prof_sites = 0;
+
+/* The literal patterns of =~ tests, compiled at startup */
+static char** regex_patterns = NULL;
+static int num_regexes = 0;
+
+/* The function whose body is being compiled */
+struct funcctx {
+	int return_used;
+	int comsub;		/* within a command substitution in it */
+	int forked;		/* within a subshell (or the like) in it */
+	int reentrant;		/* see declare_buffer() */
+	int sourced;		/* it's a sourced file, without a frame */
+	struct csection decls;
+	struct csection cleanup;
+};
+
+#define FUNC_RETURN "funcreturn"
+
+static struct funcctx* curfunc = NULL;
+
 struct loopnest {
 	struct loopnest* next;
 	char* entry;
 	char* exit;
+	int redir_depth;
+	int entry_used;		/* by a continue */
+	int exit_used;		/* by a break */
+	char* cleanup;		/* to free() on the way out, if anything */
 };
 
 static int indent_level = 0;
 static struct loopnest* loopstack = NULL;
 
+/* How many compound commands' redirections are in effect */
+static int redir_depth = 0;
+
+/* Where compile_simple_command() should store the pid of the next
+ * background command it launches, if anywhere */
+static char* bgpid_lvalue = NULL;
+
 static void push_loopnest(char* entry, char* exit)
 {
 	struct loopnest* newtop = malloc(sizeof(struct loopnest));
 	newtop->entry = entry;
 	newtop->exit = exit;
+	newtop->redir_depth = redir_depth;
+	newtop->entry_used = 0;
+	newtop->exit_used = 0;
+	newtop->cleanup = NULL;
 	newtop->next = loopstack;
 	loopstack = newtop;
 }
@@ -126,30 +307,37 @@ static void indent(void)
 #define make_failure() do { icoutsn("G_status = 1"); } while (0)
 #define make_success() do { icoutsn("G_status = 0"); } while (0)
 
-static void cencode_string(const char* str)
+static void fcencode_string(FILE* f, const char* str)
 {
 	int i;
 
 	for (i = 0; str[i]; i++) {
 		switch (str[i]) {
-		case '"': cout("\\\""); break;
-		case '\n': cout("\\n"); break;
-		case '\r': cout("\\r"); break;
-		case '\t': cout("\\t"); break;
-		case '\f': cout("\\f"); break;
-		case '\v': cout("\\v"); break;
-		case '\a': cout("\\a"); break;
-		case '\b': cout("\\b"); break;
+		case '"': fputs("\\\"",f); break;
+		case '\\': fputs("\\\\",f); break;
+		case '\n': fputs("\\n",f); break;
+		case '\r': fputs("\\r",f); break;
+		case '\t': fputs("\\t",f); break;
+		case '\f': fputs("\\f",f); break;
+		case '\v': fputs("\\v",f); break;
+		case '\a': fputs("\\a",f); break;
+		case '\b': fputs("\\b",f); break;
 
 		default:
-			if (isprint(str[i]))
-				cout("%c",str[i]);
+			/* octal, since a hex escape would swallow following hex digits */
+			if (isprint((unsigned char)str[i]))
+				fputc(str[i],f);
 			else
-				cout("\\x%02hhx",str[i]);
+				fprintf(f,"\\%03o",(unsigned char)str[i]);
 		}
 	}
 }
 
+static void cencode_string(const char* str)
+{
+	fcencode_string(bashc_output,str);
+}
+
 /* Returns a pointer to a malloc()ed string of the name of a new
  * identifier, with option "base" name */
 static __must_use char* new_ident(const char* base)
@@ -162,528 +350,6143 @@ static __must_use char* new_ident(const char* base)
 }
 
 /*
- * Outputs a C array of string literals, optionally terminated by a
- * NULL if 'addnullterm' is true.  Returns the length of the array,
- * including the NULL if present.
+ * Words are parsed (from the raw text the parser leaves in them) into
+ * a list of segments: literal text, with its quoting removed, and
+ * expansions.  Words that turn out to be all literal text
+ * compile to static strings; the rest are expanded at run time into a
+ * struct bashc_wordbuf (see libbashc/words.c).
  */
-static int wordlist_to_cstr_array(WORD_LIST* wds, int addnullterm)
-{
-	WORD_LIST* wd;
-	int n;
+#define WS_LIT 0
+#define WS_PARAM 1
+#define WS_ARITH 2	/* $(( )); `text' is the translated expression */
+#define WS_COMSUB 3	/* $( ) or ` `; `text' is the command */
+
+struct wordseg {
+	struct wordseg* next;
+	int type;
+	char* text;		/* the literal text, the parameter's name, C, or shell */
+	int quoted;
+	int op;			/* 0, one of -=+? for ${p-w} etc., or # for ${#p} */
+	int colon;		/* ${p:-w} rather than ${p-w} */
+	struct wordseg* operand;
+};
 
-	cout("{ ");
+/* What a word is parsed as (see parse_word()) */
+#define WP_WORD 0		/* a command word */
+#define WP_PATTERN 1		/* a pattern: quoted pattern characters are escaped */
+#define WP_REGEX 2		/* a regular expression: likewise ERE characters */
+#define WP_STRING 3		/* a [[ ]] operand, with no pathname expansion */
+
+struct wparse {
+	struct wordseg* segs;
+	struct wordseg** tail;
+	char* lit;
+	size_t litlen,litsize;
+	int havelit;		/* there's literal text, even if it's empty */
+	int glob;		/* unquoted pattern characters were seen */
+	int quiet;		/* don't complain about what can't be compiled */
+	int pattern;		/* WP_*: what's being parsed */
+};
 
-	for (n = 0, wd = wds; wd; wd = wd->next, n++) {
-		if (wd->word->flags)
-			EXPNYI();
-		cout("\"");
-		cencode_string(wd->word->word);
-		cout("\", ");
+#define wp_nyi(p,...) do { if (!(p)->quiet) NYI(__VA_ARGS__); } while (0)
+
+static void free_segs(struct wordseg* seg)
+{
+	struct wordseg* next;
+
+	for (; seg; seg = next) {
+		next = seg->next;
+		free(seg->text);
+		free_segs(seg->operand);
+		free(seg);
 	}
+}
 
-	if (addnullterm) {
-		n += 1;
-		cout("NULL, ");
+static void wp_init(struct wparse* p, int quiet)
+{
+	memset(p,0,sizeof(*p));
+	p->tail = &p->segs;
+	p->quiet = quiet;
+}
+
+static void wp_addlit(struct wparse* p, const char* s, size_t len)
+{
+	if (p->litlen + len + 1 > p->litsize) {
+		p->litsize = (p->litlen + len + 1) * 2;
+		p->lit = xrealloc(p->lit,p->litsize);
 	}
+	memcpy(p->lit + p->litlen,s,len);
+	p->litlen += len;
+	p->lit[p->litlen] = '\0';
+	p->havelit = 1;
+}
 
-	cout("}");
+/* Add quoted text, which in a pattern or regex has to stay literal */
+static void wp_addquoted(struct wparse* p, const char* s, size_t len)
+{
+	const char* special;
+	size_t n;
+
+	if (p->pattern == WP_PATTERN)
+		special = "*?[]\\";
+	else if (p->pattern == WP_REGEX)
+		special = ".[\\()*+?{|^$";
+	else {
+		wp_addlit(p,s,len);
+		return;
+	}
 
-	return n;
+	for (; len; s += n, len -= n) {
+		if ((n = strcspn(s,special)) > len)
+			n = len;
+		if (!n) {
+			wp_addlit(p,"\\",1);
+			n = 1;
+		}
+		wp_addlit(p,s,n);
+	}
 }
 
-/* Compile-time I/O context.  Strings put in the fdnames array should
- * always be malloced. */
-struct ctioctx {
-	int numfds;
-	char* fdnames[][2];
-};
+static struct wordseg* wp_append(struct wparse* p, int type)
+{
+	struct wordseg* seg = xmalloc(sizeof(*seg));
 
-static __must_use struct ctioctx* new_ioc(int numfds)
+	memset(seg,0,sizeof(*seg));
+	seg->type = type;
+	*p->tail = seg;
+	p->tail = &seg->next;
+
+	return seg;
+}
+
+/* Finish any pending literal text as a segment */
+static void wp_flush(struct wparse* p)
 {
-	struct ctioctx* ioc = malloc(sizeof(struct ctioctx)
-	                             + numfds*sizeof(ioc->fdnames[0]));
-	ioc->numfds = numfds;
-	return ioc;
+	if (!p->havelit)
+		return;
+
+	wp_append(p,WS_LIT)->text = p->lit ? p->lit : savestring("");
+	p->lit = NULL;
+	p->litlen = p->litsize = 0;
+	p->havelit = 0;
 }
 
-static __must_use struct ctioctx* merge_iocs(struct ctioctx* a, struct ctioctx* b)
+static void wp_abandon(struct wparse* p)
 {
-	int i,j;
-	struct ctioctx* ioc;
+	free_segs(p->segs);
+	free(p->lit);
+}
 
-	if (!a) return b;
-	if (!b) return a;
+static int parse_text(struct wparse* p, const char** sp, int dquoted, int inbrace);
+static char* translate_arith(const char* text, int quiet);
 
-	ioc = new_ioc(a->numfds + b->numfds);
-	for (i = 0; i < a->numfds; i++) {
-		ioc->fdnames[i][0] = a->fdnames[i][0];
-		ioc->fdnames[i][1] = a->fdnames[i][1];
+/* Set when code that can call bashc_abandon() has been emitted */
+static int may_abandon = 0;
+
+/*
+ * Parse an arithmetic expansion, `*sp' pointing just past the `$(('.
+ * Returns 0 if it can't be compiled.
+ */
+static int parse_arith(struct wparse* p, const char** sp, int dquoted)
+{
+	const char* s = *sp;
+	struct wordseg* seg;
+	char* text;
+	char* expr;
+	int depth = 0;
+
+	for (; *s; s++) {
+		if (*s == '(')
+			depth++;
+		else if (*s == ')' && depth)
+			depth--;
+		else if (*s == ')' && s[1] == ')')
+			break;
 	}
-	for (j = 0; j < b->numfds; j++) {
-		ioc->fdnames[i+j][0] = b->fdnames[j][0];
-		ioc->fdnames[i+j][1] = b->fdnames[j][1];
+	if (!*s) {
+		wp_nyi(p,"$((%s",*sp);
+		return 0;
 	}
-	return ioc;
+
+	text = substring(*sp,0,s - *sp);
+	expr = translate_arith(text,p->quiet);
+	free(text);
+	if (!expr)
+		return 0;
+
+	if (dquoted && !p->litlen)
+		p->havelit = 0;
+	wp_flush(p);
+
+	seg = wp_append(p,WS_ARITH);
+	seg->text = expr;
+	seg->quoted = dquoted;
+	*sp = s + 2;
+
+	return 1;
 }
 
 /*
- * Make room for 'n' more entries.  Alternately, if 'n' is negative,
- * shrink by that many entries, freeing the entries in the freed
- * slots.  Returns a possibly-relocated `ioc', or NULL on error or
- * shrinking to zero size.
+ * Add a command substitution of `text' (malloced), which has been
+ * found to end at `end'.
  */
-static __must_use struct ctioctx* ioc_grow(struct ctioctx* ioc, int n)
+static void wp_addcomsub(struct wparse* p, char* text, const char** sp, const char* end,
+                         int dquoted)
 {
-	int old,i;
+	struct wordseg* seg;
 
-	old = ioc ? ioc->numfds : 0;
+	if (dquoted && !p->litlen)
+		p->havelit = 0;
+	wp_flush(p);
 
-	if (old + n < 0)
-		fatal_error("tried to shrink ctioctx below zero size");
+	seg = wp_append(p,WS_COMSUB);
+	seg->text = text;
+	seg->quoted = dquoted;
+	*sp = end;
+}
 
-	if (n < 0) {
-		for (i = old + n; i < old; i++) {
-			free(ioc->fdnames[i][0]);
-			free(ioc->fdnames[i][1]);
-		}
+/*
+ * Parse a command substitution, `*sp' pointing just past the `$(';
+ * the parser's already checked it's well-formed.
+ */
+static int parse_comsub(struct wparse* p, const char** sp, int dquoted)
+{
+	char* text;
+	int i = 0;
+
+	text = extract_command_subst((char*)*sp,&i,SX_NOLONGJMP);
+	if ((*sp)[i] != ')') {
+		wp_nyi(p,"$(%s",*sp);
+		free(text);
+		return 0;
 	}
 
-	if (old + n == 0) {
-		free(ioc);
-		ioc = NULL;
-	} else {
-		ioc = realloc(ioc,sizeof(struct ctioctx) + (old+n)*sizeof(ioc->fdnames[0]));
-		if (ioc)
-			ioc->numfds = old + n;
+	wp_addcomsub(p,text,sp,*sp + i + 1,dquoted);
+	return 1;
+}
+
+/*
+ * Parse an old-style command substitution, `*sp' pointing just past
+ * the opening backquote.  Within it, backslash quotes only $, ` and
+ * \ (and " between double quotes).
+ */
+static int parse_backquote(struct wparse* p, const char** sp, int dquoted)
+{
+	const char* s;
+	char* text;
+	size_t len = 0;
+
+	text = xmalloc(strlen(*sp) + 1);
+	for (s = *sp; *s && *s != '`'; s++) {
+		if (*s == '\\' && s[1] && (strchr("$`\\",s[1]) || (dquoted && s[1] == '"')))
+			s++;
+		text[len++] = *s;
 	}
+	text[len] = '\0';
 
-	return ioc;
+	if (!*s) {
+		wp_nyi(p,"unterminated `%s",*sp);
+		free(text);
+		return 0;
+	}
+
+	wp_addcomsub(p,text,sp,s + 1,dquoted);
+	return 1;
 }
 
-static void make_rtioctx(struct ctioctx* ioc, const char* name)
+/*
+ * Parse a parameter expansion, `*sp' pointing just past the `$'.
+ * Returns 0 if it can't be compiled.
+ */
+static int parse_param(struct wparse* p, const char** sp, int dquoted)
 {
-	int i,num;
+	const char* s = *sp;
+	struct wordseg* seg;
+	struct wparse sub;
+	int braced = *s == '{';
+	int lenop = 0;
+	size_t len;
+
+	if (braced && *++s == '#' && s[1] != '}') {
+		lenop = 1;
+		s++;
+	}
 
-	num = ioc ? ioc->numfds : 0;
+	if (isdigit((unsigned char)*s))
+		len = braced ? strspn(s,"0123456789") : 1;
+	else if (braced && *s == '!' && s[1] != '}')
+		len = 0;
+	else if (*s && strchr("?#@*$!",*s))
+		len = 1;
+	else {
+		for (len = 0; isalnum((unsigned char)s[len]) || s[len] == '_'; len++)
+			;
+	}
 
-	if (num) {
-		icoutsn("struct rtioctx* %s = malloc(sizeof(struct rtioctx) + "
-		        "%d*sizeof(%s->fds[0]))",name,num,name);
-		icoutsn("%s->numfds = %d",name,ioc->numfds);
-		for (i = 0; i < ioc->numfds; i++) {
-			icoutsn("%s->fds[%d][0] = %s",name,i,ioc->fdnames[i][0]);
-			icoutsn("%s->fds[%d][1] = %s",name,i,ioc->fdnames[i][1]);
+	if (!len) {
+		if (braced)
+			wp_nyi(p,"${...} expansions");
+		else if (*s == '(' && s[1] == '(') {
+			*sp = s + 2;
+			return parse_arith(p,sp,dquoted);
+		} else if (*s == '(') {
+			*sp = s + 1;
+			return parse_comsub(p,sp,dquoted);
 		}
-	} else {
-		icoutsn("struct rtioctx* %s = NULL",name);
+		else if (*s == '\'' || (*s == '"' && !dquoted))
+			wp_nyi(p,"$%c...%c quoting",*s,*s);
+		else if (*s == '-')
+			wp_nyi(p,"$%c",*s);
+		else {
+			/* a lone $ is just a $ */
+			wp_addlit(p,"$",1);
+			*sp = s;
+			return 1;
+		}
+		return 0;
 	}
-}
 
-/* Constants for flags arguments to compile_* functions */
-#define CF_BACKGROUND 1
+	/* a quoted expansion always makes a word, so "" before it adds nothing */
+	if (dquoted && !p->litlen)
+		p->havelit = 0;
+	wp_flush(p);
 
-static struct ctioctx* compile_simple_command(COMMAND* cmd, int override_builtin,
-                                              struct ctioctx* ioc, int flags);
-static struct ctioctx* compile_command(COMMAND* cmd, struct ctioctx* ioc, int flags);
+	seg = wp_append(p,WS_PARAM);
+	seg->text = substring(s,0,len);
+	seg->quoted = dquoted;
+	seg->op = lenop ? '#' : 0;
+	s += len;
 
-static void comment_command(const char* label, COMMAND* cmd)
-{
-	icout("/* ");
-	if (label)
-		cout("%s: ",label);
-	coutn("$ %s */",make_command_string(cmd));
-}
+	if (!braced) {
+		*sp = s;
+		return 1;
+	}
 
-static void compile_breakcont(int isbreak, WORD_LIST* args)
-{
-	int i;
-	struct loopnest* loop;
-	long level;
-	char* levelstr;
-	char* endptr;
-	char* cmdname = isbreak ? "break" : "continue";
+	if (!lenop && *s == ':' && s[1] && strchr("-=+?",s[1])) {
+		seg->colon = 1;
+		s++;
+	}
+	if (!lenop && *s && strchr("-=+?",*s)) {
+		seg->op = *s++;
+		wp_init(&sub,p->quiet);
+		sub.pattern = p->pattern;
+		if (!parse_text(&sub,&s,dquoted,1)) {
+			wp_abandon(&sub);
+			return 0;
+		}
+		wp_flush(&sub);
+		seg->operand = sub.segs;
+		p->glob |= sub.glob;
+	}
 
-	if (args->next && args->next->next) {
-		report_error("%s: too many arguments",cmdname);
-		return;
+	if (*s != '}') {
+		wp_nyi(p,"${...} expansions");
+		return 0;
+	} else if (seg->op && seg->op != '#'
+	           && (!strcmp(seg->text,"@") || !strcmp(seg->text,"*"))) {
+		wp_nyi(p,"${%s%c...}",seg->text,seg->op);
+		return 0;
+	} else if (seg->op == '=' && !legal_identifier(seg->text)) {
+		wp_nyi(p,"${%s=...}",seg->text);
+		return 0;
 	}
 
-	if (args->next) {
-		if (args->next->word->flags) {
-			EXPNYI();
-			return;
-		}
-		levelstr = args->next->word->word;
-		errno = 0;
-		level = strtol(levelstr,&endptr,10);
-		/* this is slightly more restrictive integer-parsing than
-		 * interpreted bash (which allows trailing whitespace) */
-		if (((level == LONG_MIN || level == LONG_MAX) && errno != 0) || *endptr) {
-			report_error("%s: %s: numeric argument required",cmdname,levelstr);
-			return;
+	*sp = s + 1;
+	return 1;
+}
+
+/*
+ * Parse word text from `*sp' up to the end of the string, a closing
+ * double quote (if `dquoted') or a closing brace (if `inbrace').
+ * Returns 0 if it can't be compiled.
+ */
+static int parse_text(struct wparse* p, const char** sp, int dquoted, int inbrace)
+{
+	const char* s = *sp;
+	const char* q;
+
+	while (*s) {
+		if ((inbrace && *s == '}') || (dquoted && !inbrace && *s == '"'))
+			break;
+
+		switch (*s) {
+		case '\\':
+			if (s[1] == '\n')
+				s += 2;
+			else if (!s[1] || (dquoted && !strchr("$`\"\\",s[1])))
+				wp_addquoted(p,s++,1);
+			else {
+				wp_addquoted(p,s + 1,1);
+				s += 2;
+			}
+			continue;
+
+		case '\'':
+			if (dquoted)
+				break;
+			if (!(q = strchr(s + 1,'\'')))
+				q = s + strlen(s);
+			wp_addquoted(p,s + 1,q - s - 1);
+			s = *q ? q + 1 : q;
+			continue;
+
+		case '"':
+			s++;
+			p->havelit = 1;
+			if (!parse_text(p,&s,1,0))
+				return 0;
+			if (*s)
+				s++;
+			continue;
+
+		case '`':
+			s++;
+			if (!parse_backquote(p,&s,dquoted))
+				return 0;
+			continue;
+
+		case '$':
+			s++;
+			if (!parse_param(p,&s,dquoted))
+				return 0;
+			continue;
+
+		case '*':
+		case '?':
+			p->glob |= !dquoted;
+			break;
+
+		case '[':
+			p->glob |= !dquoted && strchr(s,']');
+			break;
 		}
-	} else
-		level = 1;
 
-	if (!loopstack) {
-		report_error("'%s' only meaningful inside a loop",cmdname);
-		return;
+		if (dquoted)
+			wp_addquoted(p,s++,1);
+		else
+			wp_addlit(p,s++,1);
 	}
 
-	for (i = 0, loop = loopstack; i < (level-1) && loop; i++, loop = loop->next);
-
-	icoutsn("goto %s",isbreak ? loop->exit : loop->entry);
+	*sp = s;
+	return 1;
 }
 
-static __must_use struct ctioctx* compile_builtin(sh_builtin_func_t* builtin,
-                                                  COMMAND* cmd, struct ctioctx* ioc,
-                                                  int flags)
+/*
+ * Parse `text' (a word, or the value in an assignment) into `*segs',
+ * as `pattern' (WP_*) says: a pattern's literal text is left as a
+ * pattern for bashc_fnmatch(), a regex's for regcomp().  Returns 0 if
+ * it can't be compiled, complaining unless `quiet'.
+ */
+static int parse_word(const char* text, struct wordseg** segs, int quiet, int pattern)
 {
-	struct simple_com* sc = cmd->value.Simple;
-	char* id;
+	struct wparse p;
+	struct wordseg* seg;
+	const char* s = text;
 
-	if (builtin == echo_builtin
-	    || builtin == test_builtin
-	    || builtin == kill_builtin) {
-		/* cheat and use system binaries for now */
-		return compile_simple_command(cmd,1,ioc,flags);
-	}
+	wp_init(&p,quiet);
+	p.pattern = pattern;
 
-	startblock();
+	if (*s == '~') {
+		if (s[1] && s[1] != '/') {
+			wp_nyi(&p,"tilde expansion of %s",s);
+			return 0;
+		}
+		seg = wp_append(&p,WS_PARAM);
+		seg->text = savestring("HOME");
+		seg->quoted = 1;
+		s++;
+	}
 
-	if (builtin == cd_builtin) {
-		make_cif("chdir(\"%s\")",sc->words->next->word->word);
-		icoutsn("perror(\"chdir: %s\")",sc->words->next->word->word);
-		make_failure();
-		make_celse();
-		make_success();
-		make_cendif();
-		cout("\n");
-	} else if (builtin == pwd_builtin) {
-		id = new_ident("cwd");
-		icoutsn("char* %s",id);
-		make_cif("!(%s = get_current_dir_name())",id);
-		icoutsn("perror(\"get_current_dir_name\")");
-		make_failure();
-		make_celse();
-		icoutsn("printf(\"%%s\\n\",%s)",id);
-		icoutsn("free(%s)",id);
-		make_success();
-		make_cendif();
-	} else if (builtin == false_builtin) {
-		make_failure();
-	} else if (builtin == colon_builtin) {
-		make_success();
-	} else if (builtin == break_builtin) {
-		compile_breakcont(1, sc->words);
-	} else if (builtin == continue_builtin) {
-		compile_breakcont(0, sc->words);
-	} else {
-		NYI("%s builtin",sc->words->word->word);
+	if (!parse_text(&p,&s,0,0)) {
+		wp_abandon(&p);
+		return 0;
 	}
+	wp_flush(&p);
 
-	endblock();
+	/* left as it is, as if nothing matched */
+	if (p.glob && !quiet && pattern == WP_WORD)
+		NYI("pathname expansion (of %s)",text);
 
-	return ioc;
+	*segs = p.segs;
+	return 1;
 }
 
-/* return the variable identifier */
-static __must_use char* build_argv(WORD_LIST* wds)
+static int parse_word_text(const char* text, struct wordseg** segs, int quiet)
 {
-	char* argvname = new_ident("argv");
-	icout("static char* const %s[] = ",argvname);
-	wordlist_to_cstr_array(wds,1);
-	cout(";\n");
-	return argvname;
+	return parse_word(text,segs,quiet,WP_WORD);
 }
 
-static void output_flags(int f)
+/* The text of a word that's all literal (malloced), or NULL */
+static __must_use char* segs_text(struct wordseg* segs)
 {
-	cout("0");
-	if (f & CF_BACKGROUND) cout("|FE_BACKGROUND");
+	if (!segs)
+		return savestring("");
+	else if (segs->type != WS_LIT || segs->next)
+		return NULL;
+
+	return savestring(segs->text);
 }
 
-/* FIXME: 'override_builtin' is an ugly hack. */
-static __must_use  struct ctioctx* compile_simple_command(COMMAND* cmd,
-                                                          int override_builtin,
-                                                          struct ctioctx* ioc, int flags)
+/*
+ * If `w' needs no expansion, return (malloced) what it stands for;
+ * otherwise NULL.
+ */
+static __must_use char* static_word(WORD_DESC* w)
 {
-	sh_builtin_func_t* builtin;
-	struct simple_com* sc = cmd->value.Simple;
-	char* argvname;
-	char* rtiocname;
-	char* retname;
-	const char* invt = (cmd->flags & CMD_INVERT_RETURN) ? "!" : "";
+	struct wordseg* segs;
+	char* text;
 
-	if (sc->redirects) {
-		NYI("redirects");
-		return ioc;
-	}
+	if (!parse_word_text(w->word,&segs,1))
+		return NULL;
 
-	if (!override_builtin &&
-	    (builtin = find_shell_builtin(sc->words->word->word)))
-		return compile_builtin(builtin,cmd,ioc,flags);
+	text = segs_text(segs);
+	free_segs(segs);
 
-	rtiocname = new_ident("rtioc");
-	retname = (flags & CF_BACKGROUND) ? NULL : new_ident("retstatus");
+	return text;
+}
+
+/* Whether any of `segs' is a command substitution */
+static int segs_have_comsub(struct wordseg* segs)
+{
+	for (; segs; segs = segs->next) {
+		if (segs->type == WS_COMSUB || segs_have_comsub(segs->operand))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int word_has_comsub(const char* text)
+{
+	struct wordseg* segs;
+	int ret;
+
+	if (!parse_word_text(text,&segs,1))
+		return 0;
+	ret = segs_have_comsub(segs);
+	free_segs(segs);
+
+	return ret;
+}
+
+/* Returns (malloced) the name of the C handle for variable `name' */
+static __must_use char* var_handle(const char* name)
+{
+	char* handle;
+
+	if (!hash_search(name,var_table,0)) {
+		hash_insert(savestring(name),var_table,0);
+		var_names = xrealloc(var_names,(num_vars+1)*sizeof(char*));
+		var_names[num_vars++] = savestring(name);
+	}
+
+	asprintf(&handle,"V_%s",name);
+	return handle;
+}
+
+/* Add a site to the profile table, returning its index */
+static int new_prof_site(int line, const char* cmdtext)
+{
+	const char* nl = strchr(cmdtext,'\n');
+	size_t len = nl ? (size_t)(nl - cmdtext) : strlen(cmdtext);
+	int more = nl != NULL;
+	struct profsite* site;
+
+	/* the first line of it will do */
+	while (len && (cmdtext[len-1] == ' ' || cmdtext[len-1] == ';'))
+		len--;
+	if (len > PROF_TEXT_MAX) {
+		len = PROF_TEXT_MAX;
+		more = 1;
+	}
+
+	prof_sites = xrealloc(prof_sites,(num_prof_sites+1)*sizeof(*prof_sites));
+	site = &prof_sites[num_prof_sites];
+	site->line = line;
+	site->text = xmalloc(len + 4);
+	memcpy(site->text,cmdtext,len);
+	strcpy(site->text + len,more ? "..." : "");
+
+	return num_prof_sites++;
+}
+
+/* Returns (malloced) a new name for a C function compiled from `name' */
+static __must_use char* function_cname(const char* name)
+{
+	char* base;
+	char* cname;
+
+	if (!legal_identifier(name))
+		return new_ident("F_");
+
+	asprintf(&base,"F_%s_",name);
+	cname = new_ident(base);
+	free(base);
+
+	return cname;
+}
+
+/* The shell function called `name', if the script defines one */
+static struct cfunc* lookup_cfunc(const char* name)
+{
+	BUCKET_CONTENTS* b = hash_search(name,func_table,0);
+
+	return b ? b->data : NULL;
+}
+
+/*
+ * Returns (malloced) a C expression for the value of parameter
+ * `name': a const char*, NULL if it's unset.
+ */
+static __must_use char* param_value(const char* name)
+{
+	char* handle;
+	char* expr;
+
+	if (isdigit((unsigned char)*name))
+		asprintf(&expr,"bashc_posparam(%d)",atoi(name));
+	else if (!strcmp(name,"?"))
+		expr = savestring("bashc_num_str(G_status)");
+	else if (!strcmp(name,"#"))
+		expr = savestring("bashc_num_str(bashc_posparams.n)");
+	else if (!strcmp(name,"$"))
+		expr = savestring("bashc_num_str(bashc_shell_pid)");
+	else if (!strcmp(name,"!"))
+		expr = savestring("bashc_lastbg()");
+	else {
+		handle = var_handle(name);
+		asprintf(&expr,"%s->value",handle);
+		free(handle);
+	}
+
+	return expr;
+}
+
+/*
+ * Arithmetic expressions are translated into C expressions on
+ * intmax_t, following the grammar in expr.c.  Variables, and the
+ * operations that can fail, go through libbashc (see
+ * libbashc/arith.c); an expression with a syntax error is left to its
+ * interpreter, which reports it at run time as bash would.
+ */
+struct arith {
+	const char* text;	/* the whole expression */
+	const char* s;
+	char* ctext;		/* `text' as a C string literal */
+	int bad;		/* a syntax error */
+	int nyi;		/* something that can't be compiled */
+	int quiet;
+};
+
+static const char* const arith_ops[] = {
+	"<<=", ">>=",
+	"**", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "++", "--",
+	"+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=",
+	"+", "-", "*", "/", "%", "<", ">", "=", "!", "~", "&", "^", "|",
+	"?", ":", ",", "(", ")",
+	NULL,
+};
+
+/* binary operators, loosest-binding first */
+static const char* const arith_levels[][5] = {
+	{ "||" }, { "&&" }, { "|" }, { "^" }, { "&" },
+	{ "==", "!=" }, { "<=", ">=", "<", ">" }, { "<<", ">>" },
+	{ "+", "-" }, { "*", "/", "%" },
+};
+#define ARITH_NLEVELS (sizeof(arith_levels)/sizeof(arith_levels[0]))
+
+/* Returns (malloced) `s' as a C string literal */
+static __must_use char* c_literal(const char* s)
+{
+	char* lit;
+	size_t len;
+	FILE* f;
+
+	if (!(f = open_memstream(&lit,&len)))
+		fatal_error("open_memstream: %s",strerror(errno));
+	fputc('"',f);
+	fcencode_string(f,s);
+	fputc('"',f);
+	fclose(f);
+
+	return lit;
+}
+
+/* Skip whitespace (and double quotes, which don't matter here) */
+static void ar_skip(struct arith* a)
+{
+	while (isspace((unsigned char)*a->s) || *a->s == '"')
+		a->s++;
+}
+
+static const char* ar_peek(struct arith* a)
+{
+	int i;
+
+	ar_skip(a);
+	for (i = 0; arith_ops[i]; i++) {
+		if (!strncmp(a->s,arith_ops[i],strlen(arith_ops[i])))
+			return arith_ops[i];
+	}
+
+	return NULL;
+}
+
+static int ar_accept(struct arith* a, const char* op)
+{
+	const char* cur = ar_peek(a);
+
+	if (!cur || strcmp(cur,op))
+		return 0;
+
+	a->s += strlen(op);
+	return 1;
+}
+
+static char* ar_syntax(struct arith* a)
+{
+	a->bad = 1;
+	return NULL;
+}
+
+static size_t ar_identlen(const char* s)
+{
+	size_t n = 0;
+
+	if (isalpha((unsigned char)*s) || *s == '_') {
+		while (isalnum((unsigned char)s[n]) || s[n] == '_')
+			n++;
+	}
+
+	return n;
+}
+
+/* Combine two operands (either of which may have failed) with `op' */
+static __must_use char* ar_binop(struct arith* a, const char* op, char* l, char* r)
+{
+	static const char* const calls[][2] = {
+		{ "+", "bashc_add" }, { "-", "bashc_sub" }, { "*", "bashc_mul" },
+		{ "<<", "bashc_shl" }, { ">>", "bashc_shr" },
+	};
+	static const char* const checked[][2] = {
+		{ "/", "bashc_arith_div" }, { "%", "bashc_arith_mod" },
+		{ "**", "bashc_arith_pow" },
+	};
+	char* expr = NULL;
+	size_t i;
+
+	if (!l || !r) {
+		free(l);
+		free(r);
+		return NULL;
+	}
+
+	for (i = 0; i < sizeof(calls)/sizeof(calls[0]); i++) {
+		if (!strcmp(op,calls[i][0]))
+			asprintf(&expr,"%s(%s,%s)",calls[i][1],l,r);
+	}
+	for (i = 0; i < sizeof(checked)/sizeof(checked[0]); i++) {
+		if (!strcmp(op,checked[i][0]))
+			asprintf(&expr,"%s(%s,%s,%s)",checked[i][1],l,r,a->ctext);
+	}
+	if (!expr)
+		asprintf(&expr,"(%s %s %s)",l,op,r);
+
+	free(l);
+	free(r);
+	return expr;
+}
+
+/* An integer constant, as expr.c's strlong() reads it */
+static __must_use char* ar_number(struct arith* a)
+{
+	const char* s = a->s;
+	const char* end;
+	uintmax_t v = 0;
+	int base = 10;
+	int digit;
+	char* expr;
+
+	for (end = s; isalnum((unsigned char)*end) || (*end && strchr("#@_",*end)); end++)
+		;
+	a->s = end;
+
+	if (memchr(s,'#',end - s)) {
+		for (base = 0; *s != '#'; s++) {
+			if (!isdigit((unsigned char)*s) || (base = base*10 + *s - '0') > 64)
+				return ar_syntax(a);
+		}
+		if (base < 2)
+			return ar_syntax(a);
+		s++;
+	} else if (end - s > 1 && s[0] == '0') {
+		if (s[1] == 'x' || s[1] == 'X') {
+			base = 16;
+			s += 2;
+		} else
+			base = 8;
+	}
+
+	if (s == end)
+		return ar_syntax(a);
+
+	for (; s < end; s++) {
+		if (isdigit((unsigned char)*s))
+			digit = *s - '0';
+		else if (islower((unsigned char)*s))
+			digit = *s - 'a' + 10;
+		else if (isupper((unsigned char)*s))
+			digit = *s - 'A' + (base <= 36 ? 10 : 36);
+		else if (*s == '@')
+			digit = 62;
+		else if (*s == '_')
+			digit = 63;
+		else
+			digit = 64;
+
+		if (digit >= base)
+			return ar_syntax(a);
+		v = v*base + digit;
+	}
+
+	if (v > INTMAX_MAX)
+		asprintf(&expr,"((intmax_t)%juu)",v);
+	else
+		asprintf(&expr,"%ju",v);
+
+	return expr;
+}
+
+/* A parameter expansion used as an operand, `a->s' pointing at the `$' */
+static __must_use char* ar_param(struct arith* a)
+{
+	struct wparse p;
+	struct wordseg* seg;
+	char* value;
+	char* handle;
+	char* expr = NULL;
+
+	wp_init(&p,a->quiet);
+	a->s++;
+	if (!parse_param(&p,&a->s,1) || !(seg = p.segs)) {
+		wp_abandon(&p);
+		a->nyi = 1;
+		return NULL;
+	}
+
+	if (seg->type == WS_ARITH)
+		asprintf(&expr,"(%s)",seg->text);
+	else if (seg->type != WS_PARAM || (seg->op && seg->op != '#')
+	         || !strcmp(seg->text,"@") || !strcmp(seg->text,"*")) {
+		wp_nyi(&p,"%s in arithmetic expressions",a->text);
+		a->nyi = 1;
+	} else if (seg->op == '#') {
+		value = param_value(seg->text);
+		asprintf(&expr,"bashc_strlen(%s)",value);
+		free(value);
+	} else if (!strcmp(seg->text,"?"))
+		expr = savestring("(intmax_t)G_status");
+	else if (!strcmp(seg->text,"#"))
+		expr = savestring("(intmax_t)bashc_posparams.n");
+	else if (!strcmp(seg->text,"$"))
+		expr = savestring("(intmax_t)bashc_shell_pid");
+	else if (isdigit((unsigned char)*seg->text) || !strcmp(seg->text,"!")) {
+		value = param_value(seg->text);
+		asprintf(&expr,"bashc_arith_str(%s)",value);
+		free(value);
+	} else {
+		handle = var_handle(seg->text);
+		asprintf(&expr,"bashc_arith_get(%s)",handle);
+		free(handle);
+	}
+
+	wp_abandon(&p);
+	return expr;
+}
+
+static char* ar_comma(struct arith* a);
+static char* ar_unary(struct arith* a);
+
+static __must_use char* ar_primary(struct arith* a)
+{
+	const char* s;
+	char* handle;
+	char* expr;
+	size_t len;
+
+	if (ar_accept(a,"(")) {
+		if (!(expr = ar_comma(a)))
+			return NULL;
+		if (!ar_accept(a,")")) {
+			free(expr);
+			return ar_syntax(a);
+		}
+		return expr;
+	}
+
+	ar_skip(a);
+	s = a->s;
+
+	if (isdigit((unsigned char)*s))
+		return ar_number(a);
+	else if (*s == '$')
+		return ar_param(a);
+	else if (!(len = ar_identlen(s)))
+		return ar_syntax(a);
+
+	a->s += len;
+	if (*a->s == '[') {
+		if (!a->quiet)
+			NYI("arrays in arithmetic expressions");
+		a->nyi = 1;
+		return NULL;
+	}
+
+	expr = substring(s,0,len);
+	handle = var_handle(expr);
+	free(expr);
+
+	if (ar_accept(a,"++"))
+		asprintf(&expr,"bashc_arith_incr(%s,1,1)",handle);
+	else if (ar_accept(a,"--"))
+		asprintf(&expr,"bashc_arith_incr(%s,-1,1)",handle);
+	else
+		asprintf(&expr,"bashc_arith_get(%s)",handle);
+
+	free(handle);
+	return expr;
+}
+
+static __must_use char* ar_unary(struct arith* a)
+{
+	const char* op = ar_peek(a);
+	char* handle;
+	char* name;
+	char* expr;
+	char* sub;
+	size_t len;
+
+	if (op && (!strcmp(op,"++") || !strcmp(op,"--"))) {
+		a->s += 2;
+		ar_skip(a);
+		if ((len = ar_identlen(a->s))) {
+			name = substring(a->s,0,len);
+			a->s += len;
+			handle = var_handle(name);
+			asprintf(&expr,"bashc_arith_incr(%s,%d,0)",handle,op[0] == '+' ? 1 : -1);
+			free(handle);
+			free(name);
+			return expr;
+		}
+		/* just two signs */
+		return ar_unary(a);
+	} else if (op && strchr("!~-+",op[0]) && !op[1]) {
+		a->s++;
+		if (!(sub = ar_unary(a)))
+			return NULL;
+		if (op[0] == '+')
+			return sub;
+		else if (op[0] == '-')
+			asprintf(&expr,"bashc_neg(%s)",sub);
+		else
+			asprintf(&expr,"(intmax_t)%c%s",op[0],sub);
+		free(sub);
+		return expr;
+	}
+
+	return ar_primary(a);
+}
+
+static __must_use char* ar_power(struct arith* a)
+{
+	char* expr = ar_unary(a);
+
+	if (expr && ar_accept(a,"**"))
+		expr = ar_binop(a,"**",expr,ar_power(a));
+
+	return expr;
+}
+
+static __must_use char* ar_binary(struct arith* a, size_t level)
+{
+	const char* op;
+	char* expr;
+	int i;
+
+	if (level == ARITH_NLEVELS)
+		return ar_power(a);
+
+	expr = ar_binary(a,level + 1);
+
+	while (expr && (op = ar_peek(a))) {
+		for (i = 0; arith_levels[level][i] && strcmp(arith_levels[level][i],op); i++)
+			;
+		if (!arith_levels[level][i])
+			break;
+		a->s += strlen(op);
+		expr = ar_binop(a,op,expr,ar_binary(a,level + 1));
+	}
+
+	return expr;
+}
+
+static __must_use char* ar_cond(struct arith* a)
+{
+	char* test = ar_binary(a,0);
+	char* yes;
+	char* no;
+	char* expr;
+
+	if (!test || !ar_accept(a,"?"))
+		return test;
+
+	yes = ar_comma(a);
+	if (!yes || !ar_accept(a,":")) {
+		free(test);
+		free(yes);
+		return yes ? ar_syntax(a) : NULL;
+	}
+
+	if (!(no = ar_cond(a))) {
+		free(test);
+		free(yes);
+		return NULL;
+	}
+
+	asprintf(&expr,"(%s ? %s : %s)",test,yes,no);
+	free(test);
+	free(yes);
+	free(no);
+	return expr;
+}
+
+static __must_use char* ar_assign(struct arith* a)
+{
+	static const char* const assignops[] = {
+		"=", "+=", "-=", "*=", "/=", "%=", "<<=", ">>=", "&=", "^=", "|=", NULL,
+	};
+	const char* start;
+	const char* op;
+	char binary[3];
+	char* handle;
+	char* name;
+	char* expr;
+	char* rhs;
+	size_t len;
+	int i;
+
+	ar_skip(a);
+	start = a->s;
+
+	if (!(len = ar_identlen(start)))
+		return ar_cond(a);
+
+	a->s += len;
+	op = ar_peek(a);
+	for (i = 0; op && assignops[i] && strcmp(assignops[i],op); i++)
+		;
+	if (!op || !assignops[i]) {
+		a->s = start;
+		return ar_cond(a);
+	}
+
+	a->s += strlen(op);
+	if (!(rhs = ar_assign(a)))
+		return NULL;
+
+	name = substring(start,0,len);
+	handle = var_handle(name);
+	free(name);
+
+	if (op[1]) {
+		/* +=, <<= and so on */
+		binary[0] = op[0];
+		binary[1] = op[1] == '=' ? '\0' : op[1];
+		binary[2] = '\0';
+		asprintf(&expr,"bashc_arith_get(%s)",handle);
+		rhs = ar_binop(a,binary,expr,rhs);
+	}
+
+	asprintf(&expr,"bashc_arith_set(%s,%s)",handle,rhs);
+	free(handle);
+	free(rhs);
+	return expr;
+}
+
+static __must_use char* ar_comma(struct arith* a)
+{
+	char* expr = ar_assign(a);
+	char* next;
+	char* tmp;
+
+	while (expr && ar_accept(a,",")) {
+		if (!(next = ar_assign(a))) {
+			free(expr);
+			return NULL;
+		}
+		asprintf(&tmp,"((void)%s, %s)",expr,next);
+		free(expr);
+		free(next);
+		expr = tmp;
+	}
+
+	return expr;
+}
+
+/*
+ * Returns (malloced) a C expression of type intmax_t evaluating
+ * arithmetic expression `text', or NULL if it can't be compiled
+ * (complaining unless `quiet').
+ */
+static __must_use char* translate_arith(const char* text, int quiet)
+{
+	struct arith a;
+	char* expr;
+
+	memset(&a,0,sizeof(a));
+	a.text = text;
+	a.s = text;
+	a.ctext = c_literal(text);
+	a.quiet = quiet;
+
+	ar_skip(&a);
+	if (!*a.s)
+		expr = savestring("(intmax_t)0");
+	else if ((expr = ar_comma(&a)) && (ar_skip(&a), *a.s)) {
+		free(expr);
+		expr = ar_syntax(&a);
+	}
+
+	if (a.nyi) {
+		free(expr);
+		expr = NULL;
+	} else if (a.bad) {
+		free(expr);
+		asprintf(&expr,"bashc_arith_eval(%s)",a.ctext);
+	}
+
+	free(a.ctext);
+	return expr;
+}
+
+static void emit_segs(struct wordseg* segs, const char* wb);
+static void emit_comsub(struct wordseg* seg, const char* wb);
+
+/*
+ * Declare a struct `type' (a wordbuf or the like) for code being
+ * output, returning (malloced) its name.  It's static, so its memory
+ * is kept for reuse, unless this is a function that can be reentered
+ * while it's in use (from a command substitution run in the shell's
+ * process), in which case each call gets its own, freed on return.
+ */
+static __must_use char* declare_buffer(const char* type, const char* base)
+{
+	char* name = new_ident(base);
+
+	if (curfunc && curfunc->reentrant) {
+		fprintf(curfunc->decls.stream,"\tstruct %s %s = { NULL, };\n",type,name);
+		fprintf(curfunc->cleanup.stream,"\t%s_free(&%s);\n",
+		        !strcmp(type,"bashc_wordbuf") ? "bashc_wb" : "bashc_capture",name);
+	} else
+		icoutsn("static struct %s %s",type,name);
+
+	return name;
+}
+
+static void emit_lit(const char* text, const char* wb)
+{
+	icout("bashc_wb_lit(%s,\"",wb);
+	cencode_string(text);
+	coutsn("\",%zu)",strlen(text));
+}
+
+/*
+ * Output code expanding `seg's operand into a temporary string, for
+ * ${p=w} and ${p?w}; returns (malloced) the wordbuf's name.
+ */
+static __must_use char* emit_operand_str(struct wordseg* seg)
+{
+	char* tmp = new_ident("wb");
+	char* ref;
+
+	asprintf(&ref,"&%s",tmp);
+	icoutsn("struct bashc_wordbuf %s = { NULL, }",tmp);
+	icoutsn("bashc_wb_start(%s,0)",ref);
+	emit_segs(seg->operand,ref);
+	free(ref);
+
+	return tmp;
+}
+
+static void emit_param(struct wordseg* seg, const char* wb)
+{
+	const char* name = seg->text;
+	char* value;
+	char* pval;
+	char* handle;
+	char* tmp;
+
+	if (!strcmp(name,"@") || !strcmp(name,"*")) {
+		if (seg->op == '#')
+			icoutsn("bashc_wb_expand(%s,bashc_num_str(bashc_posparams.n),%d)",
+			        wb,seg->quoted);
+		else
+			icoutsn("bashc_wb_%s(%s,%d)",*name == '@' ? "at" : "star",wb,
+			        seg->quoted);
+		return;
+	}
+
+	value = param_value(name);
+
+	if (!seg->op) {
+		icoutsn("bashc_wb_expand(%s,%s,%d)",wb,value,seg->quoted);
+		free(value);
+		return;
+	} else if (seg->op == '#') {
+		icoutsn("bashc_wb_expand(%s,bashc_num_str(bashc_strlen(%s)),%d)",wb,value,
+		        seg->quoted);
+		free(value);
+		return;
+	}
+
+	pval = new_ident("pval");
+	startblock();
+	icoutsn("const char* %s = %s",pval,value);
+	make_cif("%sbashc_param_unset(%s,%d)",seg->op == '+' ? "!" : "",pval,seg->colon);
+
+	switch (seg->op) {
+	case '-':
+	case '+':
+		if (seg->quoted)
+			emit_lit("",wb);
+		emit_segs(seg->operand,wb);
+		if (seg->op == '-') {
+			make_celse();
+			icoutsn("bashc_wb_expand(%s,%s,%d)",wb,pval,seg->quoted);
+		}
+		break;
+
+	case '=':
+		tmp = emit_operand_str(seg);
+		handle = var_handle(name);
+		icoutsn("bashc_setvar(%s,bashc_wb_str(&%s))",handle,tmp);
+		icoutsn("bashc_wb_free(&%s)",tmp);
+		icoutsn("%s = %s->value",pval,handle);
+		free(handle);
+		free(tmp);
+		break;
+
+	case '?':
+		tmp = emit_operand_str(seg);
+		icoutsn("bashc_param_error(\"%s\",bashc_wb_str(&%s))",name,tmp);
+		free(tmp);
+		break;
+	}
+
+	make_cendif();
+	if (seg->op == '=' || seg->op == '?')
+		icoutsn("bashc_wb_expand(%s,%s,%d)",wb,pval,seg->quoted);
+	endblock();
+
+	free(pval);
+	free(value);
+}
+
+/* Output code appending `segs' to wordbuf `wb' (a C pointer expression) */
+static void emit_segs(struct wordseg* segs, const char* wb)
+{
+	for (; segs; segs = segs->next) {
+		if (segs->type == WS_LIT)
+			emit_lit(segs->text,wb);
+		else if (segs->type == WS_ARITH) {
+			icoutsn("bashc_wb_expand(%s,bashc_num_str(bashc_arith_value(%s)),%d)",
+			        wb,segs->text,segs->quoted);
+			may_abandon = 1;
+		} else if (segs->type == WS_COMSUB)
+			emit_comsub(segs,wb);
+		else
+			emit_param(segs,wb);
+	}
+}
+
+/*
+ * Output code expanding `segs' as a single string into a new wordbuf
+ * (see declare_buffer()) started with `wbflags'.  Returns (malloced) a
+ * C expression for the result.
+ */
+static __must_use char* emit_string(struct wordseg* segs, const char* wbflags)
+{
+	char* wb = declare_buffer("bashc_wordbuf","wb");
+	char* expr;
+
+	icoutsn("bashc_wb_start(&%s,%s)",wb,wbflags);
+	asprintf(&expr,"&%s",wb);
+	emit_segs(segs,expr);
+	free(expr);
+	asprintf(&expr,"bashc_wb_str(&%s)",wb);
+	free(wb);
+
+	return expr;
+}
+
+/*
+ * Parse `text', and if it needs expanding output code to expand it as a
+ * single string (as for an assignment or a redirection) into a new
+ * wordbuf.  Returns (malloced) a C expression for the result,
+ * or NULL if it can't be compiled; `*isstatic' (if given) says
+ * whether it's a constant.
+ */
+static __must_use char* expand_to_string(const char* text, int* isstatic)
+{
+	struct wordseg* segs;
+	char* lit;
+	char* expr;
+
+	if (!parse_word_text(text,&segs,0))
+		return NULL;
+
+	if ((lit = segs_text(segs))) {
+		expr = c_literal(lit);
+		free(lit);
+		if (isstatic)
+			*isstatic = 1;
+	} else {
+		expr = emit_string(segs,"0");
+		if (isstatic)
+			*isstatic = 0;
+	}
+
+	free_segs(segs);
+	return expr;
+}
+
+/* Compile-time I/O context.  Strings put in the fdnames array should
+ * always be malloced. */
+struct ctioctx {
+	int numfds;
+	char* fdnames[][2];
+};
+
+static __must_use struct ctioctx* new_ioc(int numfds)
+{
+	struct ctioctx* ioc = malloc(sizeof(struct ctioctx)
+	                             + numfds*sizeof(ioc->fdnames[0]));
+	ioc->numfds = numfds;
+	return ioc;
+}
+
+static __must_use struct ctioctx* merge_iocs(struct ctioctx* a, struct ctioctx* b)
+{
+	int i,j;
+	struct ctioctx* ioc;
+
+	if (!a) return b;
+	if (!b) return a;
+
+	ioc = new_ioc(a->numfds + b->numfds);
+	for (i = 0; i < a->numfds; i++) {
+		ioc->fdnames[i][0] = a->fdnames[i][0];
+		ioc->fdnames[i][1] = a->fdnames[i][1];
+	}
+	for (j = 0; j < b->numfds; j++) {
+		ioc->fdnames[i+j][0] = b->fdnames[j][0];
+		ioc->fdnames[i+j][1] = b->fdnames[j][1];
+	}
+	return ioc;
+}
+
+/*
+ * Make room for 'n' more entries.  Alternately, if 'n' is negative,
+ * shrink by that many entries, freeing the entries in the freed
+ * slots.  Returns a possibly-relocated `ioc', or NULL on error or
+ * shrinking to zero size.
+ */
+static __must_use struct ctioctx* ioc_grow(struct ctioctx* ioc, int n)
+{
+	int old,i;
+
+	old = ioc ? ioc->numfds : 0;
+
+	if (old + n < 0)
+		fatal_error("tried to shrink ctioctx below zero size");
+
+	if (n < 0) {
+		for (i = old + n; i < old; i++) {
+			free(ioc->fdnames[i][0]);
+			free(ioc->fdnames[i][1]);
+		}
+	}
+
+	if (old + n == 0) {
+		free(ioc);
+		ioc = NULL;
+	} else {
+		ioc = realloc(ioc,sizeof(struct ctioctx) + (old+n)*sizeof(ioc->fdnames[0]));
+		if (ioc)
+			ioc->numfds = old + n;
+	}
+
+	return ioc;
+}
+
+/*
+ * Output a run-time I/O context from `ioc' and the redirection plan
+ * `plan' (with `nredirs' entries, static if `planstatic'), either of
+ * which may be empty.  Returns (malloced) the C expression to pass for
+ * it.  Nothing is allocated at run time: the context lives on the
+ * stack if it has pipe ends or a run-time plan in it, and in static
+ * storage if not.
+ */
+static __must_use char* make_rtioctx(struct ctioctx* ioc, const char* plan,
+                                     int nredirs, int planstatic)
+{
+	int i,num;
+	char* name;
+	char* expr;
+
+	num = ioc ? ioc->numfds : 0;
+
+	if (!num && !nredirs)
+		return strdup("NULL");
+
+	name = new_ident("rtioc");
+
+	if (num) {
+		icout("const int %s_fds[%d][2] = { ",name,num);
+		for (i = 0; i < num; i++)
+			cout("{ %s, %s }, ",ioc->fdnames[i][0],ioc->fdnames[i][1]);
+		coutn("};");
+		icoutsn("const struct rtioctx %s = { %d, %s, %d, %s_fds }",name,
+		        nredirs,nredirs ? plan : "NULL",num,name);
+	} else {
+		icoutsn("%sconst struct rtioctx %s = { %d, %s, 0, NULL }",
+		        planstatic ? "static " : "",name,nredirs,plan);
+	}
+
+	asprintf(&expr,"&%s",name);
+	free(name);
+
+	return expr;
+}
+
+/* One entry of a redirection plan, as C source */
+struct ctredir {
+	const char* op;
+	int fd;
+	int src;
+	const char* oflags;
+	char* path;		/* a C expression */
+};
+
+/* Parse a literal `[n][-]' duplication target; returns 0 if it isn't one */
+static int parse_dup_word(const char* word, int* fd, int* move)
+{
+	char* end;
+	long n;
+
+	*move = 0;
+	if (!strcmp(word,"-")) {
+		*fd = -1;
+		return 1;
+	}
+
+	errno = 0;
+	n = strtol(word,&end,10);
+	if (end == word || !isdigit(*word) || errno || n > INT_MAX)
+		return 0;
+	if (*end == '-') {
+		*move = 1;
+		end++;
+	}
+	if (*end)
+		return 0;
+
+	*fd = n;
+	return 1;
+}
+
+/*
+ * Translate redirection `r' into (up to two) plan entries in `out';
+ * returns how many, or -1 if it can't be compiled.  `*isstatic' is
+ * cleared if the target has to be expanded at run time.
+ */
+static int translate_redirect(REDIRECT* r, struct ctredir out[2], int* isstatic)
+{
+	enum r_instruction ri = r->instruction;
+	char* path = NULL;
+	char* dupword;
+	const char* oflags = NULL;
+	int fd = r->redirector.dest;
+	int src,move,ok,pathstatic;
+
+	if (r->rflags & REDIR_VARASSIGN) {
+		NYI("{varname} redirections");
+		return -1;
+	} else if (fd < 0) {
+		report_error("file descriptor out of range");
+		return -1;
+	}
+
+	switch (ri) {
+	case r_reading_until:
+	case r_deblank_reading_until:
+	case r_reading_string:
+		NYI("here-documents");
+		return -1;
+
+	case r_duplicating_input:
+	case r_duplicating_output:
+	case r_move_input:
+	case r_move_output:
+		src = r->redirectee.dest;
+		move = ri == r_move_input || ri == r_move_output;
+		break;
+
+	case r_close_this:
+		src = -1;
+		move = 0;
+		break;
+
+	case r_duplicating_input_word:
+	case r_duplicating_output_word:
+	case r_move_input_word:
+	case r_move_output_word:
+		if (!(dupword = static_word(r->redirectee.filename))) {
+			EXPNYI();
+			return -1;
+		}
+		ok = parse_dup_word(dupword,&src,&move);
+		free(dupword);
+		if (ok) {
+			move |= ri == r_move_input_word || ri == r_move_output_word;
+			break;
+		} else if (ri != r_duplicating_output_word || fd != 1) {
+			report_error("%s: ambiguous redirect",r->redirectee.filename->word);
+			return -1;
+		}
+		/* >&word is &>word */
+		ri = r_err_and_out;
+		/* FALLTHROUGH */
+
+	default:
+		if (!(path = expand_to_string(r->redirectee.filename->word,&pathstatic)))
+			return -1;
+		*isstatic &= pathstatic;
+		break;
+	}
+
+	switch (ri) {
+	case r_output_direction:
+	case r_output_force:
+	case r_err_and_out:
+		oflags = "O_WRONLY|O_CREAT|O_TRUNC";
+		break;
+	case r_appending_to:
+	case r_append_err_and_out:
+		oflags = "O_WRONLY|O_CREAT|O_APPEND";
+		break;
+	case r_input_direction:
+	case r_inputa_direction:
+		oflags = "O_RDONLY";
+		break;
+	case r_input_output:
+		oflags = "O_RDWR|O_CREAT";
+		break;
+	default:
+		break;
+	}
+
+	if (oflags) {
+		out[0].op = "RTREDIR_OPEN";
+		out[0].fd = fd;
+		out[0].src = -1;
+		out[0].oflags = oflags;
+		out[0].path = path;
+		if (ri != r_err_and_out && ri != r_append_err_and_out)
+			return 1;
+		/* ...and then 2>&1 */
+		out[1].op = "RTREDIR_DUP";
+		out[1].fd = 2;
+		out[1].src = fd;
+		out[1].oflags = "0";
+		out[1].path = NULL;
+		return 2;
+	}
+
+	out[0].op = src < 0 ? "RTREDIR_CLOSE" : move ? "RTREDIR_MOVE" : "RTREDIR_DUP";
+	out[0].fd = fd;
+	out[0].src = src;
+	out[0].oflags = "0";
+	out[0].path = NULL;
+	return 1;
+}
+
+static void free_plan(struct ctredir* plan, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		free(plan[i].path);
+	free(plan);
+}
+
+/*
+ * Output `redirs' as a redirection plan, returning its name (NULL if
+ * it can't be compiled) and length.  The plan is static unless some
+ * target has to be expanded at run time, in which case `*isstatic'
+ * (if given) is cleared.
+ */
+static __must_use char* build_redir_plan(REDIRECT* redirs, int* nredirs,
+                                         int* isstatic)
+{
+	struct ctredir* plan = NULL;
+	REDIRECT* r;
+	char* name;
+	int i,n;
+	int planstatic = 1;
+
+	for (*nredirs = 0, r = redirs; r; r = r->next) {
+		plan = xrealloc(plan,(*nredirs + 2)*sizeof(*plan));
+		if ((n = translate_redirect(r,plan + *nredirs,&planstatic)) < 0) {
+			free_plan(plan,*nredirs);
+			return NULL;
+		}
+		*nredirs += n;
+	}
+
+	name = new_ident("redirs");
+	icoutn("%sconst struct rtredir %s[] = {",planstatic ? "static " : "",name);
+	for (i = 0; i < *nredirs; i++) {
+		icoutn("\t{ %s, %d, %d, %s, %s },",plan[i].op,plan[i].fd,plan[i].src,
+		       plan[i].oflags,plan[i].path ? plan[i].path : "NULL");
+	}
+	icoutn("};");
+
+	free_plan(plan,*nredirs);
+	if (isstatic)
+		*isstatic = planstatic;
+
+	return name;
+}
+
+/* Constants for flags arguments to compile_* functions */
+#define CF_BACKGROUND 1
+#define CF_EXEC 2	/* the last thing its process does; see compile_forked() */
+
+static struct ctioctx* compile_command(COMMAND* cmd, struct ctioctx* ioc, int flags);
+
+static void comment_command(const char* label, COMMAND* cmd)
+{
+	icout("/* ");
+	if (label)
+		cout("%s: ",label);
+	coutn("$ %s */",make_command_string(cmd));
+}
+
+static void compile_breakcont(int isbreak, WORD_LIST* args)
+{
+	int i;
+	struct loopnest* loop;
+	struct loopnest* inner;
+	long level;
+	char* levelstr;
+	char* endptr;
+	char* cmdname = isbreak ? "break" : "continue";
+
+	if (args->next && args->next->next) {
+		report_error("%s: too many arguments",cmdname);
+		return;
+	}
+
+	if (args->next) {
+		if (!(levelstr = static_word(args->next->word))) {
+			EXPNYI();
+			return;
+		}
+		errno = 0;
+		level = strtol(levelstr,&endptr,10);
+		/* this is slightly more restrictive integer-parsing than
+		 * interpreted bash (which allows trailing whitespace) */
+		if (((level == LONG_MIN || level == LONG_MAX) && errno != 0) || *endptr) {
+			report_error("%s: %s: numeric argument required",cmdname,levelstr);
+			free(levelstr);
+			return;
+		}
+		free(levelstr);
+	} else
+		level = 1;
+
+	if (!loopstack) {
+		report_error("'%s' only meaningful inside a loop",cmdname);
+		return;
+	}
+
+	for (i = 0, loop = loopstack; i < (level-1) && loop->next; i++, loop = loop->next);
+
+	if (loop->redir_depth < redir_depth)
+		icoutsn("bashc_redir_unwind(%d)",redir_depth - loop->redir_depth);
+	for (inner = loopstack; inner != loop; inner = inner->next) {
+		if (inner->cleanup)
+			icoutsn("free(%s)",inner->cleanup);
+	}
+	if (isbreak && loop->cleanup)
+		icoutsn("free(%s)",loop->cleanup);
+	make_success();
+	icoutsn("goto %s",isbreak ? loop->exit : loop->entry);
+	if (isbreak)
+		loop->exit_used = 1;
+	else
+		loop->entry_used = 1;
+}
+
+/* Builtins implemented natively by libbashc, and their runtime names */
+static const struct rtbuiltin {
+	sh_builtin_func_t* builtin;
+	const char* rtfunc;
+} rtbuiltins[] = {
+	{ echo_builtin, "bashc_echo" },
+	{ test_builtin, "bashc_test" },
+	{ kill_builtin, "bashc_kill" },
+	{ cd_builtin, "bashc_cd" },
+	{ pwd_builtin, "bashc_pwd" },
+	{ wait_builtin, "bashc_wait" },
+};
+
+static const char* find_rtbuiltin(sh_builtin_func_t* builtin)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(rtbuiltins)/sizeof(rtbuiltins[0]); i++) {
+		if (rtbuiltins[i].builtin == builtin)
+			return rtbuiltins[i].rtfunc;
+	}
+
+	return NULL;
+}
+
+/* `set', for the options the runtime knows about */
+static void compile_set(WORD_LIST* args)
+{
+	WORD_LIST* wd;
+	char* opt;
+	char* arg = NULL;
+	int ok;
+
+	for (wd = args; wd; wd = wd->next) {
+		if (!(opt = static_word(wd->word))) {
+			EXPNYI();
+			return;
+		}
+		ok = (opt[0] == '-' || opt[0] == '+') && !strcmp(opt+1,"o") && wd->next
+		     && (arg = static_word(wd->next->word)) && !strcmp(arg,"pipefail");
+		if (!ok)
+			NYI("set %s",opt);
+		free(opt);
+		free(arg);
+		arg = NULL;
+		if (!ok)
+			return;
+		wd = wd->next;
+	}
+
+	for (wd = args; wd; wd = wd->next->next) {
+		opt = static_word(wd->word);
+		icoutsn("bashc_pipefail = %d",opt[0] == '-');
+		free(opt);
+	}
+	make_success();
+}
+
+/* Report `name' as an invalid identifier when run */
+static void emit_invalid_identifier(const char* builtin, const char* name)
+{
+	icout("bashc_builtin_error(&bashc_stderr,\"%s\",\"`%%s': not a valid identifier\",\"",
+	      builtin);
+	cencode_string(name);
+	coutsn("\")");
+}
+
+/*
+ * If `w' is an assignment we can compile, return (malloced) the
+ * variable's handle, with `*value' pointing at the text of the value.
+ */
+static __must_use char* parse_assignment(WORD_DESC* w, const char** value)
+{
+	const char* text = w->word;
+	char* name;
+	char* handle = NULL;
+	int eq;
+
+	if ((eq = assignment(text,0)) <= 0)
+		return NULL;
+
+	name = substring(text,0,eq);
+	if (text[eq-1] == '+')
+		NYI("+= assignments");
+	else if (!legal_identifier(name) || (w->flags & W_COMPASSIGN))
+		NYI("array assignments");
+	else {
+		handle = var_handle(name);
+		*value = text + eq + 1;
+	}
+	free(name);
+
+	return handle;
+}
+
+/*
+ * Output assignment `w', or if `save' is non-NULL a temporary one for
+ * the command that follows, saving the variable's old state there.
+ * Returns (malloced) the variable's handle, or NULL if it can't be
+ * compiled.
+ */
+static __must_use char* emit_assignment(WORD_DESC* w, const char* save)
+{
+	const char* text;
+	char* handle;
+	char* value;
+
+	if (!(handle = parse_assignment(w,&text)))
+		return NULL;
+	else if (!(value = expand_to_string(text,NULL))) {
+		free(handle);
+		return NULL;
+	}
+
+	if (save)
+		icoutsn("bashc_var_settemp(%s,%s,%s)",save,handle,value);
+	else
+		icoutsn("bashc_setvar(%s,%s)",handle,value);
+	free(value);
+
+	return handle;
+}
+
+/* `export', for plain variables */
+static void compile_export(WORD_LIST* args)
+{
+	WORD_LIST* wd;
+	char* handle;
+	char* name;
+	char* eq;
+	int bad = 0;
+
+	if (!args) {
+		NYI("export with no arguments");
+		return;
+	}
+
+	for (wd = args; wd; wd = wd->next) {
+		if (assignment(wd->word->word,0) > 0) {
+			if (!(handle = emit_assignment(wd->word,NULL)))
+				return;
+		} else if (!(name = static_word(wd->word))) {
+			EXPNYI();
+			return;
+		} else if (name[0] == '-') {
+			NYI("export %s",name);
+			free(name);
+			return;
+		} else {
+			/* a quoted assignment, perhaps */
+			if ((eq = strchr(name,'=')))
+				*eq = '\0';
+			if (!legal_identifier(name)) {
+				if (eq)
+					*eq = '=';
+				emit_invalid_identifier("export",name);
+				free(name);
+				bad = 1;
+				continue;
+			}
+			handle = var_handle(name);
+			if (eq) {
+				icout("bashc_setvar(%s,\"",handle);
+				cencode_string(eq + 1);
+				coutsn("\")");
+			}
+			free(name);
+		}
+		icoutsn("bashc_export(%s,1)",handle);
+		free(handle);
+	}
+
+	icoutsn("G_status = %d",bad);
+}
+
+/* `unset', for plain variables and functions */
+static void compile_unset(WORD_LIST* args)
+{
+	WORD_LIST* wd;
+	struct cfunc* func;
+	char* handle;
+	char* name;
+	int bad = 0;
+	int funcs = 0;
+
+	for (wd = args; wd; wd = wd->next) {
+		if (!(name = static_word(wd->word))) {
+			EXPNYI();
+			return;
+		} else if ((!strcmp(name,"-v") || !strcmp(name,"-f")) && wd == args) {
+			funcs = name[1] == 'f';
+			free(name);
+			continue;
+		} else if (funcs) {
+			/* one the script never defines can't be set */
+			if ((func = lookup_cfunc(name)))
+				icoutsn("%s->fn = NULL",func->handle);
+		} else if (name[0] == '-') {
+			NYI("unset %s",name);
+			free(name);
+			return;
+		} else if (!legal_identifier(name)) {
+			emit_invalid_identifier("unset",name);
+			bad = 1;
+		} else {
+			handle = var_handle(name);
+			icoutsn("bashc_unsetvar(%s)",handle);
+			free(handle);
+		}
+		free(name);
+	}
+
+	icoutsn("G_status = %d",bad);
+}
+
+static void compile_shift(WORD_LIST* args)
+{
+	char* countstr;
+	char* endptr;
+	long count = 1;
+
+	if (args) {
+		if (!(countstr = static_word(args->word))) {
+			EXPNYI();
+			return;
+		}
+		errno = 0;
+		count = strtol(countstr,&endptr,10);
+		if (errno || !*countstr || *endptr || count > INT_MAX || count < INT_MIN) {
+			report_error("shift: %s: numeric argument required",countstr);
+			free(countstr);
+			return;
+		}
+		free(countstr);
+	}
+
+	icoutsn("G_status = bashc_shift(%ld)",count);
+}
+
+/* `local', for plain variables */
+static void compile_local(WORD_LIST* args)
+{
+	WORD_LIST* wd;
+	const char* text;
+	char* handle;
+	char* value;
+	char* name;
+	int bad = 0;
+
+	if (!curfunc) {
+		icoutsn("bashc_builtin_error(&bashc_stderr,\"local\",\"can only be used in a function\")");
+		make_failure();
+		return;
+	} else if (curfunc->sourced) {
+		/* it depends on whether it was sourced from a function */
+		NYI("local in a sourced file");
+		return;
+	} else if (!args) {
+		NYI("local with no arguments");
+		return;
+	}
+
+	for (wd = args; wd; wd = wd->next) {
+		if (assignment(wd->word->word,0) > 0) {
+			/* the value is expanded before the variable goes local */
+			if (!(handle = parse_assignment(wd->word,&text)))
+				return;
+			else if (!(value = expand_to_string(text,NULL))) {
+				free(handle);
+				return;
+			}
+			icoutsn("bashc_local(%s)",handle);
+			icoutsn("bashc_setvar(%s,%s)",handle,value);
+			free(handle);
+			free(value);
+			continue;
+		} else if (!(name = static_word(wd->word))) {
+			EXPNYI();
+			return;
+		} else if (name[0] == '-') {
+			NYI("local %s",name);
+			free(name);
+			return;
+		} else if (!legal_identifier(name)) {
+			emit_invalid_identifier("local",name);
+			bad = 1;
+		} else {
+			handle = var_handle(name);
+			icoutsn("bashc_local(%s)",handle);
+			free(handle);
+		}
+		free(name);
+	}
+
+	icoutsn("G_status = %d",bad);
+}
+
+/* `return' from the function being compiled */
+static void compile_return(WORD_LIST* args)
+{
+	struct loopnest* loop;
+	intmax_t n;
+	char* arg;
+
+	if (!curfunc || curfunc->comsub) {
+		icoutsn("bashc_builtin_error(&bashc_stderr,\"return\","
+		        "\"can only `return' from a function or sourced script\")");
+		make_failure();
+		return;
+	} else if (args && args->next) {
+		report_error("return: too many arguments");
+		return;
+	}
+
+	if (args && (arg = static_word(args->word))) {
+		if (legal_number(arg,&n))
+			icoutsn("G_status = %d",(int)(n & 255));
+		else {
+			icout("bashc_builtin_error(&bashc_stderr,\"return\",\"%%s: numeric argument required\",\"");
+			cencode_string(arg);
+			coutsn("\")");
+			icoutsn("G_status = 2");
+		}
+		free(arg);
+	} else if (args) {
+		if (!(arg = expand_to_string(args->word->word,NULL)))
+			return;
+		icoutsn("G_status = bashc_return_status(%s)",arg);
+		free(arg);
+	}
+
+	if (curfunc->forked) {
+		/* it's a subshell that's returning, not the function */
+		icoutsn("bashc_exit(G_status)");
+		return;
+	}
+
+	for (loop = loopstack; loop; loop = loop->next) {
+		if (loop->cleanup)
+			icoutsn("free(%s)",loop->cleanup);
+	}
+	if (redir_depth)
+		icoutsn("bashc_redir_unwind(%d)",redir_depth);
+	icoutsn("goto %s",FUNC_RETURN);
+	curfunc->return_used = 1;
+}
+
+static void compile_source(WORD_LIST* args);
+
+/* Output code expanding `words' only for what that does, like ${x:=y} */
+static void expand_and_discard(WORD_LIST* words)
+{
+	struct wordseg* segs;
+	char* lit;
+	char* expr;
+
+	for (; words; words = words->next) {
+		if (!parse_word_text(words->word->word,&segs,0))
+			continue;
+		if ((lit = segs_text(segs)))
+			free(lit);
+		else {
+			expr = emit_string(segs,"0");
+			free(expr);
+		}
+		free_segs(segs);
+	}
+}
+
+/* `words' starts with the builtin's name */
+static __must_use struct ctioctx* compile_builtin(sh_builtin_func_t* builtin,
+                                                  WORD_LIST* words, struct ctioctx* ioc,
+                                                  int flags)
+{
+	startblock();
+
+	if (builtin == false_builtin) {
+		expand_and_discard(words->next);
+		make_failure();
+	} else if (builtin == colon_builtin) {
+		expand_and_discard(words->next);
+		make_success();
+	} else if (builtin == break_builtin) {
+		compile_breakcont(1, words);
+	} else if (builtin == continue_builtin) {
+		compile_breakcont(0, words);
+	} else if (builtin == set_builtin) {
+		compile_set(words->next);
+	} else if (builtin == export_builtin) {
+		compile_export(words->next);
+	} else if (builtin == unset_builtin) {
+		compile_unset(words->next);
+	} else if (builtin == shift_builtin) {
+		compile_shift(words->next);
+	} else if (builtin == local_builtin) {
+		compile_local(words->next);
+	} else if (builtin == return_builtin) {
+		compile_return(words->next);
+	} else if (builtin == source_builtin) {
+		compile_source(words->next);
+	} else {
+		NYI("%s builtin",words->word->word);
+	}
+
+	endblock();
+
+	return ioc;
+}
+
+/* Record `name' as a command to resolve via $PATH at startup */
+static void note_literal_command(const char* name)
+{
+	if (strchr(name,'/') || hash_search(name,literal_cmd_table,0))
+		return;
+
+	hash_insert(savestring(name),literal_cmd_table,0);
+	literal_cmds = xrealloc(literal_cmds,(num_literal_cmds+1)*sizeof(char*));
+	literal_cmds[num_literal_cmds++] = savestring(name);
+}
+
+/*
+ * Output the argument list `wds', returning (malloced) its name, or
+ * NULL if it can't be compiled.  If no word needs expanding it's a
+ * static array; otherwise it's built at run time (in a wordbuf that's
+ * reused each time; see declare_buffer()), and `*isdynamic' (if given)
+ * is set.
+ */
+static __must_use char* build_argv(WORD_LIST* wds, int* isdynamic)
+{
+	struct wordseg** segs;
+	WORD_LIST* wd;
+	char* argvname = NULL;
+	char* wb;
+	char* ref;
+	int i,n,nparsed;
+	int dynamic = 0;
+
+	n = list_length((GENERIC_LIST*)wds);
+	segs = xmalloc(n * sizeof(*segs));
+
+	for (nparsed = 0, wd = wds; wd; wd = wd->next, nparsed++) {
+		if (!parse_word_text(wd->word->word,&segs[nparsed],0))
+			goto out;
+		if (segs[nparsed] && (segs[nparsed]->type != WS_LIT || segs[nparsed]->next))
+			dynamic = 1;
+	}
+
+	argvname = new_ident("argv");
+	if (isdynamic)
+		*isdynamic = dynamic;
+
+	if (!dynamic) {
+		icout("static char* const %s[] = { ",argvname);
+		for (i = 0; i < n; i++) {
+			cout("\"");
+			cencode_string(segs[i] ? segs[i]->text : "");
+			cout("\", ");
+		}
+		coutn("NULL, };");
+	} else {
+		wb = declare_buffer("bashc_wordbuf","wb");
+		asprintf(&ref,"&%s",wb);
+		icoutsn("bashc_wb_start(%s,1)",ref);
+		for (i = 0; i < n; i++) {
+			if (i > 0)
+				icoutsn("bashc_wb_break(%s)",ref);
+			if (!segs[i])
+				emit_lit("",ref);
+			emit_segs(segs[i],ref);
+		}
+		icoutsn("char* const* %s = bashc_wb_argv(%s)",argvname,ref);
+		free(ref);
+		free(wb);
+	}
+
+out:
+	for (i = 0; i < nparsed; i++)
+		free_segs(segs[i]);
+	free(segs);
+
+	return argvname;
+}
+
+/* Skip the assignments at the start of a simple command */
+static WORD_LIST* first_command_word(WORD_LIST* wds)
+{
+	while (wds && (wds->word->flags & W_ASSIGNMENT))
+		wds = wds->next;
+
+	return wds;
+}
+
+/*
+ * A simple command with no command name: assignments and redirections.
+ * Its status is that of the last command substitution in it, if any.
+ */
+static void compile_assignments(struct simple_com* sc)
+{
+	WORD_LIST* wd;
+	char* handle;
+	char* plan;
+	int nredirs;
+	int comsub = 0;
+
+	startblock();
+
+	for (wd = sc->words; wd; wd = wd->next) {
+		if (!(handle = emit_assignment(wd->word,NULL))) {
+			endblock();
+			return;
+		}
+		free(handle);
+		comsub |= word_has_comsub(wd->word->word);
+	}
+
+	if (!sc->redirects) {
+		if (!comsub)
+			make_success();
+	} else if ((plan = build_redir_plan(sc->redirects,&nredirs,NULL))) {
+		if (!comsub)
+			icoutsn("G_status = bashc_check_redirs(%s,%d)",plan,nredirs);
+		else {
+			make_cif("bashc_check_redirs(%s,%d)",plan,nredirs);
+			make_failure();
+			make_cendif();
+		}
+		free(plan);
+	}
+
+	endblock();
+}
+
+static void output_flags(int f)
+{
+	cout("0");
+	if (f & CF_BACKGROUND) cout("|FE_BACKGROUND");
+}
+
+static void compile_forked(COMMAND* cmd, struct ctioctx* ioc, const char* pidlval);
+
+/*
+ * Call shell function `func' with `argvname' (in the foreground),
+ * storing its status in `retname'.  Its redirections, if any, are
+ * applied to the shell around the call.
+ */
+static void emit_function_call(struct cfunc* func, const char* argvname, const char* plan,
+                               int nredirs, const char* retname, const char* invt)
+{
+	char* callee;
+
+	if (func->cname)
+		callee = savestring(func->cname);
+	else
+		asprintf(&callee,"%s->fn",func->handle);
+
+	if (plan) {
+		make_cif("!bashc_redir_push(%s,%d)",plan,nredirs);
+		icoutsn("%s = %s%s(%s)",retname,invt,callee,argvname);
+		icoutsn("bashc_redir_pop()");
+		make_celse();
+		icoutsn("%s = %s1",retname,invt);
+		make_cendif();
+	} else
+		icoutsn("%s = %s%s(%s)",retname,invt,callee,argvname);
+
+	free(callee);
+}
+
+static __must_use  struct ctioctx* compile_simple_command(COMMAND* cmd,
+                                                          struct ctioctx* ioc, int flags)
+{
+	sh_builtin_func_t* builtin;
+	struct simple_com* sc = cmd->value.Simple;
+	WORD_LIST* words = first_command_word(sc->words);
+	WORD_LIST* wd;
+	struct cfunc* func;
+	const char* rtbuiltin = NULL;
+	char* name;
+	char* argvname;
+	char* rtiocname;
+	char* retname;
+	char* saved = NULL;
+	char* save;
+	char* handle;
+	char* plan = NULL;
+	int nredirs = 0;
+	int planstatic = 1;
+	int i,nassign = 0;
+	int exec;
+	char* pidlval = bgpid_lvalue;
+	const char* invt = ((cmd->flags & CMD_INVERT_RETURN)
+	                    && !(flags & CF_BACKGROUND)) ? "!" : "";
+
+	bgpid_lvalue = NULL;
+
+	if (!words) {
+		compile_assignments(sc);
+		return ioc;
+	}
+
+	/* with a name known only at run time, it's up to bashc_run_command() */
+	name = static_word(words->word);
+	func = name ? lookup_cfunc(name) : NULL;
+
+	if (name && (builtin = find_shell_builtin(name))
+	    && !(rtbuiltin = find_rtbuiltin(builtin))) {
+		if (func)
+			NYI("functions overriding builtins (%s)",name);
+		free(name);
+		if (!sc->redirects)
+			ioc = compile_builtin(builtin,words,ioc,flags);
+		else if (builtin == source_builtin) {
+			/* the file's commands run with them applied, as a function's */
+			startblock();
+			if ((plan = build_redir_plan(sc->redirects,&nredirs,NULL))) {
+				make_cif("!bashc_redir_push(%s,%d)",plan,nredirs);
+				ioc = compile_builtin(builtin,words,ioc,flags);
+				icoutsn("bashc_redir_pop()");
+				make_celse();
+				make_failure();
+				make_cendif();
+			}
+			endblock();
+			free(plan);
+		} else {
+			/* none of these do any I/O, so only the side effects matter */
+			startblock();
+			if ((plan = build_redir_plan(sc->redirects,&nredirs,NULL))) {
+				make_cif("!(G_status = bashc_check_redirs(%s,%d))",plan,nredirs);
+				ioc = compile_builtin(builtin,words,ioc,flags);
+				make_cendif();
+			}
+			endblock();
+			free(plan);
+		}
+		if (*invt)
+			icoutsn("G_status = !G_status");
+		return ioc;
+	}
+
+	if (func && (flags & CF_BACKGROUND)) {
+		/* the call runs in a child of its own */
+		free(name);
+		compile_forked(cmd,ioc,pidlval);
+		if (!pidlval)
+			make_success();
+		return ioc;
+	}
+
+	if (name && !rtbuiltin && !func)
+		note_literal_command(name);
+
+	/* an external command with nothing after it can replace the process */
+	exec = (flags & CF_EXEC) && name && !rtbuiltin && !func && !*invt;
+
+	startblock();
+
+	if (!(argvname = build_argv(words,NULL))
+	    || (sc->redirects
+	        && !(plan = build_redir_plan(sc->redirects,&nredirs,&planstatic)))) {
+		endblock();
+		free(argvname);
+		free(name);
+		return ioc;
+	}
+
+	retname = (flags & CF_BACKGROUND) || exec ? NULL : new_ident("retstatus");
+	if (retname)
+		icoutsn("pid_t %s",retname);
+
+	/* assignments preceding the command last only as long as it does */
+	for (wd = sc->words; wd != words; wd = wd->next)
+		nassign++;
+	if (nassign) {
+		saved = new_ident("saved");
+		icoutsn("struct bashc_varsave %s[%d]",saved,nassign);
+		for (i = 0, wd = sc->words; wd != words; wd = wd->next, i++) {
+			asprintf(&save,"&%s[%d]",saved,i);
+			handle = emit_assignment(wd->word,save);
+			free(save);
+			if (!handle) {
+				nassign = i;
+				break;
+			}
+			free(handle);
+		}
+	}
+
+	rtiocname = make_rtioctx(ioc,plan,nredirs,planstatic);
+
+	if (func) {
+		/* the function can abandon the command (see compile_toplevel()) */
+		may_abandon = 1;
+		make_cif("%s->fn",func->handle);
+		emit_function_call(func,argvname,plan,nredirs,retname,invt);
+		make_celse();
+	}
+
+	if (exec) {
+		/* nothing's left for this process to do */
+		icoutsn("exec_argv(%s,%s)",argvname,rtiocname);
+		endblock();
+		goto out;
+	}
+
+	if (retname)
+		icout("%s = ",retname);
+	else if (pidlval)
+		icout("%s = ",pidlval);
+	else
+		icout("bashc_job_add(");
+	if (rtbuiltin)
+		cout("%srun_builtin(%s,%s,%s,",invt,rtbuiltin,argvname,rtiocname);
+	else if (name)
+		cout("%sforkexec_argv(%s,%s,",invt,argvname,rtiocname);
+	else
+		cout("%sbashc_run_command(%s,%s,",invt,argvname,rtiocname);
+	output_flags(flags);
+	if (retname || pidlval)
+		coutsn(")");
+	else
+		coutsn("|FE_JOB))");
+
+	if (func)
+		make_cendif();
+
+	for (i = nassign; i-- > 0; )
+		icoutsn("bashc_var_restore(&%s[%d])",saved,i);
+
+	if (!(flags & CF_BACKGROUND))
+		icoutsn("G_status = %s",retname);
+	else if (!pidlval)
+		icoutsn("G_status = 0");
+
+	endblock();
+	cout("\n");
+
+out:
+	free(rtiocname);
+	free(argvname);
+	free(retname);
+	free(saved);
+	free(name);
+	free(plan);
+
+	return ioc;
+}
+
+/*
+ * Compile `cmd' to run in a forked child with I/O context `ioc',
+ * storing the child's pid in `pidlval' (if non-NULL; otherwise it's a
+ * background job, started once bashc_job_slot() allows and noted with
+ * bashc_job_add()).  The child exits
+ * once it's done, so it's compiled with CF_EXEC: if it ends with an
+ * external command, that's exec()ed in place, with no second fork.
+ */
+static void compile_forked(COMMAND* cmd, struct ctioctx* ioc, const char* pidlval)
+{
+	char* rtiocname;
+	char* pidname = pidlval ? NULL : new_ident("bgpid");
+	struct loopnest* savedloops = loopstack;
+
+	startblock();
+	if (pidname)
+		icoutsn("pid_t %s",pidname);
+	rtiocname = make_rtioctx(ioc,NULL,0,1);
+	if (pidname)
+		icoutsn("bashc_job_slot()");
+
+	make_cif("!(%s = bashc_fork(%s))",pidlval ? pidlval : pidname,rtiocname);
+	ccomment("child");
+	/* break and continue can't reach loops in the parent */
+	loopstack = NULL;
+	if (curfunc)
+		curfunc->forked++;
+	compile_command(cmd,NULL,CF_EXEC);
+	if (curfunc)
+		curfunc->forked--;
+	loopstack = savedloops;
+	icoutsn("bashc_exit(G_status)");
+	make_cendif();
+	if (pidname)
+		icoutsn("bashc_job_add(%s)",pidname);
+
+	endblock();
+
+	free(rtiocname);
+	free(pidname);
+}
+
+/*
+ * Whether any of `segs' is an arithmetic expansion, which can fail, or
+ * a command substitution, which runs a command of its own.
+ */
+static int segs_need_child(struct wordseg* segs)
+{
+	for (; segs; segs = segs->next) {
+		if (segs->type == WS_ARITH || segs->type == WS_COMSUB
+		    || segs_need_child(segs->operand))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Whether expanding simple command `cmd's words can abandon it (see
+ * bashc_abandon()) or has to wait for another command.  Run in the
+ * background or in a pipeline, such a command has to be expanded in a
+ * child of its own, as bash would, so a failure doesn't reach the
+ * shell and the pipeline isn't held up.
+ */
+static int expansion_needs_child(COMMAND* cmd)
+{
+	struct wordseg* segs;
+	WORD_LIST* w;
+	int ret = 0;
+
+	if (cmd->type != cm_simple)
+		return 0;
+
+	for (w = cmd->value.Simple->words; w && !ret; w = w->next) {
+		if (parse_word_text(w->word->word,&segs,1)) {
+			ret = segs_need_child(segs);
+			free_segs(segs);
+		}
+	}
+
+	return ret;
+}
+
+/* Whether `cmd' launches a single process of its own */
+static int launches_process(COMMAND* cmd)
+{
+	sh_builtin_func_t* builtin;
+	struct simple_com* sc;
+	WORD_LIST* words;
+	struct cfunc* func;
+	char* name;
+
+	if (cmd->type != cm_simple || (cmd->flags & CMD_INVERT_RETURN)
+	    || expansion_needs_child(cmd))
+		return 0;
+
+	sc = cmd->value.Simple;
+	if (!(words = first_command_word(sc->words)))
+		return 0;
+	else if (!(name = static_word(words->word)))
+		return 1;
+
+	builtin = find_shell_builtin(name);
+	func = lookup_cfunc(name);
+	free(name);
+
+	return !func && (!builtin || find_rtbuiltin(builtin));
+}
+
+/* Append the stages of pipeline `cmd' to `stages', returning the new count */
+static int flatten_pipeline(COMMAND* cmd, COMMAND*** stages, int n)
+{
+	if (cmd->type == cm_connection && cmd->value.Connection->connector == '|'
+	    && !(cmd->flags & CMD_INVERT_RETURN)) {
+		n = flatten_pipeline(cmd->value.Connection->first,stages,n);
+		return flatten_pipeline(cmd->value.Connection->second,stages,n);
+	}
+
+	*stages = xrealloc(*stages,(n+1)*sizeof(**stages));
+	(*stages)[n] = cmd;
+	return n + 1;
+}
+
+/*
+ * Compile an N-stage pipeline: launch every stage in the background,
+ * then reap them all in one go.  Each pipe is created just before the
+ * stage that writes to it and the parent's ends are closed as soon as
+ * both stages using it have been started, so no stage inherits any
+ * pipe but its own.
+ */
+static __must_use struct ctioctx* compile_pipe(COMMAND* cmd, struct ctioctx* ioc,
+                                               int flags)
+{
+	COMMAND** stages = NULL;
+	char* pipes;
+	char* pids;
+	char* donelabel;
+	char* pidlval;
+	int nstages,i,nio;
+
+	if (flags & CF_BACKGROUND) {
+		compile_forked(cmd,ioc,NULL);
+		icoutsn("G_status = 0");
+		return ioc;
+	}
+
+	nstages = flatten_pipeline(cmd->value.Connection->first,&stages,0);
+	nstages = flatten_pipeline(cmd->value.Connection->second,&stages,nstages);
+
+	pipes = new_ident("pipe");
+	pids = new_ident("pids");
+	donelabel = new_ident("pipedone");
+
+	ccomment("%d-stage pipeline",nstages);
+	startblock();
+
+	icoutsn("int %s[%d][2]",pipes,nstages-1);
+	icout("pid_t %s[%d] = { ",pids,nstages);
+	for (i = 0; i < nstages; i++)
+		cout("-1, ");
+	coutn("};");
+
+	for (i = 0; i < nstages; i++) {
+		nio = 0;
+
+		if (i < nstages-1) {
+			make_cif("bashc_pipe(%s[%d])",pipes,i);
+			if (i > 0)
+				icoutsn("close(%s[%d][0])",pipes,i-1);
+			icoutsn("goto %s",donelabel);
+			make_cendif();
+		}
+
+		if (i > 0) {
+			ioc = ioc_grow(ioc,1);
+			asprintf(&ioc->fdnames[ioc->numfds-1][0],"%s[%d][0]",pipes,i-1);
+			ioc->fdnames[ioc->numfds-1][1] = strdup("0");
+			nio += 1;
+		}
+		if (i < nstages-1) {
+			ioc = ioc_grow(ioc,2);
+			asprintf(&ioc->fdnames[ioc->numfds-2][0],"%s[%d][1]",pipes,i);
+			ioc->fdnames[ioc->numfds-2][1] = strdup("1");
+			asprintf(&ioc->fdnames[ioc->numfds-1][0],"%s[%d][0]",pipes,i);
+			ioc->fdnames[ioc->numfds-1][1] = strdup("IO_CLOSE_FD");
+			nio += 2;
+		}
+
+		asprintf(&pidlval,"%s[%d]",pids,i);
+		if (launches_process(stages[i])) {
+			bgpid_lvalue = pidlval;
+			ioc = compile_command(stages[i],ioc,CF_BACKGROUND);
+		} else
+			compile_forked(stages[i],ioc,pidlval);
+		free(pidlval);
+
+		ioc = ioc_grow(ioc,-nio);
+
+		if (i > 0)
+			icoutsn("close(%s[%d][0])",pipes,i-1);
+		if (i < nstages-1)
+			icoutsn("close(%s[%d][1])",pipes,i);
+	}
+
+	coutn("%s:",donelabel);
+	icoutsn("G_status = bashc_wait_pipeline(%s,%d)",pids,nstages);
+	if (cmd->flags & CMD_INVERT_RETURN)
+		icoutsn("G_status = !G_status");
+
+	endblock();
+	cout("\n");
+
+	free(stages);
+	free(pipes);
+	free(pids);
+	free(donelabel);
+
+	return ioc;
+}
+
+/*
+ * Whether simple command `cmd' is compiled to run in the program
+ * itself: assignments alone, or a builtin the compiler does inline.
+ */
+static int runs_inline(COMMAND* cmd)
+{
+	sh_builtin_func_t* builtin;
+	WORD_LIST* words;
+	char* name;
+
+	if (!(words = first_command_word(cmd->value.Simple->words)))
+		return 1;
+	else if (!(name = static_word(words->word)))
+		return 0;
+
+	builtin = find_shell_builtin(name);
+	free(name);
+
+	return builtin && !find_rtbuiltin(builtin);
+}
+
+/*
+ * Whether `cmd' can be compiled with CF_BACKGROUND: a simple command
+ * that needn't be expanded in a child and isn't run inline, or a
+ * pipeline or subshell, each of which forks on its own.  Anything else,
+ * run in the background, is forked whole.
+ */
+static int runs_in_background(COMMAND* cmd)
+{
+	if (cmd->type == cm_simple)
+		return !expansion_needs_child(cmd) && !runs_inline(cmd);
+	else if (cmd->type == cm_connection)
+		return cmd->value.Connection->connector == '|' && !cmd->redirects;
+	else
+		return cmd->type == cm_subshell && !cmd->redirects;
+}
+
+/*
+ * Status flow.  Before a compound command's code is output, its parts
+ * are checked for what they do with the exit status: whether it's
+ * fixed at compile time, and whether a part sets its own before it can
+ * look at the one left by what ran before it.  That lets constant
+ * tests be folded away, along with branches that can never run and
+ * stores to G_status that are bound to be overwritten unread.
+ */
+#define STATUS_UNKNOWN (-1)
+
+/*
+ * The status of `cmd' if it does nothing but set a status that's known
+ * at compile time (true, false and :, and lists of them); otherwise
+ * STATUS_UNKNOWN.
+ */
+static int constant_status(COMMAND* cmd)
+{
+	struct simple_com* sc;
+	sh_builtin_func_t* builtin;
+	WORD_LIST* wd;
+	char* name;
+	int st;
+
+	if (!cmd || cmd->redirects)
+		return STATUS_UNKNOWN;
+
+	switch (cmd->type) {
+	case cm_simple:
+		sc = cmd->value.Simple;
+		if (sc->redirects || !sc->words || (sc->words->word->flags & W_ASSIGNMENT))
+			return STATUS_UNKNOWN;
+		/* expanding an argument could have side effects */
+		for (wd = sc->words->next; wd; wd = wd->next) {
+			if (!(name = static_word(wd->word)))
+				return STATUS_UNKNOWN;
+			free(name);
+		}
+		if (!(name = static_word(sc->words->word)))
+			return STATUS_UNKNOWN;
+		builtin = lookup_cfunc(name) ? NULL : find_shell_builtin(name);
+		free(name);
+		if (builtin == colon_builtin)
+			st = 0;
+		else if (builtin == false_builtin)
+			st = 1;
+		else
+			return STATUS_UNKNOWN;
+		break;
+
+	case cm_group:
+		st = constant_status(cmd->value.Group->command);
+		break;
+
+	case cm_connection:
+		if ((st = constant_status(cmd->value.Connection->first)) == STATUS_UNKNOWN)
+			return st;
+		switch (cmd->value.Connection->connector) {
+		case ';':
+			st = constant_status(cmd->value.Connection->second);
+			break;
+		case AND_AND:
+			if (!st)
+				st = constant_status(cmd->value.Connection->second);
+			break;
+		case OR_OR:
+			if (st)
+				st = constant_status(cmd->value.Connection->second);
+			break;
+		default:
+			return STATUS_UNKNOWN;
+		}
+		break;
+
+	default:
+		return STATUS_UNKNOWN;
+	}
+
+	if (st != STATUS_UNKNOWN && (cmd->flags & CMD_INVERT_RETURN))
+		st = !st;
+
+	return st;
+}
+
+/* Whether word `text' can expand $? */
+static int word_reads_status(const char* text)
+{
+	return strstr(text,"$?") || strstr(text,"${?") || strstr(text,"${#?");
+}
+
+static int words_read_status(WORD_LIST* words)
+{
+	for (; words; words = words->next) {
+		if (word_reads_status(words->word->word))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int cond_reads_status(COND_COM* c)
+{
+	if (!c)
+		return 0;
+	else if (c->type == COND_TERM)
+		return word_reads_status(c->op->word);
+
+	return cond_reads_status(c->left) || cond_reads_status(c->right);
+}
+
+static int redirs_read_status(REDIRECT* r)
+{
+	for (; r; r = r->next) {
+		switch (r->instruction) {
+		case r_duplicating_input:
+		case r_duplicating_output:
+		case r_move_input:
+		case r_move_output:
+		case r_close_this:
+			break;
+		default:
+			if (word_reads_status(r->redirectee.filename->word))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Builtins compiled inline (see compile_builtin()) that always set a status */
+static int sets_status_builtin(sh_builtin_func_t* builtin)
+{
+	return builtin == false_builtin || builtin == colon_builtin
+		|| builtin == break_builtin || builtin == continue_builtin
+		|| builtin == set_builtin || builtin == export_builtin
+		|| builtin == unset_builtin || builtin == shift_builtin
+		|| builtin == local_builtin;
+}
+
+/*
+ * Whether `cmd' might look at the status left by the command before it
+ * ($?, or `return' with no argument) before it sets its own.  Anything
+ * that isn't known not to, including any call to a shell function,
+ * might.
+ */
+static int reads_status(COMMAND* cmd)
+{
+	struct simple_com* sc;
+	sh_builtin_func_t* builtin;
+	WORD_LIST* words;
+	char* name;
+	int ret;
+
+	if (!cmd || redirs_read_status(cmd->redirects))
+		return 1;
+
+	switch (cmd->type) {
+	case cm_simple:
+		sc = cmd->value.Simple;
+		if (words_read_status(sc->words) || redirs_read_status(sc->redirects))
+			return 1;
+		else if (!(words = first_command_word(sc->words)))
+			return 0;
+		else if (!(name = static_word(words->word)))
+			return 1;
+		builtin = find_shell_builtin(name);
+		ret = lookup_cfunc(name) || (builtin && !find_rtbuiltin(builtin)
+		                             && !sets_status_builtin(builtin));
+		free(name);
+		return ret;
+
+	case cm_connection:
+		if (cmd->value.Connection->connector == '|')
+			return reads_status(cmd->value.Connection->first)
+				|| reads_status(cmd->value.Connection->second);
+		return reads_status(cmd->value.Connection->first);
+
+	case cm_group:
+		return reads_status(cmd->value.Group->command);
+	case cm_subshell:
+		return reads_status(cmd->value.Subshell->command);
+	case cm_if:
+		return reads_status(cmd->value.If->test);
+	case cm_while:
+	case cm_until:
+		return reads_status(cmd->value.While->test);
+	case cm_for:
+		return words_read_status(cmd->value.For->map_list);
+
+	case cm_arith:
+		return words_read_status(cmd->value.Arith->exp);
+	case cm_cond:
+		return cond_reads_status(cmd->value.Cond);
+
+	case cm_function_def:
+		return 0;
+
+	default:
+		return 1;
+	}
+}
+
+static __must_use struct ctioctx* compile_connection(COMMAND* cmd,
+                                                     struct ctioctx* ioc, int flags)
+{
+	struct connection* conn = cmd->value.Connection;
+	int st = constant_status(conn->first);
+
+	switch (conn->connector) {
+
+	case ';':
+		/* a constant status that's overwritten unread needn't be stored */
+		if (st == STATUS_UNKNOWN || reads_status(conn->second))
+			ioc = compile_command(conn->first,ioc,flags & ~CF_EXEC);
+		ioc = compile_command(conn->second,ioc,flags);
+		break;
+
+	case '|':
+		ioc = compile_pipe(cmd,ioc,flags & ~CF_EXEC);
+		break;
+
+	case '&':
+		if (!runs_in_background(conn->first)) {
+			compile_forked(conn->first,ioc,NULL);
+			make_success();
+		} else
+			ioc = compile_command(conn->first,ioc,
+			                      (flags & ~CF_EXEC)|CF_BACKGROUND);
+		ioc = compile_command(conn->second,ioc,flags);
+		break;
+
+	case AND_AND:
+	case OR_OR:
+		if (st == STATUS_UNKNOWN) {
+			ioc = compile_command(conn->first,ioc,flags & ~CF_EXEC);
+			make_cif("%sG_status",conn->connector == AND_AND ? "!" : "");
+			ioc = compile_command(conn->second,ioc,flags);
+			make_cendif();
+		} else if ((conn->connector == AND_AND) == (st != 0)) {
+			/* the second never runs */
+			ioc = compile_command(conn->first,ioc,flags);
+		} else {
+			if (reads_status(conn->second))
+				ioc = compile_command(conn->first,ioc,flags & ~CF_EXEC);
+			ioc = compile_command(conn->second,ioc,flags);
+		}
+		break;
+
+	default:
+		fatal_error("bad connector type in compile_connection");
+		
+	}
+
+	return ioc;
+}
+
+static __must_use struct ctioctx* compile_if(COMMAND* cmd, struct ctioctx* ioc,
+                                             int flags)
+{
+	struct if_com* ifc = cmd->value.If;
+	int st = constant_status(ifc->test);
+	COMMAND* branch;
+
+	if (st != STATUS_UNKNOWN) {
+		/* only one branch can run */
+		branch = st ? ifc->false_case : ifc->true_case;
+		ccomment("if (always %s)",st ? "false" : "true");
+		if (!branch)
+			make_success();
+		else {
+			if (reads_status(branch))
+				icoutsn("G_status = %d",st);
+			compile_command(branch,ioc,flags);
+		}
+		return ioc;
+	}
+
+	ccomment("if");
+	compile_command(ifc->test,ioc,flags & ~CF_EXEC);
+
+	make_cif("!G_status");
+	ccomment("then");
+
+	compile_command(ifc->true_case,ioc,flags);
+
+	make_celse();
+	if (ifc->false_case) {
+		ccomment("else");
+		compile_command(ifc->false_case,ioc,flags);
+	} else
+		make_success();
+
+	make_cendif();
+	ccomment("fi");
+
+	return ioc;
+}
+
+static __must_use struct ctioctx* compile_while(COMMAND* cmd, struct ctioctx* ioc,
+                                                int flags, int invert)
+{
+	char* entrypt;
+	char* exitpt;
+	char* loopstatus;
+	struct while_com* wh = cmd->value.While;
+	int st = constant_status(wh->test);
+
+	if (st != STATUS_UNKNOWN && (st == 0) == invert) {
+		ccomment("%s (never runs)",invert ? "until" : "while");
+		make_success();
+		return ioc;
+	}
+
+	entrypt = new_ident("whileentry");
+	exitpt = new_ident("whileexit");
+	loopstatus = new_ident("whilestatus");
+
+	if (st == STATUS_UNKNOWN)
+		icoutsn("int %s = 0",loopstatus);
+	else
+		ccomment("%s (only a break ends it)",invert ? "until" : "while");
+	coutn("%s:",entrypt);
+
+	push_loopnest(entrypt,exitpt);
+	startblock();
+	if (st == STATUS_UNKNOWN) {
+		compile_command(wh->test,ioc,flags);
+		make_cif("%sG_status",invert ? "!" : "");
+		icoutsn("G_status = %s",loopstatus);
+		icoutsn("goto %s",exitpt);
+		make_cendif();
+	} else if (reads_status(wh->action))
+		icoutsn("G_status = %d",st);
+
+	compile_command(wh->action,ioc,flags);
+	if (st == STATUS_UNKNOWN)
+		icoutsn("%s = G_status",loopstatus);
+	icoutsn("goto %s",entrypt);
+	endblock();
+
+	/* a label can't end a block, so each is given a statement */
+	if (st == STATUS_UNKNOWN || loopstack->exit_used)
+		coutn("%s: ;",exitpt);
+	pop_loopnest();
+
+	free(entrypt);
+	free(exitpt);
+	free(loopstatus);
+
+	return ioc;
+}
+
+/* A brace sequence expression {first..last[..incr]} of integers */
+struct seqexpr {
+	intmax_t first,last,incr;
+	int width;		/* zero-padded to this width, if nonzero */
+};
+
+/* Parse an integer in a sequence expression, advancing `*sp' */
+static int parse_seqnum(const char** sp, intmax_t* n, int* width)
+{
+	const char* s = *sp;
+	const char* digits = s + (*s == '-' || *s == '+');
+	char* end;
+
+	if (!isdigit((unsigned char)*digits))
+		return 0;
+
+	errno = 0;
+	*n = strtoimax(s,&end,10);
+	if (errno)
+		return 0;
+
+	if (width && *digits == '0' && isdigit((unsigned char)digits[1]))
+		*width = end - s;
+	*sp = end;
+
+	return 1;
+}
+
+/* Whether `text' is a word consisting of just a sequence expression */
+static int parse_seqexpr(const char* text, struct seqexpr* seq)
+{
+	const char* s = text;
+	int w1 = 0,w2 = 0;
+
+	seq->incr = 1;
+
+	if (*s++ != '{' || !parse_seqnum(&s,&seq->first,&w1) || strncmp(s,"..",2))
+		return 0;
+	s += 2;
+	if (!parse_seqnum(&s,&seq->last,&w2))
+		return 0;
+	if (!strncmp(s,"..",2)) {
+		s += 2;
+		if (!parse_seqnum(&s,&seq->incr,NULL))
+			return 0;
+	}
+	if (strcmp(s,"}"))
+		return 0;
+
+	/* as in braces.c, the increment's sign doesn't matter */
+	if (seq->incr < 0)
+		seq->incr = -seq->incr;
+	else if (!seq->incr)
+		seq->incr = 1;
+	if (seq->first > seq->last)
+		seq->incr = -seq->incr;
+
+	seq->width = w1 > w2 ? w1 : w2;
+
+	return 1;
+}
+
+/*
+ * for name in {first..last[..incr]}: count, rather than expanding the
+ * sequence into a list.
+ */
+static void compile_for_seq(struct seqexpr* seq, const char* handle, COMMAND* action,
+                            struct ctioctx* ioc, int flags)
+{
+	char* bodypt = new_ident("forbody");
+	char* nextpt = new_ident("fornext");
+	char* exitpt = new_ident("forexit");
+	char* loopstatus = new_ident("forstatus");
+	char* counter = new_ident("fori");
+	char* buf;
+	/* the last value actually reached, computed without overflowing */
+	intmax_t last = seq->first + (intmax_t)(((uintmax_t)seq->last - seq->first)
+	                                        / seq->incr) * seq->incr;
+
+	if (seq->incr < 0)
+		last = seq->first - (intmax_t)(((uintmax_t)seq->first - seq->last)
+		                               / -seq->incr) * -seq->incr;
+
+	startblock();
+	icoutsn("intmax_t %s = %jd",counter,seq->first);
+	icoutsn("int %s = 0",loopstatus);
+
+	coutn("%s:",bodypt);
+	if (seq->width) {
+		buf = new_ident("forbuf");
+		startblock();
+		icoutsn("char %s[32]",buf);
+		icoutsn("snprintf(%s,sizeof(%s),\"%%0*jd\",%d,%s)",buf,buf,seq->width,counter);
+		icoutsn("bashc_setvar(%s,%s)",handle,buf);
+		endblock();
+		free(buf);
+	} else
+		icoutsn("bashc_arith_set(%s,%s)",handle,counter);
+
+	push_loopnest(nextpt,exitpt);
+	compile_command(action,ioc,flags);
+	icoutsn("%s = G_status",loopstatus);
+
+	if (loopstack->entry_used)
+		coutn("%s:",nextpt);
+	make_cif("%s != %jd",counter,last);
+	icoutsn("%s += %jd",counter,seq->incr);
+	icoutsn("goto %s",bodypt);
+	make_cendif();
+	icoutsn("G_status = %s",loopstatus);
+	endblock();
+	if (loopstack->exit_used)
+		coutn("%s: ;",exitpt);
+	pop_loopnest();
+
+	free(bodypt);
+	free(nextpt);
+	free(exitpt);
+	free(loopstatus);
+	free(counter);
+}
+
+/*
+ * for name in words: the words are expanded once into an argument
+ * list (a static array if they're all literal), then stepped through.
+ */
+static __must_use struct ctioctx* compile_for(COMMAND* cmd, struct ctioctx* ioc,
+                                              int flags)
+{
+	FOR_COM* fc = cmd->value.For;
+	struct seqexpr seq;
+	char* name = fc->name->word;
+	char* handle;
+	char* words;
+	char* index;
+	char* nextpt;
+	char* exitpt;
+	char* loopstatus;
+	char* copy = NULL;
+	int dynamic;
+
+	if (!legal_identifier(name)) {
+		NYI("for with an invalid variable name (%s)",name);
+		make_failure();
+		return ioc;
+	}
+
+	ccomment("for %s in ...",name);
+	handle = var_handle(name);
+
+	if (fc->map_list && !fc->map_list->next
+	    && parse_seqexpr(fc->map_list->word->word,&seq)) {
+		compile_for_seq(&seq,handle,fc->action,ioc,flags);
+		free(handle);
+		return ioc;
+	}
+
+	startblock();
+	if (!(words = build_argv(fc->map_list,&dynamic))) {
+		endblock();
+		make_failure();
+		free(handle);
+		return ioc;
+	}
+
+	/* a recursive call from the body would reuse a static list */
+	if (curfunc && dynamic) {
+		copy = new_ident("forwords");
+		icoutsn("char** %s = bashc_argv_dup(%s)",copy,words);
+		free(words);
+		words = savestring(copy);
+	}
+
+	index = new_ident("fori");
+	nextpt = new_ident("fornext");
+	exitpt = new_ident("forexit");
+	loopstatus = new_ident("forstatus");
+
+	icoutsn("int %s = -1",index);
+	icoutsn("int %s = 0",loopstatus);
+
+	coutn("%s:",nextpt);
+	make_cif("!%s[++%s]",words,index);
+	if (copy)
+		icoutsn("free(%s)",copy);
+	icoutsn("G_status = %s",loopstatus);
+	icoutsn("goto %s",exitpt);
+	make_cendif();
+	icoutsn("bashc_setvar(%s,%s[%s])",handle,words,index);
+
+	push_loopnest(nextpt,exitpt);
+	loopstack->cleanup = copy;
+	compile_command(fc->action,ioc,flags);
+	icoutsn("%s = G_status",loopstatus);
+	icoutsn("goto %s",nextpt);
+	endblock();
+	coutn("%s: ;",exitpt);
+	pop_loopnest();
+
+	free(handle);
+	free(words);
+	free(index);
+	free(nextpt);
+	free(exitpt);
+	free(loopstatus);
+	free(copy);
+
+	return ioc;
+}
+
+/*
+ * case: each pattern is classified at compile time.  Literal ones are
+ * looked up in a sorted table with bashc_case_lookup() (if there are
+ * enough of them), stars around literal text become prefix, suffix
+ * and substring tests, and anything else goes to bashc_fnmatch().
+ * A case whose patterns are all literal (bar a final `*') compiles to
+ * a switch on the table index.
+ */
+#define PAT_LITERAL 0		/* `text' */
+#define PAT_ANY 1		/* * */
+#define PAT_PREFIX 2		/* text* */
+#define PAT_SUFFIX 3		/* *text */
+#define PAT_CONTAINS 4		/* *text* */
+#define PAT_AFFIXES 5		/* text*suffix */
+#define PAT_GENERAL 6		/* `text' is a pattern for bashc_fnmatch() */
+#define PAT_DYNAMIC 7		/* expanded at run time */
+#define PAT_NONE 8		/* couldn't be compiled: never matches */
+
+/* Case patterns with at least this many distinct literals use a table */
+#define CASE_TABLE_MIN 3
+
+struct casepat {
+	int kind;
+	char* text;
+	char* suffix;
+	struct wordseg* segs;	/* PAT_DYNAMIC */
+	int id;			/* PAT_LITERAL: index in the table, or -1 */
+};
+
+/* Classify static pattern `pat' (in bashc_fnmatch() form) */
+static void classify_pattern(const char* pat, struct casepat* cp)
+{
+	char** parts = xmalloc((strlen(pat) + 2) * sizeof(*parts));
+	char* part = xmalloc(strlen(pat) + 1);
+	const char* s;
+	size_t len = 0;
+	int i,nparts = 0,first = -1,last = -1,nonempty = 0;
+
+	cp->kind = PAT_GENERAL;
+	cp->text = savestring(pat);
+	cp->suffix = NULL;
+	cp->id = -1;
+
+	/* split it into literal parts at the stars */
+	for (s = pat; ; s++) {
+		if (!*s || *s == '*') {
+			part[len] = '\0';
+			parts[nparts++] = savestring(part);
+			len = 0;
+			if (!*s)
+				break;
+		} else if (*s == '?' || *s == '[')
+			goto out;
+		else if (*s == '\\' && s[1])
+			part[len++] = *++s;
+		else
+			part[len++] = *s;
+	}
+
+	for (i = 0; i < nparts; i++) {
+		if (*parts[i]) {
+			if (first < 0)
+				first = i;
+			last = i;
+			nonempty++;
+		}
+	}
+
+	free(cp->text);
+	cp->text = NULL;
+
+	if (nparts == 1)
+		cp->kind = PAT_LITERAL;
+	else if (!nonempty)
+		cp->kind = PAT_ANY;
+	else if (nonempty == 1 && first == 0)
+		cp->kind = PAT_PREFIX;
+	else if (nonempty == 1 && last == nparts - 1)
+		cp->kind = PAT_SUFFIX;
+	else if (nonempty == 1)
+		cp->kind = PAT_CONTAINS;
+	else if (nonempty == 2 && first == 0 && last == nparts - 1) {
+		cp->kind = PAT_AFFIXES;
+		cp->suffix = savestring(parts[last]);
+	} else {
+		cp->kind = PAT_GENERAL;
+		cp->text = savestring(pat);
+	}
+
+	if (!cp->text)
+		cp->text = savestring(first < 0 ? "" : parts[first]);
+
+out:
+	for (i = 0; i < nparts; i++)
+		free(parts[i]);
+	free(parts);
+	free(part);
+}
+
+static int strptrcmp(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a,*(char* const*)b);
+}
+
+/*
+ * If there are enough distinct literal patterns, output a sorted table
+ * of them and set their ids; returns the table's name, or NULL.
+ */
+static __must_use char* emit_case_table(struct casepat** pats, int* npats, int nclauses,
+                                        int* ntable)
+{
+	char** strs = NULL;
+	char** found;
+	char* table;
+	int i,j,n = 0;
+
+	for (i = 0; i < nclauses; i++) {
+		for (j = 0; j < npats[i]; j++) {
+			if (pats[i][j].kind == PAT_LITERAL) {
+				strs = xrealloc(strs,(n + 1)*sizeof(*strs));
+				strs[n++] = pats[i][j].text;
+			}
+		}
+	}
+
+	if (n)
+		qsort(strs,n,sizeof(*strs),strptrcmp);
+	for (i = j = 0; i < n; i++) {
+		if (!j || strcmp(strs[j-1],strs[i]))
+			strs[j++] = strs[i];
+	}
+	n = j;
+
+	if (n < CASE_TABLE_MIN) {
+		free(strs);
+		return NULL;
+	}
+
+	table = new_ident("casetab");
+	icout("static const char* const %s[] = { ",table);
+	for (i = 0; i < n; i++) {
+		cout("\"");
+		cencode_string(strs[i]);
+		cout("\", ");
+	}
+	coutn("};");
+
+	for (i = 0; i < nclauses; i++) {
+		for (j = 0; j < npats[i]; j++) {
+			if (pats[i][j].kind == PAT_LITERAL) {
+				found = bsearch(&pats[i][j].text,strs,n,sizeof(*strs),strptrcmp);
+				pats[i][j].id = found - strs;
+			}
+		}
+	}
+
+	*ntable = n;
+	free(strs);
+	return table;
+}
+
+/* Returns (malloced) a C test of static pattern `cp' against `word' */
+static __must_use char* pattern_test(struct casepat* cp, const char* word,
+                                     const char* index)
+{
+	char* lit = c_literal(cp->text);
+	char* suffix;
+	char* test = NULL;
+	size_t len = strlen(cp->text);
+
+	switch (cp->kind) {
+	case PAT_LITERAL:
+		if (cp->id >= 0)
+			asprintf(&test,"%s == %d",index,cp->id);
+		else
+			asprintf(&test,"!strcmp(%s,%s)",word,lit);
+		break;
+	case PAT_ANY:
+		test = savestring("1");
+		break;
+	case PAT_PREFIX:
+		asprintf(&test,"!strncmp(%s,%s,%zu)",word,lit,len);
+		break;
+	case PAT_SUFFIX:
+		asprintf(&test,"bashc_has_suffix(%s,%s,%zu)",word,lit,len);
+		break;
+	case PAT_CONTAINS:
+		asprintf(&test,"strstr(%s,%s) != NULL",word,lit);
+		break;
+	case PAT_AFFIXES:
+		/* the suffix mustn't overlap the prefix */
+		suffix = c_literal(cp->suffix);
+		asprintf(&test,"(!strncmp(%s,%s,%zu) && bashc_has_suffix(%s + %zu,%s,%zu))",
+		         word,lit,len,word,len,suffix,strlen(cp->suffix));
+		free(suffix);
+		break;
+	case PAT_GENERAL:
+		asprintf(&test,"bashc_fnmatch(%s,%s)",lit,word);
+		break;
+	case PAT_NONE:
+		test = savestring("0");
+		break;
+	}
+
+	free(lit);
+	return test;
+}
+
+/*
+ * Output code setting `hit' if clause `pats' matches, with dynamic
+ * patterns only expanded if the ones before them didn't match.
+ */
+static void emit_clause_test(struct casepat* pats, int n, const char* word,
+                             const char* index, const char* hit)
+{
+	char* test;
+	char* pat;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			make_cif("!%s",hit);
+		if (pats[i].kind == PAT_DYNAMIC) {
+			pat = emit_string(pats[i].segs,"BASHC_WB_PATTERN");
+			icoutsn("%s = bashc_fnmatch(%s,%s)",hit,pat,word);
+			free(pat);
+		} else {
+			test = pattern_test(&pats[i],word,index);
+			icoutsn("%s = %s",hit,test);
+			free(test);
+		}
+		if (i > 0)
+			make_cendif();
+	}
+}
+
+/* Output the body of case clause `pl', or make it succeed if it's empty */
+static void emit_clause_body(PATTERN_LIST* pl, struct ctioctx* ioc, int flags)
+{
+	if (pl->action)
+		compile_command(pl->action,ioc,flags);
+	else
+		make_success();
+}
+
+/* case as a switch, when every pattern is literal or `*' */
+static void emit_case_switch(PATTERN_LIST* clauses, struct casepat** pats, int* npats,
+                             const char* table, int ntable, const char* word,
+                             struct ctioctx* ioc, int flags)
+{
+	PATTERN_LIST* pl;
+	char* labelled = xmalloc(ntable);
+	int i,j,any = 0;
+
+	memset(labelled,0,ntable);
+
+	icoutn("switch (bashc_case_lookup(%s,%d,%s)) {",table,ntable,word);
+	for (i = 0, pl = clauses; pl; i++, pl = pl->next) {
+		/* nothing after a `*' is matched, only fallen into */
+		for (j = 0; j < npats[i] && !any; j++) {
+			if (pats[i][j].kind == PAT_ANY) {
+				icoutn("default:");
+				any = 1;
+			} else if (!labelled[pats[i][j].id]) {
+				icoutn("case %d:",pats[i][j].id);
+				labelled[pats[i][j].id] = 1;
+			}
+		}
+		indent_level++;
+		emit_clause_body(pl,ioc,flags);
+		/* ;& after the last clause falls into nothing */
+		if ((pl->flags & CASEPAT_FALLTHROUGH) && pl->next)
+			ccomment("fallthrough");
+		else
+			icoutsn("break");
+		indent_level--;
+	}
+	if (!any) {
+		icoutn("default:");
+		indent_level++;
+		make_success();
+		indent_level--;
+	}
+	icoutn("}");
+
+	free(labelled);
+}
+
+/*
+ * case as a chain of tests, in clause order.  Returns (malloced) the
+ * label to be placed after the case's block, or NULL if none is needed.
+ */
+static __must_use char* emit_case_chain(PATTERN_LIST* clauses, struct casepat** pats,
+                                        int* npats, const char* index, const char* word,
+                                        struct ctioctx* ioc, int flags)
+{
+	PATTERN_LIST* pl;
+	char* hit = new_ident("casehit");
+	char* ran = NULL;
+	char* endpt = new_ident("caseend");
+	char* bodypt = NULL;
+	char* nextbodypt;
+	int i,endused = 0;
+
+	icoutsn("int %s",hit);
+	/* with ;& and ;;& falling out of the chain doesn't mean no match */
+	for (pl = clauses; pl && !ran; pl = pl->next) {
+		if (pl->flags & (CASEPAT_FALLTHROUGH|CASEPAT_TESTNEXT)) {
+			ran = new_ident("caseran");
+			icoutsn("int %s = 0",ran);
+		}
+	}
+
+	for (i = 0, pl = clauses; pl; i++, pl = pl->next) {
+		nextbodypt = (pl->flags & CASEPAT_FALLTHROUGH) && pl->next
+		             ? new_ident("casebody") : NULL;
+
+		emit_clause_test(pats[i],npats[i],word,index,hit);
+		make_cif("%s",hit);
+		if (bodypt)
+			coutn("%s:",bodypt);
+		if (ran)
+			icoutsn("%s = 1",ran);
+		emit_clause_body(pl,ioc,flags);
+		if (nextbodypt)
+			icoutsn("goto %s",nextbodypt);
+		else if (!(pl->flags & (CASEPAT_FALLTHROUGH|CASEPAT_TESTNEXT))) {
+			icoutsn("goto %s",endpt);
+			endused = 1;
+		}
+		make_cendif();
+
+		free(bodypt);
+		bodypt = nextbodypt;
+	}
+
+	/* nothing matched */
+	if (ran) {
+		make_cif("!%s",ran);
+		make_success();
+		make_cendif();
+	} else
+		make_success();
+
+	free(hit);
+	free(ran);
+	if (!endused) {
+		free(endpt);
+		endpt = NULL;
+	}
+
+	return endpt;
+}
+
+static __must_use struct ctioctx* compile_case(COMMAND* cmd, struct ctioctx* ioc,
+                                               int flags)
+{
+	CASE_COM* cc = cmd->value.Case;
+	PATTERN_LIST* pl;
+	WORD_LIST* wl;
+	struct casepat** pats;
+	int* npats;
+	char* lit;
+	char* word;
+	char* wordvar;
+	char* index = NULL;
+	char* table;
+	char* endpt = NULL;
+	int i,j,nclauses,ntable = 0;
+	int simple = 1,testnext = 0;
+
+	if (!(word = expand_to_string(cc->word->word,NULL))) {
+		make_failure();
+		return ioc;
+	}
+
+	nclauses = list_length((GENERIC_LIST*)cc->clauses);
+	pats = xmalloc(nclauses * sizeof(*pats));
+	npats = xmalloc(nclauses * sizeof(*npats));
+
+	for (i = 0, pl = cc->clauses; pl; i++, pl = pl->next) {
+		npats[i] = list_length((GENERIC_LIST*)pl->patterns);
+		pats[i] = xmalloc(npats[i] * sizeof(**pats));
+		memset(pats[i],0,npats[i] * sizeof(**pats));
+		testnext |= (pl->flags & CASEPAT_TESTNEXT) != 0;
+
+		for (j = 0, wl = pl->patterns; wl; j++, wl = wl->next) {
+			pats[i][j].id = -1;
+			if (!parse_word(wl->word->word,&pats[i][j].segs,0,WP_PATTERN)) {
+				pats[i][j].kind = PAT_NONE;
+				pats[i][j].text = savestring("");
+			} else if ((lit = segs_text(pats[i][j].segs))) {
+				classify_pattern(lit,&pats[i][j]);
+				free(lit);
+			} else
+				pats[i][j].kind = PAT_DYNAMIC;
+
+			if (pats[i][j].kind != PAT_LITERAL && pats[i][j].kind != PAT_ANY)
+				simple = 0;
+		}
+	}
+
+	ccomment("case");
+	startblock();
+	wordvar = new_ident("caseword");
+	icoutsn("const char* %s = %s",wordvar,word);
+
+	table = emit_case_table(pats,npats,nclauses,&ntable);
+
+	if (table && simple && !testnext)
+		emit_case_switch(cc->clauses,pats,npats,table,ntable,wordvar,ioc,flags);
+	else {
+		if (table) {
+			index = new_ident("casei");
+			icoutsn("int %s = bashc_case_lookup(%s,%d,%s)",index,table,ntable,wordvar);
+		}
+		endpt = emit_case_chain(cc->clauses,pats,npats,index,wordvar,ioc,flags);
+	}
+
+	endblock();
+	if (endpt)
+		coutn("%s: ;",endpt);
+
+	for (i = 0; i < nclauses; i++) {
+		for (j = 0; j < npats[i]; j++) {
+			free(pats[i][j].text);
+			free(pats[i][j].suffix);
+			free_segs(pats[i][j].segs);
+		}
+		free(pats[i]);
+	}
+	free(pats);
+	free(npats);
+	free(word);
+	free(wordvar);
+	free(index);
+	free(table);
+	free(endpt);
+
+	return ioc;
+}
+
+/* The text of an arithmetic command's expression (malloced) */
+static __must_use char* arith_text(WORD_LIST* words)
+{
+	char* text = savestring("");
+	size_t len = 0;
+
+	for (; words; words = words->next) {
+		text = xrealloc(text,len + strlen(words->word->word) + 2);
+		if (len)
+			text[len++] = ' ';
+		strcpy(text + len,words->word->word);
+		len += strlen(words->word->word);
+	}
+
+	return text;
+}
+
+/* Returns (malloced) the C for an arithmetic command's expression, or NULL */
+static __must_use char* arith_expr(WORD_LIST* words)
+{
+	char* text = arith_text(words);
+	char* expr = translate_arith(text,0);
+
+	free(text);
+	return expr;
+}
+
+static __must_use struct ctioctx* compile_arith(COMMAND* cmd, struct ctioctx* ioc)
+{
+	char* expr;
+
+	if (!(expr = arith_expr(cmd->value.Arith->exp))) {
+		make_failure();
+		return ioc;
+	}
+
+	icoutsn("G_status = %sbashc_arith_status(%s)",
+	        cmd->flags & CMD_INVERT_RETURN ? "!" : "",expr);
+	free(expr);
+
+	return ioc;
+}
+
+/*
+ * for ((init; test; step)): the expressions run as C, the body between
+ * them; an error in any of them ends the loop with a status of 1.
+ */
+static __must_use struct ctioctx* compile_arith_for(COMMAND* cmd, struct ctioctx* ioc,
+                                                    int flags)
+{
+	ARITH_FOR_COM* af = cmd->value.ArithFor;
+	char* init = arith_expr(af->init);
+	char* test = arith_expr(af->test);
+	char* step = arith_expr(af->step);
+	char* toppt;
+	char* contpt;
+	char* exitpt;
+	char* loopstatus;
+
+	if (!init || !test || !step) {
+		make_failure();
+		free(init);
+		free(test);
+		free(step);
+		return ioc;
+	}
+
+	toppt = new_ident("fortop");
+	contpt = new_ident("fornext");
+	exitpt = new_ident("forexit");
+	loopstatus = new_ident("forstatus");
+
+	ccomment("for ((...))");
+	startblock();
+	icoutsn("int %s = 0",loopstatus);
+	make_cif("!bashc_arith_loop(((void)%s, 1),&%s)",init,loopstatus);
+	icoutsn("goto %s",exitpt);
+	make_cendif();
+
+	coutn("%s:",toppt);
+	/* an empty test is true */
+	make_cif("!bashc_arith_loop(%s,&%s)",af->test ? test : "1",loopstatus);
+	icoutsn("goto %s",exitpt);
+	make_cendif();
+
+	push_loopnest(contpt,exitpt);
+	compile_command(af->action,ioc,flags);
+	icoutsn("%s = G_status",loopstatus);
+	if (loopstack->entry_used)
+		coutn("%s:",contpt);
+	pop_loopnest();
+
+	make_cif("!bashc_arith_loop(((void)%s, 1),&%s)",step,loopstatus);
+	icoutsn("goto %s",exitpt);
+	make_cendif();
+	icoutsn("goto %s",toppt);
+
+	coutn("%s:",exitpt);
+	icoutsn("G_status = %s",loopstatus);
+	endblock();
+
+	free(toppt);
+	free(contpt);
+	free(exitpt);
+	free(loopstatus);
+	free(init);
+	free(test);
+	free(step);
+
+	return ioc;
+}
+
+/*
+ * [[ ]]: the expression compiles to code computing its status as
+ * execute_cond_node() does, into a variable of its own (so that $? in
+ * its operands is still the last command's), each operand expanded
+ * only when its test is reached.  String and pattern tests are done
+ * inline (== and != as case patterns are), integer comparisons as C
+ * arithmetic, and file tests by bashc_test_unary(); an operand given
+ * more than one file test is stat()ed just once, unless something that
+ * might change a variable comes between.  A literal =~ pattern is
+ * compiled once, at startup (see output_regexes()).
+ */
+struct condstat {
+	struct condstat* next;
+	char* word;		/* the operand's text */
+	int tests;		/* file tests of it */
+	char* arg;		/* C variables for its expansion, */
+	char* st;		/* its stat() */
+	char* ok;		/* and -1 until then, or whether it worked */
+};
+
+struct condctx {
+	struct condstat* stats;
+};
+
+/* Unary operators that look at a stat() of the file */
+static int cond_stat_op(const char* op)
+{
+	return op[0] == '-' && op[1] && !op[2] && strchr("abcdefgkpsuGNOS",op[1]);
+}
+
+/* Whether expanding `segs' might assign a variable */
+static int segs_assign(struct wordseg* segs)
+{
+	for (; segs; segs = segs->next) {
+		if (segs->type == WS_ARITH || segs->type == WS_COMSUB || segs->op == '='
+		    || segs_assign(segs->operand))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int word_assigns(const char* text)
+{
+	struct wordseg* segs;
+	int ret;
+
+	if (!parse_word(text,&segs,1,WP_STRING))
+		return 1;
+	ret = segs_assign(segs);
+	free_segs(segs);
+
+	return ret;
+}
+
+/* Count the file tests of each operand in `c' that can be stat()ed once */
+static void cond_note_stats(COND_COM* c, struct condctx* cc)
+{
+	struct condstat* cs;
+	const char* word;
+
+	if (!c)
+		return;
+
+	if (c->type == COND_UNARY && cond_stat_op(c->op->word)) {
+		word = c->left->op->word;
+		for (cs = cc->stats; cs && strcmp(cs->word,word); cs = cs->next)
+			;
+		if (!cs) {
+			if (word_assigns(word))
+				return;
+			cs = xmalloc(sizeof(*cs));
+			memset(cs,0,sizeof(*cs));
+			cs->word = savestring(word);
+			cs->next = cc->stats;
+			cc->stats = cs;
+		}
+		cs->tests++;
+	} else if (c->type != COND_UNARY && c->type != COND_BINARY) {
+		cond_note_stats(c->left,cc);
+		cond_note_stats(c->right,cc);
+	}
+}
+
+/* Output code making the operands stat()ed be stat()ed again */
+static void cond_forget(struct condctx* cc)
+{
+	struct condstat* cs;
+
+	for (cs = cc->stats; cs; cs = cs->next) {
+		if (cs->ok)
+			icoutsn("%s = -1",cs->ok);
+	}
+}
+
+/*
+ * Output code expanding operand `text' as `mode' (WP_*), noting in
+ * `*assigns' whether that might assign a variable.  Returns (malloced)
+ * a C expression for the result, or NULL if it can't be compiled.
+ */
+static __must_use char* cond_operand(const char* text, int mode, int* assigns)
+{
+	struct wordseg* segs;
+	char* lit;
+	char* expr;
+
+	if (!parse_word(text,&segs,0,mode))
+		return NULL;
+
+	if ((lit = segs_text(segs))) {
+		expr = c_literal(lit);
+		free(lit);
+	} else
+		expr = emit_string(segs,mode == WP_PATTERN ? "BASHC_WB_PATTERN"
+		                   : mode == WP_REGEX ? "BASHC_WB_REGEX" : "0");
+	*assigns |= segs_assign(segs);
+
+	free_segs(segs);
+	return expr;
+}
+
+/*
+ * Output code expanding operand `text' of an integer comparison, and
+ * return (malloced) a C intmax_t expression evaluating it, or NULL.
+ */
+static __must_use char* cond_arith(const char* text)
+{
+	struct wordseg* segs;
+	char* lit;
+	char* expr;
+	char* str;
+
+	if (!parse_word(text,&segs,0,WP_STRING))
+		return NULL;
+
+	if ((lit = segs_text(segs))) {
+		expr = translate_arith(lit,0);
+		free(lit);
+	} else if (segs->type == WS_PARAM && !segs->next && !segs->op
+	           && legal_identifier(segs->text)) {
+		/* its value is cached, as in (( )) */
+		str = var_handle(segs->text);
+		asprintf(&expr,"bashc_arith_get(%s)",str);
+		free(str);
+	} else {
+		str = emit_string(segs,"0");
+		asprintf(&expr,"bashc_arith_str(%s)",str);
+		free(str);
+	}
+
+	free_segs(segs);
+	return expr;
+}
+
+/* Whether pattern word `text' uses an extended pattern, like @(a|b) */
+static int extended_pattern(const char* text)
+{
+	const char* s;
+
+	for (s = text; (s = strchr(s,'(')); s++) {
+		if (s > text && strchr("?*+@!",s[-1]))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* The index of =~ pattern `pattern' in the startup table, adding it if need be */
+static int regex_index(const char* pattern)
+{
+	int i;
+
+	for (i = 0; i < num_regexes; i++) {
+		if (!strcmp(regex_patterns[i],pattern))
+			return i;
+	}
+
+	regex_patterns = xrealloc(regex_patterns,(num_regexes+1)*sizeof(*regex_patterns));
+	regex_patterns[num_regexes] = savestring(pattern);
+	return num_regexes++;
+}
+
+static void compile_cond_unary(COND_COM* c, const char* st, struct condctx* cc)
+{
+	const char* op = c->op->word;
+	const char* word = c->left->op->word;
+	struct condstat* cs;
+	char* arg;
+	int assigns = 0;
+
+	for (cs = cc->stats; cs && strcmp(cs->word,word); cs = cs->next)
+		;
+	if (cs && cs->ok && cond_stat_op(op)) {
+		make_cif("%s < 0",cs->ok);
+		if (!(arg = cond_operand(word,WP_STRING,&assigns)))
+			arg = savestring("\"\"");
+		icoutsn("%s = %s",cs->arg,arg);
+		icoutsn("%s = !stat(%s,&%s)",cs->ok,cs->arg,cs->st);
+		make_cendif();
+		icoutsn("%s = !bashc_test_unary('%c',%s,&%s,%s)",st,op[1],cs->arg,cs->st,cs->ok);
+		free(arg);
+		return;
+	}
+
+	if (!(arg = cond_operand(word,WP_STRING,&assigns))) {
+		icoutsn("%s = 1",st);
+		return;
+	}
+	if (assigns)
+		cond_forget(cc);
+
+	if (!strcmp(op,"-z"))
+		icoutsn("%s = *%s != '\\0'",st,arg);
+	else if (!strcmp(op,"-n"))
+		icoutsn("%s = *%s == '\\0'",st,arg);
+	else
+		icoutsn("%s = !bashc_test_unary('%c',%s,NULL,0)",st,op[1],arg);
+
+	free(arg);
+}
+
+/* Integer comparison `op' of `l' and `r' */
+static void compile_cond_arith(const char* l, const char* op, const char* r,
+                               const char* st, struct condctx* cc)
+{
+	static const char* const ops[][2] = {
+		{ "-eq", "==" }, { "-ne", "!=" }, { "-lt", "<" },
+		{ "-le", "<=" }, { "-gt", ">" }, { "-ge", ">=" },
+	};
+	char* lexpr = cond_arith(l);
+	char* rexpr = cond_arith(r);
+	char* lval;
+	size_t i;
+
+	for (i = 0; i < sizeof(ops)/sizeof(ops[0]) && strcmp(ops[i][0],op); i++)
+		;
+	if (!lexpr || !rexpr || i == sizeof(ops)/sizeof(ops[0])) {
+		if (lexpr && rexpr)
+			NYI("[[ ]] operator %s",op);
+		icoutsn("%s = 1",st);
+	} else {
+		/* the left operand's evaluated first */
+		lval = new_ident("condl");
+		icoutsn("intmax_t %s = %s",lval,lexpr);
+		icoutsn("%s = bashc_arith_status(%s %s %s)",st,lval,ops[i][1],rexpr);
+		free(lval);
+	}
+
+	/* variables' values are expressions, and could assign others */
+	cond_forget(cc);
+	free(lexpr);
+	free(rexpr);
+}
+
+static void compile_cond_binary(COND_COM* c, const char* st, struct condctx* cc)
+{
+	const char* op = c->op->word;
+	const char* ltext = c->left->op->word;
+	const char* rtext = c->right->op->word;
+	struct wordseg* segs;
+	struct casepat cp;
+	char* l;
+	char* r = NULL;
+	char* lit;
+	char* test = NULL;
+	char* regex;
+	int assigns = 0;
+
+	if (op[0] == '-' && strcmp(op,"-nt") && strcmp(op,"-ot") && strcmp(op,"-ef")) {
+		compile_cond_arith(ltext,op,rtext,st,cc);
+		return;
+	}
+
+	if (!(l = cond_operand(ltext,WP_STRING,&assigns))) {
+		icoutsn("%s = 1",st);
+		return;
+	}
+
+	if (!strcmp(op,"=~")) {
+		if (!parse_word(rtext,&segs,0,WP_REGEX))
+			test = savestring("1");
+		else if ((lit = segs_text(segs))) {
+			asprintf(&test,"bashc_regex_match(&bashc_regexes[%d],%s)",regex_index(lit),l);
+			free(lit);
+		} else {
+			regex = new_ident("condre");
+			icoutsn("static struct bashc_regex %s",regex);
+			r = emit_string(segs,"BASHC_WB_REGEX");
+			asprintf(&test,"bashc_regex_match(bashc_regex_dynamic(&%s,%s),%s)",regex,r,l);
+			assigns |= segs_assign(segs);
+			free(regex);
+			free_segs(segs);
+		}
+		icoutsn("%s = %s",st,test);
+		/* it sets BASH_REMATCH */
+		assigns = 1;
+	} else if (!strcmp(op,"==") || !strcmp(op,"=") || !strcmp(op,"!=")) {
+		if (extended_pattern(rtext)) {
+			NYI("extended pattern %s",rtext);
+			test = savestring("0");
+		} else if (!parse_word(rtext,&segs,0,WP_PATTERN))
+			test = savestring("0");
+		else if ((lit = segs_text(segs))) {
+			classify_pattern(lit,&cp);
+			test = pattern_test(&cp,l,NULL);
+			free(cp.text);
+			free(cp.suffix);
+			free(lit);
+			free_segs(segs);
+		} else {
+			r = emit_string(segs,"BASHC_WB_PATTERN");
+			asprintf(&test,"bashc_fnmatch(%s,%s)",r,l);
+			assigns |= segs_assign(segs);
+			free_segs(segs);
+		}
+		icoutsn("%s = %s(%s)",st,op[0] == '!' ? "" : "!",test);
+	} else if (!(r = cond_operand(rtext,WP_STRING,&assigns)))
+		icoutsn("%s = 1",st);
+	else if (op[0] == '<' || op[0] == '>')
+		icoutsn("%s = !(strcoll(%s,%s) %c 0)",st,l,r,op[0]);
+	else
+		icoutsn("%s = !bashc_test_binary(%s,\"%s\",%s,NULL)",st,l,op,r);
+
+	if (assigns)
+		cond_forget(cc);
+
+	free(l);
+	free(r);
+	free(test);
+}
+
+static void compile_cond_node(COND_COM* c, const char* st, struct condctx* cc)
+{
+	switch (c->type) {
+	case COND_EXPR:
+		compile_cond_node(c->left,st,cc);
+		break;
+	case COND_AND:
+	case COND_OR:
+		compile_cond_node(c->left,st,cc);
+		make_cif("%s %s 0",st,c->type == COND_AND ? "==" : "!=");
+		compile_cond_node(c->right,st,cc);
+		make_cendif();
+		break;
+	case COND_UNARY:
+		compile_cond_unary(c,st,cc);
+		break;
+	case COND_BINARY:
+		compile_cond_binary(c,st,cc);
+		break;
+	default:
+		NYI("[[ ]] node type %d",c->type);
+		icoutsn("%s = 1",st);
+		return;
+	}
+
+	if (c->flags & CMD_INVERT_RETURN)
+		icoutsn("%s = !%s",st,st);
+}
+
+static __must_use struct ctioctx* compile_cond(COMMAND* cmd, struct ctioctx* ioc)
+{
+	struct condctx cc = { NULL, };
+	struct condstat* cs;
+	struct condstat* next;
+	char* st = new_ident("cond");
+
+	cond_note_stats(cmd->value.Cond,&cc);
+
+	ccomment("[[ ... ]]");
+	startblock();
+	icoutsn("int %s",st);
+	for (cs = cc.stats; cs; cs = cs->next) {
+		if (cs->tests < 2)
+			continue;
+		cs->arg = new_ident("condarg");
+		cs->st = new_ident("condst");
+		cs->ok = new_ident("condok");
+		icoutsn("const char* %s = NULL",cs->arg);
+		icoutsn("struct stat %s",cs->st);
+		icoutsn("int %s = -1",cs->ok);
+	}
+
+	compile_cond_node(cmd->value.Cond,st,&cc);
+	icoutsn("G_status = %s%s",cmd->flags & CMD_INVERT_RETURN ? "!" : "",st);
+	endblock();
+
+	for (cs = cc.stats; cs; cs = next) {
+		next = cs->next;
+		free(cs->word);
+		free(cs->arg);
+		free(cs->st);
+		free(cs->ok);
+		free(cs);
+	}
+	free(st);
+
+	return ioc;
+}
+
+/*
+ * Command substitution.  The command is compiled inline, normally to
+ * run in a forked child with its output read from a pipe.  But if it
+ * can't affect the shell's own state -- it's made of native builtins,
+ * control flow, and calls to functions that are themselves that way,
+ * assigning only to variables local to those functions -- it runs in
+ * the shell's own process, with its output captured straight into a
+ * buffer (see libbashc/comsub.c).
+ */
+
+static void expand_command_braces(COMMAND* cmd);
+
+/*
+ * Parse `text' (from `where', for messages) into `*cmdp' (NULL if it's
+ * empty), leaving the parser as it was.  Returns 0 on a syntax error.
+ */
+static int parse_text_commands(const char* text, const char* where, COMMAND** cmdp)
+{
+	sh_parser_state_t ps;
+	sh_input_line_state_t ls;
+	COMMAND* saved = global_command;
+	COMMAND* cmd = NULL;
+	char* buf = savestring(text);
+	int savedeof = EOF_Reached;
+	int savedline = line_number;
+	int ok = 1;
+
+	save_parser_state(&ps);
+	save_input_line_state(&ls);
+	push_stream(0);
+	with_input_from_string(buf,where);
+
+	while (*bash_input.location.string) {
+		global_command = NULL;
+		if (parse_command()) {
+			ok = 0;
+			break;
+		} else if (global_command)
+			cmd = cmd ? command_connect(cmd,global_command,';') : global_command;
+		if (current_token == yacc_EOF)
+			break;
+	}
+
+	pop_stream();
+	restore_parser_state(&ps);
+	reset_parser();
+	restore_input_line_state(&ls);
+
+	global_command = saved;
+	EOF_Reached = savedeof;
+	line_number = savedline;
+	free(buf);
+
+	if (!ok && cmd) {
+		dispose_command(cmd);
+		cmd = NULL;
+	}
+	expand_command_braces(cmd);
+	*cmdp = cmd;
+
+	return ok;
+}
+
+/* Parse the text of a command substitution, as parse_text_commands() */
+static int parse_comsub_command(const char* text, COMMAND** cmdp)
+{
+	return parse_text_commands(text,"command substitution",cmdp);
+}
+
+/* What's known about a command being checked with command_pure() */
+struct purity {
+	WORD_LIST* locals;	/* of the function it's in, if it's in one */
+	int infunc;
+	struct cfunc** callees;	/* the functions it calls */
+	int ncallees;
+};
+
+static int command_pure(COMMAND* cmd, struct purity* pu);
+
+static int assignable(const char* name, struct purity* pu)
+{
+	WORD_LIST* wd;
+
+	for (wd = pu->locals; wd; wd = wd->next) {
+		if (!strcmp(wd->word->word,name))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Whether arithmetic translated to `expr' assigns only to local variables */
+static int arith_pure(const char* expr, struct purity* pu)
+{
+	static const char* const setters[] = { "bashc_arith_set(V_", "bashc_arith_incr(V_", };
+	const char* s;
+	char* name;
+	size_t i,len;
+	int ok;
+
+	/* expressions only known at run time could assign anything */
+	if (strstr(expr,"bashc_arith_eval("))
+		return 0;
+
+	for (i = 0; i < sizeof(setters)/sizeof(setters[0]); i++) {
+		for (s = expr; (s = strstr(s,setters[i])); s += len) {
+			s += strlen(setters[i]);
+			len = strspn(s,"abcdefghijklmnopqrstuvwxyz"
+			             "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+			name = substring(s,0,len);
+			ok = assignable(name,pu);
+			free(name);
+			if (!ok)
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int arith_words_pure(WORD_LIST* words, struct purity* pu)
+{
+	char* text = arith_text(words);
+	char* expr = translate_arith(text,1);
+	int ok = expr && arith_pure(expr,pu);
+
+	free(text);
+	free(expr);
+	return ok;
+}
+
+static int segs_pure(struct wordseg* segs, struct purity* pu)
+{
+	for (; segs; segs = segs->next) {
+		if ((segs->type == WS_PARAM && segs->op == '=' && !assignable(segs->text,pu))
+		    || (segs->type == WS_ARITH && !arith_pure(segs->text,pu))
+		    || !segs_pure(segs->operand,pu))
+			return 0;
+	}
+
+	/* a command substitution in it runs apart, one way or the other */
+	return 1;
+}
+
+static int word_pure(const char* text, struct purity* pu)
+{
+	struct wordseg* segs;
+	int ok;
+
+	if (!parse_word_text(text,&segs,1))
+		return 0;
+	ok = segs_pure(segs,pu);
+	free_segs(segs);
+
+	return ok;
+}
+
+static int words_pure(WORD_LIST* words, struct purity* pu)
+{
+	for (; words; words = words->next) {
+		if (!word_pure(words->word->word,pu))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Whether integer comparison operand `w' assigns only local variables */
+static int cond_arith_pure(WORD_DESC* w, struct purity* pu)
+{
+	char* lit = static_word(w);
+	char* expr = lit ? translate_arith(lit,1) : NULL;
+	int ok = expr && arith_pure(expr,pu);
+
+	free(lit);
+	free(expr);
+	return ok;
+}
+
+static int cond_pure(COND_COM* c, struct purity* pu)
+{
+	const char* op;
+
+	if (!c)
+		return 1;
+
+	switch (c->type) {
+	case COND_TERM:
+		return word_pure(c->op->word,pu);
+	case COND_BINARY:
+		op = c->op->word;
+		/* it sets BASH_REMATCH */
+		if (!strcmp(op,"=~"))
+			return 0;
+		if (op[0] == '-' && strcmp(op,"-nt") && strcmp(op,"-ot") && strcmp(op,"-ef"))
+			return cond_arith_pure(c->left->op,pu)
+				&& cond_arith_pure(c->right->op,pu);
+		/* FALLTHROUGH */
+	default:
+		return cond_pure(c->left,pu) && cond_pure(c->right,pu);
+	}
+}
+
+/*
+ * Whether a builtin's redirections are safe: anything but copying its
+ * standard output, which in the shell's process isn't the capture.
+ */
+static int redirects_pure(REDIRECT* r, struct purity* pu)
+{
+	char* word;
+	int src,move,ok;
+
+	for (; r; r = r->next) {
+		switch (r->instruction) {
+		case r_duplicating_input:
+		case r_duplicating_output:
+		case r_move_input:
+		case r_move_output:
+			if (r->redirectee.dest == 1)
+				return 0;
+			break;
+
+		case r_duplicating_input_word:
+		case r_duplicating_output_word:
+		case r_move_input_word:
+		case r_move_output_word:
+			if (!(word = static_word(r->redirectee.filename)))
+				return 0;
+			ok = !parse_dup_word(word,&src,&move) || src != 1;
+			free(word);
+			if (!ok)
+				return 0;
+			break;
+
+		case r_close_this:
+			break;
+
+		default:
+			if (!word_pure(r->redirectee.filename->word,pu))
+				return 0;
+			break;
+		}
+	}
+
+	return 1;
+}
+
+static int function_pure(struct cfunc* func);
+
+static void add_callee(struct purity* pu, struct cfunc* func)
+{
+	int i;
+
+	for (i = 0; i < pu->ncallees; i++) {
+		if (pu->callees[i] == func)
+			return;
+	}
+
+	pu->callees = xrealloc(pu->callees,(pu->ncallees+1)*sizeof(*pu->callees));
+	pu->callees[pu->ncallees++] = func;
+}
+
+static int simple_pure(COMMAND* cmd, struct purity* pu)
+{
+	struct simple_com* sc = cmd->value.Simple;
+	WORD_LIST* words = first_command_word(sc->words);
+	WORD_LIST* wd;
+	sh_builtin_func_t* builtin;
+	struct cfunc* func;
+	const char* rtbuiltin;
+	char* name;
+	int eq;
+
+	for (wd = sc->words; wd != words; wd = wd->next) {
+		/* those preceding a command are undone after it */
+		eq = assignment(wd->word->word,0);
+		name = substring(wd->word->word,0,eq);
+		if (!words && !assignable(name,pu)) {
+			free(name);
+			return 0;
+		}
+		free(name);
+		if (!word_pure(wd->word->word + eq + 1,pu))
+			return 0;
+	}
+
+	if (!words)
+		return !sc->redirects || redirects_pure(sc->redirects,pu);
+	else if (!(name = static_word(words->word)))
+		return 0;
+
+	func = lookup_cfunc(name);
+	builtin = find_shell_builtin(name);
+	free(name);
+
+	if (!words_pure(words,pu))
+		return 0;
+
+	if (func) {
+		add_callee(pu,func);
+		return !builtin && !sc->redirects && function_pure(func);
+	} else if (!builtin)
+		return 0;
+	else if ((rtbuiltin = find_rtbuiltin(builtin)))
+		return builtin != cd_builtin && builtin != wait_builtin
+			&& redirects_pure(sc->redirects,pu);
+	else if (sc->redirects)
+		return 0;
+
+	if (builtin == colon_builtin || builtin == false_builtin
+	    || builtin == break_builtin || builtin == continue_builtin)
+		return 1;
+	else if (builtin == local_builtin || builtin == return_builtin
+	         || builtin == shift_builtin)
+		return pu->infunc;
+
+	return 0;
+}
+
+/*
+ * Whether `cmd' can be run in the shell's process as a command
+ * substitution, or in a function it calls; see above.
+ */
+static int command_pure(COMMAND* cmd, struct purity* pu)
+{
+	PATTERN_LIST* pl;
+
+	if (!cmd)
+		return 1;
+	else if (cmd->redirects && cmd->type != cm_simple)
+		return 0;
+
+	switch (cmd->type) {
+	case cm_simple:
+		return simple_pure(cmd,pu);
+
+	case cm_connection:
+		if (cmd->value.Connection->connector == '|'
+		    || cmd->value.Connection->connector == '&')
+			return 0;
+		return command_pure(cmd->value.Connection->first,pu)
+			&& command_pure(cmd->value.Connection->second,pu);
+
+	case cm_group:
+		return command_pure(cmd->value.Group->command,pu);
+
+	case cm_if:
+		return command_pure(cmd->value.If->test,pu)
+			&& command_pure(cmd->value.If->true_case,pu)
+			&& command_pure(cmd->value.If->false_case,pu);
+
+	case cm_while:
+	case cm_until:
+		return command_pure(cmd->value.While->test,pu)
+			&& command_pure(cmd->value.While->action,pu);
+
+	case cm_for:
+		return assignable(cmd->value.For->name->word,pu)
+			&& words_pure(cmd->value.For->map_list,pu)
+			&& command_pure(cmd->value.For->action,pu);
+
+	case cm_case:
+		if (!word_pure(cmd->value.Case->word->word,pu))
+			return 0;
+		for (pl = cmd->value.Case->clauses; pl; pl = pl->next) {
+			if (!words_pure(pl->patterns,pu) || !command_pure(pl->action,pu))
+				return 0;
+		}
+		return 1;
+
+	case cm_arith:
+		return arith_words_pure(cmd->value.Arith->exp,pu);
+
+	case cm_cond:
+		return cond_pure(cmd->value.Cond,pu);
+
+	case cm_arith_for:
+		return arith_words_pure(cmd->value.ArithFor->init,pu)
+			&& arith_words_pure(cmd->value.ArithFor->test,pu)
+			&& arith_words_pure(cmd->value.ArithFor->step,pu)
+			&& command_pure(cmd->value.ArithFor->action,pu);
+
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Call `fn' on `cmd' and each command within it (but not in functions
+ * it defines), until it returns nonzero; returns what it last did.
+ */
+static int walk_commands(COMMAND* cmd, int (*fn)(COMMAND*, void*), void* arg)
+{
+	PATTERN_LIST* pl;
+	int ret;
+
+	if (!cmd || (ret = fn(cmd,arg)))
+		return cmd ? ret : 0;
+
+	switch (cmd->type) {
+	case cm_connection:
+		return walk_commands(cmd->value.Connection->first,fn,arg)
+			|| walk_commands(cmd->value.Connection->second,fn,arg);
+	case cm_group:
+		return walk_commands(cmd->value.Group->command,fn,arg);
+	case cm_subshell:
+		return walk_commands(cmd->value.Subshell->command,fn,arg);
+	case cm_if:
+		return walk_commands(cmd->value.If->test,fn,arg)
+			|| walk_commands(cmd->value.If->true_case,fn,arg)
+			|| walk_commands(cmd->value.If->false_case,fn,arg);
+	case cm_while:
+	case cm_until:
+		return walk_commands(cmd->value.While->test,fn,arg)
+			|| walk_commands(cmd->value.While->action,fn,arg);
+	case cm_for:
+		return walk_commands(cmd->value.For->action,fn,arg);
+	case cm_arith_for:
+		return walk_commands(cmd->value.ArithFor->action,fn,arg);
+	case cm_case:
+		for (pl = cmd->value.Case->clauses; pl; pl = pl->next) {
+			if (walk_commands(pl->action,fn,arg))
+				return 1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Brace-expand `words' as brace_expand_word_list() would, returning the
+ * new list; the assignments before a command name are left alone, as
+ * bash separates them out first.
+ */
+static WORD_LIST* brace_expand_words(WORD_LIST* words)
+{
+#if defined (BRACE_EXPANSION)
+	WORD_LIST* out = NULL;
+	WORD_LIST* next;
+	WORD_DESC* w;
+	char** exps;
+	int i,cmdword = 0;
+
+	for (; words; words = next) {
+		next = words->next;
+		cmdword |= !(words->word->flags & W_ASSIGNMENT);
+		if (!cmdword || (words->word->flags & W_NOBRACE)
+		    || !strchr(words->word->word,'{')) {
+			words->next = out;
+			out = words;
+			continue;
+		}
+
+		exps = brace_expand(words->word->word);
+		for (i = 0; exps[i]; i++) {
+			if (!strcmp(exps[i],words->word->word))
+				w = copy_word(words->word);
+			else
+				w = make_word(exps[i]);
+			free(exps[i]);
+			out = make_word_list(w,out);
+		}
+		free(exps);
+		words->next = NULL;
+		dispose_words(words);
+	}
+
+	return REVERSE_LIST(out,WORD_LIST*);
+#else
+	return words;
+#endif
+}
+
+/*
+ * For walk_commands(): brace-expand the words of simple commands and
+ * for lists, before anything else looks at them.  A for list that's
+ * just a sequence expression is left for compile_for() to count.
+ */
+static int expand_braces(COMMAND* cmd, void* arg)
+{
+	FOR_COM* fc;
+	struct seqexpr seq;
+
+	switch (cmd->type) {
+	case cm_function_def:
+		return walk_commands(cmd->value.Function_def->command,expand_braces,arg);
+	case cm_simple:
+		cmd->value.Simple->words = brace_expand_words(cmd->value.Simple->words);
+		return 0;
+	case cm_for:
+		fc = cmd->value.For;
+		if (!fc->map_list || fc->map_list->next
+		    || !parse_seqexpr(fc->map_list->word->word,&seq))
+			fc->map_list = brace_expand_words(fc->map_list);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static void expand_command_braces(COMMAND* cmd)
+{
+	walk_commands(cmd,expand_braces,NULL);
+}
+
+/* For walk_commands(): note the names `local' is given */
+static int note_locals(COMMAND* cmd, void* arg)
+{
+	WORD_LIST** locals = arg;
+	WORD_LIST* words;
+	char* name;
+	int eq;
+
+	if (cmd->type != cm_simple
+	    || !(words = first_command_word(cmd->value.Simple->words))
+	    || !(name = static_word(words->word)))
+		return 0;
+
+	if (!strcmp(name,"local")) {
+		for (words = words->next; words; words = words->next) {
+			eq = assignment(words->word->word,0);
+			*locals = make_word_list(make_bare_word(eq > 0 ? "" : words->word->word),
+			                         *locals);
+			if (eq > 0) {
+				free((*locals)->word->word);
+				(*locals)->word->word = substring(words->word->word,0,eq);
+			}
+		}
+	}
+	free(name);
+
+	return 0;
+}
+
+/*
+ * Whether function `func' is pure (see command_pure()), assuming (for
+ * recursion) that any function whose analysis is under way is.  A
+ * result is only kept if it didn't depend on that assumption about
+ * another function.
+ */
+#define PURITY_UNKNOWN 0
+#define PURITY_CHECKING 1
+#define PURITY_PURE 2
+#define PURITY_IMPURE 3
+
+static int purity_depth = 0;
+static int purity_low;		/* the shallowest analysis assumed pure */
+
+static int function_pure(struct cfunc* func)
+{
+	struct purity pu;
+	int savedlow = purity_low;
+	int ok;
+
+	if (func->ndefs != 1 || !func->body)
+		return 0;
+	else if (func->purity == PURITY_CHECKING) {
+		if (func->depth < purity_low)
+			purity_low = func->depth;
+		return 1;
+	} else if (func->purity != PURITY_UNKNOWN)
+		return func->purity == PURITY_PURE;
+
+	memset(&pu,0,sizeof(pu));
+	pu.infunc = 1;
+	walk_commands(func->body,note_locals,&pu.locals);
+
+	func->purity = PURITY_CHECKING;
+	func->depth = ++purity_depth;
+	purity_low = INT_MAX;
+	ok = command_pure(func->body,&pu);
+	purity_depth--;
+
+	if (!ok)
+		func->purity = PURITY_IMPURE;
+	else if (purity_low >= func->depth)
+		func->purity = PURITY_PURE;
+	else
+		func->purity = PURITY_UNKNOWN;
+	if (purity_low >= func->depth)
+		purity_low = savedlow;
+	else if (savedlow < purity_low)
+		purity_low = savedlow;
+
+	free(func->callees);
+	func->callees = pu.callees;
+	func->ncallees = pu.ncallees;
+	dispose_words(pu.locals);
+
+	return ok;
+}
+
+/* Add the functions `func' calls, directly or not, to `pu->callees' */
+static void add_callees(struct purity* pu, struct cfunc* func)
+{
+	int i,n = pu->ncallees;
+
+	for (i = 0; i < func->ncallees; i++)
+		add_callee(pu,func->callees[i]);
+	for (; n < pu->ncallees; n++)
+		add_callees(pu,pu->callees[n]);
+}
+
+/*
+ * Whether command substitution `cmd' can run in the shell's process.
+ * If so, `pu->callees' has the functions it can call, which have to be
+ * defined when it's run for it to run that way.
+ */
+static int comsub_pure(COMMAND* cmd, struct purity* pu)
+{
+	int i,n;
+
+	memset(pu,0,sizeof(*pu));
+	if (!command_pure(cmd,pu))
+		return 0;
+
+	for (i = 0, n = pu->ncallees; i < n; i++)
+		add_callees(pu,pu->callees[i]);
+
+	return 1;
+}
+
+static int segs_reenter(struct wordseg* segs);
+
+static int words_reenter(WORD_LIST* words)
+{
+	struct wordseg* segs;
+	int ret = 0;
+
+	for (; words && !ret; words = words->next) {
+		if (parse_word_text(words->word->word,&segs,1)) {
+			ret = segs_reenter(segs);
+			free_segs(segs);
+		}
+	}
+
+	return ret;
+}
+
+/* For walk_commands(): see function_reentrant() */
+static int command_reenters(COMMAND* cmd, void* arg)
+{
+	PATTERN_LIST* pl;
+	WORD_LIST word;
+
+	switch (cmd->type) {
+	case cm_simple:
+		return words_reenter(cmd->value.Simple->words);
+	case cm_for:
+		return words_reenter(cmd->value.For->map_list);
+	case cm_case:
+		word.next = NULL;
+		word.word = cmd->value.Case->word;
+		if (words_reenter(&word))
+			return 1;
+		for (pl = cmd->value.Case->clauses; pl; pl = pl->next) {
+			if (words_reenter(pl->patterns))
+				return 1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Whether any of `segs' is a command substitution that can run in the
+ * shell's process and call a function, or has one inside it.
+ */
+static int segs_reenter(struct wordseg* segs)
+{
+	struct purity pu;
+	COMMAND* cmd;
+	int ret = 0;
+
+	for (; segs && !ret; segs = segs->next) {
+		if (segs->type == WS_COMSUB && parse_comsub_command(segs->text,&cmd)) {
+			ret = (comsub_pure(cmd,&pu) && pu.ncallees)
+				|| walk_commands(cmd,command_reenters,NULL);
+			free(pu.callees);
+			dispose_command(cmd);
+		} else
+			ret = segs_reenter(segs->operand);
+	}
 
-	startblock();
-	if (retname)
-		icoutsn("pid_t %s",retname);
-	argvname = build_argv(sc->words);
+	return ret;
+}
 
-	make_rtioctx(ioc,rtiocname);
+/*
+ * Whether a function with body `body' can be called again while it's
+ * expanding a word: only from a command substitution in the word, run
+ * in the shell's process.  Its wordbufs then can't be static.
+ */
+static int function_reentrant(COMMAND* body)
+{
+	return walk_commands(body,command_reenters,NULL);
+}
 
-	if (retname)
-		icout("%s = ",retname);
-	icout("%sforkexec_argv(%s,%s,",invt,argvname,rtiocname);
-	output_flags(flags);
-	coutsn(")");
+static int needs_interpreter(COMMAND* cmd);
 
-	if (flags & CF_BACKGROUND) {
-		icoutsn("G_status = 0");
+/* Compile command substitution `cmd' to run in the shell's process */
+static void emit_comsub_here(COMMAND* cmd, const char* cap)
+{
+	icoutsn("bashc_capture_begin(&%s)",cap);
+	make_cif("!setjmp(%s.jmp)",cap);
+	if (cmd)
+		compile_command(cmd,NULL,0);
+	else
+		make_success();
+	make_celse();
+	make_failure();
+	make_cendif();
+	icoutsn("bashc_capture_end(&%s)",cap);
+}
+
+/* Compile command substitution `cmd' to run in a child */
+static void emit_comsub_forked(COMMAND* cmd, const char* cap)
+{
+	make_cif("!bashc_capture_fork(&%s)",cap);
+	ccomment("child");
+	if (cmd)
+		compile_command(cmd,NULL,CF_EXEC);
+	else
+		make_success();
+	icoutsn("bashc_exit(G_status)");
+	make_cendif();
+	icoutsn("G_status = bashc_capture_wait(&%s)",cap);
+}
+
+/* Output code appending the output of command substitution `seg' to `wb' */
+static void emit_comsub(struct wordseg* seg, const char* wb)
+{
+	struct loopnest* savedloops = loopstack;
+	int saveddepth = redir_depth;
+	int savedabandon = may_abandon;
+	struct purity pu;
+	COMMAND* cmd;
+	char* cap;
+	int i;
+
+	if (!parse_comsub_command(seg->text,&cmd)) {
+		make_failure();
+		return;
+	}
+
+	cap = declare_buffer("bashc_capture","cap");
+
+	/* it's a command of its own, out of reach of break, continue and return */
+	loopstack = NULL;
+	redir_depth = 0;
+	if (curfunc)
+		curfunc->comsub++;
+
+	/* what's interpreted writes to the real standard output */
+	if (!comsub_pure(cmd,&pu) || (bashc_hybrid && needs_interpreter(cmd)))
+		emit_comsub_forked(cmd,cap);
+	else if (!pu.ncallees)
+		emit_comsub_here(cmd,cap);
+	else {
+		/* only if the functions it calls are there to be called */
+		icout("if (");
+		for (i = 0; i < pu.ncallees; i++)
+			cout("%s%s->fn",i ? " && " : "",pu.callees[i]->handle);
+		coutn(") {");
+		++indent_level;
+		emit_comsub_here(cmd,cap);
+		make_celse();
+		emit_comsub_forked(cmd,cap);
+		make_cendif();
+	}
+
+	if (curfunc)
+		curfunc->comsub--;
+	loopstack = savedloops;
+	redir_depth = saveddepth;
+	/* a failure in it just ends it */
+	may_abandon = savedabandon;
+
+	icoutsn("bashc_wb_expand(%s,%s.buf,%d)",wb,cap,seg->quoted);
+
+	free(pu.callees);
+	if (cmd)
+		dispose_command(cmd);
+	free(cap);
+}
+
+static void open_section(struct csection* sec)
+{
+	sec->buf = NULL;
+	sec->len = 0;
+	if (!(sec->stream = open_memstream(&sec->buf,&sec->len)))
+		fatal_error("open_memstream: %s",strerror(errno));
+}
+
+static void close_section(struct csection* sec, FILE* out)
+{
+	fclose(sec->stream);
+	fwrite(sec->buf,1,sec->len,out);
+	free(sec->buf);
+}
+
+/*
+ * Compile the body of a shell function as C function `cname', in a
+ * section of its own.  It runs in a frame (see libbashc/funcs.c) and
+ * returns its status.  If `sourced', it's instead the commands of
+ * sourced file `name', which run in the frame they're sourced from.
+ */
+static void compile_function_body(COMMAND* body, const char* name, const char* cname,
+                                  int sourced)
+{
+	struct csection sec;
+	struct funcctx fc;
+	struct funcctx* savedfunc = curfunc;
+	struct loopnest* savedloops = loopstack;
+	FILE* savedout = bashc_output;
+	int savedindent = indent_level;
+	int saveddepth = redir_depth;
+	size_t bodystart;
+	char* label;
+
+	fprintf(globals_section.stream,"static int %s(char* const argv[]);\n",cname);
+
+	open_section(&sec);
+	bashc_output = sec.stream;
+	indent_level = 0;
+	/* loops and redirections in the caller are out of reach */
+	loopstack = NULL;
+	redir_depth = 0;
+	fc.return_used = 0;
+	fc.comsub = 0;
+	fc.forked = 0;
+	fc.sourced = sourced;
+	if ((fc.reentrant = function_reentrant(body))) {
+		open_section(&fc.decls);
+		open_section(&fc.cleanup);
+	}
+	curfunc = &fc;
+
+	if (!strstr(name,"*/"))
+		coutn(sourced ? "/* source %s */" : "/* %s () */",name);
+	coutn("static int %s(char* const argv[])",cname);
+	coutn("{");
+	fflush(sec.stream);
+	bodystart = sec.len;
+	indent_level = 1;
+	if (!sourced) {
+		icoutsn("struct bashc_frame frame");
+		cout("\n");
+		icoutsn("bashc_enter(&frame,argv)");
+	}
+	if (bashc_profile) {
+		asprintf(&label,sourced ? "source %s" : "%s ()",name);
+		icoutsn("int prof = bashc_prof_enter(&bashc_prof_sites[%d])",
+		        new_prof_site(line_number,label));
+		free(label);
+	}
+	compile_command(body,NULL,0);
+	if (fc.return_used)
+		coutn("%s: ;",FUNC_RETURN);
+	if (bashc_profile)
+		icoutsn("bashc_prof_exit(prof)");
+	if (!sourced)
+		icoutsn("bashc_leave(&frame)");
+	if (fc.reentrant)
+		close_section(&fc.cleanup,bashc_output);
+	icoutsn("return G_status");
+	coutn("}\n");
+
+	fclose(sec.stream);
+	if (fc.reentrant) {
+		/* its buffers are declared first */
+		fwrite(sec.buf,1,bodystart,funcs_section.stream);
+		close_section(&fc.decls,funcs_section.stream);
+		fwrite(sec.buf + bodystart,1,sec.len - bodystart,funcs_section.stream);
 	} else
-		icoutsn("G_status = %s",retname);
+		fwrite(sec.buf,1,sec.len,funcs_section.stream);
+	free(sec.buf);
+
+	curfunc = savedfunc;
+	loopstack = savedloops;
+	redir_depth = saveddepth;
+	indent_level = savedindent;
+	bashc_output = savedout;
+}
+
+/*
+ * A subshell runs its body in a forked child (see compile_forked()),
+ * which is waited for unless it's in the background.  In a child that
+ * has nothing else to do, the body just runs in place.
+ */
+static __must_use struct ctioctx* compile_subshell(COMMAND* cmd, struct ctioctx* ioc,
+                                                   int flags)
+{
+	COMMAND* body = cmd->value.Subshell->command;
+	char* pidlval = bgpid_lvalue;
+	char* pidname;
+
+	bgpid_lvalue = NULL;
 
+	if ((flags & CF_EXEC) && !(cmd->flags & CMD_INVERT_RETURN))
+		return compile_command(body,ioc,flags);
+	else if (flags & CF_BACKGROUND) {
+		compile_forked(body,ioc,pidlval);
+		if (!pidlval)
+			make_success();
+		return ioc;
+	}
+
+	ccomment("subshell");
+	startblock();
+	pidname = new_ident("subpid");
+	icoutsn("pid_t %s",pidname);
+	compile_forked(body,ioc,pidname);
+	icoutsn("G_status = %sbashc_wait_child(%s)",
+	        (cmd->flags & CMD_INVERT_RETURN) ? "!" : "",pidname);
+	endblock();
+
+	free(pidname);
+
+	return ioc;
+}
+
+/* A function definition fills in the function's slot */
+static __must_use struct ctioctx* compile_function_def(COMMAND* cmd, struct ctioctx* ioc)
+{
+	FUNCTION_DEF* fd = cmd->value.Function_def;
+	const char* name = fd->name->word;
+	struct cfunc* func = lookup_cfunc(name);
+	char* cname;
+
+	if (!func) {
+		/* it wasn't seen by collect_functions() */
+		NYI("function definitions in command substitutions");
+		make_failure();
+		return ioc;
+	}
+
+	cname = func->cname ? savestring(func->cname) : function_cname(name);
+
+	compile_function_body(fd->command,name,cname,0);
+
+	icoutsn("%s->fn = %s",func->handle,cname);
+	if (bashc_hybrid) {
+		/* for interpreted commands that call it */
+		icout("%s->src = \"",func->handle);
+		cencode_string(make_command_string(cmd));
+		coutsn("\"");
+	}
+	make_success();
+
+	free(cname);
+
+	return ioc;
+}
+
+static struct csourced* load_sourced(const char* name, int collect);
+
+/*
+ * `source' (or `.') of a literal file name, with no arguments: a call
+ * to the file's commands, compiled the first time it's sourced.
+ */
+static void compile_source(WORD_LIST* args)
+{
+	struct csourced* src;
+	char* name;
+
+	if (!args) {
+		icoutsn("bashc_builtin_error(&bashc_stderr,\"source\",\"filename argument required\")");
+		icoutsn("G_status = 2");
+		return;
+	} else if (args->next) {
+		NYI("source with arguments");
+		return;
+	} else if (!(name = static_word(args->word))) {
+		NYI("source of a non-literal file name");
+		return;
+	}
+
+	if (!(src = load_sourced(name,0))) {
+		NYI("source of %s, which can't be read",name);
+		free(name);
+		return;
+	}
+	free(name);
+
+	if (!src->body) {
+		make_success();
+		return;
+	} else if (!src->cname) {
+		src->cname = new_ident("sourced");
+		compile_function_body(src->body,src->path,src->cname,1);
+	}
+	icoutsn("G_status = %s(NULL)",src->cname);
+}
+
+/*
+ * Compile a compound command with redirections, which (unlike a
+ * simple command's) have to be applied to the shell itself.
+ */
+static __must_use struct ctioctx* compile_redirected(COMMAND* cmd,
+                                                     struct ctioctx* ioc, int flags)
+{
+	REDIRECT* redirs = cmd->redirects;
+	char* plan;
+	int nredirs;
+
+	startblock();
+
+	if ((plan = build_redir_plan(redirs,&nredirs,NULL))) {
+		make_cif("!bashc_redir_push(%s,%d)",plan,nredirs);
+		redir_depth++;
+		cmd->redirects = NULL;
+		ioc = compile_command(cmd,ioc,flags);
+		cmd->redirects = redirs;
+		redir_depth--;
+		icoutsn("bashc_redir_pop()");
+		make_celse();
+		make_failure();
+		make_cendif();
+	}
+
+	endblock();
+	free(plan);
+
+	return ioc;
+}
+
+/* The line `cmd' starts on, if the parser noted it, or 0 */
+static int command_line(COMMAND* cmd)
+{
+	switch (cmd->type) {
+	case cm_simple:
+		return cmd->value.Simple->line;
+	case cm_for:
+		return cmd->value.For->line;
+	case cm_case:
+		return cmd->value.Case->line;
+	case cm_arith:
+		return cmd->value.Arith->line;
+	case cm_arith_for:
+		return cmd->value.ArithFor->line;
+	case cm_cond:
+		return cmd->value.Cond->line;
+	case cm_function_def:
+		return cmd->value.Function_def->line;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Whether `cmd' is a site for --compile-profile: anything but a list
+ * or group (whose commands are sites of their own) or a function
+ * definition (whose body is one).
+ */
+static int profiled_site(COMMAND* cmd)
+{
+	switch (cmd->type) {
+	case cm_group:
+	case cm_function_def:
+		return 0;
+	case cm_connection:
+		return cmd->value.Connection->connector == '|';
+	default:
+		return 1;
+	}
+}
+
+/* The line a site starts on, for the profile */
+static int site_line(COMMAND* cmd)
+{
+	int line;
+
+	if ((line = command_line(cmd)) > 0)
+		return line;
+
+	switch (cmd->type) {
+	case cm_connection:
+		return site_line(cmd->value.Connection->first);
+	case cm_while:
+	case cm_until:
+		return site_line(cmd->value.While->test);
+	case cm_if:
+		return site_line(cmd->value.If->test);
+	case cm_group:
+		return site_line(cmd->value.Group->command);
+	case cm_subshell:
+		return site_line(cmd->value.Subshell->command);
+	default:
+		return line_number;
+	}
+}
+
+static __must_use struct ctioctx* compile_command_type(COMMAND* cmd, struct ctioctx* ioc,
+                                                       int flags);
+
+/*
+ * Compile `cmd' (with --compile-profile) between entering and leaving
+ * its site.
+ */
+static __must_use struct ctioctx* compile_profiled(COMMAND* cmd, struct ctioctx* ioc,
+                                                   int flags)
+{
+	char* depth = new_ident("prof");
+
+	startblock();
+	icoutsn("int %s = bashc_prof_enter(&bashc_prof_sites[%d])",depth,
+	        new_prof_site(site_line(cmd),make_command_string(cmd)));
+	ioc = compile_command_type(cmd,ioc,flags);
+	icoutsn("bashc_prof_exit(%s)",depth);
+	endblock();
+
+	free(depth);
+
+	return ioc;
+}
+
+static int count_simple(COMMAND* cmd, void* count)
+{
+	if (cmd->type == cm_simple)
+		++*(int*)count;
+	return 0;
+}
+
+/*
+ * With --compile-hybrid, output code running `cmd' (which couldn't be
+ * compiled) in bash, as bashc_interpret() does, in I/O context `ioc'.
+ */
+static void emit_interpreted(COMMAND* cmd, struct ctioctx* ioc, int flags,
+                             const char* pidlval)
+{
+	char* rtiocname;
+
+	walk_commands(cmd,count_simple,&interpreted_commands);
+	interpreted_fragments++;
+
+	startblock();
+	ccomment("interpreted");
+	rtiocname = make_rtioctx(ioc,NULL,0,1);
+	if (!(flags & CF_BACKGROUND))
+		icout("G_status = ");
+	else if (pidlval)
+		icout("%s = ",pidlval);
+	else
+		icout("bashc_job_add(");
+	cout("bashc_interpret(\"");
+	cencode_string(make_command_string(cmd));
+	cout("\",G_status,%s,",rtiocname);
+	output_flags(flags);
+	if (!(flags & CF_BACKGROUND) || pidlval)
+		coutsn(")");
+	else {
+		coutsn("|FE_JOB))");
+		make_success();
+	}
 	endblock();
-	cout("\n");
 
 	free(rtiocname);
-	free(argvname);
-	free(retname);
+}
+
+static __must_use struct ctioctx* compile_native(COMMAND* cmd, struct ctioctx* ioc,
+                                                 int flags);
+
+/*
+ * With --compile-hybrid, compile `cmd' if it can be compiled, and
+ * otherwise (if anything in it couldn't be, not counting the commands
+ * within it that are themselves interpreted) run it in bash.
+ */
+static __must_use struct ctioctx* compile_hybrid(COMMAND* cmd, struct ctioctx* ioc,
+                                                 int flags)
+{
+	struct csection sec;
+	FILE* savedout = bashc_output;
+	int savedindent = indent_level;
+	int savednyi = nyi_count;
+	int savednative = native_commands;
+	int savedinterp = interpreted_commands;
+	int savedfrags = interpreted_fragments;
+	char* pidlval = bgpid_lvalue;
+
+	open_section(&sec);
+	bashc_output = sec.stream;
+	ioc = compile_native(cmd,ioc,flags);
+	fclose(sec.stream);
+	bashc_output = savedout;
+	indent_level = savedindent;
+
+	if (nyi_count == savednyi) {
+		fwrite(sec.buf,1,sec.len,bashc_output);
+		free(sec.buf);
+		return ioc;
+	}
+
+	free(sec.buf);
+	nyi_count = savednyi;
+	native_commands = savednative;
+	interpreted_commands = savedinterp;
+	interpreted_fragments = savedfrags;
+	bgpid_lvalue = NULL;
+	emit_interpreted(cmd,ioc,flags,pidlval);
 
 	return ioc;
 }
 
-static __must_use struct ctioctx* compile_pipe(COMMAND* first, COMMAND* second,
-                                               struct ctioctx* ioc, int flags)
+/*
+ * Whether (with --compile-hybrid) any of `cmd' would be interpreted,
+ * found by compiling it and throwing the code away.
+ */
+static int needs_interpreter(COMMAND* cmd)
 {
-	char* pipeends;
-	char* pidname;
-	int ofst;
+	struct csection sec;
+	FILE* savedout = bashc_output;
+	int savedindent = indent_level;
+	int savednative = native_commands;
+	int savedinterp = interpreted_commands;
+	int savedfrags = interpreted_fragments;
+	int ret;
+
+	open_section(&sec);
+	bashc_output = sec.stream;
+	nyi_quiet++;
+	compile_command(cmd,NULL,0);
+	nyi_quiet--;
+	fclose(sec.stream);
+	free(sec.buf);
+	bashc_output = savedout;
+	indent_level = savedindent;
+
+	ret = interpreted_fragments != savedfrags;
+	native_commands = savednative;
+	interpreted_commands = savedinterp;
+	interpreted_fragments = savedfrags;
+
+	return ret;
+}
+
+static __must_use struct ctioctx* compile_command(COMMAND* cmd, struct ctioctx* ioc,
+                                                  int flags)
+{
+	if (!cmd)
+		return ioc;
+
+	if (bashc_hybrid)
+		return compile_hybrid(cmd,ioc,flags);
+
+	return compile_native(cmd,ioc,flags);
+}
+
+static __must_use struct ctioctx* compile_native(COMMAND* cmd, struct ctioctx* ioc,
+                                                 int flags)
+{
+	int line,st;
+
+	/* the whole script has been parsed, so set the line for messages */
+	if ((line = command_line(cmd)) > 0)
+		line_number = line;
+
+	if (cmd->type == cm_simple)
+		native_commands++;
+
+	if (cmd->type != cm_simple && cmd->redirects)
+		return compile_redirected(cmd,ioc,flags);
+
+	/* a command that only sets a constant status is just that store */
+	if (!(flags & CF_BACKGROUND) && (st = constant_status(cmd)) != STATUS_UNKNOWN) {
+		icoutsn("G_status = %d",st);
+		return ioc;
+	}
+
+	/* in anything else, what runs last isn't known till run time */
+	if (cmd->type != cm_simple && cmd->type != cm_connection && cmd->type != cm_group
+	    && cmd->type != cm_if && cmd->type != cm_subshell)
+		flags &= ~CF_EXEC;
+
+	if (bashc_profile && profiled_site(cmd))
+		return compile_profiled(cmd,ioc,flags);
+
+	return compile_command_type(cmd,ioc,flags);
+}
+
+static __must_use struct ctioctx* compile_command_type(COMMAND* cmd, struct ctioctx* ioc,
+                                                       int flags)
+{
+	switch (cmd->type) {
+
+	case cm_select:
+	case cm_coproc:
+		NYI("(command type %d)",cmd->type);
+		break;
+
+	case cm_cond:
+		ioc = compile_cond(cmd,ioc);
+		break;
+
+	case cm_subshell:
+		ioc = compile_subshell(cmd,ioc,flags);
+		break;
+
+	case cm_for:
+		ioc = compile_for(cmd,ioc,flags);
+		break;
+
+	case cm_function_def:
+		ioc = compile_function_def(cmd,ioc);
+		break;
+
+	case cm_group:
+		ioc = compile_command(cmd->value.Group->command,ioc,flags);
+		break;
+
+	case cm_case:
+		ioc = compile_case(cmd,ioc,flags);
+		break;
+
+	case cm_arith:
+		ioc = compile_arith(cmd,ioc);
+		break;
 
-	pipeends = new_ident("pipe");
-	pidname = new_ident("bgpid");
+	case cm_arith_for:
+		ioc = compile_arith_for(cmd,ioc,flags);
+		break;
 
-	startblock();
+	case cm_until:
+		ioc = compile_while(cmd,ioc,flags,1);
+		break;
 
-	icoutsn("int %s[2]",pipeends);
-	icoutsn("pid_t %s",pidname);
+	case cm_while:
+		ioc = compile_while(cmd,ioc,flags,0);
+		break;
 
-	make_cif("!pipe(%s)",pipeends);
+	case cm_if:
+		ioc = compile_if(cmd,ioc,flags);
+		break;
 
-	ioc = ioc_grow(ioc,2);
-	ofst = ioc->numfds - 2;
-	asprintf(&ioc->fdnames[ofst][0],"%s[1]",pipeends);
-	ioc->fdnames[ofst][1] = strdup("1");
-	asprintf(&ioc->fdnames[ofst+1][0],"%s[0]",pipeends);
-	ioc->fdnames[ofst+1][1] = strdup("IO_CLOSE_FD");
+	case cm_simple:
+		ioc = compile_simple_command(cmd,ioc,flags);
+		break;
 
-	ioc = compile_command(first,ioc,flags|CF_BACKGROUND);
-	ioc = ioc_grow(ioc,-2);
+	case cm_connection:
+		ioc = compile_connection(cmd,ioc,flags);
+		break;
 
-	icoutsn("close(%s[1])",pipeends);
+	default:
+		fatal_error("bad command type in compile_command()");
+	}
 
-	ioc = ioc_grow(ioc,1);
-	ofst = ioc->numfds - 1;
-	asprintf(&ioc->fdnames[ofst][0],"%s[0]",pipeends);
-	ioc->fdnames[ofst][1] = strdup("0");
+	return ioc;
+}
 
-	ioc = compile_command(second,ioc,flags);
-	ioc = ioc_grow(ioc,-1);
+static void init_compiler_output(void)
+{
+	literal_cmd_table = hash_create(0);
+	var_table = hash_create(0);
+	func_table = hash_create(0);
+	sourced_table = hash_create(0);
+	open_section(&globals_section);
+	open_section(&funcs_section);
+	open_section(&main_section);
+	bashc_output = main_section.stream;
+	indent_level = 1;
+}
 
-	icoutsn("close(%s[0])",pipeends);
+/* Emit the table of literal command names and the code to prime the
+ * path cache with them */
+static void output_literal_commands(void)
+{
+	int i;
 
-	icoutsn("waitpid(%s,NULL,0)",pidname);
+	if (!num_literal_cmds)
+		return;
 
-	make_celse();
+	bashc_output = globals_section.stream;
+	cout("static const char* const bashc_literal_cmds[] = { ");
+	for (i = 0; i < num_literal_cmds; i++) {
+		cout("\"");
+		cencode_string(literal_cmds[i]);
+		cout("\", ");
+		free(literal_cmds[i]);
+	}
+	coutn("NULL, };\n");
 
-	icoutsn("perror(\"pipe\")");
+	free(literal_cmds);
+	literal_cmds = NULL;
+	num_literal_cmds = 0;
+}
 
-	make_cendif();
+/* Declare the variable handles, or (if `bind') look them up */
+static void output_var_handles(FILE* out, int bind)
+{
+	int i;
 
-	endblock();
-	cout("\n");
+	for (i = 0; i < num_vars; i++) {
+		if (bind)
+			fprintf(out,"\tV_%s = bashc_var(\"%s\");\n",var_names[i],var_names[i]);
+		else
+			fprintf(out,"static struct bashc_var* V_%s;\n",var_names[i]);
+	}
+	if (num_vars)
+		fputc('\n',out);
+}
 
-	free(pipeends);
-	free(pidname);
+/* Declare the function slots, or (if `bind') look them up */
+static void output_func_handles(FILE* out, int bind)
+{
+	struct cfunc* func;
+	int i;
 
-	return ioc;
+	for (i = 0; i < num_funcs; i++) {
+		func = lookup_cfunc(func_names[i]);
+		if (bind) {
+			fprintf(out,"\t%s = bashc_func(\"",func->handle);
+			fcencode_string(out,func_names[i]);
+			fputs("\");\n",out);
+		} else
+			fprintf(out,"static struct bashc_func* %s;\n",func->handle);
+	}
+	if (num_funcs)
+		fputc('\n',out);
 }
 
-static __must_use struct ctioctx* compile_connection(COMMAND* cmd,
-                                                     struct ctioctx* ioc, int flags)
+/* Define the profile's table of sites, or (if `bind') start it */
+static void output_prof_sites(FILE* out, int bind)
 {
-	struct connection* conn = cmd->value.Connection;
+	int i;
 
-	switch (conn->connector) {
+	if (!bashc_profile || !num_prof_sites)
+		return;
 
-	case ';':
-		ioc = compile_command(conn->first,ioc,flags);
-		ioc = compile_command(conn->second,ioc,flags);
-		break;
+	if (bind) {
+		fprintf(out,"\tbashc_prof_init(bashc_prof_sites,%d);\n\n",num_prof_sites);
+		return;
+	}
 
-	case '|':
-		ioc = compile_pipe(conn->first,conn->second,ioc,flags);
-		break;
+	fputs("static struct bashc_prof_site bashc_prof_sites[] = {\n",out);
+	for (i = 0; i < num_prof_sites; i++) {
+		fprintf(out,"\t{ %d, \"",prof_sites[i].line);
+		fcencode_string(out,prof_sites[i].text);
+		fputs("\", },\n",out);
+	}
+	fputs("};\n\n",out);
+}
 
-	case '&':
-		ioc = compile_command(conn->first,ioc,flags|CF_BACKGROUND);
-		ioc = compile_command(conn->second,ioc,flags);
-		break;
+static void output_regexes(FILE* out, int bind)
+{
+	int i;
 
-	case AND_AND:
-		ioc = compile_command(conn->first,ioc,flags);
-		make_cif("!G_status");
-		ioc = compile_command(conn->second,ioc,flags);
-		make_cendif();
-		break;
+	if (!num_regexes)
+		return;
 
-	case OR_OR:
-		ioc = compile_command(conn->first,ioc,flags);
-		make_cif("G_status");
-		ioc = compile_command(conn->second,ioc,flags);
-		make_cendif();
-		break;
+	if (bind) {
+		fprintf(out,"\tbashc_regex_init(bashc_regexes,%d);\n\n",num_regexes);
+		return;
+	}
 
-	default:
-		fatal_error("bad connector type in compile_connection");
-		
+	fputs("static struct bashc_regex bashc_regexes[] = {\n",out);
+	for (i = 0; i < num_regexes; i++) {
+		fputs("\t{ .pattern = \"",out);
+		fcencode_string(out,regex_patterns[i]);
+		fputs("\" },\n",out);
 	}
+	fputs("};\n\n",out);
+}
 
-	return ioc;
+static void free_csourced(PTR_T data)
+{
+	struct csourced* src = data;
+
+	free(src->path);
+	free(src->cname);
+	if (src->body)
+		dispose_command(src->body);
+	free(src);
 }
 
-static __must_use struct ctioctx* compile_if(COMMAND* cmd, struct ctioctx* ioc,
-                                             int flags)
+static void free_cfunc(PTR_T data)
 {
-	struct if_com* ifc = cmd->value.If;
+	struct cfunc* func = data;
 
-	ccomment("if");
-	compile_command(ifc->test,ioc,flags);
+	free(func->handle);
+	free(func->cname);
+	free(func->callees);
+	free(func);
+}
 
-	make_cif("!G_status");
-	ccomment("then");
+/*
+ * The script's name, less its directory and suffix: the name of the
+ * builtin for --compile-loadable (made into a C identifier if `cident')
+ * or of the command for --compile-multicall.
+ */
+static char* script_name(int cident)
+{
+	const char* path = dollar_vars[0] ? dollar_vars[0] : "";
+	const char* base = strrchr(path,'/');
+	char* name;
+	char* p;
+
+	base = base ? base + 1 : path;
+	p = name = xmalloc(strlen(base) + 2);
+	if (cident && (!*base || *base == '.' || isdigit((unsigned char)*base)))
+		*p++ = '_';
+	for (; *base && *base != '.'; base++)
+		*p++ = !cident || isalnum((unsigned char)*base) ? *base : '_';
+	*p = '\0';
+
+	return name;
+}
 
-	compile_command(ifc->true_case,ioc,flags);
+static void finish_compiler_output(FILE* out)
+{
+	char* name;
+	int i;
 
-	if (ifc->false_case) {
-		make_celse();
-		ccomment("else");
-		compile_command(ifc->false_case,ioc,flags);
+	output_literal_commands();
+
+	fputs(bashc_header,out);
+	output_var_handles(out,0);
+	output_func_handles(out,0);
+	output_prof_sites(out,0);
+	output_regexes(out,0);
+	close_section(&globals_section,out);
+	if (num_funcs)
+		fputc('\n',out);
+	close_section(&funcs_section,out);
+	fputs(bashc_loadable_outpath || bashc_multicall_outpath
+	      ? bashc_script_prologue : bashc_main_prologue,out);
+	output_var_handles(out,1);
+	output_func_handles(out,1);
+	output_prof_sites(out,1);
+	output_regexes(out,1);
+	if (HASH_ENTRIES(literal_cmd_table))
+		fputs("\tbashc_path_prime(bashc_literal_cmds);\n\n",out);
+	close_section(&main_section,out);
+	fputs(bashc_footer,out);
+	if (bashc_loadable_outpath) {
+		name = script_name(1);
+		fprintf(out,bashc_loadable_trailer,name);
+		free(name);
+	} else if (bashc_multicall_outpath) {
+		name = script_name(0);
+		fputs(bashc_multicall_trailer_start,out);
+		fcencode_string(out,name);
+		fputs(bashc_multicall_trailer_end,out);
+		free(name);
 	}
 
-	make_cendif();
-	ccomment("fi");
-
-	return ioc;
+	hash_flush(literal_cmd_table,free);
+	hash_dispose(literal_cmd_table);
+	hash_flush(var_table,free);
+	hash_dispose(var_table);
+	for (i = 0; i < num_vars; i++)
+		free(var_names[i]);
+	free(var_names);
+	var_names = NULL;
+	num_vars = 0;
+	hash_flush(func_table,free_cfunc);
+	hash_dispose(func_table);
+	for (i = 0; i < num_funcs; i++)
+		free(func_names[i]);
+	free(func_names);
+	func_names = NULL;
+	num_funcs = 0;
+	hash_flush(sourced_table,free_csourced);
+	hash_dispose(sourced_table);
+	free(sourced_files);
+	sourced_files = NULL;
+	num_sourced = 0;
+	for (i = 0; i < num_prof_sites; i++)
+		free(prof_sites[i].text);
+	free(prof_sites);
+	prof_sites = NULL;
+	num_prof_sites = 0;
+	for (i = 0; i < num_regexes; i++)
+		free(regex_patterns[i]);
+	free(regex_patterns);
+	regex_patterns = NULL;
+	num_regexes = 0;
+	bashc_output = out;
+	indent_level = 0;
 }
 
-static __must_use struct ctioctx* compile_while(COMMAND* cmd, struct ctioctx* ioc,
-                                                int flags, int invert)
+/*
+ * Compile a top-level command, with `flags' (CF_EXEC, if it's the
+ * last).  If it can be abandoned partway (see bashc_abandon()), its
+ * code is wrapped in a setjmp() so the program can carry on with the
+ * next one, as bash does.
+ */
+static __must_use struct ctioctx* compile_toplevel(COMMAND* cmd, struct ctioctx* ioc,
+                                                   int flags)
 {
-	char* entrypt;
-	char* exitpt;
-	char* loopstatus;
-	struct while_com* wh = cmd->value.While;
-
-	entrypt = new_ident("whileentry");
-	exitpt = new_ident("whileexit");
-	loopstatus = new_ident("whilestatus");
-
-	icoutsn("int %s = 0",loopstatus);
-	coutn("%s:",entrypt);
+	struct csection sec;
+	const char* line;
+	const char* nl;
 
-	push_loopnest(entrypt,exitpt);
-	startblock();
-	compile_command(wh->test,ioc,flags);
+	open_section(&sec);
+	bashc_output = sec.stream;
+	may_abandon = 0;
 
-	make_cif("%sG_status",invert ? "!" : "");
-	icoutsn("G_status = %s",loopstatus);
-	icoutsn("goto %s",exitpt);
-	make_cendif();
+	ioc = compile_command(cmd,ioc,flags);
 
-	compile_command(wh->action,ioc,flags);
-	icoutsn("%s = G_status",loopstatus);
-	icoutsn("goto %s",entrypt);
-	endblock();
+	fclose(sec.stream);
+	bashc_output = main_section.stream;
 
-	pop_loopnest();
-	coutn("%s:",exitpt);
+	if (!may_abandon) {
+		fwrite(sec.buf,1,sec.len,bashc_output);
+		free(sec.buf);
+		return ioc;
+	}
 
-	free(entrypt);
-	free(exitpt);
-	free(loopstatus);
+	make_cif("!setjmp(bashc_toplevel)");
+	icoutsn("bashc_toplevel_active = 1");
+	for (line = sec.buf; line < sec.buf + sec.len; line = nl + 1) {
+		if (!(nl = memchr(line,'\n',sec.buf + sec.len - line)))
+			nl = sec.buf + sec.len - 1;
+		if (*line == '\t')
+			fputc('\t',bashc_output);
+		fwrite(line,1,nl - line + 1,bashc_output);
+	}
+	make_celse();
+	make_failure();
+	make_cendif();
+	icoutsn("bashc_toplevel_active = 0");
+	free(sec.buf);
 
 	return ioc;
 }
 
-static __must_use struct ctioctx* compile_command(COMMAND* cmd, struct ctioctx* ioc,
-                                                  int flags)
+/* Note the functions defined anywhere in `cmd' */
+static void collect_functions(COMMAND* cmd)
 {
+	BUCKET_CONTENTS* b;
+	struct cfunc* func;
+	PATTERN_LIST* pl;
+	const char* name;
+
 	if (!cmd)
-		return ioc;
+		return;
 
 	switch (cmd->type) {
+	case cm_function_def:
+		name = cmd->value.Function_def->name->word;
+		if ((func = lookup_cfunc(name))) {
+			func->ndefs++;
+			free(func->cname);
+			func->cname = NULL;
+			func->body = NULL;
+		} else {
+			func = xmalloc(sizeof(*func));
+			memset(func,0,sizeof(*func));
+			if (legal_identifier(name))
+				asprintf(&func->handle,"FN_%s",name);
+			else
+				func->handle = new_ident("FN_");
+			func->cname = function_cname(name);
+			func->ndefs = 1;
+			func->body = cmd->value.Function_def->command;
+			b = hash_insert(savestring(name),func_table,0);
+			b->data = func;
+			func_names = xrealloc(func_names,(num_funcs+1)*sizeof(char*));
+			func_names[num_funcs++] = savestring(name);
+		}
+		collect_functions(cmd->value.Function_def->command);
+		break;
 
 	case cm_for:
-	case cm_case:
-	case cm_select:
-	case cm_function_def:
-	case cm_group:
-	case cm_arith:
-	case cm_cond:
+		collect_functions(cmd->value.For->action);
+		break;
+
 	case cm_arith_for:
-	case cm_subshell:
-	case cm_coproc:
-		NYI("(command type %d)",cmd->type);
+		collect_functions(cmd->value.ArithFor->action);
 		break;
 
-	case cm_until:
-		ioc = compile_while(cmd,ioc,flags,1);
+	case cm_select:
+		collect_functions(cmd->value.Select->action);
+		break;
+
+	case cm_case:
+		for (pl = cmd->value.Case->clauses; pl; pl = pl->next)
+			collect_functions(pl->action);
 		break;
 
 	case cm_while:
-		ioc = compile_while(cmd,ioc,flags,0);
+	case cm_until:
+		collect_functions(cmd->value.While->test);
+		collect_functions(cmd->value.While->action);
 		break;
 
 	case cm_if:
-		ioc = compile_if(cmd,ioc,flags);
+		collect_functions(cmd->value.If->test);
+		collect_functions(cmd->value.If->true_case);
+		collect_functions(cmd->value.If->false_case);
 		break;
 
-	case cm_simple:
-		ioc = compile_simple_command(cmd,0,ioc,flags);
+	case cm_connection:
+		collect_functions(cmd->value.Connection->first);
+		collect_functions(cmd->value.Connection->second);
 		break;
 
-	case cm_connection:
-		ioc = compile_connection(cmd,ioc,flags);
+	case cm_group:
+		collect_functions(cmd->value.Group->command);
+		break;
+
+	case cm_subshell:
+		collect_functions(cmd->value.Subshell->command);
+		break;
+
+	case cm_coproc:
+		collect_functions(cmd->value.Coproc->command);
 		break;
 
 	default:
-		fatal_error("bad command type in compile_command()");
+		break;
 	}
+}
 
-	return ioc;
+/*
+ * Find the file that `source name' would read, as bash would now
+ * (see builtins/source.def), returning its full path, or NULL.
+ */
+static char* resolve_source(const char* name)
+{
+	char* path = NULL;
+	char* full;
+
+	if (absolute_pathname(name) || (posixly_correct && strchr(name,'/')))
+		path = savestring(name);
+	else if (source_uses_path)
+		path = find_path_file(name);
+	if (!path && source_searches_cwd)
+		path = savestring(name);
+	if (!path)
+		return NULL;
+
+	full = realpath(path,NULL);
+	free(path);
+
+	return full;
 }
 
-static void init_compiler_output(void)
+/* Read all of file `path' into a string, or return NULL */
+static char* read_source_file(const char* path)
 {
-	fputs(bashc_header,bashc_output);
-	indent_level = 1;
+	struct csection sec;
+	char buf[8192];
+	size_t n;
+	FILE* f;
+
+	if (!(f = fopen(path,"r")))
+		return NULL;
+	open_section(&sec);
+	while ((n = fread(buf,1,sizeof(buf),f)) > 0)
+		fwrite(buf,1,n,sec.stream);
+	fclose(sec.stream);
+	if (ferror(f)) {
+		free(sec.buf);
+		sec.buf = NULL;
+	}
+	fclose(f);
+
+	return sec.buf;
 }
 
-static void finish_compiler_output(void)
+static int note_sourced(COMMAND* cmd, void* arg);
+
+/*
+ * The file `source name' reads, parsed, the first time it's asked
+ * for; NULL if it can't be found, read or parsed.  If `collect', the
+ * functions it defines, and the files it sources in turn, are noted as
+ * the script's own are.
+ */
+static struct csourced* load_sourced(const char* name, int collect)
 {
-	fputs(bashc_footer,bashc_output);
-	indent_level = 0;
+	BUCKET_CONTENTS* b;
+	struct csourced* src;
+	char* path;
+	char* text;
+	int savedline = line_number;
+	int ok;
+
+	if (!(path = resolve_source(name)))
+		return NULL;
+	if ((b = hash_search(path,sourced_table,0))) {
+		free(path);
+		return b->data;
+	} else if (!(text = read_source_file(path))) {
+		free(path);
+		return NULL;
+	}
+
+	src = xmalloc(sizeof(*src));
+	src->path = path;
+	src->cname = NULL;
+	line_number = 0;
+	ok = parse_text_commands(text,path,&src->body);
+	line_number = savedline;
+	free(text);
+	if (!ok) {
+		free(path);
+		free(src);
+		return NULL;
+	}
+
+	/* in before its own sources are, in case it sources itself */
+	b = hash_insert(savestring(path),sourced_table,0);
+	b->data = src;
+	sourced_files = xrealloc(sourced_files,(num_sourced+1)*sizeof(*sourced_files));
+	sourced_files[num_sourced++] = src;
+
+	if (collect) {
+		collect_functions(src->body);
+		walk_commands(src->body,note_sourced,NULL);
+	}
+
+	return src;
+}
+
+/* For walk_commands(): load the files sourced by literal names */
+static int note_sourced(COMMAND* cmd, void* arg)
+{
+	WORD_LIST* words;
+	char* name;
+
+	switch (cmd->type) {
+	case cm_function_def:
+		return walk_commands(cmd->value.Function_def->command,note_sourced,arg);
+	case cm_simple:
+		if (!(words = first_command_word(cmd->value.Simple->words))
+		    || !(name = static_word(words->word)))
+			return 0;
+		if ((!strcmp(name,"source") || !strcmp(name,".")) && words->next
+		    && !words->next->next) {
+			free(name);
+			if ((name = static_word(words->next->word)))
+				load_sourced(name,1);
+		}
+		free(name);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/* The files sourced, for --compile-deps, one per line */
+static void output_sourced_deps(void)
+{
+	FILE* f;
+	int i;
+
+	if (!(f = fopen(bashc_deps_outpath,"w"))) {
+		report_error("Failed to open %s for writing",bashc_deps_outpath);
+		return;
+	}
+	for (i = 0; i < num_sourced; i++)
+		fprintf(f,"%s\n",sourced_files[i]->path);
+	if (fclose(f))
+		report_error("failed to close %s",bashc_deps_outpath);
+}
+
+/*
+ * For walk_commands(): whether `cmd', or any function it defines, is
+ * something that has to outlive the last command: a background job,
+ * which the shell would still be there to reap, or a trap.
+ */
+static int needs_shell_after(COMMAND* cmd, void* arg)
+{
+	WORD_LIST* words;
+	char* name;
+	int ret;
+
+	switch (cmd->type) {
+	case cm_function_def:
+		return walk_commands(cmd->value.Function_def->command,needs_shell_after,arg);
+	case cm_connection:
+		return cmd->value.Connection->connector == '&';
+	case cm_coproc:
+		return 1;
+	case cm_simple:
+		if (!(words = first_command_word(cmd->value.Simple->words))
+		    || !(name = static_word(words->word)))
+			return 0;
+		ret = !strcmp(name,"trap");
+		free(name);
+		return ret;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Whether the last of the script's commands can exec() an external
+ * command in place of forking it, as bash does for `bash -c' (see
+ * optimize_fork() in builtins/evalstring.c): only if nothing needs the
+ * shell to still be around afterward.
+ */
+static int tail_exec_ok(COMMAND** cmds, int ncmds)
+{
+	int i;
+
+	for (i = 0; i < ncmds; i++) {
+		if (walk_commands(cmds[i],needs_shell_after,NULL))
+			return 0;
+	}
+	/* sourced anywhere (or nowhere); they're not likely to be many */
+	for (i = 0; i < num_sourced; i++) {
+		if (walk_commands(sourced_files[i]->body,needs_shell_after,NULL))
+			return 0;
+	}
+
+	return 1;
 }
 
+/*
+ * Compile the script.  It's all parsed first, so that the functions it
+ * defines are known wherever they're called from.  Returns nonzero if
+ * it couldn't be written, or if anything in it couldn't be compiled
+ * (and so is missing from the program written).
+ */
 int compile_input(void)
 {
 	int ret;
 	struct ctioctx* ioc = NULL;
+	COMMAND** cmds = NULL;
+	int i,ncmds = 0;
+	int tailexec;
+
+	FILE* out;
 
-	if (!(bashc_output = fopen(bashc_outpath,"w"))) {
+	if (!(out = fopen(bashc_outpath,"w"))) {
 		report_error("Failed to open %s for writing",bashc_outpath);
 		exit_shell(EX_NOTFOUND);
 	}
@@ -695,8 +6498,11 @@ int compile_input(void)
 			ret = 1;
 			EOF_Reached = EOF;
 		} else if (global_command) {
-			ioc = compile_command(global_command,ioc,0);
-			dispose_command(global_command);
+			expand_command_braces(global_command);
+			collect_functions(global_command);
+			walk_commands(global_command,note_sourced,NULL);
+			cmds = xrealloc(cmds,(ncmds+1)*sizeof(*cmds));
+			cmds[ncmds++] = global_command;
 			global_command = NULL;
 		}
 
@@ -704,13 +6510,36 @@ int compile_input(void)
 			EOF_Reached = EOF;
 	}
 
-	finish_compiler_output();
+	/* a loadable builtin mustn't exec() over the shell */
+	tailexec = !bashc_loadable_outpath && !bashc_profile && tail_exec_ok(cmds,ncmds);
+	for (i = 0; i < ncmds; i++)
+		ioc = compile_toplevel(cmds[i],ioc,tailexec && i == ncmds-1 ? CF_EXEC : 0);
+
+	if (bashc_deps_outpath)
+		output_sourced_deps();
+
+	/* kept till now for function_pure() */
+	for (i = 0; i < ncmds; i++)
+		dispose_command(cmds[i]);
+	free(cmds);
+
+	finish_compiler_output(out);
 	/* FIXME: free ioc */
 
+	if (bashc_hybrid && native_commands + interpreted_commands) {
+		fprintf(stderr,"%s: %d of %d commands (%.1f%%) compiled, %d interpreted "
+		        "in %d fragment%s\n",bashc_outpath,native_commands,
+		        native_commands + interpreted_commands,
+		        100.0 * native_commands / (native_commands + interpreted_commands),
+		        interpreted_commands,interpreted_fragments,
+		        interpreted_fragments == 1 ? "" : "s");
+	}
+
 	if (fclose(bashc_output)) {
 		report_error("failed to close %s",bashc_outpath);
 		return 1;
 	}
 
-	return 0;
+	/* the program's written, but it's missing what couldn't be compiled */
+	return nyi_count != 0;
 }
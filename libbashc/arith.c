@@ -0,0 +1,577 @@
+/*
+ * Shell arithmetic at run time.
+ *
+ * The compiler translates arithmetic expressions into C on intmax_t,
+ * calling on this file for the operations that can fail and for
+ * variables, whose values are themselves evaluated as expressions (as
+ * in expr.c), by a small interpreter for the same grammar.
+ *
+ * After an error the rest of the expression is still evaluated, with
+ * the failing operation yielding 0, but nothing more is reported; the
+ * generated code finds out with bashc_arith_status() or
+ * bashc_arith_value() once the whole expression is done.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "libbashc.h"
+
+/* as in expr.c */
+#define MAX_EXPR_RECURSION_LEVEL 1024
+
+static int arith_failed = 0;
+static int recursion_level = 0;
+
+/* how many variables the interpreter has looked at */
+static unsigned long var_refs = 0;
+
+static void arith_error(const char* expr, const char* msg)
+{
+	if (!arith_failed++)
+		bashc_builtin_error(&bashc_stderr,expr,"%s",msg);
+}
+
+intmax_t bashc_arith_div(intmax_t a, intmax_t b, const char* expr)
+{
+	if (!b) {
+		arith_error(expr,"division by 0");
+		return 0;
+	}
+
+	/* the one quotient that overflows */
+	return b == -1 ? bashc_neg(a) : a / b;
+}
+
+intmax_t bashc_arith_mod(intmax_t a, intmax_t b, const char* expr)
+{
+	if (!b) {
+		arith_error(expr,"division by 0");
+		return 0;
+	}
+
+	return b == -1 ? 0 : a % b;
+}
+
+intmax_t bashc_arith_pow(intmax_t a, intmax_t b, const char* expr)
+{
+	intmax_t r = 1;
+
+	if (b < 0) {
+		arith_error(expr,"exponent less than 0");
+		return 0;
+	}
+
+	while (b--)
+		r = bashc_mul(r,a);
+
+	return r;
+}
+
+/* A command's status from the value of its expression, as (( )) has */
+int bashc_arith_status(intmax_t n)
+{
+	if (arith_failed) {
+		arith_failed = 0;
+		return 1;
+	}
+
+	return n == 0;
+}
+
+/*
+ * For arithmetic for-loops: whether to go on, given a test's value
+ * (or a nonzero one, for the other expressions).  An error stops the
+ * loop with a status of 1.
+ */
+int bashc_arith_loop(intmax_t n, int* status)
+{
+	if (arith_failed) {
+		arith_failed = 0;
+		*status = 1;
+		return 0;
+	}
+
+	return n != 0;
+}
+
+/* The value of $(( )); an error abandons the command */
+intmax_t bashc_arith_value(intmax_t n)
+{
+	if (arith_failed) {
+		arith_failed = 0;
+		bashc_abandon();
+	}
+
+	return n;
+}
+
+/*
+ * Parse an integer constant the way expr.c's strlong() does: decimal,
+ * octal with a leading 0, hex with 0x, or base#digits.  Returns 0, or
+ * -1 having reported an error.
+ */
+int bashc_arith_number(const char* s, size_t len, intmax_t* value, const char* expr)
+{
+	const char* end = s + len;
+	uintmax_t v = 0;
+	int base = 10;
+	int digit;
+	const char* hash;
+
+	if ((hash = memchr(s,'#',len))) {
+		for (base = 0; s < hash; s++) {
+			if (!isdigit((unsigned char)*s) || (base = base*10 + *s - '0') > 64)
+				break;
+		}
+		if (s != hash || base < 2 || base > 64) {
+			arith_error(expr,"invalid arithmetic base");
+			return -1;
+		}
+		s++;
+	} else if (len > 1 && s[0] == '0') {
+		if (s[1] == 'x' || s[1] == 'X') {
+			base = 16;
+			s += 2;
+		} else
+			base = 8;
+	}
+
+	if (s == end) {
+		arith_error(expr,"invalid number");
+		return -1;
+	}
+
+	for (; s < end; s++) {
+		if (isdigit((unsigned char)*s))
+			digit = *s - '0';
+		else if (islower((unsigned char)*s))
+			digit = *s - 'a' + 10;
+		else if (isupper((unsigned char)*s))
+			digit = *s - 'A' + (base <= 36 ? 10 : 36);
+		else if (*s == '@')
+			digit = 62;
+		else if (*s == '_')
+			digit = 63;
+		else
+			digit = 64;
+
+		if (digit >= base) {
+			arith_error(expr,"value too great for base");
+			return -1;
+		}
+		v = v*base + digit;
+	}
+
+	*value = (intmax_t)v;
+	return 0;
+}
+
+/* The interpreter, for expressions that turn up in variables */
+struct evalctx {
+	const char* expr;
+	const char* s;
+	int noeval;	/* in the unevaluated part of && || ?: */
+	int error;	/* a syntax error: stop parsing */
+};
+
+static const char* const operators[] = {
+	"<<=", ">>=",
+	"**", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "++", "--",
+	"+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=",
+	"+", "-", "*", "/", "%", "<", ">", "=", "!", "~", "&", "^", "|",
+	"?", ":", ",", "(", ")",
+	NULL,
+};
+
+static const char* peek_op(struct evalctx* c)
+{
+	int i;
+
+	while (isspace((unsigned char)*c->s))
+		c->s++;
+
+	for (i = 0; operators[i]; i++) {
+		if (!strncmp(c->s,operators[i],strlen(operators[i])))
+			return operators[i];
+	}
+
+	return NULL;
+}
+
+static int accept_op(struct evalctx* c, const char* op)
+{
+	const char* cur = peek_op(c);
+
+	if (!cur || strcmp(cur,op))
+		return 0;
+
+	c->s += strlen(op);
+	return 1;
+}
+
+static intmax_t syntax_error(struct evalctx* c, const char* msg)
+{
+	if (!c->error)
+		arith_error(c->expr,msg);
+	c->error = 1;
+	return 0;
+}
+
+static size_t ident_len(const char* s)
+{
+	size_t n = 0;
+
+	if (isalpha((unsigned char)*s) || *s == '_') {
+		while (isalnum((unsigned char)s[n]) || s[n] == '_')
+			n++;
+	}
+
+	return n;
+}
+
+static struct bashc_var* ident_var(const char* name, size_t len)
+{
+	char buf[256];
+	char* p = len < sizeof(buf) ? buf : malloc(len + 1);
+	struct bashc_var* v;
+
+	memcpy(p,name,len);
+	p[len] = '\0';
+	v = bashc_var(p);
+	var_refs++;
+	if (p != buf)
+		free(p);
+
+	return v;
+}
+
+/* Apply binary operator `op' */
+static intmax_t binop(struct evalctx* c, const char* op, intmax_t a, intmax_t b)
+{
+	if (c->noeval)
+		return 0;
+
+	switch (op[0]) {
+	case '+': return bashc_add(a,b);
+	case '-': return bashc_sub(a,b);
+	case '*': return op[1] == '*' ? bashc_arith_pow(a,b,c->expr) : bashc_mul(a,b);
+	case '/': return bashc_arith_div(a,b,c->expr);
+	case '%': return bashc_arith_mod(a,b,c->expr);
+	case '&': return op[1] == '&' ? a && b : a & b;
+	case '|': return op[1] == '|' ? a || b : a | b;
+	case '^': return a ^ b;
+	case '=': return a == b;
+	case '!': return a != b;
+	case '<':
+		return op[1] == '<' ? bashc_shl(a,b) : op[1] == '=' ? a <= b : a < b;
+	case '>':
+		return op[1] == '>' ? bashc_shr(a,b) : op[1] == '=' ? a >= b : a > b;
+	}
+
+	return 0;
+}
+
+static intmax_t eval_comma(struct evalctx* c);
+static intmax_t eval_assign(struct evalctx* c);
+static intmax_t eval_unary(struct evalctx* c);
+
+static intmax_t eval_primary(struct evalctx* c)
+{
+	struct bashc_var* v;
+	const char* s;
+	intmax_t n = 0;
+	size_t len;
+
+	if (accept_op(c,"(")) {
+		n = eval_comma(c);
+		if (!accept_op(c,")"))
+			return syntax_error(c,"missing `)'");
+		return n;
+	}
+
+	peek_op(c);
+	s = c->s;
+
+	if (isdigit((unsigned char)*s)) {
+		for (len = 0; isalnum((unsigned char)s[len]) || (s[len] && strchr("#@_",s[len])); len++)
+			;
+		c->s += len;
+		if (bashc_arith_number(s,len,&n,c->expr))
+			c->error = 1;
+		return n;
+	} else if (!(len = ident_len(s)))
+		return syntax_error(c,"syntax error: operand expected");
+
+	c->s += len;
+	v = ident_var(s,len);
+	if (accept_op(c,"++"))
+		return c->noeval ? 0 : bashc_arith_incr(v,1,1);
+	else if (accept_op(c,"--"))
+		return c->noeval ? 0 : bashc_arith_incr(v,-1,1);
+
+	return c->noeval ? 0 : bashc_arith_get(v);
+}
+
+static intmax_t eval_unary(struct evalctx* c)
+{
+	const char* op = peek_op(c);
+	size_t len;
+
+	if (op && (!strcmp(op,"++") || !strcmp(op,"--"))) {
+		c->s += 2;
+		peek_op(c);
+		if ((len = ident_len(c->s))) {
+			c->s += len;
+			return c->noeval ? 0 : bashc_arith_incr(ident_var(c->s - len,len),
+			                                        op[0] == '+' ? 1 : -1,0);
+		}
+		/* just two signs */
+		return op[0] == '+' ? eval_unary(c) : bashc_neg(bashc_neg(eval_unary(c)));
+	} else if (accept_op(c,"!"))
+		return !eval_unary(c);
+	else if (accept_op(c,"~"))
+		return ~eval_unary(c);
+	else if (accept_op(c,"-"))
+		return bashc_neg(eval_unary(c));
+	else if (accept_op(c,"+"))
+		return eval_unary(c);
+
+	return eval_primary(c);
+}
+
+static intmax_t eval_power(struct evalctx* c)
+{
+	intmax_t n = eval_unary(c);
+
+	if (accept_op(c,"**"))
+		n = binop(c,"**",n,eval_power(c));
+
+	return n;
+}
+
+/* binary operators, loosest-binding first */
+static const char* const levels[][5] = {
+	{ "||" }, { "&&" }, { "|" }, { "^" }, { "&" },
+	{ "==", "!=" }, { "<=", ">=", "<", ">" }, { "<<", ">>" },
+	{ "+", "-" }, { "*", "/", "%" },
+};
+#define NLEVELS (sizeof(levels)/sizeof(levels[0]))
+
+static intmax_t eval_binary(struct evalctx* c, size_t level)
+{
+	const char* op;
+	intmax_t n,m;
+	int i;
+
+	if (level == NLEVELS)
+		return eval_power(c);
+
+	n = eval_binary(c,level + 1);
+
+	while (!c->error && (op = peek_op(c))) {
+		for (i = 0; levels[level][i] && strcmp(levels[level][i],op); i++)
+			;
+		if (!levels[level][i])
+			break;
+		c->s += strlen(op);
+
+		if (!strcmp(op,"&&") || !strcmp(op,"||")) {
+			/* only evaluate as much as needed */
+			if (op[0] == '&' ? !n : n)
+				c->noeval++;
+			m = eval_binary(c,level + 1);
+			if (op[0] == '&' ? !n : n)
+				c->noeval--;
+			n = op[0] == '&' ? n && m : n || m;
+		} else
+			n = binop(c,op,n,eval_binary(c,level + 1));
+	}
+
+	return n;
+}
+
+static intmax_t eval_cond(struct evalctx* c)
+{
+	intmax_t n = eval_binary(c,0);
+	intmax_t a,b;
+
+	if (!accept_op(c,"?"))
+		return n;
+
+	if (!n)
+		c->noeval++;
+	a = eval_comma(c);
+	if (!n)
+		c->noeval--;
+
+	if (!accept_op(c,":"))
+		return syntax_error(c,"`:' expected for conditional expression");
+
+	if (n)
+		c->noeval++;
+	b = eval_cond(c);
+	if (n)
+		c->noeval--;
+
+	return n ? a : b;
+}
+
+static intmax_t eval_assign(struct evalctx* c)
+{
+	static const char* const assignops[] = {
+		"=", "+=", "-=", "*=", "/=", "%=", "<<=", ">>=", "&=", "^=", "|=", NULL,
+	};
+	const char* start;
+	const char* op;
+	char binary[3];
+	struct bashc_var* v;
+	size_t len;
+	intmax_t n;
+	int i;
+
+	peek_op(c);
+	start = c->s;
+
+	if ((len = ident_len(start))) {
+		c->s += len;
+		op = peek_op(c);
+		for (i = 0; op && assignops[i] && strcmp(assignops[i],op); i++)
+			;
+		if (op && assignops[i]) {
+			c->s += strlen(op);
+			n = eval_assign(c);
+			if (c->noeval || c->error)
+				return 0;
+			v = ident_var(start,len);
+			if (op[1]) {
+				/* +=, <<= and so on */
+				binary[0] = op[0];
+				binary[1] = op[1] == '=' ? '\0' : op[1];
+				binary[2] = '\0';
+				n = binop(c,binary,bashc_arith_get(v),n);
+			}
+			return bashc_arith_set(v,n);
+		}
+		c->s = start;
+	}
+
+	return eval_cond(c);
+}
+
+static intmax_t eval_comma(struct evalctx* c)
+{
+	intmax_t n = eval_assign(c);
+
+	while (!c->error && accept_op(c,","))
+		n = eval_assign(c);
+
+	return n;
+}
+
+/* Evaluate `s' as an arithmetic expression (an empty one being 0) */
+/*
+ * Values are usually plain decimal numbers, which don't need the
+ * interpreter.  Returns 0 if `s' isn't one (or is too big to be sure).
+ */
+static int plain_decimal(const char* s, intmax_t* n)
+{
+	intmax_t v = 0;
+	int neg = 0;
+
+	while (isspace((unsigned char)*s))
+		s++;
+	if (*s == '-' || *s == '+')
+		neg = *s++ == '-';
+	if (!isdigit((unsigned char)*s) || (*s == '0' && s[1] && !isspace((unsigned char)s[1])))
+		return 0;
+
+	for (; isdigit((unsigned char)*s); s++) {
+		if (v > (INTMAX_MAX - 9) / 10)
+			return 0;
+		v = v * 10 + (*s - '0');
+	}
+
+	while (isspace((unsigned char)*s))
+		s++;
+	if (*s)
+		return 0;
+
+	*n = neg ? -v : v;
+	return 1;
+}
+
+intmax_t bashc_arith_eval(const char* s)
+{
+	struct evalctx c = { s, s, 0, 0, };
+	intmax_t n;
+
+	if (plain_decimal(s,&n))
+		return n;
+
+	if (recursion_level >= MAX_EXPR_RECURSION_LEVEL) {
+		arith_error(s,"expression recursion level exceeded");
+		return 0;
+	}
+
+	recursion_level++;
+
+	if (peek_op(&c), !*c.s)
+		n = 0;
+	else if ((n = eval_comma(&c)), !c.error && (peek_op(&c), *c.s))
+		n = syntax_error(&c,"syntax error in expression");
+
+	recursion_level--;
+
+	return c.error ? 0 : n;
+}
+
+/*
+ * A variable's value as a number.  Values that don't refer to other
+ * variables are kept, so a counter isn't reparsed on every use.
+ */
+intmax_t bashc_arith_get(struct bashc_var* v)
+{
+	unsigned long refs = var_refs;
+	intmax_t n;
+
+	if (v->flags & VAR_NUMCACHED)
+		return v->num;
+	else if (!v->value)
+		return 0;
+
+	n = bashc_arith_eval(v->value);
+	if (!arith_failed && var_refs == refs) {
+		v->num = n;
+		v->flags |= VAR_NUMCACHED;
+	}
+
+	return n;
+}
+
+intmax_t bashc_arith_set(struct bashc_var* v, intmax_t n)
+{
+	bashc_setvar(v,bashc_num_str(n));
+	v->num = n;
+	v->flags |= VAR_NUMCACHED;
+
+	return n;
+}
+
+/* ++v, --v (`post' clear) or v++, v-- (`post' set) */
+intmax_t bashc_arith_incr(struct bashc_var* v, intmax_t delta, int post)
+{
+	intmax_t old = bashc_arith_get(v);
+	intmax_t n = bashc_arith_set(v,bashc_add(old,delta));
+
+	return post ? old : n;
+}
+
+/* A parameter's value (NULL if unset) as a number */
+intmax_t bashc_arith_str(const char* s)
+{
+	return s ? bashc_arith_eval(s) : 0;
+}
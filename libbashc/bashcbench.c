@@ -0,0 +1,437 @@
+/*
+ * Compare scripts run interpreted, by bash, and compiled.
+ *
+ * usage: bashcbench [-n runs] [-j] script...
+ *
+ * Each script is compiled once (timed) and run once each way, checking
+ * that both succeed and that the compiled program's output is bash's.
+ * Then it's run `runs' times (default 5) each way with its output
+ * discarded, reporting the mean wall, user and system time and the
+ * largest maximum RSS, all including the processes it starts; any run
+ * failing fails the script.  The processes it forks and execs are
+ * counted in one more run of each, traced with ptrace() so as not to
+ * slow the timed ones down.  -j reports in JSON instead of a table.
+ *
+ * $BASHC_SH, $BASHC_CC, $BASHC_INCLUDE and $BASHC_LIBRARY override the
+ * compiler, C compiler, include directory and library built in.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#if defined (__linux__)
+#include <sys/ptrace.h>
+#endif
+
+#include "tool.h"
+
+struct result {
+	double wall,user,sys;	/* mean seconds */
+	long maxrss;		/* kilobytes */
+	long forks,execs;	/* -1 if they couldn't be counted */
+};
+
+const char* progname = "bashcbench";
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double tv_secs(const struct timeval* tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* In the child: run `argv' with its output going to file `out', or nowhere */
+static void child_exec(char* const argv[], const char* out, int quiet)
+{
+	int fd;
+
+	if ((fd = open("/dev/null",O_RDWR)) != -1) {
+		dup2(fd,0);
+		dup2(fd,1);
+		if (quiet)
+			dup2(fd,2);
+		if (fd > 2)
+			close(fd);
+	}
+	if (out && ((fd = open(out,O_WRONLY|O_CREAT|O_TRUNC,0666)) == -1
+	            || dup2(fd,1) == -1))
+		_exit(127);
+	execvp(argv[0],argv);
+	_exit(127);
+}
+
+/*
+ * Run `argv' once, adding its times to `r'; returns its exit status
+ * (as from waitpid()), or -1.
+ */
+static int timed_run(char* const argv[], struct result* r)
+{
+	struct rusage ru;
+	double start;
+	pid_t pid;
+	int status;
+
+	start = now();
+	if (!(pid = fork()))
+		child_exec(argv,NULL,0);
+	else if (pid == -1)
+		return -1;
+
+	while (wait4(pid,&status,0,&ru) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	r->wall += now() - start;
+	r->user += tv_secs(&ru.ru_utime);
+	r->sys += tv_secs(&ru.ru_stime);
+	if (ru.ru_maxrss > r->maxrss)
+		r->maxrss = ru.ru_maxrss;
+
+	return status;
+}
+
+/*
+ * Count the processes that `argv' forks and the programs it execs
+ * (not counting its own), by tracing it and everything it starts.
+ */
+static void count_processes(char* const argv[], struct result* r)
+{
+#if defined (__linux__)
+	pid_t pid,w;
+	int status,sig,event;
+	long forks = 0,execs = 0;
+
+	r->forks = r->execs = -1;
+
+	if (!(pid = fork())) {
+		if (ptrace(PTRACE_TRACEME,0,NULL,NULL) == -1)
+			_exit(127);
+		raise(SIGSTOP);
+		child_exec(argv,NULL,1);
+	} else if (pid == -1)
+		return;
+
+	if (waitpid(pid,&status,0) != pid || !WIFSTOPPED(status)) {
+		waitpid(pid,&status,0);
+		return;
+	}
+	ptrace(PTRACE_SETOPTIONS,pid,NULL,
+	       (void*)(long)(PTRACE_O_TRACEFORK|PTRACE_O_TRACEVFORK
+	                     |PTRACE_O_TRACECLONE|PTRACE_O_TRACEEXEC
+	                     |PTRACE_O_EXITKILL));
+	ptrace(PTRACE_CONT,pid,NULL,NULL);
+
+	/* until every traced process has gone */
+	while ((w = waitpid(-1,&status,__WALL)) != -1 || errno == EINTR) {
+		if (w == -1 || !WIFSTOPPED(status))
+			continue;
+
+		sig = WSTOPSIG(status);
+		event = status >> 16;
+		if (sig == SIGTRAP && event) {
+			if (event == PTRACE_EVENT_EXEC)
+				execs++;
+			else
+				forks++;
+			sig = 0;
+		} else if (sig == SIGSTOP || sig == SIGTRAP) {
+			/* a new process's first stop, or the like */
+			sig = 0;
+		}
+		ptrace(PTRACE_CONT,w,NULL,(void*)(long)sig);
+	}
+
+	r->forks = forks;
+	r->execs = execs - 1;
+#else
+	(void)argv;
+	r->forks = r->execs = -1;
+#endif
+}
+
+/*
+ * Run `argv' `runs' times, and once more to count its processes;
+ * returns 0, the status of a run that failed, or -1.
+ */
+static int measure(char* const argv[], int runs, struct result* r)
+{
+	int i,status;
+
+	memset(r,0,sizeof(*r));
+	for (i = 0; i < runs; i++) {
+		if ((status = timed_run(argv,r)))
+			return status;
+	}
+	r->wall /= runs;
+	r->user /= runs;
+	r->sys /= runs;
+	count_processes(argv,r);
+
+	return 0;
+}
+
+/* Run `argv' once with its output going to file `out'; returns as timed_run() */
+static int output_run(char* const argv[], const char* out)
+{
+	pid_t pid;
+	int status;
+
+	if (!(pid = fork()))
+		child_exec(argv,out,0);
+	else if (pid == -1)
+		return -1;
+
+	while (waitpid(pid,&status,0) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	return status;
+}
+
+/* Whether files `a' and `b' have the same contents */
+static int same_files(const char* a, const char* b)
+{
+	FILE* fa = fopen(a,"r");
+	FILE* fb = fopen(b,"r");
+	int ca,cb,same = fa && fb;
+
+	while (same) {
+		ca = getc(fa);
+		cb = getc(fb);
+		if (ca != cb)
+			same = 0;
+		else if (ca == EOF)
+			break;
+	}
+
+	if (fa)
+		fclose(fa);
+	if (fb)
+		fclose(fb);
+
+	return same;
+}
+
+/* Report that `script' failed, with status `status' (or -1 and errno) */
+static void report_failure(const char* script, const char* mode, int status)
+{
+	if (status == -1)
+		fprintf(stderr,"%s: %s: %s\n",progname,script,strerror(errno));
+	else if (WIFSIGNALED(status))
+		fprintf(stderr,"%s: %s: %s: killed by signal %d\n",progname,script,mode,
+		        WTERMSIG(status));
+	else
+		fprintf(stderr,"%s: %s: %s: exited with status %d\n",progname,script,mode,
+		        WEXITSTATUS(status));
+}
+
+/*
+ * Run `script' once each way with its output kept, checking that both
+ * succeed and that the compiled program's output is bash's.
+ */
+static int check_output(const char* script, char* const interp_argv[],
+                        char* const comp_argv[], const char* interp_out,
+                        const char* comp_out)
+{
+	int status;
+
+	if ((status = output_run(interp_argv,interp_out))) {
+		report_failure(script,"interpreted",status);
+		return 0;
+	} else if ((status = output_run(comp_argv,comp_out))) {
+		report_failure(script,"compiled",status);
+		return 0;
+	} else if (!same_files(interp_out,comp_out)) {
+		fprintf(stderr,"%s: %s: compiled output differs from interpreted\n",
+		        progname,script);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Compile `script' as `prog', returning the seconds it took, or -1 */
+static double compile(const char* script, const char* prog, const char* csrc)
+{
+	char include[4096];
+	double start = now();
+
+	snprintf(include,sizeof(include),"-I%s",setting("BASHC_INCLUDE",BASHC_DEFAULT_INCLUDE));
+	{
+		char* const compile_argv[] = {
+			(char*)setting("BASHC_SH",BASHC_DEFAULT_SH), "--compile",
+			(char*)csrc, (char*)script, NULL,
+		};
+		char* const cc_argv[] = {
+			(char*)setting("BASHC_CC",BASHC_DEFAULT_CC), "-O2", include,
+			"-o", (char*)prog, (char*)csrc,
+			(char*)setting("BASHC_LIBRARY",BASHC_DEFAULT_LIBRARY), NULL,
+		};
+
+		if (!run(compile_argv) || !run(cc_argv))
+			return -1;
+	}
+
+	return now() - start;
+}
+
+static void print_count(long n)
+{
+	if (n < 0)
+		printf("%7s","-");
+	else
+		printf("%7ld",n);
+}
+
+static void print_row(const char* script, const char* mode, const struct result* r)
+{
+	printf("%-24s %-12s %10.1f %10.1f %10.1f %10ld",script,mode,
+	       r->wall * 1000,r->user * 1000,r->sys * 1000,r->maxrss);
+	print_count(r->forks);
+	print_count(r->execs);
+}
+
+static void json_string(const char* s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c",*s);
+		else if ((unsigned char)*s < ' ')
+			printf("\\u%04x",*s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static void json_count(const char* name, long n)
+{
+	if (n < 0)
+		printf(", \"%s\": null",name);
+	else
+		printf(", \"%s\": %ld",name,n);
+}
+
+static void json_result(const char* mode, const struct result* r)
+{
+	printf("\"%s\": { \"wall_ms\": %.3f, \"user_ms\": %.3f, \"sys_ms\": %.3f, "
+	       "\"maxrss_kb\": %ld",mode,r->wall * 1000,r->user * 1000,
+	       r->sys * 1000,r->maxrss);
+	json_count("forks",r->forks);
+	json_count("execs",r->execs);
+	printf(" }");
+}
+
+int main(int argc, char** argv)
+{
+	char dirtmpl[] = "/tmp/bashcbench.XXXXXX";
+	char prog[sizeof(dirtmpl) + 16];
+	char csrc[sizeof(dirtmpl) + 16];
+	char interp_out[sizeof(dirtmpl) + 16];
+	char comp_out[sizeof(dirtmpl) + 16];
+	const char* sh = setting("BASHC_SH",BASHC_DEFAULT_SH);
+	struct result interp,comp;
+	double ctime;
+	int runs = 5,json = 0;
+	int opt,i,status,failed = 0,reported = 0;
+
+	while ((opt = getopt(argc,argv,"n:j")) != -1) {
+		switch (opt) {
+		case 'n': runs = atoi(optarg); break;
+		case 'j': json = 1; break;
+		default:
+			fprintf(stderr,"usage: %s [-n runs] [-j] script...\n",progname);
+			return 2;
+		}
+	}
+	if (optind == argc || runs < 1) {
+		fprintf(stderr,"usage: %s [-n runs] [-j] script...\n",progname);
+		return 2;
+	}
+
+	if (!mkdtemp(dirtmpl)) {
+		fprintf(stderr,"%s: %s: %s\n",progname,dirtmpl,strerror(errno));
+		return 1;
+	}
+	snprintf(prog,sizeof(prog),"%s/prog",dirtmpl);
+	snprintf(csrc,sizeof(csrc),"%s/prog.c",dirtmpl);
+	snprintf(interp_out,sizeof(interp_out),"%s/interp.out",dirtmpl);
+	snprintf(comp_out,sizeof(comp_out),"%s/comp.out",dirtmpl);
+
+	if (json)
+		printf("{ \"runs\": %d, \"scripts\": [",runs);
+	else
+		printf("%-24s %-12s %10s %10s %10s %10s %7s %7s\n","script","mode",
+		       "wall ms","user ms","sys ms","maxrss KB","forks","execs");
+
+	for (i = optind; i < argc; i++) {
+		const char* name = strrchr(argv[i],'/') ? strrchr(argv[i],'/') + 1 : argv[i];
+		char* const interp_argv[] = { (char*)sh, argv[i], NULL, };
+		char* const comp_argv[] = { prog, NULL, };
+
+		if ((ctime = compile(argv[i],prog,csrc)) < 0) {
+			fprintf(stderr,"%s: %s: failed to compile\n",progname,argv[i]);
+			failed = 1;
+			continue;
+		}
+		if (!check_output(argv[i],interp_argv,comp_argv,interp_out,comp_out)) {
+			failed = 1;
+			continue;
+		}
+		if ((status = measure(interp_argv,runs,&interp))) {
+			report_failure(argv[i],"interpreted",status);
+			failed = 1;
+			continue;
+		} else if ((status = measure(comp_argv,runs,&comp))) {
+			report_failure(argv[i],"compiled",status);
+			failed = 1;
+			continue;
+		}
+
+		if (json) {
+			printf("%s\n  { \"script\": ",reported++ ? "," : "");
+			json_string(name);
+			printf(", \"compile_ms\": %.3f,\n    ",ctime * 1000);
+			json_result("interpreted",&interp);
+			printf(",\n    ");
+			json_result("compiled",&comp);
+			printf(",\n    \"speedup\": %.3f }",comp.wall > 0 ? interp.wall / comp.wall : 0);
+		} else {
+			print_row(name,"interpreted",&interp);
+			putchar('\n');
+			print_row(name,"compiled",&comp);
+			printf("   %.1fx faster (compile: %.0f ms)\n",
+			       comp.wall > 0 ? interp.wall / comp.wall : 0,ctime * 1000);
+		}
+		fflush(stdout);
+	}
+
+	if (json)
+		printf("\n] }\n");
+
+	unlink(prog);
+	unlink(csrc);
+	unlink(interp_out);
+	unlink(comp_out);
+	rmdir(dirtmpl);
+
+	return failed;
+}
@@ -0,0 +1,418 @@
+/*
+ * Run a shell script compiled, caching the compiled program.
+ *
+ * usage: bashcrun script [args...]
+ *
+ * so a script can start with `#!/path/to/bashcrun'.  The cache is
+ * keyed on a hash of the script's contents and the identity (device,
+ * inode, size and modification time) of the compiler and libbashc, so
+ * rebuilding either invalidates it.  A hit costs hashing the script,
+ * checking it against the copy kept with the program, checking the
+ * files it sources (which are compiled into the program) against the
+ * hashes of their contents in its manifest, and an exec().  Which files
+ * those are can depend on the working directory and $PATH, so the
+ * manifest of a script that sources any records them, and a run with
+ * others compiles it afresh.
+ * A miss compiles the script into a temporary file in the cache and
+ * renames it into place, so concurrent runs never see half-written
+ * programs.  If the script can't be compiled (the compiler fails if
+ * there's anything in it that it can't compile), it's interpreted, and
+ * the copy and manifest are kept without a program, so later runs
+ * interpret it straight away.
+ *
+ * The cache is $BASHC_CACHE_DIR, or else bashc under $XDG_CACHE_HOME
+ * or ~/.cache.  $BASHC_SH, $BASHC_CC, $BASHC_INCLUDE and $BASHC_LIBRARY
+ * override the compiler, C compiler, include directory and library
+ * built in.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tool.h"
+
+const char* progname = "bashcrun";
+
+static void* xmalloc(size_t n)
+{
+	void* p;
+
+	if (!(p = malloc(n))) {
+		perror(progname);
+		exit(126);
+	}
+
+	return p;
+}
+
+static char* path_join(const char* dir, const char* name)
+{
+	size_t dlen = strlen(dir);
+	char* p = xmalloc(dlen + strlen(name) + 2);
+
+	memcpy(p,dir,dlen);
+	p[dlen] = '/';
+	strcpy(p + dlen + 1,name);
+
+	return p;
+}
+
+/* Read all of file `path', returning NULL (with errno set) on failure */
+static char* read_file(const char* path, size_t* lenp)
+{
+	struct stat st;
+	char* buf;
+	size_t len = 0;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path,O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd,&st)) {
+		close(fd);
+		return NULL;
+	}
+
+	buf = xmalloc(st.st_size + 1);
+	while ((n = read(fd,buf + len,st.st_size - len)) > 0)
+		len += n;
+	close(fd);
+	if (n == -1) {
+		free(buf);
+		return NULL;
+	}
+
+	*lenp = len;
+	return buf;
+}
+
+static uint64_t fnv1a(uint64_t h, const void* p, size_t len)
+{
+	const unsigned char* s = p;
+
+	while (len--)
+		h = (h ^ *s++) * 0x100000001b3ull;
+
+	return h;
+}
+
+/* Mix the identity of file `path' into `h' */
+static uint64_t hash_file_id(uint64_t h, const char* path)
+{
+	struct stat st;
+	int64_t id[5] = { 0, };
+
+	h = fnv1a(h,path,strlen(path) + 1);
+	if (!stat(path,&st)) {
+		id[0] = st.st_dev;
+		id[1] = st.st_ino;
+		id[2] = st.st_size;
+		id[3] = st.st_mtim.tv_sec;
+		id[4] = st.st_mtim.tv_nsec;
+	}
+
+	return fnv1a(h,id,sizeof(id));
+}
+
+/* Create directory `dir' and any missing parents */
+static int make_dirs(char* dir)
+{
+	char* p;
+
+	for (p = dir + 1; (p = strchr(p,'/')); p++) {
+		*p = '\0';
+		if (mkdir(dir,0777) && errno != EEXIST) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+	if (mkdir(dir,0777) && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static char* cache_dir(void)
+{
+	const char* s;
+
+	if ((s = getenv("BASHC_CACHE_DIR")) && *s)
+		return strcpy(xmalloc(strlen(s) + 1),s);
+	else if ((s = getenv("XDG_CACHE_HOME")) && *s)
+		return path_join(s,"bashc");
+	else if ((s = getenv("HOME")) && *s)
+		return path_join(s,".cache/bashc");
+	else
+		return NULL;
+}
+
+/* Write `len' bytes of `buf' to new file `path' */
+static int write_file(const char* path, const char* buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path,O_WRONLY|O_CREAT|O_TRUNC,0666)) == -1)
+		return -1;
+	for (; len; buf += n, len -= n) {
+		if ((n = write(fd,buf,len)) == -1) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	return close(fd);
+}
+
+/* The hash of the contents of file `path', or 0 if it can't be read */
+static uint64_t hash_file(const char* path)
+{
+	uint64_t h;
+	size_t len;
+	char* text;
+
+	if (!(text = read_file(path,&len)))
+		return 0;
+	h = fnv1a(0xcbf29ce484222325ull,text,len);
+	free(text);
+
+	return h;
+}
+
+/*
+ * What decides which files a script sources (by a relative name): the
+ * working directory, and $PATH.  Returns (malloced) a line of each.
+ */
+static char* source_context(void)
+{
+	const char* path = getenv("PATH");
+	char* cwd;
+	char* ctx;
+
+	if (!(cwd = getcwd(NULL,0)) && !(cwd = strdup(""))) {
+		perror(progname);
+		exit(126);
+	}
+	if (!path)
+		path = "";
+	ctx = xmalloc(strlen(cwd) + strlen(path) + 16);
+	sprintf(ctx,"cwd %s\nPATH %s\n",cwd,path);
+	free(cwd);
+
+	return ctx;
+}
+
+/*
+ * Make the manifest `deps' from the compiler's list of the files the
+ * script sources, `list': the context they were found in (see
+ * source_context()), if there are any, and a line for each, of the
+ * hash of its contents and its path.
+ */
+static int write_deps(const char* list, const char* deps)
+{
+	FILE* in;
+	FILE* out;
+	char path[4096];
+	char* ctx;
+	size_t n;
+	int ok;
+
+	if (!(in = fopen(list,"r")))
+		return -1;
+	if (!(out = fopen(deps,"w"))) {
+		fclose(in);
+		return -1;
+	}
+	while (fgets(path,sizeof(path),in)) {
+		if ((n = strlen(path)) && path[n - 1] == '\n')
+			path[n - 1] = '\0';
+		if (ftell(out) == 0) {
+			ctx = source_context();
+			fputs(ctx,out);
+			free(ctx);
+		}
+		fprintf(out,"%016llx %s\n",(unsigned long long)hash_file(path),path);
+	}
+	ok = !ferror(in);
+	fclose(in);
+
+	return fclose(out) || !ok ? -1 : 0;
+}
+
+/*
+ * Whether the files listed in manifest `deps' are as they were, and
+ * would be found where they were
+ */
+static int same_deps(const char* deps)
+{
+	unsigned long long h;
+	char* buf;
+	char* ctx;
+	char* line;
+	char* next;
+	char* path;
+	size_t len;
+	int same = 1;
+
+	if (!(buf = read_file(deps,&len)))
+		return 0;
+	buf[len] = '\0';
+
+	line = buf;
+	if (len) {
+		ctx = source_context();
+		same = !strncmp(buf,ctx,strlen(ctx));
+		line += strlen(ctx);
+		free(ctx);
+	}
+	for (; same && *line; line = next) {
+		if ((next = strchr(line,'\n')))
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		h = strtoull(line,&path,16);
+		same = *path == ' ' && hash_file(path + 1) == h;
+	}
+	free(buf);
+
+	return same;
+}
+
+/*
+ * Compile `script' (whose contents are `text') into the cache as
+ * `bin', with a copy of the script as `copy' and the manifest of the
+ * files it sources as `deps'; if the compiler fails, the copy and
+ * manifest are kept without `bin'.
+ */
+static int compile(const char* script, const char* text, size_t len,
+                   const char* bin, const char* copy, const char* deps)
+{
+	char* tmp = xmalloc(strlen(bin) + 32);
+	char* tmpc = xmalloc(strlen(bin) + 32);
+	char* tmpcopy = xmalloc(strlen(bin) + 32);
+	char* tmplist = xmalloc(strlen(bin) + 32);
+	char* tmpdeps = xmalloc(strlen(bin) + 32);
+	char* include;
+	int compiled,ok = 0;
+
+	sprintf(tmp,"%s.%ld.tmp",bin,(long)getpid());
+	sprintf(tmpc,"%s.c",tmp);
+	sprintf(tmpcopy,"%s.sh",tmp);
+	sprintf(tmplist,"%s.list",tmp);
+	sprintf(tmpdeps,"%s.deps",tmp);
+	include = xmalloc(strlen(setting("BASHC_INCLUDE",BASHC_DEFAULT_INCLUDE)) + 3);
+	sprintf(include,"-I%s",setting("BASHC_INCLUDE",BASHC_DEFAULT_INCLUDE));
+
+	{
+		char* const compile_argv[] = {
+			(char*)setting("BASHC_SH",BASHC_DEFAULT_SH), "--compile-deps",
+			tmplist, "--compile", tmpc, (char*)script, NULL,
+		};
+		char* const cc_argv[] = {
+			(char*)setting("BASHC_CC",BASHC_DEFAULT_CC), "-O2", include,
+			"-o", tmp, tmpc, (char*)setting("BASHC_LIBRARY",BASHC_DEFAULT_LIBRARY),
+			NULL,
+		};
+
+		/* these go in first: the program's presence means they are */
+		compiled = run(compile_argv);
+		ok = compiled && run(cc_argv);
+		if ((ok || !compiled)
+		    && !write_deps(tmplist,tmpdeps) && !rename(tmpdeps,deps)
+		    && !write_file(tmpcopy,text,len) && !rename(tmpcopy,copy))
+			ok = ok && !rename(tmp,bin);
+		else
+			ok = 0;
+	}
+
+	unlink(tmpc);
+	unlink(tmplist);
+	if (!ok) {
+		unlink(tmp);
+		unlink(tmpcopy);
+		unlink(tmpdeps);
+	}
+	free(include);
+	free(tmpdeps);
+	free(tmplist);
+	free(tmpcopy);
+	free(tmpc);
+	free(tmp);
+
+	return ok;
+}
+
+/* Whether `copy' holds exactly `text' */
+static int same_script(const char* copy, const char* text, size_t len)
+{
+	size_t clen;
+	char* ctext;
+	int same;
+
+	if (!(ctext = read_file(copy,&clen)))
+		return 0;
+	same = clen == len && !memcmp(ctext,text,len);
+	free(ctext);
+
+	return same;
+}
+
+int main(int argc, char** argv)
+{
+	const char* sh = setting("BASHC_SH",BASHC_DEFAULT_SH);
+	char name[17];
+	char* text;
+	char* dir;
+	char* bin;
+	char* copy;
+	char* deps;
+	size_t len;
+	uint64_t h;
+
+	if (argc < 2) {
+		fprintf(stderr,"usage: %s script [args...]\n",progname);
+		return 2;
+	}
+
+	if (!(text = read_file(argv[1],&len))) {
+		fprintf(stderr,"%s: %s: %s\n",progname,argv[1],strerror(errno));
+		return 127;
+	}
+
+	h = fnv1a(0xcbf29ce484222325ull,text,len);
+	h = hash_file_id(h,sh);
+	h = hash_file_id(h,setting("BASHC_LIBRARY",BASHC_DEFAULT_LIBRARY));
+	h = fnv1a(h,setting("BASHC_CC",BASHC_DEFAULT_CC),strlen(setting("BASHC_CC",BASHC_DEFAULT_CC)));
+	snprintf(name,sizeof(name),"%016llx",(unsigned long long)h);
+
+	if (!(dir = cache_dir()) || make_dirs(dir))
+		goto interpret;
+	bin = path_join(dir,name);
+	copy = xmalloc(strlen(bin) + 4);
+	sprintf(copy,"%s.sh",bin);
+	deps = xmalloc(strlen(bin) + 8);
+	sprintf(deps,"%s.deps",bin);
+
+	/* the script's $0 is its own name, as when it's interpreted */
+	if (same_script(copy,text,len) && same_deps(deps)) {
+		/* with no program, it's known not to compile */
+		if (access(bin,X_OK))
+			goto interpret;
+		execv(bin,argv + 1);
+	}
+	if (compile(argv[1],text,len,bin,copy,deps))
+		execv(bin,argv + 1);
+
+interpret:
+	argv[0] = (char*)sh;
+	execvp(sh,argv);
+	fprintf(stderr,"%s: %s: %s\n",progname,sh,strerror(errno));
+	return 126;
+}
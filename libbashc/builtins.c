@@ -0,0 +1,483 @@
+/*
+ * Builtins implemented natively in the compiled program, following
+ * the behavior of their counterparts in builtins/ (but not all of
+ * their options).
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "libbashc.h"
+
+#define ESC '\033'
+
+static int hexvalue(int c)
+{
+	if (isdigit(c))
+		return c - '0';
+	else
+		return tolower(c) - 'a' + 10;
+}
+
+/* Write the UTF-8 encoding of `c' */
+static void put_utf8(struct bashc_out* out, unsigned long c)
+{
+	char buf[4];
+	int n;
+
+	if (c < 0x80) {
+		buf[0] = c;
+		n = 1;
+	} else if (c < 0x800) {
+		buf[0] = 0xc0 | (c >> 6);
+		buf[1] = 0x80 | (c & 0x3f);
+		n = 2;
+	} else if (c < 0x10000) {
+		buf[0] = 0xe0 | (c >> 12);
+		buf[1] = 0x80 | ((c >> 6) & 0x3f);
+		buf[2] = 0x80 | (c & 0x3f);
+		n = 3;
+	} else {
+		buf[0] = 0xf0 | ((c >> 18) & 0x07);
+		buf[1] = 0x80 | ((c >> 12) & 0x3f);
+		buf[2] = 0x80 | ((c >> 6) & 0x3f);
+		buf[3] = 0x80 | (c & 0x3f);
+		n = 4;
+	}
+
+	bout_write(out,buf,n);
+}
+
+/*
+ * Write `s', expanding backslash escapes as `echo -e' does (see
+ * ansicstr() in lib/sh/strtrans.c).  Returns 1 if a \c was seen.
+ */
+static int echo_escaped(struct bashc_out* out, const char* s)
+{
+	int c,n;
+	unsigned long v;
+
+	while ((c = *s++)) {
+		if (c != '\\' || !*s) {
+			bout_putc(out,c);
+			continue;
+		}
+
+		switch (c = *s++) {
+		case 'a': c = '\a'; break;
+		case 'b': c = '\b'; break;
+		case 'e': case 'E': c = ESC; break;
+		case 'f': c = '\f'; break;
+		case 'n': c = '\n'; break;
+		case 'r': c = '\r'; break;
+		case 't': c = '\t'; break;
+		case 'v': c = '\v'; break;
+		case '\\': break;
+
+		case '0':
+			/* up to three octal digits after the 0 */
+			for (c = 0, n = 3; n-- && *s >= '0' && *s <= '7'; s++)
+				c = c*8 + (*s - '0');
+			c &= 0xff;
+			break;
+
+		case 'x':
+			for (c = 0, n = 2; n && isxdigit((unsigned char)*s); n--, s++)
+				c = c*16 + hexvalue(*s);
+			if (n == 2) {
+				/* \x followed by non-hex digits is passed through */
+				bout_putc(out,'\\');
+				c = 'x';
+			}
+			c &= 0xff;
+			break;
+
+		case 'u':
+		case 'U':
+			n = c == 'u' ? 4 : 8;
+			for (v = 0; n && isxdigit((unsigned char)*s); n--, s++)
+				v = v*16 + hexvalue(*s);
+			if (n == (c == 'u' ? 4 : 8)) {
+				bout_putc(out,'\\');
+				break;
+			}
+			put_utf8(out,v);
+			continue;
+
+		case 'c':
+			return 1;
+
+		default:
+			bout_putc(out,'\\');
+			break;
+		}
+
+		bout_putc(out,c);
+	}
+
+	return 0;
+}
+
+int bashc_echo(char* const argv[], struct bashc_out* out, struct bashc_out* err)
+{
+	int i,newline = 1,escapes = 0;
+	const char* opt;
+
+	for (i = 1; argv[i] && argv[i][0] == '-'; i++) {
+		/* only a word made up entirely of valid options counts */
+		opt = argv[i] + 1;
+		if (!*opt || opt[strspn(opt,"neE")])
+			break;
+
+		for (; *opt; opt++) {
+			switch (*opt) {
+			case 'n': newline = 0; break;
+			case 'e': escapes = 1; break;
+			case 'E': escapes = 0; break;
+			}
+		}
+	}
+
+	out->error = 0;
+
+	for (; argv[i]; i++) {
+		if (!escapes)
+			bout_puts(out,argv[i]);
+		else if (echo_escaped(out,argv[i])) {
+			newline = 0;
+			break;
+		}
+
+		if (argv[i+1])
+			bout_putc(out,' ');
+	}
+
+	if (newline)
+		bout_putc(out,'\n');
+
+	if (out->error) {
+		bashc_builtin_error(err,"echo","write error: %s",strerror(out->error));
+		return 1;
+	}
+
+	return 0;
+}
+
+int bashc_cd(char* const argv[], struct bashc_out* out, struct bashc_out* err)
+{
+	const char* dir = argv[1];
+	const char* pwd;
+	char* cwd;
+	int printdir = 0;
+
+	if (argv[1] && !strcmp(argv[1],"--"))
+		dir = argv[2];
+
+	if (!dir) {
+		if (!(dir = bashc_getvar("HOME"))) {
+			bashc_builtin_error(err,"cd","HOME not set");
+			return 1;
+		}
+	} else if (!strcmp(dir,"-")) {
+		if (!(dir = bashc_getvar("OLDPWD"))) {
+			bashc_builtin_error(err,"cd","OLDPWD not set");
+			return 1;
+		}
+		printdir = 1;
+	}
+
+	if (chdir(dir)) {
+		bashc_builtin_error(err,"cd","%s: %s",dir,strerror(errno));
+		return 1;
+	}
+
+	if ((pwd = bashc_getvar("PWD")))
+		bashc_setvar(bashc_var("OLDPWD"),pwd);
+	if ((cwd = get_current_dir_name())) {
+		bashc_setvar(bashc_var("PWD"),cwd);
+		if (printdir) {
+			bout_puts(out,cwd);
+			bout_putc(out,'\n');
+		}
+		free(cwd);
+	}
+
+	return 0;
+}
+
+int bashc_pwd(char* const argv[], struct bashc_out* out, struct bashc_out* err)
+{
+	char* cwd;
+
+	(void)argv;
+
+	if (!(cwd = get_current_dir_name())) {
+		bashc_builtin_error(err,"pwd","error retrieving current directory: %s",
+		                    strerror(errno));
+		return 1;
+	}
+
+	bout_puts(out,cwd);
+	bout_putc(out,'\n');
+	free(cwd);
+
+	return 0;
+}
+
+static const struct signame {
+	int num;
+	const char* name;
+} signames[] = {
+	{ SIGHUP, "HUP" }, { SIGINT, "INT" }, { SIGQUIT, "QUIT" },
+	{ SIGILL, "ILL" }, { SIGTRAP, "TRAP" }, { SIGABRT, "ABRT" },
+	{ SIGBUS, "BUS" }, { SIGFPE, "FPE" }, { SIGKILL, "KILL" },
+	{ SIGUSR1, "USR1" }, { SIGSEGV, "SEGV" }, { SIGUSR2, "USR2" },
+	{ SIGPIPE, "PIPE" }, { SIGALRM, "ALRM" }, { SIGTERM, "TERM" },
+#ifdef SIGSTKFLT
+	{ SIGSTKFLT, "STKFLT" },
+#endif
+	{ SIGCHLD, "CHLD" }, { SIGCONT, "CONT" }, { SIGSTOP, "STOP" },
+	{ SIGTSTP, "TSTP" }, { SIGTTIN, "TTIN" }, { SIGTTOU, "TTOU" },
+	{ SIGURG, "URG" }, { SIGXCPU, "XCPU" }, { SIGXFSZ, "XFSZ" },
+	{ SIGVTALRM, "VTALRM" }, { SIGPROF, "PROF" },
+#ifdef SIGWINCH
+	{ SIGWINCH, "WINCH" },
+#endif
+#ifdef SIGIO
+	{ SIGIO, "IO" },
+#endif
+#ifdef SIGPWR
+	{ SIGPWR, "PWR" },
+#endif
+	{ SIGSYS, "SYS" },
+};
+
+#define NUM_SIGNAMES ((int)(sizeof(signames) / sizeof(signames[0])))
+
+/*
+ * Returns the name of signal `sig' (without the SIG prefix) in a
+ * static buffer, or NULL if it doesn't have one.
+ */
+const char* bashc_signal_name(int sig)
+{
+	static char buf[32];
+	int i;
+
+	if (sig == 0)
+		return "EXIT";
+
+	for (i = 0; i < NUM_SIGNAMES; i++) {
+		if (signames[i].num == sig)
+			return signames[i].name;
+	}
+
+#ifdef SIGRTMIN
+	if (sig == SIGRTMIN)
+		return "RTMIN";
+	else if (sig == SIGRTMAX)
+		return "RTMAX";
+	else if (sig > SIGRTMIN && sig < SIGRTMAX) {
+		if (sig - SIGRTMIN <= (SIGRTMAX - SIGRTMIN) / 2)
+			snprintf(buf,sizeof(buf),"RTMIN+%d",sig - SIGRTMIN);
+		else
+			snprintf(buf,sizeof(buf),"RTMAX-%d",SIGRTMAX - sig);
+		return buf;
+	}
+#endif
+
+	return NULL;
+}
+
+/*
+ * Convert a signal name or number to a signal number, or -1 if it's
+ * invalid.  Names are matched case-insensitively, with or without
+ * the SIG prefix.
+ */
+int bashc_signal_number(const char* spec)
+{
+	char* end;
+	const char* name;
+	long n;
+	int i;
+
+	if (isdigit((unsigned char)*spec)) {
+		n = strtol(spec,&end,10);
+		return (*end || n >= NSIG) ? -1 : (int)n;
+	}
+
+	if (!strncasecmp(spec,"SIG",3))
+		spec += 3;
+
+	if (!strcasecmp(spec,"EXIT"))
+		return 0;
+
+	for (i = 1; i < NSIG; i++) {
+		if ((name = bashc_signal_name(i)) && !strcasecmp(spec,name))
+			return i;
+	}
+
+	return -1;
+}
+
+static void list_signals(struct bashc_out* out)
+{
+	int i,column = 0;
+	const char* name;
+
+	for (i = 1; i < NSIG; i++) {
+		if (!(name = bashc_signal_name(i)))
+			continue;
+		bout_printf(out,"%2d) SIG%s",i,name);
+		if (++column < 5)
+			bout_putc(out,'\t');
+		else {
+			bout_putc(out,'\n');
+			column = 0;
+		}
+	}
+
+	if (column)
+		bout_putc(out,'\n');
+}
+
+/* kill -l [sigspec...] */
+static int kill_list(char* const argv[], struct bashc_out* out, struct bashc_out* err)
+{
+	int i,sig,ret = 0;
+	const char* name;
+
+	if (!argv[0]) {
+		list_signals(out);
+		return 0;
+	}
+
+	for (i = 0; argv[i]; i++) {
+		if (isdigit((unsigned char)argv[i][0])) {
+			sig = atoi(argv[i]);
+			/* an exit status from a signalled process */
+			if (sig > 128)
+				sig -= 128;
+			if ((name = bashc_signal_name(sig))) {
+				bout_puts(out,name);
+				bout_putc(out,'\n');
+				continue;
+			}
+		} else if ((sig = bashc_signal_number(argv[i])) >= 0) {
+			bout_printf(out,"%d\n",sig);
+			continue;
+		}
+
+		bashc_builtin_error(err,"kill","%s: invalid signal specification",argv[i]);
+		ret = 1;
+	}
+
+	return ret;
+}
+
+static int kill_usage(struct bashc_out* err)
+{
+	bashc_builtin_error(err,"kill","usage: kill [-s sigspec | -n signum | -sigspec] "
+	                    "pid | jobspec ... or kill -l [sigspec]");
+	return 2;
+}
+
+int bashc_kill(char* const argv[], struct bashc_out* out, struct bashc_out* err)
+{
+	int i,sig = SIGTERM,ret = 0;
+	int sig_found = 0;
+	const char* spec;
+	char* end;
+	long pid;
+
+	for (i = 1; argv[i] && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i],"--")) {
+			i++;
+			break;
+		} else if (!strcmp(argv[i],"-l") || !strcmp(argv[i],"-L")) {
+			return kill_list(argv + i + 1,out,err);
+		} else if (!strcmp(argv[i],"-s") || !strcmp(argv[i],"-n")) {
+			if (!(spec = argv[++i]))
+				return kill_usage(err);
+		} else if (sig_found) {
+			/* after a signal, it's a process group */
+			break;
+		} else
+			spec = argv[i] + 1;
+
+		if ((sig = bashc_signal_number(spec)) < 0) {
+			bashc_builtin_error(err,"kill","%s: invalid signal specification",spec);
+			return 1;
+		}
+		sig_found = 1;
+	}
+
+	if (!argv[i])
+		return kill_usage(err);
+
+	for (; argv[i]; i++) {
+		if (argv[i][0] == '%') {
+			bashc_builtin_error(err,"kill","%s: no such job",argv[i]);
+			ret = 1;
+			continue;
+		}
+
+		errno = 0;
+		pid = strtol(argv[i],&end,10);
+		if (!argv[i][0] || *end || errno) {
+			bashc_builtin_error(err,"kill","%s: arguments must be process or job IDs",
+			                    argv[i]);
+			ret = 1;
+		} else if (kill((pid_t)pid,sig)) {
+			bashc_builtin_error(err,"kill","(%ld) - %s",pid,strerror(errno));
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
+
+int bashc_true(char* const argv[], struct bashc_out* out, struct bashc_out* err)
+{
+	(void)argv, (void)out, (void)err;
+	return 0;
+}
+
+int bashc_false(char* const argv[], struct bashc_out* out, struct bashc_out* err)
+{
+	(void)argv, (void)out, (void)err;
+	return 1;
+}
+
+static const struct builtin_ent {
+	const char* name;
+	bashc_builtin* fn;
+} builtin_table[] = {
+	{ "echo", bashc_echo }, { "test", bashc_test }, { "[", bashc_test },
+	{ "kill", bashc_kill }, { "cd", bashc_cd }, { "pwd", bashc_pwd },
+	{ "wait", bashc_wait },
+	{ "true", bashc_true }, { "false", bashc_false }, { ":", bashc_true },
+};
+
+/*
+ * The native builtin called `name', if there is one, for commands whose
+ * name isn't known until run time.
+ */
+bashc_builtin* bashc_find_builtin(const char* name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(builtin_table)/sizeof(builtin_table[0]); i++) {
+		if (!strcmp(builtin_table[i].name,name))
+			return builtin_table[i].fn;
+	}
+
+	return NULL;
+}
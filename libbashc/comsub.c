@@ -0,0 +1,185 @@
+/*
+ * Command substitution.
+ *
+ * The output is collected in a struct bashc_capture.  Usually the
+ * command runs in a forked child writing to a pipe, which is read with
+ * large reads into a buffer grown as need be.  When the compiler can
+ * tell it runs entirely in this process (native builtins, and shell
+ * functions made only of them, with no effect on the shell's state)
+ * there's no fork: bashc_stdout is pointed at the buffer for the
+ * duration, so the output's appended straight to it.
+ *
+ * Either way trailing newlines are stripped and NUL bytes dropped, as
+ * bash's read_comsub() does.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "libbashc.h"
+
+/* The least room to make for each read */
+#define CAPTURE_MIN_READ 16384
+
+static void grow_capture(struct bashc_capture* c, size_t need)
+{
+	size_t size = c->size ? c->size : CAPTURE_MIN_READ;
+
+	if (c->len + need < c->size)
+		return;
+
+	while (c->len + need >= size)
+		size *= 2;
+	if (!(c->buf = realloc(c->buf,size))) {
+		perror("realloc");
+		exit(1);
+	}
+	c->size = size;
+}
+
+void bashc_capture_append(struct bashc_capture* c, const char* buf, size_t len)
+{
+	grow_capture(c,len);
+	memcpy(c->buf + c->len,buf,len);
+	c->len += len;
+}
+
+/* Turn what's been captured into the substitution's value */
+static void finish_capture(struct bashc_capture* c)
+{
+	char* end;
+	char* p;
+
+	grow_capture(c,1);
+
+	if ((p = memchr(c->buf,'\0',c->len))) {
+		bashc_builtin_error(&bashc_stderr,"warning",
+		                    "command substitution: ignored null byte in input");
+		for (end = p; p < c->buf + c->len; p++) {
+			if (*p)
+				*end++ = *p;
+		}
+		c->len = end - c->buf;
+	}
+
+	while (c->len && c->buf[c->len - 1] == '\n')
+		c->len--;
+	c->buf[c->len] = '\0';
+}
+
+/*
+ * Start a substitution run in this process.  If it's abandoned (see
+ * bashc_abandon()) it longjmp()s to `c->jmp', so the caller has to
+ * setjmp() there before running it, and call bashc_capture_end() either
+ * way.
+ */
+void bashc_capture_begin(struct bashc_capture* c)
+{
+	bout_flush(&bashc_stdout);
+
+	c->len = 0;
+	c->prev = bashc_stdout.capture;
+	c->frames = bashc_frame_top();
+	c->redirs = bashc_redir_depth();
+	bashc_stdout.capture = c;
+}
+
+void bashc_capture_end(struct bashc_capture* c)
+{
+	bashc_stdout.capture = c->prev;
+	finish_capture(c);
+}
+
+/*
+ * For bashc_abandon(): if a substitution's running in this process,
+ * abandon that (as bash would abandon the subshell running it), undoing
+ * any function calls and redirections made within it.
+ */
+void bashc_capture_abandon(void)
+{
+	struct bashc_capture* c = bashc_stdout.capture;
+
+	if (!c)
+		return;
+
+	bashc_leave_to(c->frames);
+	bashc_redir_unwind(bashc_redir_depth() - c->redirs);
+	longjmp(c->jmp,1);
+}
+
+/*
+ * Start a substitution run in a child, like fork(): returns 0 in the
+ * child, whose standard output goes to a pipe, and nonzero in the
+ * parent, which should then call bashc_capture_wait().
+ */
+pid_t bashc_capture_fork(struct bashc_capture* c)
+{
+	int fds[2];
+	int map[2][2];
+	struct rtioctx ioc = { 0, NULL, 2, (const int (*)[2])map, };
+	pid_t pid;
+
+	c->len = 0;
+	c->fd = -1;
+	c->pid = -1;
+
+	if (bashc_pipe(fds))
+		return -1;
+
+	map[0][0] = fds[1];
+	map[0][1] = 1;
+	map[1][0] = fds[0];
+	map[1][1] = IO_CLOSE_FD;
+
+	if (!(pid = bashc_fork(&ioc)))
+		return 0;
+
+	close(fds[1]);
+	if (pid == -1)
+		close(fds[0]);
+	else {
+		c->fd = fds[0];
+		c->pid = pid;
+	}
+
+	return pid;
+}
+
+/* Collect the output of a child started by bashc_capture_fork(), returning its status */
+int bashc_capture_wait(struct bashc_capture* c)
+{
+	ssize_t n;
+	int status;
+
+	if (c->fd == -1) {
+		finish_capture(c);
+		return 1;
+	}
+
+	for (;;) {
+		grow_capture(c,CAPTURE_MIN_READ);
+		n = read(c->fd,c->buf + c->len,c->size - c->len - 1);
+		if (n > 0)
+			c->len += n;
+		else if (!n || errno != EINTR)
+			break;
+	}
+	close(c->fd);
+
+	if (bashc_waitpid(c->pid,&status)) {
+		perror("waitpid");
+		status = 1 << 8;
+	}
+
+	finish_capture(c);
+	return bashc_wstatus(status);
+}
+
+void bashc_capture_free(struct bashc_capture* c)
+{
+	free(c->buf);
+}
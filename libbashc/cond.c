@@ -0,0 +1,99 @@
+/*
+ * Regular expressions for [[ string =~ regex ]].
+ *
+ * The compiler gathers the literal patterns of a program's =~ tests
+ * into a table, which bashc_regex_init() compiles once at startup, as
+ * sh_regmatch() would on every test.  A pattern known only at run time
+ * has a struct bashc_regex of its own, recompiled only when the pattern
+ * changes.  As in bash, a pattern that doesn't compile makes the test's
+ * status 2.  Only the whole match is kept, in $BASH_REMATCH, there
+ * being no arrays.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <regex.h>
+
+#include "libbashc.h"
+
+static void regex_compile(struct bashc_regex* r)
+{
+	r->status = regcomp(&r->re,r->pattern,REG_EXTENDED);
+	r->ready = 1;
+}
+
+static void regex_free(struct bashc_regex* r)
+{
+	if (r->ready && !r->status)
+		regfree(&r->re);
+	r->ready = 0;
+}
+
+/* Compile the `n' patterns of table `r' (those not done already) */
+void bashc_regex_init(struct bashc_regex* r, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!r[i].ready)
+			regex_compile(&r[i]);
+	}
+}
+
+/* Make `r' pattern `pattern', compiling it unless it already is */
+struct bashc_regex* bashc_regex_dynamic(struct bashc_regex* r, const char* pattern)
+{
+	if (r->ready && !strcmp(r->pattern,pattern))
+		return r;
+
+	regex_free(r);
+	free(r->copy);
+	if (!(r->copy = strdup(pattern))) {
+		perror("strdup");
+		exit(1);
+	}
+	r->pattern = r->copy;
+	regex_compile(r);
+
+	return r;
+}
+
+/* Set $BASH_REMATCH to the `len' bytes at `s' */
+static void set_rematch(const char* s, size_t len)
+{
+	static char* buf = NULL;
+	static size_t size = 0;
+
+	if (len >= size) {
+		size = len + 64;
+		if (!(buf = realloc(buf,size))) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(buf,s,len);
+	buf[len] = '\0';
+
+	bashc_setvar(bashc_var("BASH_REMATCH"),buf);
+}
+
+/* Match `s' against `r': the status of the test, 0, 1 or 2 */
+int bashc_regex_match(struct bashc_regex* r, const char* s)
+{
+	regmatch_t m;
+
+	if (!r->ready)
+		regex_compile(r);
+	if (r->status)
+		return 2;
+
+	if (regexec(&r->re,s,1,&m,0)) {
+		bashc_unsetvar(bashc_var("BASH_REMATCH"));
+		return 1;
+	}
+
+	set_rematch(s + m.rm_so,m.rm_eo - m.rm_so);
+	return 0;
+}
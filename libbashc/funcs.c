@@ -0,0 +1,199 @@
+/*
+ * Shell functions.
+ *
+ * Each function is compiled to a C function of its own, called with
+ * the words of the command as its argv.  A definition stores it in the
+ * function's slot, a struct bashc_func which (like a variable) is
+ * looked up once at startup and never freed; call sites check the slot
+ * is filled before calling, and commands whose names are only known at
+ * run time find it with bashc_find_func().
+ *
+ * A call runs in a frame holding the caller's positional parameters
+ * and the previous state of the variables made local, which are put
+ * back when it returns (or is abandoned; see bashc_abandon()).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "libbashc.h"
+
+#define FUNC_BUCKETS 64
+
+static struct bashc_func* buckets[FUNC_BUCKETS];
+
+/* the innermost call in progress */
+static struct bashc_frame* frames = NULL;
+
+static unsigned int hash_name(const char* s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+
+	return h % FUNC_BUCKETS;
+}
+
+/* Find the slot for function `name', creating it (undefined) if need be */
+struct bashc_func* bashc_func(const char* name)
+{
+	struct bashc_func* f;
+	unsigned int h = hash_name(name);
+	size_t len;
+
+	for (f = buckets[h]; f; f = f->next) {
+		if (!strcmp(f->name,name))
+			return f;
+	}
+
+	len = strlen(name);
+	if (!(f = calloc(1,sizeof(*f) + len + 1))) {
+		perror("calloc");
+		exit(1);
+	}
+	memcpy(f->name,name,len);
+	f->next = buckets[h];
+	buckets[h] = f;
+
+	return f;
+}
+
+/* The function `name', or NULL if there isn't one defined */
+struct bashc_func* bashc_find_func(const char* name)
+{
+	struct bashc_func* f;
+
+	for (f = buckets[hash_name(name)]; f; f = f->next) {
+		if (!strcmp(f->name,name))
+			return f->fn ? f : NULL;
+	}
+
+	return NULL;
+}
+
+/* Undefine every function, to run a script again (see loadable.c) */
+void bashc_funcs_reset(void)
+{
+	struct bashc_func* f;
+	int i;
+
+	for (i = 0; i < FUNC_BUCKETS; i++) {
+		for (f = buckets[i]; f; f = f->next) {
+			f->fn = NULL;
+			f->src = NULL;
+		}
+	}
+	frames = NULL;
+}
+
+/* Call `fn' on each function slot */
+void bashc_funcs_each(void (*fn)(struct bashc_func* f, void* arg), void* arg)
+{
+	struct bashc_func* f;
+	int i;
+
+	for (i = 0; i < FUNC_BUCKETS; i++) {
+		for (f = buckets[i]; f; f = f->next)
+			fn(f,arg);
+	}
+}
+
+/*
+ * Start a call with arguments `argv' (argv[0] being the function's
+ * name).  They're copied, since the caller's argv may be in static
+ * storage that a recursive call would reuse.
+ */
+void bashc_enter(struct bashc_frame* fr, char* const argv[])
+{
+	fr->args = bashc_argv_dup(argv + 1);
+
+	fr->posparams = bashc_posparams;
+	bashc_posparams.n = 0;
+	while (fr->args[bashc_posparams.n])
+		bashc_posparams.n++;
+	bashc_posparams.v = fr->args;
+
+	fr->locals = NULL;
+	fr->nlocals = fr->localsize = 0;
+	fr->next = frames;
+	frames = fr;
+}
+
+/* Finish the innermost call, which is `fr' */
+void bashc_leave(struct bashc_frame* fr)
+{
+	while (fr->nlocals)
+		bashc_var_restore(&fr->locals[--fr->nlocals]);
+	free(fr->locals);
+
+	bashc_posparams = fr->posparams;
+	free(fr->args);
+
+	frames = fr->next;
+}
+
+/* The innermost call in progress, if any */
+struct bashc_frame* bashc_frame_top(void)
+{
+	return frames;
+}
+
+/*
+ * Finish every call made since `fr' was the innermost (every call, if
+ * it's NULL), for a command that's been abandoned.
+ */
+void bashc_leave_to(struct bashc_frame* fr)
+{
+	while (frames != fr)
+		bashc_leave(frames);
+}
+
+/* `local name': make `v' local to the innermost call */
+void bashc_local(struct bashc_var* v)
+{
+	struct bashc_frame* fr = frames;
+	int i;
+
+	for (i = 0; i < fr->nlocals; i++) {
+		if (fr->locals[i].var == v)
+			return;
+	}
+
+	if (fr->nlocals == fr->localsize) {
+		fr->localsize = fr->localsize ? 2 * fr->localsize : 4;
+		fr->locals = realloc(fr->locals,fr->localsize * sizeof(*fr->locals));
+		if (!fr->locals) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	bashc_var_save(&fr->locals[fr->nlocals++],v);
+}
+
+/* The status for `return arg', where `arg' is only known at run time */
+int bashc_return_status(const char* arg)
+{
+	const char* s = arg;
+	char* end;
+	intmax_t n;
+	int ok;
+
+	while (isspace((unsigned char)*s))
+		s++;
+	n = strtoimax(s,&end,10);
+	ok = end != s && isdigit((unsigned char)end[-1]);
+	while (isspace((unsigned char)*end))
+		end++;
+
+	if (!ok || *end) {
+		bashc_builtin_error(&bashc_stderr,"return","%s: numeric argument required",arg);
+		return 2;
+	}
+
+	return n & 255;
+}
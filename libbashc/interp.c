@@ -0,0 +1,482 @@
+/*
+ * Commands the compiler couldn't compile (see --compile-hybrid), run
+ * by bash.
+ *
+ * The command's text is run with `bash -c', with the positional
+ * parameters, preceded by assignments of the variables that aren't
+ * exported (those that are go in the environment), the definitions of
+ * the functions currently defined, and $? set to what it was.  When it
+ * runs in the foreground, its effect on the variables is brought back:
+ * bash dumps them all to a temporary file before the command and again
+ * after it, and whatever changed is changed here too (a change to $PWD
+ * meaning a cd), as are the positional parameters.  If it exits, so
+ * does this program.
+ *
+ * The dump is a NUL-separated name, attributes (as from ${name@a}) and
+ * value for each set variable; a lone NUL ends each dump, and the
+ * positional parameters, each NUL-terminated, follow the second.  An
+ * array's value is its `declare -p'.  Read-only variables and bash's
+ * own dynamic ones are left out.
+ *
+ * This program has no arrays, so those a command leaves are kept as
+ * their declarations, which later commands run by bash start with,
+ * until compiled code assigns or unsets the name.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libbashc.h"
+
+#ifndef BASHC_DEFAULT_SH
+#define BASHC_DEFAULT_SH "bash"
+#endif
+
+struct sbuf {
+	char* s;
+	size_t len,size;
+};
+
+static void sb_add(struct sbuf* b, const char* s, size_t len)
+{
+	size_t size = b->size ? b->size : 1024;
+
+	while (b->len + len >= size)
+		size *= 2;
+	if (size != b->size) {
+		if (!(b->s = realloc(b->s,size))) {
+			perror("realloc");
+			exit(1);
+		}
+		b->size = size;
+	}
+	memcpy(b->s + b->len,s,len);
+	b->len += len;
+	b->s[b->len] = '\0';
+}
+
+static void sb_puts(struct sbuf* b, const char* s)
+{
+	sb_add(b,s,strlen(s));
+}
+
+/* Append `s' single-quoted */
+static void sb_quote(struct sbuf* b, const char* s)
+{
+	const char* q;
+
+	sb_add(b,"'",1);
+	while ((q = strchr(s,'\''))) {
+		sb_add(b,s,q - s);
+		sb_add(b,"'\\''",4);
+		s = q + 1;
+	}
+	sb_puts(b,s);
+	sb_add(b,"'",1);
+}
+
+/* Variables bash keeps for itself, which aren't passed either way */
+static int special_name(const char* name)
+{
+	static const char* const names[] = {
+		"_", "FUNCNAME", "GROUPS", "LINENO", "RANDOM", "SRANDOM",
+		"SECONDS", "PIPESTATUS", "SHLVL", "HISTCMD", "EUID", "UID",
+		"PPID", "SHELLOPTS", "BASHOPTS", "DIRSTACK", NULL,
+	};
+	int i;
+
+	if (!strncmp(name,"BASH",4) || !strncmp(name,"EPOCH",5)
+	    || !strncmp(name,"COMP_",5) || !strncmp(name,"__bashc_",8))
+		return 1;
+	for (i = 0; names[i]; i++) {
+		if (!strcmp(name,names[i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* The arrays left by commands run by bash, as declarations */
+struct bash_array {
+	char* name;
+	char* decl;
+	struct bashc_var* var;	/* and its version, while it's unset */
+	unsigned int version;
+};
+
+static struct bash_array* arrays = NULL;
+static int narrays = 0,arrays_size = 0;
+
+static void drop_array(const char* name)
+{
+	int i;
+
+	for (i = 0; i < narrays; i++) {
+		if (!strcmp(arrays[i].name,name)) {
+			free(arrays[i].name);
+			free(arrays[i].decl);
+			arrays[i] = arrays[--narrays];
+			return;
+		}
+	}
+}
+
+/* Keep array `name', leaving it unset here */
+static void keep_array(const char* name, const char* decl)
+{
+	struct bashc_var* v = bashc_var(name);
+
+	drop_array(name);
+	bashc_unsetvar(v);
+	if (narrays == arrays_size) {
+		arrays_size = arrays_size ? arrays_size * 2 : 8;
+		if (!(arrays = realloc(arrays,arrays_size * sizeof(*arrays)))) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	if (!(arrays[narrays].name = strdup(name))
+	    || !(arrays[narrays].decl = strdup(decl))) {
+		perror("strdup");
+		exit(1);
+	}
+	arrays[narrays].var = v;
+	arrays[narrays].version = v->version;
+	narrays++;
+}
+
+/* Append the declarations of the arrays compiled code hasn't touched */
+static void declare_arrays(struct sbuf* b)
+{
+	int i = 0;
+
+	while (i < narrays) {
+		if (arrays[i].var->version != arrays[i].version)
+			drop_array(arrays[i].name);
+		else
+			sb_puts(b,arrays[i++].decl);
+	}
+}
+
+static void assign_var(struct bashc_var* v, void* arg)
+{
+	struct sbuf* b = arg;
+
+	if (!v->value || (v->flags & VAR_EXPORTED) || special_name(v->name))
+		return;
+	sb_puts(b,v->name);
+	sb_add(b,"=",1);
+	sb_quote(b,v->value);
+	sb_add(b,"\n",1);
+}
+
+static void define_func(struct bashc_func* f, void* arg)
+{
+	struct sbuf* b = arg;
+
+	if (f->fn && f->src) {
+		sb_puts(b,f->src);
+		sb_add(b,"\n",1);
+	}
+}
+
+/* Append the definition of __bashc_dump, which dumps the variables */
+static void define_dump(struct sbuf* b)
+{
+	static const char prefixes[] =
+		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+	const char* p;
+	char name[] = "\"${!x@}\"";
+
+	sb_puts(b,"__bashc_dump()\n{\n\tlocal __bashc_v\n\tfor __bashc_v in");
+	for (p = prefixes; *p; p++) {
+		name[4] = *p;
+		sb_add(b," ",1);
+		sb_puts(b,name);
+	}
+	sb_puts(b,"; do\n"
+	        "\t\tcase $__bashc_v in __bashc_*) continue ;; esac\n"
+	        "\t\tif [[ ${!__bashc_v@a} == *[aA]* ]]; then\n"
+	        "\t\t\tprintf '%s\\0%s\\0' \"$__bashc_v\" \"${!__bashc_v@a}\"\n"
+	        "\t\t\tdeclare -p \"$__bashc_v\"\n"
+	        "\t\t\tprintf '\\0'\n"
+	        "\t\telif [[ -n ${!__bashc_v+set} ]]; then\n"
+	        "\t\t\tprintf '%s\\0%s\\0%s\\0' \"$__bashc_v\" \"${!__bashc_v@a}\" \"${!__bashc_v}\"\n"
+	        "\t\tfi\n"
+	        "\tdone\n}\n");
+}
+
+/* A variable as dumped */
+struct dumped {
+	const char* name;
+	const char* attrs;
+	const char* value;
+};
+
+/*
+ * Parse the dump from `p' to `end' into `vars', returning how many
+ * there are, and leaving `*next' after the separator (or at `end' if
+ * there's none).
+ */
+static int parse_dump(const char* p, const char* end, struct dumped** vars,
+                      const char** next)
+{
+	struct dumped* v = NULL;
+	int n = 0,size = 0;
+
+	while (p < end && *p) {
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			if (!(v = realloc(v,size * sizeof(*v)))) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		v[n].name = p;
+		p += strlen(p) + 1;
+		if (p >= end)
+			break;
+		v[n].attrs = p;
+		p += strlen(p) + 1;
+		if (p >= end)
+			break;
+		v[n].value = p;
+		p += strlen(p) + 1;
+		n++;
+	}
+
+	*vars = v;
+	*next = p < end ? p + 1 : end;
+	return n;
+}
+
+static const struct dumped* find_dumped(const struct dumped* vars, int n, const char* name)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!strcmp(vars[i].name,name))
+			return &vars[i];
+	}
+
+	return NULL;
+}
+
+/* Whether a variable with attributes `attrs' can be brought back */
+static int plain_var(const char* name, const char* attrs)
+{
+	return !strpbrk(attrs,"aAnr") && !special_name(name)
+		&& bashc_legal_name(name,strlen(name));
+}
+
+/* Whether it's an array to be kept for bash */
+static int array_var(const char* name, const char* attrs)
+{
+	return strpbrk(attrs,"aA") && !strchr(attrs,'r') && !special_name(name)
+		&& bashc_legal_name(name,strlen(name));
+}
+
+/* Bring back the positional parameters, from `p' to `end' */
+static void read_posparams(const char* p, const char* end)
+{
+	const char* q;
+	char** v;
+	int i,n;
+
+	for (n = 0, q = p; q < end; q += strlen(q) + 1)
+		n++;
+	if (n == bashc_posparams.n) {
+		for (i = 0, q = p; i < n && !strcmp(q,bashc_posparams.v[i]); i++)
+			q += strlen(q) + 1;
+		if (i == n)
+			return;
+	}
+
+	/* like shift's, the old ones aren't freed: a frame may have them */
+	if (!(v = malloc((n + 1) * sizeof(*v)))) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0, q = p; i < n; i++, q += strlen(q) + 1)
+		v[i] = strdup(q);
+	v[n] = NULL;
+	bashc_posparams.n = n;
+	bashc_posparams.v = v;
+}
+
+/*
+ * Bring back the changes the command made to the variables and
+ * positional parameters, from the dump `buf'; returns 0 if the dump
+ * after the command is missing (the command exited), -1 if there's no
+ * dump at all.
+ */
+static int read_back(const char* buf, size_t len)
+{
+	const char* end = buf + len;
+	const char* p;
+	const struct dumped* d;
+	struct dumped* before;
+	struct dumped* after;
+	struct bashc_var* v;
+	int nbefore,nafter,i;
+
+	if (!len)
+		return -1;
+
+	nbefore = parse_dump(buf,end,&before,&p);
+	if (p >= end) {
+		free(before);
+		return 0;
+	}
+	nafter = parse_dump(p,end,&after,&p);
+	read_posparams(p,end);
+
+	for (i = 0; i < nafter; i++) {
+		d = find_dumped(before,nbefore,after[i].name);
+		if (d && !strcmp(d->value,after[i].value) && !strcmp(d->attrs,after[i].attrs))
+			continue;
+		if (array_var(after[i].name,after[i].attrs)) {
+			keep_array(after[i].name,after[i].value);
+			continue;
+		} else if (!plain_var(after[i].name,after[i].attrs))
+			continue;
+		drop_array(after[i].name);
+		v = bashc_var(after[i].name);
+		bashc_setvar(v,after[i].value);
+		bashc_export(v,strchr(after[i].attrs,'x') != NULL);
+		if (!strcmp(after[i].name,"PWD") && chdir(after[i].value))
+			perror(after[i].value);
+	}
+	for (i = 0; i < nbefore; i++) {
+		if (find_dumped(after,nafter,before[i].name))
+			continue;
+		if (plain_var(before[i].name,before[i].attrs))
+			bashc_unsetvar(bashc_var(before[i].name));
+		else if (array_var(before[i].name,before[i].attrs))
+			drop_array(before[i].name);
+	}
+
+	free(before);
+	free(after);
+
+	return 1;
+}
+
+/* Read all of file descriptor `fd' */
+static char* read_all(int fd, size_t* lenp)
+{
+	struct sbuf b = { NULL, 0, 0, };
+	char buf[8192];
+	ssize_t n;
+
+	sb_add(&b,"",0);
+	while ((n = read(fd,buf,sizeof(buf))) > 0)
+		sb_add(&b,buf,n);
+
+	*lenp = b.len;
+	return b.s;
+}
+
+/*
+ * Run command `text' in bash, with $? as `status', in I/O context
+ * `ioc'.  Returns as forkexec_argv() does.
+ */
+pid_t bashc_interpret(const char* text, int status, const struct rtioctx* ioc, int flags)
+{
+	/* not getenv(): environ is rebuilt (and the old one freed) on exec */
+	const char* sh = bashc_getvar("BASHC_SH");
+	const char* tmpdir = bashc_getvar("TMPDIR");
+	char** argv;
+	char* dumppath = NULL;
+	char* dump;
+	struct sbuf b = { NULL, 0, 0, };
+	char num[16];
+	size_t len;
+	pid_t ret;
+	int fd = -1;
+	int i,n;
+
+	if (!sh || !*sh)
+		sh = BASHC_DEFAULT_SH;
+
+	/* a command in the background is a subshell: nothing comes back */
+	if (!(flags & FE_BACKGROUND)) {
+		if (asprintf(&dumppath,"%s/bashc-interp.XXXXXX",
+		             tmpdir && *tmpdir ? tmpdir : "/tmp") == -1) {
+			perror("asprintf");
+			exit(1);
+		}
+		if ((fd = mkostemp(dumppath,O_CLOEXEC)) == -1) {
+			perror(dumppath);
+			free(dumppath);
+			dumppath = NULL;
+		}
+	}
+
+	declare_arrays(&b);
+	bashc_vars_each(assign_var,&b);
+	if (bashc_pipefail)
+		sb_puts(&b,"set -o pipefail\n");
+	bashc_funcs_each(define_func,&b);
+	if (dumppath) {
+		define_dump(&b);
+		sb_puts(&b,"__bashc_dump >");
+		sb_quote(&b,dumppath);
+		sb_add(&b,"\n",1);
+	}
+	snprintf(num,sizeof(num),"%d",status);
+	sb_puts(&b,"__bashc_status() { return $1; }\n__bashc_status ");
+	sb_puts(&b,num);
+	sb_add(&b,"\n",1);
+	sb_puts(&b,text);
+	sb_add(&b,"\n",1);
+	if (dumppath) {
+		sb_puts(&b,"__bashc_st=$?\n{ printf '\\0'; __bashc_dump; printf '\\0'; "
+		        "[ $# = 0 ] || printf '%s\\0' \"$@\"; } >>");
+		sb_quote(&b,dumppath);
+		sb_puts(&b,"\nexit $__bashc_st\n");
+	}
+
+	n = bashc_posparams.n;
+	if (!(argv = malloc((n + 5) * sizeof(*argv)))) {
+		perror("malloc");
+		exit(1);
+	}
+	argv[0] = (char*)sh;
+	argv[1] = "-c";
+	argv[2] = b.s;
+	argv[3] = (char*)(bashc_posparams.zero ? bashc_posparams.zero : sh);
+	for (i = 0; i < n; i++)
+		argv[i + 4] = bashc_posparams.v[i];
+	argv[n + 4] = NULL;
+
+	ret = forkexec_argv(argv,ioc,flags);
+
+	if (dumppath) {
+		dump = read_all(fd,&len);
+		close(fd);
+		unlink(dumppath);
+		if (!read_back(dump,len)) {
+			/* it exited */
+			if (getpid() == bashc_shell_pid) {
+				bashc_flush();
+				bashc_loadable_exit(ret);
+				exit(ret);
+			}
+			bashc_exit(ret);
+		}
+		free(dump);
+		free(dumppath);
+	}
+
+	free(argv);
+	free(b.s);
+
+	return ret;
+}
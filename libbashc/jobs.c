@@ -0,0 +1,548 @@
+/*
+ * Background jobs.
+ *
+ * Every background command's pid goes into a table, hashed by pid, so
+ * that `wait' can find it and its status can be kept once it's been
+ * reaped.  Finished jobs are also kept on a list in the order they were
+ * reaped, for `wait -n', and forgotten once reported (or, past
+ * JOBS_KEEP of them, oldest first).
+ *
+ * Children are reaped with waitpid(-1,...,WNOHANG), one call per
+ * child, when SIGCHLD has said there's something to reap: whenever
+ * another job's started, and by `wait'.  That can reap a foreground
+ * child (a pipeline stage, say) before it's waited for, so its status
+ * is kept in the same table until bashc_waitpid() asks for it.
+ *
+ * If $BASHC_MAXJOBS is set in the environment, starting a job while
+ * that many are still running first waits for one of them to finish.
+ *
+ * A script run as a loadable builtin shares its process with bash,
+ * whose own children mustn't be reaped out from under it, so there
+ * (see bashc_jobs_reset()) each of the script's live jobs is checked
+ * in turn instead.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "libbashc.h"
+
+/* How many finished jobs to remember statuses of */
+#define JOBS_KEEP 4096
+
+struct job {
+	struct job* hnext;
+	pid_t pid;
+	int isjob;		/* rather than a foreground child reaped early */
+	int done;
+	int status;		/* as from waitpid(), once it's done */
+	/* on the list of live jobs or of finished ones */
+	struct job* prev;
+	struct job* next;
+};
+
+struct joblist {
+	struct job* head;
+	struct job* tail;
+	int n;
+};
+
+static struct job** table = NULL;
+static size_t table_size = 0;	/* a power of two */
+static size_t table_count = 0;
+
+static struct joblist live = { NULL, NULL, 0, };
+static struct joblist done = { NULL, NULL, 0, };
+
+/* Jobs not yet reaped */
+int bashc_jobs_live = 0;
+
+/* Reap only our own jobs, not any child; see bashc_jobs_reset() */
+static int own_only = 0;
+
+/* $BASHC_MAXJOBS, or 0 for no limit; -1 until it's been looked at */
+static int max_jobs = -1;
+
+static volatile sig_atomic_t child_exited = 0;
+static int handler_set = 0;
+
+static char lastbg[32];
+static int have_lastbg = 0;
+
+static size_t hash_pid(pid_t pid)
+{
+	return ((size_t)pid * 2654435761u) & (table_size - 1);
+}
+
+static struct job* find_job(pid_t pid)
+{
+	struct job* j;
+
+	if (!table)
+		return NULL;
+
+	for (j = table[hash_pid(pid)]; j; j = j->hnext) {
+		if (j->pid == pid)
+			return j;
+	}
+
+	return NULL;
+}
+
+static void grow_table(void)
+{
+	struct job** old = table;
+	size_t oldsize = table_size;
+	struct job* j;
+	struct job* next;
+	size_t i,h;
+
+	table_size = table_size ? table_size * 2 : 64;
+	if (!(table = calloc(table_size,sizeof(*table)))) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (i = 0; i < oldsize; i++) {
+		for (j = old[i]; j; j = next) {
+			next = j->hnext;
+			h = hash_pid(j->pid);
+			j->hnext = table[h];
+			table[h] = j;
+		}
+	}
+	free(old);
+}
+
+static void append_job(struct joblist* l, struct job* j)
+{
+	j->next = NULL;
+	j->prev = l->tail;
+	if (l->tail)
+		l->tail->next = j;
+	else
+		l->head = j;
+	l->tail = j;
+	l->n++;
+}
+
+static void unlink_job(struct joblist* l, struct job* j)
+{
+	if (j->prev)
+		j->prev->next = j->next;
+	else
+		l->head = j->next;
+	if (j->next)
+		j->next->prev = j->prev;
+	else
+		l->tail = j->prev;
+	l->n--;
+}
+
+static struct job* add_job(pid_t pid, int isjob)
+{
+	struct job* j;
+	size_t h;
+
+	if (table_count >= table_size)
+		grow_table();
+
+	if (!(j = malloc(sizeof(*j)))) {
+		perror("malloc");
+		exit(1);
+	}
+	j->pid = pid;
+	j->isjob = isjob;
+	j->done = 0;
+	j->status = 0;
+	j->prev = j->next = NULL;
+	if (isjob)
+		append_job(&live,j);
+
+	h = hash_pid(pid);
+	j->hnext = table[h];
+	table[h] = j;
+	table_count++;
+
+	return j;
+}
+
+static void remove_job(struct job* j)
+{
+	struct job** p;
+
+	for (p = &table[hash_pid(j->pid)]; *p != j; p = &(*p)->hnext)
+		;
+	*p = j->hnext;
+	table_count--;
+
+	if (j->isjob) {
+		if (j->done)
+			unlink_job(&done,j);
+		else {
+			unlink_job(&live,j);
+			bashc_jobs_live--;
+		}
+	}
+	free(j);
+}
+
+/* Note that child `pid' has finished with `status' */
+static void child_done(pid_t pid, int status)
+{
+	struct job* j;
+
+	if (!(j = find_job(pid)))
+		j = add_job(pid,0);
+	j->done = 1;
+	j->status = status;
+
+	if (!j->isjob)
+		return;
+
+	bashc_jobs_live--;
+	unlink_job(&live,j);
+	append_job(&done,j);
+	if (done.n > JOBS_KEEP)
+		remove_job(done.head);
+}
+
+static void sigchld_handler(int sig)
+{
+	(void)sig;
+	child_exited = 1;
+}
+
+/* Reap whichever of our own jobs have finished; returns how many */
+static int poll_own(void)
+{
+	struct job* j;
+	struct job* next;
+	int status,n = 0;
+
+	for (j = live.head; j; j = next) {
+		next = j->next;
+		if (waitpid(j->pid,&status,WNOHANG) > 0) {
+			child_done(j->pid,status);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/* Reap whatever children have finished, without waiting */
+void bashc_jobs_poll(void)
+{
+	pid_t pid;
+	int status;
+
+	if (!child_exited)
+		return;
+	child_exited = 0;
+
+	if (own_only)
+		poll_own();
+	else {
+		while ((pid = waitpid(-1,&status,WNOHANG)) > 0)
+			child_done(pid,status);
+	}
+}
+
+/*
+ * wait_any() for own_only: wait for SIGCHLD (blocked meanwhile, so
+ * that it can't slip in between checking and waiting) until one of
+ * our jobs has finished.
+ */
+static pid_t wait_own(void)
+{
+	sigset_t chld,old;
+	pid_t pid = 0;
+
+	sigemptyset(&chld);
+	sigaddset(&chld,SIGCHLD);
+	sigprocmask(SIG_BLOCK,&chld,&old);
+
+	while (live.head) {
+		child_exited = 0;
+		if (poll_own()) {
+			pid = done.tail->pid;
+			break;
+		}
+		sigsuspend(&old);
+	}
+
+	sigprocmask(SIG_SETMASK,&old,NULL);
+
+	return pid ? pid : -1;
+}
+
+/*
+ * Wait for any child to finish, noting it; returns its pid, or -1 if
+ * there are none.
+ */
+static pid_t wait_any(void)
+{
+	uint64_t start = bashc_prof_clock();
+	pid_t pid;
+	int status;
+
+	if (own_only) {
+		pid = wait_own();
+		bashc_prof_forkwait(start);
+		return pid;
+	}
+
+	while ((pid = waitpid(-1,&status,0)) == -1) {
+		if (errno != EINTR) {
+			bashc_prof_forkwait(start);
+			return -1;
+		}
+	}
+	bashc_prof_forkwait(start);
+	child_done(pid,status);
+
+	return pid;
+}
+
+static int choose_max_jobs(void)
+{
+	const char* s = getenv("BASHC_MAXJOBS");
+	char* end;
+	long n;
+
+	if (!s || !*s)
+		return 0;
+	n = strtol(s,&end,10);
+	if (*end || n <= 0 || n > INT_MAX)
+		return 0;
+
+	return n;
+}
+
+/*
+ * Wait, if need be, until there's room under $BASHC_MAXJOBS for
+ * another job to start.
+ */
+void bashc_job_slot(void)
+{
+	if (max_jobs < 0)
+		max_jobs = choose_max_jobs();
+	if (!max_jobs)
+		return;
+
+	bashc_jobs_poll();
+	while (bashc_jobs_live >= max_jobs && wait_any() != -1)
+		;
+}
+
+/*
+ * Note background job `pid' (as returned by forkexec_argv() and
+ * friends, so -1 if it couldn't be started), making it $!.
+ */
+void bashc_job_add(pid_t pid)
+{
+	struct sigaction sa;
+
+	if (pid == -1)
+		return;
+
+	if (!handler_set) {
+		memset(&sa,0,sizeof(sa));
+		sa.sa_handler = sigchld_handler;
+		sa.sa_flags = SA_RESTART|SA_NOCLDSTOP;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGCHLD,&sa,NULL);
+		handler_set = 1;
+		/* any that finished before now went unnoticed */
+		child_exited = 1;
+	}
+
+	/* added before polling, in case it's already finished */
+	add_job(pid,1);
+	bashc_jobs_live++;
+	bashc_jobs_poll();
+
+	snprintf(lastbg,sizeof(lastbg),"%ld",(long)pid);
+	have_lastbg = 1;
+}
+
+/* $!, or NULL if no job's been started */
+const char* bashc_lastbg(void)
+{
+	return have_lastbg ? lastbg : NULL;
+}
+
+/*
+ * Forget every job, in a forked child (which, like a subshell, has
+ * none of its own, though $! carries over).  The table's left to leak,
+ * rather than taking time in every fork to free it.
+ */
+void bashc_jobs_forget(void)
+{
+	table = NULL;
+	table_size = table_count = 0;
+	live.head = live.tail = NULL;
+	live.n = 0;
+	done.head = done.tail = NULL;
+	done.n = 0;
+	bashc_jobs_live = 0;
+
+	if (handler_set) {
+		signal(SIGCHLD,SIG_DFL);
+		handler_set = 0;
+	}
+}
+
+/*
+ * Start afresh, freeing every job and forgetting $!, to run a script
+ * again in the same process (see loadable.c); if `own', only ever
+ * reap its own jobs.  The SIGCHLD handler's left for the caller to
+ * restore.
+ */
+void bashc_jobs_reset(int own)
+{
+	size_t i;
+	struct job* j;
+	struct job* next;
+
+	for (i = 0; i < table_size; i++) {
+		for (j = table[i]; j; j = next) {
+			next = j->hnext;
+			free(j);
+		}
+	}
+	free(table);
+	table = NULL;
+	table_size = table_count = 0;
+	live.head = live.tail = NULL;
+	live.n = 0;
+	done.head = done.tail = NULL;
+	done.n = 0;
+	bashc_jobs_live = 0;
+
+	handler_set = 0;
+	child_exited = 0;
+	have_lastbg = 0;
+	max_jobs = -1;
+	own_only = own;
+}
+
+/*
+ * waitpid() for child `pid', which may already have been reaped;
+ * returns 0, or -1 (with errno set) on failure.
+ */
+int bashc_waitpid(pid_t pid, int* status)
+{
+	struct job* j = find_job(pid);
+	uint64_t start;
+
+	if (j && j->done) {
+		*status = j->status;
+		remove_job(j);
+		return 0;
+	}
+
+	start = bashc_prof_clock();
+	while (waitpid(pid,status,0) == -1) {
+		if (errno != EINTR) {
+			bashc_prof_forkwait(start);
+			return -1;
+		}
+	}
+	bashc_prof_forkwait(start);
+
+	if (j)
+		remove_job(j);
+
+	return 0;
+}
+
+static int wait_error(struct bashc_out* err, const char* fmt, const char* arg)
+{
+	bashc_builtin_error(err,"wait",fmt,arg);
+	return 127;
+}
+
+/* wait -n: the status of the next job to finish */
+static int wait_next(void)
+{
+	struct job* j;
+	int status;
+
+	while (!done.head) {
+		if (!bashc_jobs_live || wait_any() == -1)
+			return 127;
+	}
+
+	j = done.head;
+	status = bashc_wstatus(j->status);
+	remove_job(j);
+
+	return status;
+}
+
+int bashc_wait(char* const argv[], struct bashc_out* out, struct bashc_out* err)
+{
+	struct job* j;
+	char* end;
+	long pid;
+	int i,status = 0;
+	int next = 0;
+
+	(void)out;
+
+	bashc_jobs_poll();
+
+	for (i = 1; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+		if (!strcmp(argv[i],"--")) {
+			i++;
+			break;
+		} else if (!strcmp(argv[i],"-n"))
+			next = 1;
+		else {
+			bashc_builtin_error(err,"wait","%s: invalid option",argv[i]);
+			bashc_builtin_error(err,"wait","usage: wait [-n] [id ...]");
+			return 2;
+		}
+	}
+
+	if (next)
+		return wait_next();
+
+	if (!argv[i]) {
+		/* everything, then forget them all */
+		while (bashc_jobs_live && wait_any() != -1)
+			;
+		while (done.head)
+			remove_job(done.head);
+		return 0;
+	}
+
+	for (; argv[i]; i++) {
+		if (argv[i][0] == '%') {
+			status = wait_error(err,"%s: no such job",argv[i]);
+			continue;
+		}
+
+		errno = 0;
+		pid = strtol(argv[i],&end,10);
+		if (!argv[i][0] || *end || errno) {
+			bashc_builtin_error(err,"wait","`%s': not a pid or valid job spec",argv[i]);
+			status = 1;
+		} else if (!(j = find_job((pid_t)pid)) || !j->isjob)
+			status = wait_error(err,"pid %s is not a child of this shell",argv[i]);
+		else if (bashc_waitpid((pid_t)pid,&status))
+			status = wait_error(err,"%s",strerror(errno));
+		else
+			status = bashc_wstatus(status);
+	}
+
+	return status;
+}
@@ -1,59 +1,485 @@
+#define _GNU_SOURCE 1
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
 #include "libbashc.h"
 
-void exec_argv(char* const argv[], struct rtioctx* ioc)
+int bashc_launch_backend = -1;
+
+int bashc_pipefail = 0;
+
+int* bashc_pipestatus = NULL;
+int bashc_npipestatus = 0;
+static int pipestatus_size = 0;
+
+jmp_buf bashc_toplevel;
+int bashc_toplevel_active = 0;
+
+jmp_buf* bashc_exit_jmp = NULL;
+int bashc_exit_status;
+
+/* Exit status for a command that couldn't be executed, as in bash */
+static int exec_failure_status(int err)
+{
+	return err == ENOENT ? 127 : 126;
+}
+
+static void report_exec_failure(const char* cmd, int err)
+{
+	fprintf(stderr,"%s: %s\n",cmd,strerror(err));
+}
+
+/* Set up a child's file descriptors according to `ioc' */
+static void apply_ioc(const struct rtioctx* ioc)
 {
 	int i;
 
-	if (ioc) {
-		for (i = 0; i < ioc->numfds; i++) {
-			if (ioc->fds[i][1] != -1) {
-				if (dup2(ioc->fds[i][0],ioc->fds[i][1]) == -1) {
-					perror("dup2");
-					exit(1);
-				} else if (close(ioc->fds[i][0])) {
-					perror("close");
-					exit(1);
-				}
-			} else {
-				if (close(ioc->fds[i][0])) {
-					perror("close");
-					exit(1);
-				}
+	if (!ioc)
+		return;
+
+	for (i = 0; i < ioc->numfds; i++) {
+		if (ioc->fds[i][1] != -1) {
+			if (dup2(ioc->fds[i][0],ioc->fds[i][1]) == -1) {
+				perror("dup2");
+				exit(1);
+			} else if (close(ioc->fds[i][0])) {
+				perror("close");
+				exit(1);
+			}
+		} else {
+			if (close(ioc->fds[i][0])) {
+				perror("close");
+				exit(1);
 			}
 		}
 	}
 
-	execvp(argv[0],argv);
-	perror("execvp");
-	exit(1);
+	if (bashc_apply_redirs(ioc->redirs,ioc->numredirs))
+		exit(1);
+}
+
+/* Set up a forked child that won't exec */
+static void child_setup(const struct rtioctx* ioc)
+{
+	apply_ioc(ioc);
+	bashc_jobs_forget();
+	bashc_prof_forget();
+
+	/* stdout may not be what the parent found it to be */
+	bout_init(&bashc_stdout,1);
+}
+
+void exec_argv(char* const argv[], const struct rtioctx* ioc)
+{
+	const char* path;
+
+	/* a compiled child may exec in place of exiting (see bashc_exit()) */
+	bashc_flush();
+	apply_ioc(ioc);
+	bashc_sync_environ();
+
+	/* a stale cached path falls back to a fresh $PATH search */
+	if ((path = bashc_path_lookup(argv[0]))) {
+		execv(path,argv);
+		if (errno == ENOENT)
+			execvp(argv[0],argv);
+	} else
+		execvp(argv[0],argv);
+	report_exec_failure(argv[0],errno);
+	exit(exec_failure_status(errno));
+}
+
+static int choose_launch_backend(void)
+{
+	const char* s = getenv("BASHC_LAUNCH");
+
+	if (s && !strcmp(s,"fork"))
+		return BASHC_LAUNCH_FORK;
+	else
+		return BASHC_LAUNCH_SPAWN;
+}
+
+/* Exit status as the shell reports it, from a waitpid() status */
+int bashc_wstatus(int status)
+{
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	else
+		return WEXITSTATUS(status);
+}
+
+static void size_pipestatus(int n)
+{
+	int* p;
+
+	if (n > pipestatus_size) {
+		if (!(p = realloc(bashc_pipestatus,n*sizeof(*p)))) {
+			perror("realloc");
+			exit(1);
+		}
+		bashc_pipestatus = p;
+		pipestatus_size = n;
+	}
+	bashc_npipestatus = n;
+}
+
+static int reap(pid_t pid)
+{
+	int status;
+
+	if (bashc_waitpid(pid,&status)) {
+		perror("waitpid");
+		return 1;
+	}
+
+	return bashc_wstatus(status);
+}
+
+/* Wait for a foreground child and return its exit status */
+static int wait_for(pid_t pid)
+{
+	size_pipestatus(1);
+	return bashc_pipestatus[0] = reap(pid);
+}
+
+/*
+ * Wait for a foreground child started with bashc_fork() (a subshell,
+ * say), returning its exit status; a pid of -1 is one that never
+ * started.
+ */
+int bashc_wait_child(pid_t pid)
+{
+	if (pid == -1) {
+		size_pipestatus(1);
+		return bashc_pipestatus[0] = 1;
+	}
+
+	return wait_for(pid);
+}
+
+/*
+ * Wait for all the stages of a pipeline, recording their statuses in
+ * bashc_pipestatus.  A pid of -1 is a stage that never started.
+ * Returns the status of the last stage, or with pipefail set that of
+ * the last one to fail.
+ */
+int bashc_wait_pipeline(const pid_t pids[], int n)
+{
+	int i,status;
+	int ret = 0;
+
+	size_pipestatus(n);
+
+	for (i = 0; i < n; i++) {
+		status = pids[i] == -1 ? 1 : reap(pids[i]);
+		bashc_pipestatus[i] = status;
+		if (status || !bashc_pipefail)
+			ret = status;
+	}
+
+	return ret;
+}
+
+/* Create a pipe for a pipeline; returns 0 on success */
+int bashc_pipe(int fds[2])
+{
+	if (pipe2(fds,O_CLOEXEC)) {
+		perror("pipe");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * A child that just exits with `status', for a background command
+ * that couldn't be started, so that it has a pid to be waited for
+ * like any other.
+ */
+static pid_t failed_child(int status)
+{
+	pid_t pid;
+
+	if (!(pid = fork()))
+		_exit(status);
+	else if (pid == -1)
+		perror("fork");
+
+	return pid;
 }
 
 /*
  * Returns -1 on error, exit status of a non-background command, or
  * the pid of the newly-forked background command.
  */
-pid_t forkexec_argv(char* const argv[], struct rtioctx* ioc, int flags)
+pid_t forkexec_argv(char* const argv[], const struct rtioctx* ioc, int flags)
 {
+	const char* path;
+	uint64_t start;
 	pid_t pid;
-	int status;
-	
-	if (!(pid = fork())) {
-		/* child */
-		exec_argv(argv,ioc);
-	} else if (pid == -1) {
+
+	if (flags & FE_JOB)
+		bashc_job_slot();
+	bashc_flush();
+
+	if (bashc_launch_backend < 0)
+		bashc_launch_backend = choose_launch_backend();
+
+	start = bashc_prof_clock();
+	pid = -1;
+	if (bashc_launch_backend == BASHC_LAUNCH_SPAWN)
+		pid = spawn_argv(argv,ioc);
+	if (pid == -1) {
+		/*
+		 * posix_spawn() reports exec failures to the parent, whose
+		 * stderr mightn't be the command's; so a failed spawn is
+		 * tried again with fork(), leaving the child to report
+		 * it (or a redirection's failure) where the command would.
+		 * The path's resolved here so that children share the result;
+		 * a child can't tell the parent that a cached path's gone,
+		 * so that's checked for here too, at the cost of an access().
+		 */
+		if ((path = bashc_path_lookup(argv[0])) && access(path,F_OK)) {
+			bashc_path_forget(argv[0]);
+			bashc_path_lookup(argv[0]);
+		}
+
+		if (!(pid = fork())) {
+			/* child */
+			exec_argv(argv,ioc);
+		}
+	}
+	bashc_prof_forkwait(start);
+	if (pid == -1) {
 		/* fork failed */
 		perror("fork");
 		return -1;
-	} else if (!(flags & FE_BACKGROUND)) {
+	}
+
+	if (!(flags & FE_BACKGROUND)) {
 		/* parent */
-		waitpid(pid,&status,0);
-		return WEXITSTATUS(status);
+		return wait_for(pid);
 	} else
 		return pid;
 }
+
+/*
+ * Run a builtin in this process, with its standard output and error
+ * wherever `ioc's redirections would put them.
+ */
+static int run_builtin_here(bashc_builtin* fn, char* const argv[],
+                            const struct rtioctx* ioc)
+{
+	struct bashc_vfdmap m;
+	struct bashc_out out,err;
+	struct bashc_out* outp = &bashc_stdout;
+	struct bashc_out* errp = &bashc_stderr;
+	int fd,status;
+
+	if (bashc_vfd_resolve(&m,ioc->redirs,ioc->numredirs)) {
+		bashc_vfd_release(&m);
+		return 1;
+	}
+
+	if ((fd = bashc_vfd(&m,1)) != 1) {
+		/* keep anything already written in order */
+		bout_flush(&bashc_stdout);
+		bout_init(&out,fd);
+		outp = &out;
+	}
+	if ((fd = bashc_vfd(&m,2)) != 2) {
+		bout_init(&err,fd);
+		err.flags = BOUT_UNBUFFERED;
+		errp = &err;
+	}
+
+	status = fn(argv,outp,errp);
+
+	if (outp != &bashc_stdout && bout_flush(outp) && !status) {
+		bashc_builtin_error(errp,argv[0],"write error: %s",strerror(outp->error));
+		status = 1;
+	}
+	bashc_vfd_release(&m);
+
+	return status;
+}
+
+/*
+ * Run a builtin.  In the foreground, and outside a pipeline, it runs
+ * in this process; otherwise it runs in a forked child, as bash does.
+ * Returns as forkexec_argv() does.
+ */
+pid_t run_builtin(bashc_builtin* fn, char* const argv[],
+                  const struct rtioctx* ioc, int flags)
+{
+	uint64_t start;
+	pid_t pid;
+	int status;
+
+	if (!(flags & FE_BACKGROUND)
+	    && (!ioc || (!ioc->numfds && ioc->numredirs <= BASHC_VFD_MAX/2))) {
+		size_pipestatus(1);
+		if (ioc)
+			status = run_builtin_here(fn,argv,ioc);
+		else
+			status = fn(argv,&bashc_stdout,&bashc_stderr);
+		return bashc_pipestatus[0] = status;
+	}
+
+	if (flags & FE_JOB)
+		bashc_job_slot();
+	bashc_flush();
+
+	start = bashc_prof_clock();
+	if (!(pid = fork())) {
+		/* child */
+		child_setup(ioc);
+		status = fn(argv,&bashc_stdout,&bashc_stderr);
+		bashc_flush();
+		_exit(status);
+	}
+	bashc_prof_forkwait(start);
+	if (pid == -1) {
+		perror("fork");
+		return -1;
+	}
+
+	if (!(flags & FE_BACKGROUND))
+		return wait_for(pid);
+	else
+		return pid;
+}
+
+/*
+ * Call shell function `f'.  In the foreground, and outside a pipeline,
+ * it runs in this process with `ioc's redirections applied around it;
+ * otherwise in a forked child.  Returns as forkexec_argv() does.
+ */
+pid_t bashc_call_func(struct bashc_func* f, char* const argv[],
+                      const struct rtioctx* ioc, int flags)
+{
+	pid_t pid;
+	int status;
+
+	if (!(flags & FE_BACKGROUND) && (!ioc || !ioc->numfds)) {
+		if (!ioc || !ioc->numredirs)
+			status = f->fn(argv);
+		else if (!bashc_redir_push(ioc->redirs,ioc->numredirs)) {
+			status = f->fn(argv);
+			bashc_redir_pop();
+		} else
+			status = 1;
+		size_pipestatus(1);
+		return bashc_pipestatus[0] = status;
+	}
+
+	if (flags & FE_JOB)
+		bashc_job_slot();
+	if (!(pid = bashc_fork(ioc)))
+		bashc_exit(f->fn(argv));
+	else if (pid == -1)
+		return -1;
+
+	if (!(flags & FE_BACKGROUND))
+		return wait_for(pid);
+	else
+		return pid;
+}
+
+/*
+ * Run a command whose name isn't known until run time: a shell
+ * function or builtin if there's one by that name, otherwise an
+ * external command.  An empty
+ * command (every word expanded to nothing) just performs its
+ * redirections.  Returns as forkexec_argv() does.
+ */
+pid_t bashc_run_command(char* const argv[], const struct rtioctx* ioc, int flags)
+{
+	struct bashc_func* f;
+	bashc_builtin* fn;
+	int status;
+
+	if (!argv[0]) {
+		status = ioc ? bashc_check_redirs(ioc->redirs,ioc->numredirs) : 0;
+		if (flags & FE_BACKGROUND)
+			return failed_child(status);
+		size_pipestatus(1);
+		return bashc_pipestatus[0] = status;
+	} else if ((f = bashc_find_func(argv[0])))
+		return bashc_call_func(f,argv,ioc,flags);
+	else if ((fn = bashc_find_builtin(argv[0])))
+		return run_builtin(fn,argv,ioc,flags);
+	else
+		return forkexec_argv(argv,ioc,flags);
+}
+
+/*
+ * Fork a child to run compiled code (a compound command in a
+ * pipeline, say) with I/O set up according to `ioc'.  Returns as
+ * fork() does; the child should finish with bashc_exit().
+ */
+pid_t bashc_fork(const struct rtioctx* ioc)
+{
+	uint64_t start;
+	pid_t pid;
+
+	bashc_flush();
+
+	start = bashc_prof_clock();
+	if (!(pid = fork())) {
+		/* like a subshell, a child gives up entirely on errors */
+		bashc_toplevel_active = 0;
+		child_setup(ioc);
+		return 0;
+	}
+	bashc_prof_forkwait(start);
+	if (pid == -1)
+		perror("fork");
+
+	return pid;
+}
+
+/*
+ * Run as a loadable builtin, the script's in the shell's own process,
+ * which mustn't exit with it: return `status' from the builtin instead.
+ * Otherwise (or in a child), just return.
+ */
+void bashc_loadable_exit(int status)
+{
+	if (bashc_exit_jmp && getpid() == bashc_shell_pid) {
+		bashc_exit_status = status;
+		longjmp(*bashc_exit_jmp,1);
+	}
+}
+
+void bashc_exit(int status)
+{
+	bashc_flush();
+	bashc_loadable_exit(status);
+	_exit(status);
+}
+
+/*
+ * Abandon the current command after an expansion error.  As in bash,
+ * the script goes on with its next top-level command, out of any
+ * function calls in progress; a forked child just exits.
+ */
+void bashc_abandon(void)
+{
+	bashc_capture_abandon();
+
+	if (!bashc_toplevel_active)
+		bashc_exit(1);
+
+	bashc_toplevel_active = 0;
+	bashc_leave_to(NULL);
+	bashc_redir_unwind_all();
+	bashc_prof_unwind();
+	longjmp(bashc_toplevel,1);
+}
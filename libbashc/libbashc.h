@@ -5,6 +5,9 @@
 #ifndef LIBBASHC_H
 #define LIBBASHC_H
 
+#include <stdint.h>
+#include <setjmp.h>
+#include <regex.h>
 #include <sys/types.h>
 
 /* Magic number for "close this fd" */
@@ -12,14 +15,433 @@
 
 /* Constants for oring together for forkexec_argv flags */
 #define FE_BACKGROUND 1
+#define FE_JOB 2		/* with FE_BACKGROUND: a job, limited by $BASHC_MAXJOBS */
 
-/* run-time I/O context */
+/* Process-launch backends for forkexec_argv() */
+#define BASHC_LAUNCH_FORK 0
+#define BASHC_LAUNCH_SPAWN 1
+
+/*
+ * A redirection plan is an array of these, carried out in order; see
+ * redir.c.
+ */
+#define RTREDIR_OPEN 0	/* open `path' with `oflags' as `fd' */
+#define RTREDIR_DUP 1	/* make `fd' a copy of `src' */
+#define RTREDIR_MOVE 2	/* ...and then close `src' */
+#define RTREDIR_CLOSE 3	/* close `fd' */
+
+/* Creation mode for files opened by redirections */
+#define REDIR_MODE 0666
+
+struct rtredir {
+	int op;
+	int fd;
+	int src;
+	int oflags;
+	const char* path;
+};
+
+/*
+ * run-time I/O context: pipe ends, then a redirection plan.  Generated
+ * code keeps these on the stack, or in static storage when nothing in
+ * them is only known at run time.
+ */
 struct rtioctx {
+	int numredirs;
+	const struct rtredir* redirs;
 	int numfds;
-	int fds[][2];
+	const int (*fds)[2];
+};
+
+/*
+ * Which backend forkexec_argv() uses.  If left negative it's chosen
+ * on first use from $BASHC_LAUNCH ("fork" or "spawn", defaulting to
+ * the latter).
+ */
+extern int bashc_launch_backend;
+
+/* set -o pipefail */
+extern int bashc_pipefail;
+
+/*
+ * Exit statuses of the stages of the last foreground pipeline (a
+ * simple command counting as a pipeline of one), as in $PIPESTATUS.
+ */
+extern int* bashc_pipestatus;
+extern int bashc_npipestatus;
+
+/* Buffered output for builtins; see output.c */
+#define BOUT_UNBUFFERED 1
+#define BOUT_LINEBUF 2
+#define BOUT_CHECKTTY 4	/* line-buffer if it turns out to be a tty */
+
+struct bashc_capture;
+
+struct bashc_out {
+	int fd;
+	int flags;
+	size_t len;
+	int error;	/* errno from the last failed write, if any */
+	struct bashc_capture* capture;	/* if set, output goes here instead */
+	char buf[4096];
 };
 
-void exec_argv(char* const argv[], struct rtioctx* ioc) __attribute__((noreturn));
-pid_t forkexec_argv(char* const argv[], struct rtioctx* ioc, int flags);
+extern struct bashc_out bashc_stdout;
+extern struct bashc_out bashc_stderr;
+
+void bout_init(struct bashc_out* out, int fd);
+int bout_flush(struct bashc_out* out);
+void bout_write(struct bashc_out* out, const char* buf, size_t len);
+void bout_puts(struct bashc_out* out, const char* s);
+void bout_putc(struct bashc_out* out, char c);
+void bout_printf(struct bashc_out* out, const char* fmt, ...)
+	__attribute__((format(printf,2,3)));
+void bashc_builtin_error(struct bashc_out* err, const char* name,
+                         const char* fmt, ...)
+	__attribute__((format(printf,3,4)));
+void bashc_flush(void);
+
+/* Builtins run natively, without a fork */
+typedef int bashc_builtin(char* const argv[], struct bashc_out* out,
+                          struct bashc_out* err);
+
+bashc_builtin bashc_echo;
+bashc_builtin bashc_test;
+bashc_builtin bashc_kill;
+bashc_builtin bashc_cd;
+bashc_builtin bashc_pwd;
+bashc_builtin bashc_wait;
+bashc_builtin bashc_true;
+bashc_builtin bashc_false;
+
+bashc_builtin* bashc_find_builtin(const char* name);
+
+struct stat;
+int bashc_test_unary(char op, const char* arg, const struct stat* st, int statok);
+int bashc_test_binary(const char* a, const char* op, const char* b, int* err);
+const char* bashc_signal_name(int sig);
+int bashc_signal_number(const char* spec);
+
+/* redirections */
+#define BASHC_VFD_MAX 16
+
+/* Where a redirection plan would leave descriptors, for builtins */
+struct bashc_vfdmap {
+	int n;
+	int fd[BASHC_VFD_MAX];
+	int real[BASHC_VFD_MAX];
+	int nopened;
+	int opened[BASHC_VFD_MAX/2];
+};
+
+int bashc_apply_redirs(const struct rtredir* redirs, int n);
+int bashc_vfd_resolve(struct bashc_vfdmap* m, const struct rtredir* redirs, int n);
+int bashc_vfd(const struct bashc_vfdmap* m, int fd);
+void bashc_vfd_release(struct bashc_vfdmap* m);
+int bashc_check_redirs(const struct rtredir* redirs, int n);
+int bashc_redir_push(const struct rtredir* redirs, int n);
+void bashc_redir_pop(void);
+void bashc_redir_unwind(int n);
+void bashc_redir_unwind_all(void);
+int bashc_redir_depth(void);
+
+/* shell variables; see vars.c */
+#define VAR_EXPORTED 1
+#define VAR_NUMCACHED 2	/* `num' is the value's arithmetic value */
+#define VAR_STALE 4	/* see bashc_vars_reset() */
+
+struct bashc_var {
+	struct bashc_var* next;
+	unsigned int flags;
+	unsigned int version;	/* bumped whenever the value changes */
+	char* value;		/* NULL if unset */
+	size_t size;
+	intmax_t num;
+	char name[];
+};
+
+/* A variable's previous state, while a temporary assignment is in effect */
+struct bashc_varsave {
+	struct bashc_var* var;
+	char* value;
+	size_t size;
+	unsigned int flags;
+};
+
+struct bashc_posparams {
+	const char* zero;
+	int n;
+	char** v;
+};
+
+extern struct bashc_posparams bashc_posparams;
+
+/* $$ */
+extern pid_t bashc_shell_pid;
+
+void bashc_init(int argc, char** argv);
+void bashc_vars_reset(char** env);
+int bashc_legal_name(const char* s, size_t len);
+struct bashc_var* bashc_var(const char* name);
+const char* bashc_getvar(const char* name);
+void bashc_setvar(struct bashc_var* v, const char* value);
+void bashc_unsetvar(struct bashc_var* v);
+void bashc_export(struct bashc_var* v, int on);
+void bashc_var_settemp(struct bashc_varsave* s, struct bashc_var* v,
+                       const char* value);
+void bashc_var_restore(struct bashc_varsave* s);
+void bashc_var_save(struct bashc_varsave* s, struct bashc_var* v);
+char** bashc_envp(void);
+void bashc_sync_environ(void);
+void bashc_vars_each(void (*fn)(struct bashc_var* v, void* arg), void* arg);
+const char* bashc_posparam(int n);
+int bashc_shift(int n);
+const char* bashc_num_str(intmax_t n);
+intmax_t bashc_strlen(const char* s);
+void bashc_param_error(const char* name, const char* msg) __attribute__((noreturn));
+
+/* ${param:-word} and friends: is the value unset (or null, with `:')? */
+#define bashc_param_unset(value,colon) (!(value) || ((colon) && !*(value)))
+
+/* word expansion; see words.c */
+#define BASHC_WB_SPLIT 1	/* split unquoted expansions into fields */
+#define BASHC_WB_PATTERN 2	/* quote pattern characters in quoted expansions */
+#define BASHC_WB_REGEX 4	/* ...or regular expression ones */
+
+struct bashc_wordbuf {
+	char* buf;
+	size_t len,size;
+	size_t start;		/* of the current word */
+	int exists;		/* the current word is there even if empty */
+	int split;		/* split unquoted expansions into fields */
+	int pattern;		/* building a pattern (1) or regular expression (2) */
+	size_t* offs;		/* where each finished word starts */
+	size_t offsize;
+	int nwords;
+	char** argv;
+	size_t argvsize;
+	size_t* globs;		/* the current word's unquoted pattern text */
+	size_t globsize;	/* (start and end offsets) */
+	int nglobs;
+};
+
+void bashc_wb_start(struct bashc_wordbuf* wb, int flags);
+void bashc_wb_lit(struct bashc_wordbuf* wb, const char* s, size_t len);
+void bashc_wb_break(struct bashc_wordbuf* wb);
+void bashc_wb_expand(struct bashc_wordbuf* wb, const char* value, int quoted);
+void bashc_wb_at(struct bashc_wordbuf* wb, int quoted);
+void bashc_wb_star(struct bashc_wordbuf* wb, int quoted);
+char** bashc_wb_argv(struct bashc_wordbuf* wb);
+const char* bashc_wb_str(struct bashc_wordbuf* wb);
+void bashc_wb_free(struct bashc_wordbuf* wb);
+char** bashc_argv_dup(char* const argv[]);
+
+/* case patterns; see match.c */
+int bashc_fnmatch(const char* p, const char* s);
+int bashc_case_lookup(const char* const table[], int n, const char* s);
+int bashc_has_suffix(const char* s, const char* suffix, size_t len);
+
+/* [[ =~ ]]; see cond.c */
+struct bashc_regex {
+	const char* pattern;
+	int ready;		/* compiled, or found not to compile */
+	int status;		/* regcomp()'s */
+	char* copy;		/* the pattern, if it's one known only at run time */
+	regex_t re;
+};
+
+void bashc_regex_init(struct bashc_regex* r, int n);
+struct bashc_regex* bashc_regex_dynamic(struct bashc_regex* r, const char* pattern);
+int bashc_regex_match(struct bashc_regex* r, const char* s);
+
+/* shell functions; see funcs.c */
+typedef int bashc_function(char* const argv[]);
+
+struct bashc_func {
+	struct bashc_func* next;
+	bashc_function* fn;	/* NULL while it isn't defined */
+	const char* src;	/* its definition, for bashc_interpret() */
+	char name[];
+};
+
+/* A function call in progress */
+struct bashc_frame {
+	struct bashc_frame* next;
+	struct bashc_posparams posparams;	/* the caller's */
+	char** args;
+	struct bashc_varsave* locals;
+	int nlocals,localsize;
+};
+
+struct bashc_func* bashc_func(const char* name);
+struct bashc_func* bashc_find_func(const char* name);
+void bashc_funcs_reset(void);
+void bashc_funcs_each(void (*fn)(struct bashc_func* f, void* arg), void* arg);
+void bashc_enter(struct bashc_frame* fr, char* const argv[]);
+void bashc_leave(struct bashc_frame* fr);
+struct bashc_frame* bashc_frame_top(void);
+void bashc_leave_to(struct bashc_frame* fr);
+void bashc_local(struct bashc_var* v);
+int bashc_return_status(const char* arg);
+pid_t bashc_call_func(struct bashc_func* f, char* const argv[],
+                      const struct rtioctx* ioc, int flags);
+
+/*
+ * Command substitution; see comsub.c.  `buf' holds the output (with
+ * trailing newlines stripped) once the substitution's finished.
+ */
+struct bashc_capture {
+	char* buf;
+	size_t len,size;
+	int fd;
+	pid_t pid;
+	/* for substitutions run in this process */
+	struct bashc_capture* prev;
+	struct bashc_frame* frames;
+	int redirs;
+	jmp_buf jmp;
+};
+
+void bashc_capture_append(struct bashc_capture* c, const char* buf, size_t len);
+void bashc_capture_begin(struct bashc_capture* c);
+void bashc_capture_end(struct bashc_capture* c);
+void bashc_capture_abandon(void);
+pid_t bashc_capture_fork(struct bashc_capture* c);
+int bashc_capture_wait(struct bashc_capture* c);
+void bashc_capture_free(struct bashc_capture* c);
+
+/* background jobs; see jobs.c */
+extern int bashc_jobs_live;
+
+void bashc_job_slot(void);
+void bashc_job_add(pid_t pid);
+void bashc_jobs_poll(void);
+void bashc_jobs_forget(void);
+void bashc_jobs_reset(int own);
+const char* bashc_lastbg(void);
+int bashc_waitpid(pid_t pid, int* status);
+
+/* arithmetic; see arith.c */
+#define bashc_add(a,b) ((intmax_t)((uintmax_t)(a) + (uintmax_t)(b)))
+#define bashc_sub(a,b) ((intmax_t)((uintmax_t)(a) - (uintmax_t)(b)))
+#define bashc_mul(a,b) ((intmax_t)((uintmax_t)(a) * (uintmax_t)(b)))
+#define bashc_neg(a) ((intmax_t)-(uintmax_t)(a))
+#define bashc_shl(a,b) ((intmax_t)((uintmax_t)(a) << ((b) & 63)))
+#define bashc_shr(a,b) ((intmax_t)(a) >> ((b) & 63))
+
+intmax_t bashc_arith_div(intmax_t a, intmax_t b, const char* expr);
+intmax_t bashc_arith_mod(intmax_t a, intmax_t b, const char* expr);
+intmax_t bashc_arith_pow(intmax_t a, intmax_t b, const char* expr);
+int bashc_arith_number(const char* s, size_t len, intmax_t* value, const char* expr);
+intmax_t bashc_arith_eval(const char* s);
+intmax_t bashc_arith_get(struct bashc_var* v);
+intmax_t bashc_arith_set(struct bashc_var* v, intmax_t n);
+intmax_t bashc_arith_incr(struct bashc_var* v, intmax_t delta, int post);
+intmax_t bashc_arith_str(const char* s);
+int bashc_arith_status(intmax_t n);
+int bashc_arith_loop(intmax_t n, int* status);
+intmax_t bashc_arith_value(intmax_t n);
+
+/*
+ * Where to go when a top-level command has to be abandoned after an
+ * expansion error; see bashc_abandon().
+ */
+extern jmp_buf bashc_toplevel;
+extern int bashc_toplevel_active;
+
+void bashc_abandon(void) __attribute__((noreturn));
+
+/*
+ * Where the script's exits go when it's run as a loadable builtin (see
+ * bashc_loadable_run()), and the status they leave.
+ */
+extern jmp_buf* bashc_exit_jmp;
+extern int bashc_exit_status;
+
+void bashc_loadable_exit(int status);
+
+/* command path cache */
+const char* bashc_path_lookup(const char* name);
+void bashc_path_forget(const char* name);
+void bashc_path_prime(const char* const names[]);
+
+void exec_argv(char* const argv[], const struct rtioctx* ioc)
+	__attribute__((noreturn));
+pid_t spawn_argv(char* const argv[], const struct rtioctx* ioc);
+pid_t forkexec_argv(char* const argv[], const struct rtioctx* ioc, int flags);
+pid_t run_builtin(bashc_builtin* fn, char* const argv[],
+                  const struct rtioctx* ioc, int flags);
+pid_t bashc_run_command(char* const argv[], const struct rtioctx* ioc, int flags);
+pid_t bashc_fork(const struct rtioctx* ioc);
+void bashc_exit(int status) __attribute__((noreturn));
+
+int bashc_wstatus(int status);
+int bashc_pipe(int fds[2]);
+int bashc_wait_child(pid_t pid);
+int bashc_wait_pipeline(const pid_t pids[], int n);
+
+/*
+ * Scripts compiled as loadable builtins (--compile-loadable); see
+ * loadable.c.  struct bashc_loadable is bash's struct builtin, which
+ * compiled code can't include the headers for.
+ */
+struct word_list;
+typedef int bashc_script(int argc, char** argv);
+
+struct bashc_loadable {
+	char* name;
+	int (*function)(struct word_list* list);
+	int flags;
+	char* const* long_doc;
+	const char* short_doc;
+	char* handle;
+};
+
+#define BASHC_BUILTIN_ENABLED 0x01
+
+int bashc_loadable_run(bashc_script* script, const char* name,
+                       struct word_list* list);
+
+/*
+ * Scripts compiled into a multi-call program (--compile-multicall);
+ * see multicall.c.  Each registers itself with BASHC_MULTICALL, in a
+ * section of its own, so the scripts linked together needn't be listed
+ * anywhere.
+ */
+struct bashc_multicall {
+	const char* name;
+	bashc_script* main;
+};
+
+#define BASHC_MULTICALL_SECTION "bashc_multicall"
+#define BASHC_MULTICALL \
+	__attribute__((used,section(BASHC_MULTICALL_SECTION),aligned(sizeof(void*))))
+
+/* commands run by bash (--compile-hybrid); see interp.c */
+pid_t bashc_interpret(const char* text, int status, const struct rtioctx* ioc, int flags);
+
+/*
+ * Profiling (--compile-profile); see profile.c.  Compiled code has a
+ * table of its command sites, of which the runtime fills in the
+ * counts and times.
+ */
+struct bashc_prof_site {
+	int line;
+	const char* text;
+	unsigned long count;
+	int active;		/* frames it has on the stack */
+	uint64_t total_ns,self_ns,forkwait_ns;
+	uint64_t child_user_us,child_sys_us;
+};
+
+extern int bashc_prof_on;
+
+void bashc_prof_init(struct bashc_prof_site* sites, int nsites);
+int bashc_prof_enter(struct bashc_prof_site* site);
+void bashc_prof_exit(int depth);
+void bashc_prof_unwind(void);
+void bashc_prof_forget(void);
+uint64_t bashc_prof_clock(void);
+void bashc_prof_forkwait(uint64_t start);
 
 #endif
@@ -0,0 +1,112 @@
+/*
+ * Running a compiled script as a loadable builtin (see
+ * --compile-loadable), in bash's own process: it gets the shell's
+ * file descriptors and exported variables, but otherwise starts afresh
+ * each time, as a separate program would.  Unlike the rest of the
+ * library, this is built against bash's headers.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "shell.h"
+#include "builtins.h"
+#include "builtins/common.h"
+
+#include "libbashc.h"
+
+/* struct bashc_loadable must be laid out just as struct builtin is */
+typedef char bashc_loadable_check[
+	sizeof(struct bashc_loadable) == sizeof(struct builtin)
+	&& offsetof(struct bashc_loadable,function) == offsetof(struct builtin,function)
+	&& offsetof(struct bashc_loadable,flags) == offsetof(struct builtin,flags)
+	&& offsetof(struct bashc_loadable,short_doc) == offsetof(struct builtin,short_doc)
+	&& BASHC_BUILTIN_ENABLED == BUILTIN_ENABLED ? 1 : -1];
+
+extern char** environ;
+
+/*
+ * Run `script' as builtin `name' with arguments `list', returning its
+ * status.
+ */
+int bashc_loadable_run(bashc_script* script, const char* name, WORD_LIST* list)
+{
+	struct sigaction sa,oldchld;
+	char** saved_environ = environ;
+	char** argv;
+	WORD_LIST* l;
+	jmp_buf exitjmp;
+	mode_t mask;
+	int argc,status,cwd;
+
+	for (argc = 1, l = list; l; l = l->next)
+		argc++;
+	if (!(argv = malloc((argc + 1) * sizeof(*argv)))) {
+		builtin_error("%s",strerror(errno));
+		return EXECUTION_FAILURE;
+	}
+	argv[0] = (char*)name;
+	for (argc = 1, l = list; l; l = l->next)
+		argv[argc++] = l->word->word;
+	argv[argc] = NULL;
+
+	/* the script's cd and umask are its own */
+	if ((cwd = open(".",O_RDONLY|O_DIRECTORY|O_CLOEXEC)) == -1) {
+		builtin_error("cannot open the current directory: %s",strerror(errno));
+		free(argv);
+		return EXECUTION_FAILURE;
+	}
+	mask = umask(0);
+	umask(mask);
+
+	/* anything the shell's written comes first */
+	fflush(stdout);
+	fflush(stderr);
+
+	/* the shell mustn't reap the script's children out from under it */
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler = SIG_DFL;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD,&sa,&oldchld);
+
+	maybe_make_export_env();
+	bashc_vars_reset(export_env);
+	bashc_funcs_reset();
+	bashc_jobs_reset(1);
+
+	/* the script exiting returns from the builtin instead */
+	if (!setjmp(exitjmp)) {
+		bashc_exit_jmp = &exitjmp;
+		status = script(argc,argv);
+	} else {
+		status = bashc_exit_status;
+		bashc_toplevel_active = 0;
+		bashc_leave_to(NULL);
+		bashc_redir_unwind_all();
+	}
+	bashc_exit_jmp = NULL;
+
+	if (fchdir(cwd))
+		builtin_error("cannot return to the current directory: %s",strerror(errno));
+	close(cwd);
+	umask(mask);
+
+	/* jobs still running are left for the shell to reap */
+	bashc_jobs_reset(0);
+	sigaction(SIGCHLD,&oldchld,NULL);
+	/* in case any of the shell's own children finished meanwhile */
+	raise(SIGCHLD);
+	environ = saved_environ;
+	free(argv);
+
+	return status;
+}
@@ -0,0 +1,180 @@
+/*
+ * Pattern matching for case statements.
+ *
+ * The compiler turns literal patterns into a sorted table searched with
+ * bashc_case_lookup(), and simple prefix/suffix/substring patterns into
+ * inline tests; anything else is matched by bashc_fnmatch(), which
+ * follows lib/glob/strmatch.c without extglob (`*' and `?' match any
+ * characters including `/' and a leading `.', ranges compare code
+ * points as with globasciiranges).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "libbashc.h"
+
+/* Decode the character at `s' into `*c', returning its length in bytes */
+static size_t next_char(const char* s, wint_t* c)
+{
+	mbstate_t state;
+	wchar_t wc;
+	size_t n;
+
+	if (!(*s & 0x80)) {
+		*c = (unsigned char)*s;
+		return 1;
+	}
+
+	memset(&state,0,sizeof(state));
+	n = mbrtowc(&wc,s,MB_CUR_MAX,&state);
+	if (n == (size_t)-1 || n == (size_t)-2 || !n) {
+		/* an invalid sequence: take it a byte at a time */
+		*c = (unsigned char)*s;
+		return 1;
+	}
+
+	*c = wc;
+	return n;
+}
+
+/* A character in a bracket expression, possibly backslash-escaped */
+static size_t bracket_char(const char* p, wint_t* c)
+{
+	if (*p == '\\' && p[1])
+		return 1 + next_char(p + 1,c);
+
+	return next_char(p,c);
+}
+
+/*
+ * Match `c' against the bracket expression after the `[' at `p'.
+ * Returns the length of the expression (up to and including the `]'),
+ * setting `*matched'; or 0 if there's no closing `]', in which case
+ * the `[' is an ordinary character.
+ */
+static size_t match_bracket(const char* p, wint_t c, int* matched)
+{
+	const char* start = p;
+	const char* end;
+	char class[32];
+	wint_t lo,hi;
+	int negate = 0;
+	int found = 0;
+
+	if (*p == '!' || *p == '^') {
+		negate = 1;
+		p++;
+	}
+
+	/* a `]' first is an ordinary character */
+	do {
+		if (!*p)
+			return 0;
+
+		if (p[0] == '[' && p[1] == ':' && (end = strstr(p + 2,":]"))
+		    && (size_t)(end - p - 2) < sizeof(class)) {
+			memcpy(class,p + 2,end - p - 2);
+			class[end - p - 2] = '\0';
+			found |= iswctype(c,wctype(class)) != 0;
+			p = end + 2;
+			continue;
+		} else if (p[0] == '[' && (p[1] == '=' || p[1] == '.') && p[2]
+		           && p[3] == p[1] && p[4] == ']') {
+			/* [=c=] and [.c.], for single characters only */
+			found |= (unsigned char)p[2] == c;
+			p += 5;
+			continue;
+		}
+
+		p += bracket_char(p,&lo);
+		hi = lo;
+		if (p[0] == '-' && p[1] && p[1] != ']')
+			p += 1 + bracket_char(p + 1,&hi);
+
+		found |= lo <= c && c <= hi;
+	} while (*p != ']');
+
+	*matched = found != negate;
+	return p + 1 - start;
+}
+
+/* Whether string `s' matches pattern `p' */
+int bashc_fnmatch(const char* p, const char* s)
+{
+	const char* star_p = NULL;
+	const char* star_s = NULL;
+	size_t plen,slen;
+	wint_t pc,sc;
+	int matched;
+
+	while (*s) {
+		if (*p == '*') {
+			while (*p == '*')
+				p++;
+			if (!*p)
+				return 1;
+			star_p = p;
+			star_s = s;
+			continue;
+		}
+
+		slen = next_char(s,&sc);
+		if (*p == '?') {
+			s += slen;
+			p++;
+			continue;
+		} else if (*p == '[' && (plen = match_bracket(p + 1,sc,&matched))) {
+			if (matched) {
+				s += slen;
+				p += plen + 1;
+				continue;
+			}
+		} else if (*p) {
+			plen = (*p == '\\' && p[1]) ? 1 + next_char(p + 1,&pc) : next_char(p,&pc);
+			if (pc == sc) {
+				s += slen;
+				p += plen;
+				continue;
+			}
+		}
+
+		/* no match here: let the last `*' take one more character */
+		if (!star_p)
+			return 0;
+		p = star_p;
+		star_s += next_char(star_s,&sc);
+		s = star_s;
+	}
+
+	while (*p == '*')
+		p++;
+
+	return !*p;
+}
+
+static int case_cmp(const void* key, const void* elt)
+{
+	return strcmp(key,*(const char* const*)elt);
+}
+
+/*
+ * Find `s' in `table', a sorted array of `n' strings; returns its
+ * index, or -1.
+ */
+int bashc_case_lookup(const char* const table[], int n, const char* s)
+{
+	const char* const* found = bsearch(s,table,n,sizeof(*table),case_cmp);
+
+	return found ? found - table : -1;
+}
+
+/* Whether `s' ends with the `len' bytes at `suffix' */
+int bashc_has_suffix(const char* s, const char* suffix, size_t len)
+{
+	size_t slen = strlen(s);
+
+	return slen >= len && !memcmp(s + slen - len,suffix,len);
+}
@@ -0,0 +1,72 @@
+/*
+ * main() for a multi-call program: several scripts compiled with
+ * --compile-multicall and linked together, sharing one copy of the
+ * library (and, with the linker merging them, of their string
+ * constants).  As with busybox, the script run is the one named by the
+ * program's name (so it can be installed as a link per script), or
+ * failing that by its first argument:
+ *
+ *	$ tools greet world
+ *	$ ln -s tools greet; ./greet world
+ *
+ * Each script's entry is put in the bashc_multicall section, whose
+ * bounds the linker provides.  This is only linked into a program from
+ * the library if nothing else defines main().
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libbashc.h"
+
+extern const struct bashc_multicall __start_bashc_multicall[] __attribute__((weak));
+extern const struct bashc_multicall __stop_bashc_multicall[] __attribute__((weak));
+
+static const struct bashc_multicall* find_script(const char* name)
+{
+	const struct bashc_multicall* s;
+
+	for (s = __start_bashc_multicall; s < __stop_bashc_multicall; s++) {
+		if (!strcmp(s->name,name))
+			return s;
+	}
+
+	return NULL;
+}
+
+static int usage(const char* progname)
+{
+	const struct bashc_multicall* s;
+
+	fprintf(stderr,"usage: %s script [arg ...]\nscripts:",progname);
+	for (s = __start_bashc_multicall; s < __stop_bashc_multicall; s++)
+		fprintf(stderr," %s",s->name);
+	fputc('\n',stderr);
+
+	return 2;
+}
+
+int main(int argc, char** argv)
+{
+	const struct bashc_multicall* s;
+	const char* name;
+
+	if (!argc)
+		return usage("bashc");
+	name = strrchr(argv[0],'/') ? strrchr(argv[0],'/') + 1 : argv[0];
+
+	if ((s = find_script(name)))
+		return s->main(argc,argv);
+
+	/* called by its own name: the script is the first argument */
+	if (argc < 2)
+		return usage(name);
+	if (!(s = find_script(argv[1]))) {
+		fprintf(stderr,"%s: %s: no such script\n",name,argv[1]);
+		return usage(name);
+	}
+
+	return s->main(argc - 1,argv + 1);
+}
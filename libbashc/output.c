@@ -0,0 +1,150 @@
+/*
+ * Buffered output for builtins run inside the compiled program.
+ *
+ * Builtins write to a struct bashc_out rather than straight to a file
+ * descriptor so that loops full of echos don't cost a write(2) each.
+ * Anything buffered has to be flushed before the program forks or
+ * execs (so children can't duplicate or overtake it) and before it
+ * exits; forkexec_argv() and friends take care of the former and the
+ * generated main() of the latter.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "libbashc.h"
+
+struct bashc_out bashc_stdout = { 1, BOUT_CHECKTTY, 0, 0, NULL, };
+struct bashc_out bashc_stderr = { 2, BOUT_UNBUFFERED, 0, 0, NULL, };
+
+void bout_init(struct bashc_out* out, int fd)
+{
+	out->fd = fd;
+	out->flags = BOUT_CHECKTTY;
+	out->len = 0;
+	out->error = 0;
+	out->capture = NULL;
+}
+
+static void write_all(struct bashc_out* out, const char* buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		if ((n = write(out->fd,buf,len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			out->error = errno;
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+int bout_flush(struct bashc_out* out)
+{
+	if (out->len && !out->capture) {
+		write_all(out,out->buf,out->len);
+		out->len = 0;
+	}
+
+	return out->error ? -1 : 0;
+}
+
+void bout_write(struct bashc_out* out, const char* buf, size_t len)
+{
+	if (out->capture) {
+		bashc_capture_append(out->capture,buf,len);
+		return;
+	}
+
+	if (out->flags & BOUT_CHECKTTY) {
+		out->flags &= ~BOUT_CHECKTTY;
+		if (isatty(out->fd))
+			out->flags |= BOUT_LINEBUF;
+	}
+
+	if (out->len + len > sizeof(out->buf)) {
+		bout_flush(out);
+		if (len > sizeof(out->buf)) {
+			write_all(out,buf,len);
+			return;
+		}
+	}
+
+	memcpy(out->buf + out->len,buf,len);
+	out->len += len;
+
+	if ((out->flags & BOUT_UNBUFFERED)
+	    || ((out->flags & BOUT_LINEBUF) && memchr(buf,'\n',len)))
+		bout_flush(out);
+}
+
+void bout_puts(struct bashc_out* out, const char* s)
+{
+	bout_write(out,s,strlen(s));
+}
+
+void bout_putc(struct bashc_out* out, char c)
+{
+	bout_write(out,&c,1);
+}
+
+void bout_printf(struct bashc_out* out, const char* fmt, ...)
+{
+	va_list va;
+	char buf[256];
+	char* big;
+	int n;
+
+	va_start(va,fmt);
+	n = vsnprintf(buf,sizeof(buf),fmt,va);
+	va_end(va);
+
+	if (n < 0)
+		return;
+	else if (n < (int)sizeof(buf)) {
+		bout_write(out,buf,n);
+		return;
+	} else if (!(big = malloc(n + 1)))
+		return;
+
+	va_start(va,fmt);
+	vsnprintf(big,n + 1,fmt,va);
+	va_end(va);
+
+	bout_write(out,big,n);
+	free(big);
+}
+
+/*
+ * Report an error from a builtin.  Pending standard output is flushed
+ * first so the two stay in order when they go to the same place.
+ */
+void bashc_builtin_error(struct bashc_out* err, const char* name,
+                         const char* fmt, ...)
+{
+	va_list va;
+	char buf[512];
+
+	bout_flush(&bashc_stdout);
+
+	va_start(va,fmt);
+	vsnprintf(buf,sizeof(buf),fmt,va);
+	va_end(va);
+
+	bout_printf(err,"%s: %s\n",name,buf);
+	bout_flush(err);
+}
+
+void bashc_flush(void)
+{
+	bout_flush(&bashc_stdout);
+	bout_flush(&bashc_stderr);
+	fflush(NULL);
+}
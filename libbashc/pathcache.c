@@ -0,0 +1,202 @@
+/*
+ * Command-name -> executable-path cache, the runtime analogue of the
+ * interpreter's hashed-command table (hashcmd.c).  Each distinct
+ * command name gets searched for in $PATH once in the parent, instead
+ * of by execvp() in every child.
+ *
+ * The whole table is flushed whenever $PATH is assigned, as in bash.
+ * Entries that stop existing are dropped by the launch code when
+ * executing them fails with ENOENT (see bashc_path_forget()), as bash
+ * does.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "libbashc.h"
+
+#define PATHCACHE_BUCKETS 256
+
+struct pathent {
+	struct pathent* next;
+	char* name;
+	char* path;
+};
+
+static struct pathent* buckets[PATHCACHE_BUCKETS];
+
+static struct bashc_var* pathvar = NULL;
+
+/* the version of $PATH the cached entries were resolved against */
+static unsigned int cached_version;
+
+static unsigned int hash_name(const char* s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+
+	return h % PATHCACHE_BUCKETS;
+}
+
+static void flush_pathcache(void)
+{
+	int i;
+	struct pathent* e;
+	struct pathent* next;
+
+	for (i = 0; i < PATHCACHE_BUCKETS; i++) {
+		for (e = buckets[i]; e; e = next) {
+			next = e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+		}
+		buckets[i] = NULL;
+	}
+}
+
+/*
+ * Flush the cache if $PATH has changed since it was populated.
+ * Returns the current value of $PATH.
+ */
+static const char* check_pathvar(void)
+{
+	if (!pathvar) {
+		pathvar = bashc_var("PATH");
+		cached_version = pathvar->version;
+	} else if (pathvar->version != cached_version) {
+		flush_pathcache();
+		cached_version = pathvar->version;
+	}
+
+	return pathvar->value;
+}
+
+static int is_executable_file(const char* path)
+{
+	struct stat st;
+
+	return !stat(path,&st) && S_ISREG(st.st_mode) && !access(path,X_OK);
+}
+
+/*
+ * Search $PATH for `name'.  Returns a malloc()ed path, or NULL if it
+ * isn't found.  `*cacheable' is cleared if the result came from a
+ * relative directory (and so depends on the current directory).
+ */
+static char* search_path(const char* pathvar, const char* name, int* cacheable)
+{
+	const char* dir;
+	const char* end;
+	size_t dirlen,namelen;
+	char* buf;
+
+	namelen = strlen(name);
+	if (!(buf = malloc(strlen(pathvar) + namelen + 3))) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (dir = pathvar; ; dir = end + 1) {
+		if (!(end = strchr(dir,':')))
+			end = dir + strlen(dir);
+		dirlen = end - dir;
+
+		if (dirlen) {
+			memcpy(buf,dir,dirlen);
+		} else {
+			/* an empty element means the current directory */
+			buf[0] = '.';
+			dirlen = 1;
+		}
+		buf[dirlen] = '/';
+		memcpy(buf + dirlen + 1,name,namelen + 1);
+
+		if (is_executable_file(buf)) {
+			*cacheable = buf[0] == '/';
+			return buf;
+		}
+
+		if (!*end)
+			break;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Returns the path to execute for command `name', or NULL if it
+ * should be left to execvp() (the name contains a slash, $PATH is
+ * unset, or nothing was found).  The returned string remains valid
+ * until the next call into the path cache.
+ */
+const char* bashc_path_lookup(const char* name)
+{
+	static char* uncached = NULL;
+	const char* pathval;
+	struct pathent* e;
+	unsigned int h;
+	int cacheable;
+	char* path;
+
+	if (strchr(name,'/') || !(pathval = check_pathvar()))
+		return NULL;
+
+	h = hash_name(name);
+	for (e = buckets[h]; e; e = e->next) {
+		if (!strcmp(e->name,name))
+			return e->path;
+	}
+
+	if (!(path = search_path(pathval,name,&cacheable)))
+		return NULL;
+
+	free(uncached);
+	uncached = NULL;
+
+	if (!cacheable)
+		return uncached = path;
+
+	if (!(e = malloc(sizeof(*e))) || !(e->name = strdup(name))) {
+		perror("malloc");
+		exit(1);
+	}
+	e->path = path;
+	e->next = buckets[h];
+	buckets[h] = e;
+
+	return e->path;
+}
+
+/* Drop any cached path for `name'. */
+void bashc_path_forget(const char* name)
+{
+	struct pathent** ep;
+	struct pathent* e;
+
+	for (ep = &buckets[hash_name(name)]; (e = *ep); ep = &e->next) {
+		if (!strcmp(e->name,name)) {
+			*ep = e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+			return;
+		}
+	}
+}
+
+/* Resolve a NULL-terminated list of command names ahead of time. */
+void bashc_path_prime(const char* const names[])
+{
+	int i;
+
+	for (i = 0; names[i]; i++)
+		bashc_path_lookup(names[i]);
+}
@@ -0,0 +1,321 @@
+/*
+ * Profiling compiled scripts (see --compile-profile).
+ *
+ * The compiler wraps each command site (a simple command, pipeline,
+ * loop, and so on, and each function body) in bashc_prof_enter() and
+ * bashc_prof_exit(), which keep a stack of the sites running.  Each
+ * site counts its runs, its wall time in all (counted once, however
+ * deeply it recurses), its own wall time less that of the sites within
+ * it, the part of its time spent forking and waiting, and the CPU time
+ * of the children it waited for.  The stacks seen are kept in a tree,
+ * with the time spent in each, for collapsed-stack output.
+ *
+ * A site left by break, return or abandoning a command is closed by
+ * the next exit from a site enclosing it, so bashc_prof_exit() takes
+ * the depth its bashc_prof_enter() returned, and pops to that.
+ *
+ * The report goes to $BASHC_PROFILE (standard error if it's unset) at
+ * exit: a table of the sites, busiest first, or, if
+ * $BASHC_PROFILE_FORMAT is `collapsed', a line per stack of its frames
+ * separated by semicolons and the microseconds spent in it, as
+ * flamegraph.pl reads.  Forked children aren't profiled; their time is
+ * their parent's, waiting for them.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "libbashc.h"
+
+struct node {
+	struct bashc_prof_site* site;
+	struct node* parent;
+	struct node* child;
+	struct node* sibling;
+	uint64_t self_ns;
+};
+
+struct frame {
+	struct node* node;
+	uint64_t start;
+	uint64_t children;	/* time in sites within it */
+	uint64_t forkwait;	/* forkwait_ns at the start */
+	struct timeval cutime,cstime;
+};
+
+int bashc_prof_on = 0;
+
+static struct bashc_prof_site* sites = NULL;
+static int nsites = 0;
+static struct node root;
+static struct frame* stack = NULL;
+static int depth = 0;
+static int stack_size = 0;
+static uint64_t forkwait_ns = 0;
+static const char* report_path = NULL;
+static int collapsed = 0;
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t tv_us(const struct timeval* tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void child_times(struct timeval* utime, struct timeval* stime)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_CHILDREN,&ru))
+		memset(&ru,0,sizeof(ru));
+	*utime = ru.ru_utime;
+	*stime = ru.ru_stime;
+}
+
+static void* xcalloc(size_t n, size_t size)
+{
+	void* p;
+
+	if (!(p = calloc(n,size))) {
+		perror("calloc");
+		exit(1);
+	}
+
+	return p;
+}
+
+static struct node* child_node(struct node* parent, struct bashc_prof_site* site)
+{
+	struct node* n;
+
+	for (n = parent->child; n; n = n->sibling) {
+		if (n->site == site)
+			return n;
+	}
+
+	n = xcalloc(1,sizeof(*n));
+	n->site = site;
+	n->parent = parent;
+	n->sibling = parent->child;
+	parent->child = n;
+
+	return n;
+}
+
+/* Enter `site', returning the depth to give bashc_prof_exit() */
+int bashc_prof_enter(struct bashc_prof_site* site)
+{
+	struct frame* f;
+	struct frame* p;
+
+	if (!bashc_prof_on)
+		return depth;
+
+	if (depth == stack_size) {
+		stack_size = stack_size ? stack_size * 2 : 64;
+		if (!(p = realloc(stack,stack_size * sizeof(*stack)))) {
+			perror("realloc");
+			exit(1);
+		}
+		stack = p;
+	}
+
+	f = &stack[depth];
+	f->node = child_node(depth ? stack[depth - 1].node : &root,site);
+	f->children = 0;
+	f->forkwait = forkwait_ns;
+	child_times(&f->cutime,&f->cstime);
+	site->count++;
+	site->active++;
+	f->start = now();
+
+	return depth++;
+}
+
+/* Leave the sites entered at `to' and deeper */
+void bashc_prof_exit(int to)
+{
+	struct bashc_prof_site* site;
+	struct timeval utime,stime;
+	struct frame* f;
+	uint64_t t,elapsed;
+
+	if (!bashc_prof_on || depth <= to)
+		return;
+
+	t = now();
+	child_times(&utime,&stime);
+
+	while (depth > to) {
+		f = &stack[--depth];
+		site = f->node->site;
+		elapsed = t - f->start;
+		f->node->self_ns += elapsed - f->children;
+		site->self_ns += elapsed - f->children;
+		if (!--site->active) {
+			site->total_ns += elapsed;
+			site->forkwait_ns += forkwait_ns - f->forkwait;
+			site->child_user_us += tv_us(&utime) - tv_us(&f->cutime);
+			site->child_sys_us += tv_us(&stime) - tv_us(&f->cstime);
+		}
+		if (depth)
+			stack[depth - 1].children += elapsed;
+	}
+}
+
+/* Leave every site, for bashc_abandon() */
+void bashc_prof_unwind(void)
+{
+	bashc_prof_exit(0);
+}
+
+/* In a forked child: its parent is the one profiling */
+void bashc_prof_forget(void)
+{
+	bashc_prof_on = 0;
+	depth = 0;
+}
+
+/* The time now, to pass to bashc_prof_forkwait(), or 0 if not profiling */
+uint64_t bashc_prof_clock(void)
+{
+	return bashc_prof_on ? now() : 0;
+}
+
+/* Count the time since `start' as spent forking or waiting */
+void bashc_prof_forkwait(uint64_t start)
+{
+	if (start && bashc_prof_on)
+		forkwait_ns += now() - start;
+}
+
+static int by_total(const void* a, const void* b)
+{
+	const struct bashc_prof_site* x = *(struct bashc_prof_site* const*)a;
+	const struct bashc_prof_site* y = *(struct bashc_prof_site* const*)b;
+
+	if (x->total_ns != y->total_ns)
+		return x->total_ns < y->total_ns ? 1 : -1;
+	return x->line - y->line;
+}
+
+static double ms(uint64_t ns)
+{
+	return ns / 1e6;
+}
+
+static void report_table(FILE* out)
+{
+	struct bashc_prof_site** order;
+	struct bashc_prof_site* s;
+	int i,n;
+
+	order = xcalloc(nsites ? nsites : 1,sizeof(*order));
+	for (i = n = 0; i < nsites; i++) {
+		if (sites[i].count)
+			order[n++] = &sites[i];
+	}
+	qsort(order,n,sizeof(*order),by_total);
+
+	fprintf(out,"%10s %10s %10s %10s %10s %10s  %s\n","count","total ms",
+	        "self ms","fork+wait","child usr","child sys","line: command");
+	for (i = 0; i < n; i++) {
+		s = order[i];
+		fprintf(out,"%10lu %10.3f %10.3f %10.3f %10.3f %10.3f  %d: %s\n",
+		        s->count,ms(s->total_ns),ms(s->self_ns),ms(s->forkwait_ns),
+		        s->child_user_us / 1e3,s->child_sys_us / 1e3,s->line,s->text);
+	}
+
+	free(order);
+}
+
+static void print_frame(FILE* out, const char* label)
+{
+	/* semicolons separate the frames */
+	for (; *label; label++)
+		putc(*label == ';' ? ',' : *label,out);
+}
+
+static void print_stack(FILE* out, struct node* n)
+{
+	if (n->parent != &root)
+		print_stack(out,n->parent);
+	putc(';',out);
+	print_frame(out,n->site->text);
+	fprintf(out," (line %d)",n->site->line);
+}
+
+static void report_collapsed(FILE* out, struct node* n, const char* name)
+{
+	struct node* c;
+
+	if (n != &root) {
+		print_frame(out,name);
+		print_stack(out,n);
+		fprintf(out," %llu\n",(unsigned long long)(n->self_ns / 1000));
+	}
+	for (c = n->child; c; c = c->sibling)
+		report_collapsed(out,c,name);
+}
+
+static void report(void)
+{
+	const char* name = bashc_posparam(0);
+	FILE* out = stderr;
+
+	if (!bashc_prof_on)
+		return;
+	bashc_prof_exit(0);
+	bashc_prof_on = 0;
+
+	if (report_path && !(out = fopen(report_path,"w"))) {
+		fprintf(stderr,"%s: %s: %s\n",name ? name : "bashc",report_path,strerror(errno));
+		return;
+	}
+
+	if (!name)
+		name = "bashc";
+	else if (strrchr(name,'/'))
+		name = strrchr(name,'/') + 1;
+
+	if (collapsed)
+		report_collapsed(out,&root,name);
+	else
+		report_table(out);
+
+	if (out != stderr)
+		fclose(out);
+	else
+		fflush(out);
+}
+
+/* Start profiling, of the `n' sites of `s' */
+void bashc_prof_init(struct bashc_prof_site* s, int n)
+{
+	static int registered = 0;
+	const char* format;
+
+	sites = s;
+	nsites = n;
+	report_path = getenv("BASHC_PROFILE");
+	if (report_path && !*report_path)
+		report_path = NULL;
+	format = getenv("BASHC_PROFILE_FORMAT");
+	collapsed = format && !strcmp(format,"collapsed");
+
+	if (!registered && !atexit(report))
+		registered = 1;
+	bashc_prof_on = 1;
+}
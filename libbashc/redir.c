@@ -0,0 +1,353 @@
+/*
+ * Redirection plans.
+ *
+ * The compiler turns a command's redirections into a static array of
+ * struct rtredir, carried out in order.  For external commands the
+ * plan is applied in the child (by exec_argv(), or as posix_spawn file
+ * actions), so the shell's own descriptors are never disturbed.
+ * Builtins run in-process resolve the plan against a small map of
+ * virtual descriptors instead, and only compound commands have the
+ * shell's descriptors actually moved around (and put back afterwards).
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "libbashc.h"
+
+/* Descriptors saved by bashc_redir_push() are kept at or above this */
+#define SAVED_FD_BASE 10
+
+static void redir_error(const struct rtredir* r, int err)
+{
+	char num[16];
+
+	if (r->op == RTREDIR_OPEN)
+		bashc_builtin_error(&bashc_stderr,r->path,"%s",strerror(err));
+	else {
+		snprintf(num,sizeof(num),"%d",r->src);
+		bashc_builtin_error(&bashc_stderr,num,"%s",strerror(err));
+	}
+}
+
+static int fd_is_open(int fd)
+{
+	return fcntl(fd,F_GETFD) != -1;
+}
+
+/* Carry out one redirection; returns 0, or -1 with errno set */
+static int apply_redir(const struct rtredir* r)
+{
+	int fd;
+
+	switch (r->op) {
+	case RTREDIR_OPEN:
+		if ((fd = open(r->path,r->oflags|O_CLOEXEC,REDIR_MODE)) == -1)
+			return -1;
+		if (fd == r->fd)
+			return fcntl(fd,F_SETFD,0) == -1 ? -1 : 0;
+		if (dup2(fd,r->fd) == -1) {
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		return 0;
+
+	case RTREDIR_DUP:
+	case RTREDIR_MOVE:
+		if (r->src == r->fd) {
+			if (!fd_is_open(r->fd))
+				return -1;
+		} else if (dup2(r->src,r->fd) == -1)
+			return -1;
+		else if (r->op == RTREDIR_MOVE)
+			close(r->src);
+		return 0;
+
+	default:
+		close(r->fd);
+		return 0;
+	}
+}
+
+/*
+ * Apply a plan to this process's descriptors, as a child about to
+ * exec does.  Returns 0, or -1 having reported the failed redirection.
+ */
+int bashc_apply_redirs(const struct rtredir* redirs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (apply_redir(&redirs[i])) {
+			redir_error(&redirs[i],errno);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int vfd_slot(const struct bashc_vfdmap* m, int fd)
+{
+	int i;
+
+	for (i = 0; i < m->n; i++) {
+		if (m->fd[i] == fd)
+			return i;
+	}
+
+	return -1;
+}
+
+/* What `fd' refers to under the map, or -1 if it's closed */
+int bashc_vfd(const struct bashc_vfdmap* m, int fd)
+{
+	int i = vfd_slot(m,fd);
+
+	if (i >= 0)
+		return m->real[i];
+
+	return fd_is_open(fd) ? fd : -1;
+}
+
+static void vfd_set(struct bashc_vfdmap* m, int fd, int real)
+{
+	int i;
+
+	if ((i = vfd_slot(m,fd)) < 0) {
+		i = m->n++;
+		m->fd[i] = fd;
+	}
+	m->real[i] = real;
+}
+
+/*
+ * Work out where a plan would leave the descriptors it touches,
+ * without changing any of ours; files are opened (close-on-exec) as
+ * needed.  Returns 0, or -1 having reported the failed redirection.
+ * Plans of more than BASHC_VFD_MAX/2 entries aren't supported.  Files
+ * opened are closed by bashc_vfd_release(), even on failure.
+ */
+int bashc_vfd_resolve(struct bashc_vfdmap* m, const struct rtredir* redirs, int n)
+{
+	const struct rtredir* r;
+	int i,fd;
+
+	m->n = 0;
+	m->nopened = 0;
+
+	for (i = 0; i < n; i++) {
+		r = &redirs[i];
+		switch (r->op) {
+		case RTREDIR_OPEN:
+			if ((fd = open(r->path,r->oflags|O_CLOEXEC,REDIR_MODE)) == -1) {
+				redir_error(r,errno);
+				return -1;
+			}
+			m->opened[m->nopened++] = fd;
+			vfd_set(m,r->fd,fd);
+			break;
+
+		case RTREDIR_DUP:
+		case RTREDIR_MOVE:
+			if ((fd = bashc_vfd(m,r->src)) == -1) {
+				redir_error(r,EBADF);
+				return -1;
+			}
+			vfd_set(m,r->fd,fd);
+			if (r->op == RTREDIR_MOVE && r->src != r->fd)
+				vfd_set(m,r->src,-1);
+			break;
+
+		default:
+			vfd_set(m,r->fd,-1);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+void bashc_vfd_release(struct bashc_vfdmap* m)
+{
+	while (m->nopened)
+		close(m->opened[--m->nopened]);
+	m->n = 0;
+}
+
+/*
+ * Perform a plan's side effects (creating and truncating files) and
+ * report any errors, for a command with nothing to run or one that
+ * doesn't do I/O.  Returns the command's exit status.
+ */
+int bashc_check_redirs(const struct rtredir* redirs, int n)
+{
+	struct bashc_vfdmap m;
+	pid_t pid;
+	int ret,status;
+
+	if (n <= BASHC_VFD_MAX/2) {
+		ret = bashc_vfd_resolve(&m,redirs,n);
+		bashc_vfd_release(&m);
+		return ret ? 1 : 0;
+	}
+
+	/* too big to resolve; just do it in a child */
+	if (!(pid = bashc_fork(NULL)))
+		bashc_exit(bashc_apply_redirs(redirs,n) ? 1 : 0);
+	else if (pid == -1 || bashc_waitpid(pid,&status))
+		return 1;
+
+	return bashc_wstatus(status);
+}
+
+/*
+ * Redirections applied to the shell itself, for compound commands.
+ * Each push saves the descriptors it's about to change (or notes that
+ * they were closed); a pop puts them back.
+ */
+struct savedfd {
+	int fd;
+	int saved;	/* -1 if `fd' was closed */
+};
+
+static struct savedfd* saved_fds = NULL;
+static int num_saved = 0;
+static int saved_size = 0;
+
+static int* frames = NULL;
+static int num_frames = 0;
+static int frames_size = 0;
+
+static void* grow(void* p, int* size, int need, size_t elsize)
+{
+	if (need <= *size)
+		return p;
+
+	*size = need < 8 ? 8 : need * 2;
+	if (!(p = realloc(p,*size * elsize))) {
+		perror("realloc");
+		exit(1);
+	}
+
+	return p;
+}
+
+/* Move any saved descriptor that happens to be `fd' out of the way */
+static int rescue_saved(int fd)
+{
+	int i,newfd;
+
+	for (i = 0; i < num_saved; i++) {
+		if (saved_fds[i].saved == fd) {
+			if ((newfd = fcntl(fd,F_DUPFD_CLOEXEC,SAVED_FD_BASE)) == -1)
+				return -1;
+			close(fd);
+			saved_fds[i].saved = newfd;
+		}
+	}
+
+	return 0;
+}
+
+static int save_fd(int fd, int frame)
+{
+	int i,saved;
+
+	for (i = frame; i < num_saved; i++) {
+		if (saved_fds[i].fd == fd)
+			return 0;
+	}
+
+	if (rescue_saved(fd))
+		return -1;
+
+	if ((saved = fcntl(fd,F_DUPFD_CLOEXEC,SAVED_FD_BASE)) == -1) {
+		if (errno != EBADF)
+			return -1;
+	}
+
+	saved_fds = grow(saved_fds,&saved_size,num_saved + 1,sizeof(*saved_fds));
+	saved_fds[num_saved].fd = fd;
+	saved_fds[num_saved].saved = saved;
+	num_saved++;
+
+	return 0;
+}
+
+/*
+ * Apply a plan to the shell's own descriptors until the matching
+ * bashc_redir_pop().  Returns 0, or -1 (with nothing left changed)
+ * having reported the failed redirection.
+ */
+int bashc_redir_push(const struct rtredir* redirs, int n)
+{
+	const struct rtredir* r;
+	int i,frame;
+
+	bashc_flush();
+
+	frames = grow(frames,&frames_size,num_frames + 1,sizeof(*frames));
+	frame = frames[num_frames++] = num_saved;
+
+	for (i = 0; i < n; i++) {
+		r = &redirs[i];
+		if (save_fd(r->fd,frame)
+		    || (r->op == RTREDIR_MOVE && save_fd(r->src,frame))
+		    || apply_redir(r)) {
+			redir_error(r,errno);
+			bashc_redir_pop();
+			return -1;
+		}
+	}
+
+	bout_init(&bashc_stdout,1);
+	return 0;
+}
+
+void bashc_redir_pop(void)
+{
+	struct savedfd* s;
+
+	bashc_flush();
+
+	num_frames--;
+	while (num_saved > frames[num_frames]) {
+		s = &saved_fds[--num_saved];
+		if (s->saved == -1)
+			close(s->fd);
+		else {
+			dup2(s->saved,s->fd);
+			close(s->saved);
+		}
+	}
+
+	bout_init(&bashc_stdout,1);
+}
+
+/* Pop `n' levels of redirections at once, for break and continue */
+void bashc_redir_unwind(int n)
+{
+	while (n--)
+		bashc_redir_pop();
+}
+
+/* How many levels are in effect */
+int bashc_redir_depth(void)
+{
+	return num_frames;
+}
+
+/* Pop every level, for a command that's been abandoned */
+void bashc_redir_unwind_all(void)
+{
+	bashc_redir_unwind(num_frames);
+}
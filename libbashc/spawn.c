@@ -0,0 +1,120 @@
+/*
+ * posix_spawn()-based process launching.  On Linux this uses
+ * clone(CLONE_VM|CLONE_VFORK) under the hood, so unlike fork() its
+ * cost doesn't grow with the size of the parent's address space.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "libbashc.h"
+
+extern char** environ;
+
+static int redir_to_file_actions(const struct rtredir* r,
+                                 posix_spawn_file_actions_t* fa)
+{
+	int err;
+
+	switch (r->op) {
+	case RTREDIR_OPEN:
+		return posix_spawn_file_actions_addopen(fa,r->fd,r->path,r->oflags,
+		                                        REDIR_MODE);
+	case RTREDIR_DUP:
+	case RTREDIR_MOVE:
+		err = posix_spawn_file_actions_adddup2(fa,r->src,r->fd);
+		if (!err && r->op == RTREDIR_MOVE && r->src != r->fd)
+			err = posix_spawn_file_actions_addclose(fa,r->src);
+		return err;
+	default:
+		return posix_spawn_file_actions_addclose(fa,r->fd);
+	}
+}
+
+/*
+ * Translate an I/O context into spawn file actions.  This must
+ * perform exactly the same sequence of operations as exec_argv().
+ */
+static int ioc_to_file_actions(const struct rtioctx* ioc,
+                               posix_spawn_file_actions_t* fa)
+{
+	int i,err;
+
+	if ((err = posix_spawn_file_actions_init(fa)))
+		return err;
+
+	for (i = 0; i < ioc->numfds; i++) {
+		if (ioc->fds[i][1] != IO_CLOSE_FD
+		    && (err = posix_spawn_file_actions_adddup2(fa,ioc->fds[i][0],
+		                                               ioc->fds[i][1])))
+			break;
+		if ((err = posix_spawn_file_actions_addclose(fa,ioc->fds[i][0])))
+			break;
+	}
+
+	for (i = 0; i < ioc->numredirs && !err; i++)
+		err = redir_to_file_actions(&ioc->redirs[i],fa);
+
+	if (err)
+		posix_spawn_file_actions_destroy(fa);
+
+	return err;
+}
+
+/* Spawn `path', or search $PATH for argv[0] if it's NULL */
+static int do_spawn(pid_t* pid, const char* path, char* const argv[],
+                    posix_spawn_file_actions_t* fap)
+{
+	if (path)
+		return posix_spawn(pid,path,fap,NULL,argv,environ);
+	else
+		return posix_spawnp(pid,argv[0],fap,NULL,argv,environ);
+}
+
+/*
+ * Launch argv[0] (via the path cache) with I/O set up according to
+ * `ioc'.  Returns the pid of the new process, or -1 with errno set if
+ * it couldn't be started (including exec failures).
+ */
+pid_t spawn_argv(char* const argv[], const struct rtioctx* ioc)
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawn_file_actions_t* fap = NULL;
+	const char* path;
+	pid_t pid;
+	int err;
+
+	if (ioc && (ioc->numfds || ioc->numredirs)) {
+		if ((err = ioc_to_file_actions(ioc,&fa))) {
+			errno = err;
+			return -1;
+		}
+		fap = &fa;
+	}
+
+	/* posix_spawnp() searches the $PATH it finds in environ, too */
+	bashc_sync_environ();
+
+	path = bashc_path_lookup(argv[0]);
+	err = do_spawn(&pid,path,argv,fap);
+
+	if (err == ENOENT && path && access(path,F_OK)) {
+		/* the cached path has gone away; search again */
+		bashc_path_forget(argv[0]);
+		path = bashc_path_lookup(argv[0]);
+		err = do_spawn(&pid,path,argv,fap);
+	}
+
+	if (fap)
+		posix_spawn_file_actions_destroy(fap);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return pid;
+}
@@ -0,0 +1,83 @@
+/*
+ * Measure process-launch throughput of forkexec_argv() with each of
+ * its backends.
+ *
+ * usage: spawnbench [-n iterations] [-m megabytes] [command [args...]]
+ *
+ * -m makes the benchmark touch that many megabytes of heap first, to
+ * simulate launching commands from a parent with a large RSS.  The
+ * command defaults to /bin/true.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libbashc/libbashc.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char* name, int backend, char* const argv[], long iters)
+{
+	long i;
+	double start,elapsed;
+
+	bashc_launch_backend = backend;
+
+	start = now();
+	for (i = 0; i < iters; i++) {
+		if (forkexec_argv(argv,NULL,0)) {
+			fprintf(stderr,"spawnbench: %s: command failed\n",argv[0]);
+			exit(1);
+		}
+	}
+	elapsed = now() - start;
+
+	printf("%-6s %8ld launches in %7.3fs: %10.1f launches/sec\n",name,
+	       iters,elapsed,iters / elapsed);
+}
+
+int main(int argc, char** argv)
+{
+	static char* const default_argv[] = { "/bin/true", NULL, };
+	char* const* cmd = default_argv;
+	long iters = 2000;
+	long megs = 0;
+	char* ballast;
+	int opt;
+
+	while ((opt = getopt(argc,argv,"n:m:")) != -1) {
+		switch (opt) {
+		case 'n': iters = atol(optarg); break;
+		case 'm': megs = atol(optarg); break;
+		default:
+			fprintf(stderr,"usage: %s [-n iterations] [-m megabytes] "
+			        "[command [args...]]\n",argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind < argc)
+		cmd = argv + optind;
+
+	if (megs > 0) {
+		if (!(ballast = malloc(megs << 20))) {
+			perror("malloc");
+			return 1;
+		}
+		memset(ballast,1,megs << 20);
+	}
+
+	printf("parent RSS ballast: %ldMB\n",megs);
+	run("fork",BASHC_LAUNCH_FORK,cmd,iters);
+	run("spawn",BASHC_LAUNCH_SPAWN,cmd,iters);
+
+	return 0;
+}
@@ -0,0 +1,429 @@
+/*
+ * The test/[ builtin, following the grammar and semantics of the
+ * interpreter's test.c.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "libbashc.h"
+
+#define TEST_ERR_STATUS 2
+
+struct testctx {
+	char* const* argv;
+	int argc;
+	int pos;
+	const char* name;
+	struct bashc_out* err;
+	jmp_buf errjmp;
+};
+
+static void test_syntax_error(struct testctx* tc, const char* fmt, const char* arg)
+	__attribute__((noreturn));
+
+static void test_syntax_error(struct testctx* tc, const char* fmt, const char* arg)
+{
+	bashc_builtin_error(tc->err,tc->name,fmt,arg);
+	longjmp(tc->errjmp,1);
+}
+
+static void beyond(struct testctx* tc)
+{
+	test_syntax_error(tc,"argument expected",NULL);
+}
+
+static void advance(struct testctx* tc, int need_more)
+{
+	if (need_more && tc->pos + 1 >= tc->argc)
+		beyond(tc);
+	tc->pos++;
+}
+
+/*
+ * Parse a decimal integer with optional surrounding whitespace, as
+ * legal_number() does.
+ */
+static int parse_int(const char* s, intmax_t* result)
+{
+	char* end;
+
+	errno = 0;
+	*result = strtoimax(s,&end,10);
+	if (end == s || errno == ERANGE)
+		return 0;
+	while (isspace((unsigned char)*end))
+		end++;
+	return !*end;
+}
+
+static intmax_t test_int(struct testctx* tc, const char* s)
+{
+	intmax_t v;
+
+	if (!parse_int(s,&v))
+		test_syntax_error(tc,"%s: integer expression expected",s);
+
+	return v;
+}
+
+static int filecomp(const char* a, const char* b, const char* op)
+{
+	struct stat sa,sb;
+	int ra,rb;
+
+	ra = stat(a,&sa);
+	rb = stat(b,&sb);
+
+	switch (op[1]) {
+	case 'n':
+		/* -nt: a exists and b doesn't, or a is newer */
+		if (ra || rb)
+			return !ra && rb;
+		return sa.st_mtim.tv_sec > sb.st_mtim.tv_sec
+			|| (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec
+			    && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec);
+	case 'o':
+		if (ra || rb)
+			return ra && !rb;
+		return sa.st_mtim.tv_sec < sb.st_mtim.tv_sec
+			|| (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec
+			    && sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec);
+	default:
+		/* -ef */
+		return !ra && !rb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+	}
+}
+
+static int binop(const char* op)
+{
+	if (op[0] == '=' && (!op[1] || (op[1] == '=' && !op[2])))
+		return 1;
+	else if ((op[0] == '<' || op[0] == '>') && !op[1])
+		return 1;
+	else if (!strcmp(op,"!="))
+		return 1;
+	else if (op[0] != '-' || !op[1] || !op[2] || op[3])
+		return 0;
+
+	return !strcmp(op,"-eq") || !strcmp(op,"-ne") || !strcmp(op,"-lt")
+		|| !strcmp(op,"-le") || !strcmp(op,"-gt") || !strcmp(op,"-ge")
+		|| !strcmp(op,"-nt") || !strcmp(op,"-ot") || !strcmp(op,"-ef");
+}
+
+static int unop(const char* op)
+{
+	if (op[0] != '-' || !op[1] || op[2])
+		return 0;
+
+	return strchr("abcdefghknoprstuvwxzGLNORS",op[1]) != NULL;
+}
+
+/* Evaluate binary operator `op'; it's assumed that binop(op) is true. */
+int bashc_test_binary(const char* a, const char* op, const char* b, int* err)
+{
+	intmax_t l,r;
+
+	if (op[0] == '=')
+		return !strcmp(a,b);
+	else if (op[0] == '!')
+		return strcmp(a,b) != 0;
+	else if (op[0] == '<')
+		return strcmp(a,b) < 0;
+	else if (op[0] == '>')
+		return strcmp(a,b) > 0;
+	else if (!strcmp(op,"-nt") || !strcmp(op,"-ot") || !strcmp(op,"-ef"))
+		return filecomp(a,b,op);
+
+	if (!parse_int(a,&l) || !parse_int(b,&r)) {
+		*err = 1;
+		return 0;
+	}
+
+	switch (op[1]) {
+	case 'e': return l == r;
+	case 'n': return l != r;
+	case 'l': return op[2] == 't' ? l < r : l <= r;
+	default: return op[2] == 't' ? l > r : l >= r;
+	}
+}
+
+/* Evaluate unary operator `op'; it's assumed that unop(op) is true. */
+int bashc_test_unary(char op, const char* arg, const struct stat* st, int statok)
+{
+	struct stat sbuf;
+	intmax_t fd;
+
+	switch (op) {
+	case 'z': return !*arg;
+	case 'n': return *arg != 0;
+	case 'o': return 0;
+	case 'v': return bashc_getvar(arg) != NULL;
+	case 'R': return 0;
+	case 't': return parse_int(arg,&fd) && fd == (int)fd && isatty((int)fd);
+	case 'r': return !faccessat(AT_FDCWD,arg,R_OK,AT_EACCESS);
+	case 'w': return !faccessat(AT_FDCWD,arg,W_OK,AT_EACCESS);
+	case 'x': return !faccessat(AT_FDCWD,arg,X_OK,AT_EACCESS);
+	case 'h':
+	case 'L':
+		return !lstat(arg,&sbuf) && S_ISLNK(sbuf.st_mode);
+	}
+
+	/* everything else needs a stat() of the file */
+	if (!st) {
+		statok = !stat(arg,&sbuf);
+		st = &sbuf;
+	}
+	if (!statok)
+		return 0;
+
+	switch (op) {
+	case 'a':
+	case 'e': return 1;
+	case 'b': return S_ISBLK(st->st_mode);
+	case 'c': return S_ISCHR(st->st_mode);
+	case 'd': return S_ISDIR(st->st_mode);
+	case 'f': return S_ISREG(st->st_mode);
+	case 'p': return S_ISFIFO(st->st_mode);
+	case 'S': return S_ISSOCK(st->st_mode);
+	case 'g': return (st->st_mode & S_ISGID) != 0;
+	case 'u': return (st->st_mode & S_ISUID) != 0;
+	case 'k': return (st->st_mode & S_ISVTX) != 0;
+	case 's': return st->st_size > 0;
+	case 'O': return st->st_uid == geteuid();
+	case 'G': return st->st_gid == getegid();
+	case 'N':
+		return st->st_mtim.tv_sec > st->st_atim.tv_sec
+			|| (st->st_mtim.tv_sec == st->st_atim.tv_sec
+			    && st->st_mtim.tv_nsec > st->st_atim.tv_nsec);
+	}
+
+	return 0;
+}
+
+static int binary_operator(struct testctx* tc)
+{
+	const char* a = tc->argv[tc->pos];
+	const char* op = tc->argv[tc->pos + 1];
+	const char* b = tc->argv[tc->pos + 2];
+	int err = 0;
+	int value;
+
+	tc->pos += 3;
+
+	value = bashc_test_binary(a,op,b,&err);
+	if (err) {
+		/* report whichever operand isn't an integer */
+		test_int(tc,a);
+		test_int(tc,b);
+	}
+
+	return value;
+}
+
+static int unary_operator(struct testctx* tc)
+{
+	const char* op = tc->argv[tc->pos];
+	const char* arg;
+
+	advance(tc,1);
+	arg = tc->argv[tc->pos++];
+
+	return bashc_test_unary(op[1],arg,NULL,0);
+}
+
+static int expr(struct testctx* tc);
+
+static int term(struct testctx* tc)
+{
+	const char* arg;
+	int value;
+
+	if (tc->pos >= tc->argc)
+		beyond(tc);
+
+	arg = tc->argv[tc->pos];
+
+	/* leading `!'s */
+	if (!strcmp(arg,"!")) {
+		value = 0;
+		while (tc->pos < tc->argc && !strcmp(tc->argv[tc->pos],"!")) {
+			advance(tc,1);
+			value = !value;
+		}
+		return value ? !term(tc) : term(tc);
+	}
+
+	/* a parenthesized subexpression */
+	if (!strcmp(arg,"(")) {
+		advance(tc,1);
+		value = expr(tc);
+		if (tc->pos >= tc->argc)
+			test_syntax_error(tc,"`)' expected",NULL);
+		else if (strcmp(tc->argv[tc->pos],")"))
+			test_syntax_error(tc,"`)' expected, found %s",tc->argv[tc->pos]);
+		tc->pos++;
+		return value;
+	}
+
+	if (tc->pos + 3 <= tc->argc && binop(tc->argv[tc->pos + 1]))
+		return binary_operator(tc);
+	else if (tc->pos + 2 <= tc->argc && unop(arg))
+		return unary_operator(tc);
+
+	tc->pos++;
+	return *arg != 0;
+}
+
+static int and(struct testctx* tc)
+{
+	int value = term(tc);
+
+	if (tc->pos < tc->argc && !strcmp(tc->argv[tc->pos],"-a")) {
+		advance(tc,0);
+		return and(tc) && value;
+	}
+
+	return value;
+}
+
+static int or(struct testctx* tc)
+{
+	int value = and(tc);
+
+	if (tc->pos < tc->argc && !strcmp(tc->argv[tc->pos],"-o")) {
+		advance(tc,0);
+		return or(tc) || value;
+	}
+
+	return value;
+}
+
+static int expr(struct testctx* tc)
+{
+	if (tc->pos >= tc->argc)
+		beyond(tc);
+
+	return or(tc);
+}
+
+static int one_argument(struct testctx* tc)
+{
+	return tc->argv[tc->pos++][0] != 0;
+}
+
+static int two_arguments(struct testctx* tc)
+{
+	const char* a = tc->argv[tc->pos];
+	const char* b = tc->argv[tc->pos + 1];
+
+	tc->pos += 2;
+
+	if (!strcmp(a,"!"))
+		return !*b;
+	else if (unop(a))
+		return bashc_test_unary(a[1],b,NULL,0);
+
+	test_syntax_error(tc,"%s: unary operator expected",a);
+}
+
+static int three_arguments(struct testctx* tc)
+{
+	const char* a = tc->argv[tc->pos];
+	const char* op = tc->argv[tc->pos + 1];
+	const char* b = tc->argv[tc->pos + 2];
+	int value;
+
+	if (binop(op))
+		return binary_operator(tc);
+
+	if (!strcmp(op,"-a") || !strcmp(op,"-o")) {
+		tc->pos += 3;
+		return op[1] == 'a' ? (*a && *b) : (*a || *b);
+	} else if (!strcmp(a,"!")) {
+		tc->pos++;
+		return !two_arguments(tc);
+	} else if (!strcmp(a,"(") && !strcmp(b,")")) {
+		tc->pos++;
+		value = one_argument(tc);
+		tc->pos++;
+		return value;
+	}
+
+	test_syntax_error(tc,"%s: binary operator expected",op);
+}
+
+static int posixtest(struct testctx* tc)
+{
+	int value;
+
+	switch (tc->argc - 1) {
+	case 0:
+		tc->pos = tc->argc;
+		return 0;
+	case 1:
+		return one_argument(tc);
+	case 2:
+		return two_arguments(tc);
+	case 3:
+		return three_arguments(tc);
+	case 4:
+		if (!strcmp(tc->argv[tc->pos],"!")) {
+			tc->pos++;
+			return !three_arguments(tc);
+		} else if (!strcmp(tc->argv[tc->pos],"(")
+		           && !strcmp(tc->argv[tc->argc - 1],")")) {
+			tc->pos++;
+			value = two_arguments(tc);
+			tc->pos++;
+			return value;
+		}
+		/* FALLTHROUGH */
+	default:
+		return expr(tc);
+	}
+}
+
+int bashc_test(char* const argv[], struct bashc_out* out, struct bashc_out* err)
+{
+	struct testctx tc;
+	int value;
+
+	(void)out;
+
+	tc.argv = argv;
+	tc.name = argv[0];
+	tc.err = err;
+	tc.pos = 1;
+	for (tc.argc = 0; argv[tc.argc]; tc.argc++);
+
+	if (setjmp(tc.errjmp))
+		return TEST_ERR_STATUS;
+
+	if (!strcmp(argv[0],"[")) {
+		if (strcmp(argv[tc.argc - 1],"]"))
+			test_syntax_error(&tc,"missing `]'",NULL);
+		tc.argc--;
+	}
+
+	value = posixtest(&tc);
+
+	if (tc.pos < tc.argc) {
+		if (tc.argv[tc.pos][0] == '-')
+			test_syntax_error(&tc,"syntax error: `%s' unexpected",tc.argv[tc.pos]);
+		else
+			test_syntax_error(&tc,"too many arguments",NULL);
+	}
+
+	return !value;
+}
@@ -0,0 +1,42 @@
+/*
+ * What bashcrun and bashcbench have in common.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "tool.h"
+
+/* Environment variable `name', or `dflt' if it's unset or empty */
+const char* setting(const char* name, const char* dflt)
+{
+	const char* s = getenv(name);
+
+	return s && *s ? s : dflt;
+}
+
+/* Run `argv', returning whether it succeeded */
+int run(char* const argv[])
+{
+	pid_t pid;
+	int status;
+
+	if (!(pid = fork())) {
+		execvp(argv[0],argv);
+		fprintf(stderr,"%s: %s: %s\n",progname,argv[0],strerror(errno));
+		_exit(127);
+	} else if (pid == -1)
+		return 0;
+
+	while (waitpid(pid,&status,0) == -1) {
+		if (errno != EINTR)
+			return 0;
+	}
+
+	return WIFEXITED(status) && !WEXITSTATUS(status);
+}
@@ -0,0 +1,28 @@
+/*
+ * What bashcrun and bashcbench, which compile scripts by running the
+ * compiler and C compiler, have in common.
+ */
+
+#ifndef BASHC_TOOL_H
+#define BASHC_TOOL_H
+
+#ifndef BASHC_DEFAULT_SH
+#define BASHC_DEFAULT_SH "bash"
+#endif
+#ifndef BASHC_DEFAULT_CC
+#define BASHC_DEFAULT_CC "cc"
+#endif
+#ifndef BASHC_DEFAULT_INCLUDE
+#define BASHC_DEFAULT_INCLUDE "."
+#endif
+#ifndef BASHC_DEFAULT_LIBRARY
+#define BASHC_DEFAULT_LIBRARY "libbashc/libbashc.a"
+#endif
+
+/* each tool's own name, for its messages */
+extern const char* progname;
+
+const char* setting(const char* name, const char* dflt);
+int run(char* const argv[]);
+
+#endif /* BASHC_TOOL_H */
@@ -0,0 +1,389 @@
+/*
+ * Shell variables and positional parameters.
+ *
+ * Variables live in a hash table and are never freed (unsetting one
+ * just drops its value), so compiled code can look each name up once
+ * at startup and keep the struct bashc_var* as a handle.  The table is
+ * populated from the environment on first use; the environment passed
+ * to commands is rebuilt from the exported variables whenever one of
+ * them has changed.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <locale.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "libbashc.h"
+
+#define VAR_BUCKETS 256
+
+extern char** environ;
+
+static struct bashc_var* buckets[VAR_BUCKETS];
+static int vars_imported = 0;
+
+/* set when an exported variable changes; see bashc_envp() */
+static int env_dirty = 1;
+static char** envp = NULL;
+
+struct bashc_posparams bashc_posparams = { NULL, 0, NULL, };
+
+pid_t bashc_shell_pid;
+
+static unsigned int hash_name(const char* s, size_t len)
+{
+	unsigned int h = 2166136261u;
+
+	while (len--)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+
+	return h % VAR_BUCKETS;
+}
+
+/* Whether the first `len' bytes of `s' are a valid variable name */
+int bashc_legal_name(const char* s, size_t len)
+{
+	size_t i;
+
+	if (!len || isdigit((unsigned char)s[0]))
+		return 0;
+
+	for (i = 0; i < len; i++) {
+		if (!isalnum((unsigned char)s[i]) && s[i] != '_')
+			return 0;
+	}
+
+	return 1;
+}
+
+static struct bashc_var* lookup(const char* name, size_t len, int create)
+{
+	struct bashc_var* v;
+	unsigned int h = hash_name(name,len);
+
+	for (v = buckets[h]; v; v = v->next) {
+		if (!strncmp(v->name,name,len) && !v->name[len])
+			return v;
+	}
+
+	if (!create)
+		return NULL;
+
+	if (!(v = calloc(1,sizeof(*v) + len + 1))) {
+		perror("calloc");
+		exit(1);
+	}
+	memcpy(v->name,name,len);
+	v->next = buckets[h];
+	buckets[h] = v;
+
+	return v;
+}
+
+static void import_environ(char** env)
+{
+	struct bashc_var* v;
+	const char* eq;
+	char** e;
+
+	vars_imported = 1;
+
+	for (e = env; e && *e; e++) {
+		if (!(eq = strchr(*e,'=')) || !bashc_legal_name(*e,eq - *e))
+			continue;
+		v = lookup(*e,eq - *e,1);
+		/* an unchanged value keeps its version, and what's cached */
+		if (!v->value || strcmp(v->value,eq + 1))
+			bashc_setvar(v,eq + 1);
+		v->flags = (v->flags & ~VAR_STALE) | VAR_EXPORTED;
+	}
+}
+
+/*
+ * Start afresh with just the variables in `env', as a new program
+ * would, for running a script again in the same process (see
+ * loadable.c).  Handles stay valid: variables are never freed.
+ */
+void bashc_vars_reset(char** env)
+{
+	struct bashc_var* v;
+	int i;
+
+	for (i = 0; i < VAR_BUCKETS; i++) {
+		for (v = buckets[i]; v; v = v->next)
+			v->flags |= VAR_STALE;
+	}
+
+	import_environ(env);
+
+	for (i = 0; i < VAR_BUCKETS; i++) {
+		for (v = buckets[i]; v; v = v->next) {
+			if (!(v->flags & VAR_STALE))
+				continue;
+			if (v->value)
+				bashc_unsetvar(v);
+			v->flags = 0;
+		}
+	}
+	env_dirty = 1;
+}
+
+/* Find variable `name', creating it (unset) if need be */
+struct bashc_var* bashc_var(const char* name)
+{
+	if (!vars_imported)
+		import_environ(environ);
+
+	return lookup(name,strlen(name),1);
+}
+
+/* The value of variable `name', or NULL if it's unset */
+const char* bashc_getvar(const char* name)
+{
+	struct bashc_var* v;
+
+	if (!vars_imported)
+		import_environ(environ);
+
+	return (v = lookup(name,strlen(name),0)) ? v->value : NULL;
+}
+
+void bashc_setvar(struct bashc_var* v, const char* value)
+{
+	size_t len = strlen(value);
+	char* p;
+
+	/* reuse the old value's space where possible */
+	if (!v->value || len >= v->size) {
+		if (!(p = malloc(len + 1))) {
+			perror("malloc");
+			exit(1);
+		}
+		free(v->value);
+		v->value = p;
+		v->size = len + 1;
+	}
+	memmove(v->value,value,len + 1);
+
+	v->version++;
+	v->flags &= ~VAR_NUMCACHED;
+	if (v->flags & VAR_EXPORTED)
+		env_dirty = 1;
+}
+
+void bashc_unsetvar(struct bashc_var* v)
+{
+	free(v->value);
+	v->value = NULL;
+	v->size = 0;
+	v->version++;
+	if (v->flags & VAR_EXPORTED)
+		env_dirty = 1;
+	v->flags &= ~(VAR_EXPORTED|VAR_NUMCACHED);
+}
+
+void bashc_export(struct bashc_var* v, int on)
+{
+	if (!on != !(v->flags & VAR_EXPORTED))
+		env_dirty = 1;
+
+	if (on)
+		v->flags |= VAR_EXPORTED;
+	else
+		v->flags &= ~VAR_EXPORTED;
+}
+
+/*
+ * Set `v' to `value' and export it, saving its previous state in `s'
+ * for bashc_var_restore(); for assignments preceding a command.
+ */
+void bashc_var_settemp(struct bashc_varsave* s, struct bashc_var* v,
+                       const char* value)
+{
+	s->var = v;
+	s->value = v->value;
+	s->size = v->size;
+	s->flags = v->flags;
+
+	v->value = NULL;
+	v->size = 0;
+	bashc_setvar(v,value);
+	bashc_export(v,1);
+}
+
+/* Save `v's state in `s' for bashc_var_restore(), leaving it unset */
+void bashc_var_save(struct bashc_varsave* s, struct bashc_var* v)
+{
+	s->var = v;
+	s->value = v->value;
+	s->size = v->size;
+	s->flags = v->flags;
+
+	v->value = NULL;
+	v->size = 0;
+	v->version++;
+	v->flags &= ~VAR_NUMCACHED;
+	if (v->flags & VAR_EXPORTED)
+		env_dirty = 1;
+}
+
+void bashc_var_restore(struct bashc_varsave* s)
+{
+	struct bashc_var* v = s->var;
+
+	free(v->value);
+	v->value = s->value;
+	v->size = s->size;
+	bashc_export(v,(s->flags & VAR_EXPORTED) != 0);
+	v->flags = s->flags & ~VAR_NUMCACHED;
+	v->version++;
+	env_dirty = 1;
+}
+
+/* The environment for commands, from the exported variables */
+char** bashc_envp(void)
+{
+	struct bashc_var* v;
+	size_t nlen,vlen;
+	int i,n;
+
+	if (!vars_imported)
+		import_environ(environ);
+
+	if (!env_dirty)
+		return envp;
+
+	if (envp) {
+		for (i = 0; envp[i]; i++)
+			free(envp[i]);
+		free(envp);
+	}
+
+	for (n = 0, i = 0; i < VAR_BUCKETS; i++) {
+		for (v = buckets[i]; v; v = v->next)
+			n += (v->flags & VAR_EXPORTED) && v->value;
+	}
+
+	if (!(envp = malloc((n + 1) * sizeof(*envp)))) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (n = 0, i = 0; i < VAR_BUCKETS; i++) {
+		for (v = buckets[i]; v; v = v->next) {
+			if (!(v->flags & VAR_EXPORTED) || !v->value)
+				continue;
+			nlen = strlen(v->name);
+			vlen = strlen(v->value);
+			if (!(envp[n] = malloc(nlen + vlen + 2))) {
+				perror("malloc");
+				exit(1);
+			}
+			memcpy(envp[n],v->name,nlen);
+			envp[n][nlen] = '=';
+			memcpy(envp[n] + nlen + 1,v->value,vlen + 1);
+			n++;
+		}
+	}
+	envp[n] = NULL;
+
+	env_dirty = 0;
+
+	return envp;
+}
+
+/* Call `fn' on each variable, set or not */
+void bashc_vars_each(void (*fn)(struct bashc_var* v, void* arg), void* arg)
+{
+	struct bashc_var* v;
+	int i;
+
+	if (!vars_imported)
+		import_environ(environ);
+
+	for (i = 0; i < VAR_BUCKETS; i++) {
+		for (v = buckets[i]; v; v = v->next)
+			fn(v,arg);
+	}
+}
+
+/* Point `environ' at the exported variables, for exec and spawn */
+void bashc_sync_environ(void)
+{
+	environ = bashc_envp();
+}
+
+/* Set up the runtime at the start of main() */
+void bashc_init(int argc, char** argv)
+{
+	/* already done if it's run from bashc_loadable_run() */
+	if (!vars_imported) {
+		setlocale(LC_ALL,"");
+		import_environ(environ);
+	}
+
+	bashc_shell_pid = getpid();
+	bashc_posparams.zero = argv[0];
+	bashc_posparams.n = argc - 1;
+	bashc_posparams.v = argv + 1;
+}
+
+/* $0, $1, ...; NULL if there's no such parameter */
+const char* bashc_posparam(int n)
+{
+	if (!n)
+		return bashc_posparams.zero;
+	else if (n > bashc_posparams.n)
+		return NULL;
+
+	return bashc_posparams.v[n - 1];
+}
+
+/* Returns the builtin's exit status */
+int bashc_shift(int n)
+{
+	if (n < 0 || n > bashc_posparams.n)
+		return 1;
+
+	bashc_posparams.n -= n;
+	bashc_posparams.v += n;
+
+	return 0;
+}
+
+/* `n' as a string, valid until the next call */
+const char* bashc_num_str(intmax_t n)
+{
+	static char buf[32];
+
+	snprintf(buf,sizeof(buf),"%" PRIdMAX,n);
+	return buf;
+}
+
+/* ${#param}: the length of `s' in characters */
+intmax_t bashc_strlen(const char* s)
+{
+	size_t n;
+
+	if (!s)
+		return 0;
+	else if ((n = mbstowcs(NULL,s,0)) == (size_t)-1)
+		return strlen(s);
+
+	return n;
+}
+
+/* ${param:?word}, ${param?word}: report an error and exit */
+void bashc_param_error(const char* name, const char* msg)
+{
+	bashc_builtin_error(&bashc_stderr,name,"%s",
+	                    msg && *msg ? msg : "parameter null or not set");
+	bashc_flush();
+	bashc_loadable_exit(1);
+	exit(1);
+}
@@ -0,0 +1,344 @@
+/*
+ * Run-time word expansion.
+ *
+ * The compiler breaks each word needing expansion into literal text
+ * and parameter expansions, and emits a sequence of calls appending
+ * them to a struct bashc_wordbuf.  In argument-list mode unquoted
+ * expansions are split into fields on $IFS; in string mode (for
+ * assignments, redirection targets and so on) they aren't, and
+ * everything goes into a single string.  A case pattern is built in
+ * string mode with quoted expansions' pattern characters escaped, and
+ * a regular expression likewise.
+ *
+ * Fields of an argument list that unquoted expansions put pattern
+ * characters in undergo pathname expansion once they're finished, as
+ * in bash; the rest of such a field is matched literally.
+ *
+ * Generated code keeps a static wordbuf for each place that needs
+ * one, so once they've grown to size, expanding words allocates
+ * nothing.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glob.h>
+
+#include "libbashc.h"
+
+#define DEFAULT_IFS " \t\n"
+
+static struct bashc_var* ifsvar = NULL;
+
+static void* xgrow(void* p, size_t need, size_t* size, size_t elsize)
+{
+	if (need <= *size)
+		return p;
+
+	*size = need < 16 ? 16 : need * 2;
+	if (!(p = realloc(p,*size * elsize))) {
+		perror("realloc");
+		exit(1);
+	}
+
+	return p;
+}
+
+static void append(struct bashc_wordbuf* wb, const char* s, size_t len)
+{
+	wb->buf = xgrow(wb->buf,wb->len + len + 1,&wb->size,1);
+	memcpy(wb->buf + wb->len,s,len);
+	wb->len += len;
+}
+
+void bashc_wb_start(struct bashc_wordbuf* wb, int flags)
+{
+	wb->len = 0;
+	wb->start = 0;
+	wb->nwords = 0;
+	wb->exists = 0;
+	wb->nglobs = 0;
+	wb->split = (flags & BASHC_WB_SPLIT) != 0;
+	wb->pattern = flags & BASHC_WB_PATTERN ? 1 : flags & BASHC_WB_REGEX ? 2 : 0;
+}
+
+/* Append literal (or quoted) text; even empty text makes a word */
+void bashc_wb_lit(struct bashc_wordbuf* wb, const char* s, size_t len)
+{
+	append(wb,s,len);
+	wb->exists = 1;
+}
+
+/* Finish a word starting at `start' (its text already appended) */
+static void add_word(struct bashc_wordbuf* wb, size_t start)
+{
+	append(wb,"",1);
+	wb->offs = xgrow(wb->offs,wb->nwords + 1,&wb->offsize,sizeof(*wb->offs));
+	wb->offs[wb->nwords++] = start;
+}
+
+/*
+ * Replace the current word with the pathnames it matches, if any,
+ * returning whether there were any.  Only the parts from unquoted
+ * expansions are pattern text; the rest is quoted for glob().
+ */
+static int glob_word(struct bashc_wordbuf* wb)
+{
+	char* pat = NULL;
+	size_t patlen = 0,patsize = 0,i;
+	glob_t g;
+	int n,r,ret = 0;
+	char c;
+
+	for (i = wb->start, n = 0; i < wb->len; i++) {
+		while (n < wb->nglobs && i >= wb->globs[2*n + 1])
+			n++;
+		c = wb->buf[i];
+		pat = xgrow(pat,patlen + 3,&patsize,1);
+		if ((n == wb->nglobs || i < wb->globs[2*n]) && strchr("*?[]\\",c))
+			pat[patlen++] = '\\';
+		pat[patlen++] = c;
+	}
+	pat[patlen] = '\0';
+
+	if (!(r = glob(pat,0,NULL,&g))) {
+		wb->len = wb->start;
+		for (i = 0; i < g.gl_pathc; i++) {
+			wb->start = wb->len;
+			append(wb,g.gl_pathv[i],strlen(g.gl_pathv[i]));
+			add_word(wb,wb->start);
+		}
+		ret = 1;
+	}
+	if (r != GLOB_NOMATCH)
+		globfree(&g);
+	free(pat);
+
+	return ret;
+}
+
+/* End the current word, if there is one */
+void bashc_wb_break(struct bashc_wordbuf* wb)
+{
+	if (!wb->split)
+		return;
+
+	if (wb->nglobs && glob_word(wb)) {
+		/* its matches are words already */
+	} else if (wb->exists)
+		add_word(wb,wb->start);
+	else
+		wb->len = wb->start;
+
+	wb->start = wb->len;
+	wb->exists = 0;
+	wb->nglobs = 0;
+}
+
+/* Append unquoted expansion text, noting it as pattern text if it is */
+static void append_unquoted(struct bashc_wordbuf* wb, const char* s, size_t len)
+{
+	size_t start = wb->len;
+
+	bashc_wb_lit(wb,s,len);
+	if (strcspn(s,"*?[") >= len)
+		return;
+
+	wb->globs = xgrow(wb->globs,2*wb->nglobs + 2,&wb->globsize,sizeof(*wb->globs));
+	wb->globs[2*wb->nglobs] = start;
+	wb->globs[2*wb->nglobs + 1] = wb->len;
+	wb->nglobs++;
+}
+
+static const char* get_ifs(void)
+{
+	if (!ifsvar)
+		ifsvar = bashc_var("IFS");
+
+	return ifsvar->value ? ifsvar->value : DEFAULT_IFS;
+}
+
+static int ifs_white(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n';
+}
+
+/* Split `s' into fields on $IFS, the first joining the current word */
+static void split_fields(struct bashc_wordbuf* wb, const char* s)
+{
+	const char* ifs = get_ifs();
+	size_t n;
+	int delim;
+
+	if (!*ifs) {
+		if (*s)
+			append_unquoted(wb,s,strlen(s));
+		return;
+	}
+
+	while (*s) {
+		if ((n = strcspn(s,ifs))) {
+			append_unquoted(wb,s,n);
+			s += n;
+			continue;
+		}
+
+		/* a run of IFS whitespace with at most one other IFS char */
+		delim = 0;
+		while (*s && strchr(ifs,*s)) {
+			if (!ifs_white(*s)) {
+				if (delim)
+					break;
+				delim = 1;
+			}
+			s++;
+		}
+
+		/* a non-whitespace delimiter ends even an empty field */
+		if (delim)
+			wb->exists = 1;
+		bashc_wb_break(wb);
+	}
+}
+
+/*
+ * Append `s', backslash-quoting the characters special in patterns
+ * (or regular expressions)
+ */
+static void append_quoted(struct bashc_wordbuf* wb, const char* s)
+{
+	const char* special = wb->pattern == 2 ? ".[\\()*+?{|^$" : "*?[]\\";
+	size_t n;
+
+	wb->exists = 1;
+	while (*s) {
+		if ((n = strcspn(s,special))) {
+			append(wb,s,n);
+			s += n;
+		} else {
+			append(wb,"\\",1);
+			append(wb,s++,1);
+		}
+	}
+}
+
+/* Append the result of a parameter expansion (NULL if it's unset) */
+void bashc_wb_expand(struct bashc_wordbuf* wb, const char* value, int quoted)
+{
+	if (!value)
+		value = "";
+
+	if (quoted && wb->pattern)
+		append_quoted(wb,value);
+	else if (quoted)
+		bashc_wb_lit(wb,value,strlen(value));
+	else if (!wb->split)
+		append(wb,value,strlen(value));
+	else
+		split_fields(wb,value);
+}
+
+/* $@ */
+void bashc_wb_at(struct bashc_wordbuf* wb, int quoted)
+{
+	int i;
+
+	for (i = 0; i < bashc_posparams.n; i++) {
+		if (i > 0) {
+			if (!wb->split)
+				append(wb," ",1);
+			else if (quoted) {
+				/* "$@" makes a word of each parameter, even empty ones */
+				wb->exists = 1;
+				bashc_wb_break(wb);
+			} else
+				bashc_wb_break(wb);
+		}
+		bashc_wb_expand(wb,bashc_posparams.v[i],quoted);
+	}
+}
+
+/* $* */
+void bashc_wb_star(struct bashc_wordbuf* wb, int quoted)
+{
+	const char* ifs;
+	int i;
+
+	if (!quoted) {
+		bashc_wb_at(wb,0);
+		return;
+	}
+
+	/* "$*" is one word, the parameters joined by the first char of $IFS */
+	ifs = get_ifs();
+	wb->exists = 1;
+	for (i = 0; i < bashc_posparams.n; i++) {
+		if (i > 0 && *ifs)
+			append(wb,ifs,1);
+		append(wb,bashc_posparams.v[i],strlen(bashc_posparams.v[i]));
+	}
+}
+
+/* Finish an argument list, returning it NULL-terminated */
+char** bashc_wb_argv(struct bashc_wordbuf* wb)
+{
+	int i;
+
+	bashc_wb_break(wb);
+
+	wb->argv = xgrow(wb->argv,wb->nwords + 1,&wb->argvsize,sizeof(*wb->argv));
+	for (i = 0; i < wb->nwords; i++)
+		wb->argv[i] = wb->buf + wb->offs[i];
+	wb->argv[i] = NULL;
+
+	return wb->argv;
+}
+
+/* Finish a string-mode expansion, returning the string */
+const char* bashc_wb_str(struct bashc_wordbuf* wb)
+{
+	wb->buf = xgrow(wb->buf,wb->len + 1,&wb->size,1);
+	wb->buf[wb->len] = '\0';
+
+	return wb->buf;
+}
+
+/* Free a wordbuf that isn't going to be used again */
+void bashc_wb_free(struct bashc_wordbuf* wb)
+{
+	free(wb->buf);
+	free(wb->offs);
+	free(wb->argv);
+	free(wb->globs);
+	memset(wb,0,sizeof(*wb));
+}
+
+/*
+ * Copy `argv' into a single malloc()ed block, for keeping an expanded
+ * list while the wordbuf it's in may be reused.
+ */
+char** bashc_argv_dup(char* const argv[])
+{
+	size_t len = 0;
+	char** v;
+	char* p;
+	int i,n;
+
+	for (n = 0; argv[n]; n++)
+		len += strlen(argv[n]) + 1;
+
+	if (!(v = malloc((n + 1) * sizeof(*v) + len))) {
+		perror("malloc");
+		exit(1);
+	}
+
+	p = (char*)(v + n + 1);
+	for (i = 0; i < n; i++) {
+		len = strlen(argv[i]) + 1;
+		v[i] = memcpy(p,argv[i],len);
+		p += len;
+	}
+	v[n] = NULL;
+
+	return v;
+}
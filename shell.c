@@ -204,6 +204,11 @@ int have_devfd = 0;
 
 #ifdef COMPILER
 char* bashc_outpath = NULL;
+char* bashc_loadable_outpath = NULL;
+char* bashc_multicall_outpath = NULL;
+char* bashc_deps_outpath = NULL;
+int bashc_profile = 0;
+int bashc_hybrid = 0;
 FILE* bashc_output = NULL;
 #endif
 
@@ -283,6 +288,11 @@ static const struct {
 #endif
 #if defined (COMPILER)
   { "compile", Charp, (int *)0x0, &bashc_outpath },
+  { "compile-loadable", Charp, (int *)0x0, &bashc_loadable_outpath },
+  { "compile-multicall", Charp, (int *)0x0, &bashc_multicall_outpath },
+  { "compile-deps", Charp, (int *)0x0, &bashc_deps_outpath },
+  { "compile-hybrid", Int, &bashc_hybrid, (char **)0x0 },
+  { "compile-profile", Int, &bashc_profile, (char **)0x0 },
 #endif
   { (char *)0x0, Int, (int *)0x0, (char **)0x0 }
 };
@@ -496,6 +506,15 @@ main (argc, argv, env)
   this_command_name = shell_name;	/* for error reporting */
   arg_index = parse_shell_options (argv, arg_index, argc);
 
+#if defined (COMPILER)
+  /* compiling all the same, only to a loadable builtin */
+  if (bashc_loadable_outpath)
+    bashc_outpath = bashc_loadable_outpath;
+  /* or to one of the scripts of a multi-call program */
+  else if (bashc_multicall_outpath)
+    bashc_outpath = bashc_multicall_outpath;
+#endif
+
   /* If user supplied the "--login" (or -l) flag, then set and invert
      LOGIN_SHELL. */
   if (make_login_shell)
@@ -821,7 +840,10 @@ main (argc, argv, env)
 
 #if defined(COMPILER)
   if (bashc_outpath)
-    compile_input ();
+    {
+      if (compile_input ())
+	last_command_exit_value = EXECUTION_FAILURE;
+    }
   else
 #endif
     /* Read commands until exit condition. */
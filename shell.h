@@ -101,6 +101,11 @@ extern int locale_mb_cur_max;
 
 #ifdef COMPILER
 extern char* bashc_outpath;
+extern char* bashc_loadable_outpath;
+extern char* bashc_multicall_outpath;
+extern char* bashc_deps_outpath;
+extern int bashc_profile;
+extern int bashc_hybrid;
 extern FILE* bashc_output;
 #endif
 
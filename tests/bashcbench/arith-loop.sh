@@ -0,0 +1,8 @@
+# nested arithmetic for loops (after arith-for.tests)
+sum=0
+for (( i = 0; i < 300; i++ )); do
+	for (( j = 0; j < 300; j++ )); do
+		(( sum += i * j % 7 ))
+	done
+done
+echo "sum: $sum"
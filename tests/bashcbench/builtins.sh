@@ -0,0 +1,9 @@
+# test and echo builtins in a loop (after test.tests)
+n=0
+for i in {1..20000}; do
+	if [ "$i" -gt 100 ] && [ -n "$i" ]; then
+		(( n++ ))
+	fi
+	echo "$i" > /dev/null
+done
+echo "count: $n"
@@ -0,0 +1,13 @@
+# classify words with case patterns (after case.tests)
+n=0 c=0 o=0 x=0
+for (( i = 0; i < 5000; i++ )); do
+	for w in apple banana cherry x.c x.h notes.txt zzz 42; do
+		case $w in
+		apple|banana|cherry) (( n++ )) ;;
+		*.c|*.h) (( c++ )) ;;
+		[0-9]*) (( o++ )) ;;
+		*) (( x++ )) ;;
+		esac
+	done
+done
+echo "fruit: $n source: $c numbers: $o other: $x"
@@ -0,0 +1,9 @@
+# command substitution of builtins and functions (after comsub.tests)
+twice() { echo "$1$1"; }
+len=0
+for (( i = 0; i < 5000; i++ )); do
+	s=$(twice $i)
+	t=`echo $s`
+	(( len += ${#t} ))
+done
+echo "length: $len"
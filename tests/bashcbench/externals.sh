@@ -0,0 +1,6 @@
+# launching external commands (after exec.tests)
+for (( i = 0; i < 300; i++ )); do
+	true
+	/bin/echo "$i" > /dev/null
+done
+echo done
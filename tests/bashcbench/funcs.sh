@@ -0,0 +1,16 @@
+# recursive shell functions with locals (after func.tests)
+fib()
+{
+	local n=$1 a
+	if (( n < 2 )); then
+		r=$n
+		return
+	fi
+	fib $(( n - 1 ))
+	a=$r
+	fib $(( n - 2 ))
+	r=$(( a + r ))
+}
+
+fib 20
+echo "fib 20: $r"
@@ -0,0 +1,6 @@
+# short pipelines of external commands (after pipe tests)
+n=0
+for (( i = 0; i < 200; i++ )); do
+	echo "line $i" | tr a-z A-Z | grep -q LINE && (( n++ ))
+done
+echo "matched: $n"
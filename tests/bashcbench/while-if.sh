@@ -0,0 +1,13 @@
+# a while loop with if/elif chains (after while.tests and if.tests)
+i=0 evens=0 threes=0 others=0
+while (( i < 100000 )); do
+	if (( i % 2 == 0 )); then
+		(( evens++ ))
+	elif (( i % 3 == 0 )); then
+		(( threes++ ))
+	else
+		(( others++ ))
+	fi
+	(( i++ ))
+done
+echo "evens: $evens threes: $threes others: $others"